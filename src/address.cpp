@@ -10,6 +10,8 @@
  */
 
 #include "address.h"
+#include "dns.h"
+#include "hook.h"
 #include "log.h"
 #include "mutex.h"
 #include "endian.h"
@@ -106,6 +108,22 @@ bool Address::Lookup (std::vector<Address::ptr>& result , const std::string& hos
         node = host;
     }
 
+    /// 协程中解析域名时用 Resolver, getaddrinfo 会阻塞整个线程
+    if(isHookEnable() && (family == AF_INET || family == AF_INET6 || family == AF_UNSPEC)
+            && (!service || !*service || strspn(service, "0123456789") == strlen(service))){
+        std::vector<IPAddress::ptr> addrs;
+        if(!ResolverMgr::GetInstance()->resolve(node, addrs, family)){
+            WYZ_LOG_ERROR(g_logger) << "Address::Lookup resolve " << node << " fail";
+            return false;
+        }
+        uint16_t port = service ? (uint16_t)atoi(service) : 0;
+        for(auto& i : addrs){
+            i->setPort(port);
+            result.push_back(i);
+        }
+        return true;
+    }
+
     int err = getaddrinfo(node.c_str(), service, &hints, &results);
     if(err){
         WYZ_LOG_ERROR(g_logger) << "Address::Lookup getaddrinfo err=" << err 
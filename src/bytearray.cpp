@@ -488,6 +488,10 @@ void ByteArray::setPosition(size_t value){
         throw std::out_of_range("set_position out of range");
     }
     m_position = value;
+    /// readv 直接写入内存块后通过 setPosition 前移, 数据长度随之增加
+    if(m_position > m_size){
+        m_size = m_position;
+    }
 
     m_cur = m_root;
     while(value > m_cur->size){
@@ -635,7 +639,7 @@ void ByteArray::addCapacity(size_t value){
         return;
     }
     value = value - old_cap;
-    int count = value / m_baseSize + ((value % m_baseSize > old_cap) ? 1 : 0) ;
+    int count = value / m_baseSize + ((value % m_baseSize) ? 1 : 0) ;
 
     Node* temp = m_root;
     while(temp->next){
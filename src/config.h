@@ -11,6 +11,7 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <typeinfo>
 #include <boost/lexical_cast.hpp>
 #include <yaml-cpp/node/node.h>
 #include <yaml-cpp/node/parse.h>
@@ -81,6 +82,31 @@ public:
     }
 };
 
+// bool 类型支持 yaml 中的 true/false 写法
+template<>
+class LexicalCast<std::string, bool>{
+public:
+    bool operator() (const std::string& str){
+        std::string v = str;
+        std::transform(v.begin(), v.end(), v.begin(), ::tolower);
+        if(v == "true" || v == "yes" || v == "on" || v == "1"){
+            return true;
+        }
+        if(v == "false" || v == "no" || v == "off" || v == "0"){
+            return false;
+        }
+        throw std::bad_cast();
+    }
+};  // 从string转变为bool 类型
+
+template<>
+class LexicalCast<bool, std::string>{
+public:
+    std::string operator() (const bool& val){
+        return val ? "true" : "false";
+    }
+};  // 从 bool 转换为 std::string类型
+
 // 支持一系列的stl 模板容器 vector list set unordered_set map unordered_map
 template<class T>
 class LexicalCast<std::string, std::vector<T>>{
@@ -0,0 +1,615 @@
+/**
+ * @file dns.cpp
+ * @brief 协程中不阻塞线程的域名解析实现
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-29
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#include "dns.h"
+#include "config.h"
+#include "hook.h"
+#include "log.h"
+#include "socket.h"
+#include "util.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
+#include <strings.h>
+#include <sys/stat.h>
+
+namespace wyz {
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_NAME("system");
+
+static wyz::ConfigVar<std::string>::ptr g_dns_resolv_conf = wyz::Config::Lookup("dns.resolv_conf", std::string("/etc/resolv.conf"), "dns resolv.conf path");
+static wyz::ConfigVar<std::string>::ptr g_dns_hosts = wyz::Config::Lookup("dns.hosts", std::string("/etc/hosts"), "dns hosts file path");
+static wyz::ConfigVar<uint32_t>::ptr g_dns_cache_size = wyz::Config::Lookup("dns.cache_size", (uint32_t)10000, "dns cache max entries");
+static wyz::ConfigVar<uint32_t>::ptr g_dns_negative_ttl = wyz::Config::Lookup("dns.negative_ttl", (uint32_t)30, "dns negative cache ttl(s) when the answer has no SOA");
+static wyz::ConfigVar<uint32_t>::ptr g_dns_max_ttl = wyz::Config::Lookup("dns.max_ttl", (uint32_t)3600, "dns cache max ttl(s)");
+
+/// 分片数
+static const size_t s_shard_count = 16;
+/// 两次检查 hosts 与 resolv.conf 是否修改的最小间隔(ms)
+static const uint64_t s_check_interval = 1000;
+
+static const uint16_t s_type_a = 1;
+static const uint16_t s_type_soa = 6;
+static const uint16_t s_type_aaaa = 28;
+static const uint16_t s_class_in = 1;
+
+static inline uint16_t Read16(const uint8_t* p){
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t Read32(const uint8_t* p){
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void Append16(std::string& buf , uint16_t v){
+    buf.push_back((char)(v >> 8));
+    buf.push_back((char)(v & 0xff));
+}
+
+static uint16_t RandomId(){
+    static thread_local std::mt19937 s_rand(std::random_device{}() ^ (uint32_t)GetCurrentUS());
+    return (uint16_t)s_rand();
+}
+
+/**
+ * @brief 生成查询报文, 递归查询一个问题
+ * @return bool             域名的某一段超过 63 字节或总长超过 255 时返回 false
+ */
+static bool BuildQuery(std::string& buf , uint16_t id , const std::string& name , uint16_t type){
+    buf.clear();
+    Append16(buf, id);
+    Append16(buf, 0x0100);      /// RD
+    Append16(buf, 1);
+    Append16(buf, 0);
+    Append16(buf, 0);
+    Append16(buf, 0);
+    size_t pos = 0;
+    while(pos < name.size()){
+        size_t end = name.find('.', pos);
+        if(end == std::string::npos){
+            end = name.size();
+        }
+        size_t len = end - pos;
+        if(len == 0 || len > 63){
+            return false;
+        }
+        buf.push_back((char)len);
+        buf.append(name, pos, len);
+        pos = end + 1;
+    }
+    buf.push_back(0);
+    if(buf.size() - 12 > 255){
+        return false;
+    }
+    Append16(buf, type);
+    Append16(buf, s_class_in);
+    return true;
+}
+
+/// 跳过报文中的域名, 包括压缩指针
+static bool SkipName(const uint8_t* p , size_t len , size_t& pos){
+    while(pos < len){
+        uint8_t l = p[pos];
+        if((l & 0xC0) == 0xC0){
+            pos += 2;
+            return pos <= len;
+        }
+        if(l & 0xC0){
+            return false;
+        }
+        pos += 1 + l;
+        if(l == 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief 解析后的应答
+ */
+struct DnsResponse{
+    uint16_t id = 0;
+    int rcode = 0;
+    std::vector<IPAddress::ptr> addrs;
+    uint32_t ttl = UINT32_MAX;      /// 地址记录中最小的 TTL
+    uint32_t negTtl = UINT32_MAX;   /// 没有地址时 SOA 给出的缓存时间
+};
+
+/**
+ * @brief 解析应答报文
+ * @param  question         查询报文中的问题部分, 应答必须原样带回(域名不区分大小写)
+ */
+static bool ParseResponse(const uint8_t* p , size_t len , const std::string& question , DnsResponse& r){
+    if(len < 12 + question.size()){
+        return false;
+    }
+    uint16_t flags = Read16(p + 2);
+    if(!(flags & 0x8000) || Read16(p + 4) != 1){
+        return false;
+    }
+    /// 域名以根标签的 0 结尾, strncasecmp 在那里停下, 最后的 QTYPE 与 QCLASS 单独比较
+    size_t qname = question.size() - 4;
+    if(strncasecmp((const char*)p + 12, question.c_str(), qname) != 0
+            || memcmp(p + 12 + qname, question.data() + qname, 4) != 0){
+        return false;
+    }
+    r.id = Read16(p);
+    r.rcode = flags & 0x0F;
+    size_t answers = Read16(p + 6);
+    size_t records = answers + Read16(p + 8);
+    size_t pos = 12 + question.size();
+    for(size_t i = 0 ; i < records ; ++i){
+        if(!SkipName(p, len, pos) || pos + 10 > len){
+            return false;
+        }
+        uint16_t type = Read16(p + pos);
+        uint16_t cls = Read16(p + pos + 2);
+        uint32_t ttl = Read32(p + pos + 4);
+        size_t rdlen = Read16(p + pos + 8);
+        pos += 10;
+        if(pos + rdlen > len){
+            return false;
+        }
+        if(cls != s_class_in){
+            pos += rdlen;
+            continue;
+        }
+        if(i < answers){
+            /// CNAME 链上的记录在同一个应答中, 只取地址
+            if(type == s_type_a && rdlen == 4){
+                sockaddr_in addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sin_family = AF_INET;
+                memcpy(&addr.sin_addr, p + pos, 4);
+                r.addrs.push_back(std::make_shared<IPv4Address>(addr));
+                r.ttl = std::min(r.ttl, ttl);
+            }else if(type == s_type_aaaa && rdlen == 16){
+                r.addrs.push_back(std::make_shared<IPv6Address>(p + pos));
+                r.ttl = std::min(r.ttl, ttl);
+            }
+        }else if(type == s_type_soa){
+            /// mname, rname 之后是 serial, refresh, retry, expire, minimum
+            size_t q = pos;
+            if(SkipName(p, pos + rdlen, q) && SkipName(p, pos + rdlen, q) && q + 20 <= pos + rdlen){
+                r.negTtl = std::min(r.negTtl, std::min(ttl, Read32(p + q + 16)));
+            }
+        }
+        pos += rdlen;
+    }
+    return true;
+}
+
+/**
+ * @brief 向一个服务器查询, 所有类型一起发出后等待应答
+ * @return int              DNS 应答码; -1 超时, 出错或者服务器失败, 换下一个服务器
+ */
+static int QueryServer(Address::ptr server , const std::string& name , const std::vector<uint16_t>& types
+                    , uint64_t timeout , std::vector<IPAddress::ptr>& addrs , uint32_t& ttl){
+    Socket::ptr sock = Socket::CreateUDP(server);
+    if(!sock->connect(server)){
+        return -1;
+    }
+    std::vector<uint16_t> ids;
+    std::string question;
+    std::string buf;
+    for(auto type : types){
+        uint16_t id = RandomId();
+        if(!BuildQuery(buf, id, name, type)){
+            return 3;
+        }
+        if(sock->send(buf.data(), buf.size()) <= 0){
+            return -1;
+        }
+        ids.push_back(id);
+    }
+    uint64_t deadline = GetCurrentMS() + timeout;
+    std::vector<IPAddress::ptr> found;
+    uint32_t addr_ttl = UINT32_MAX;
+    uint32_t neg_ttl = UINT32_MAX;
+    int rcode = 0;
+    uint8_t rsp[4096];
+    while(!ids.empty()){
+        uint64_t now = GetCurrentMS();
+        if(now >= deadline){
+            return -1;
+        }
+        sock->setRecvTimeout(deadline - now);
+        int n = sock->recv(rsp, sizeof(rsp));
+        if(n <= 0){
+            return -1;
+        }
+        DnsResponse r;
+        auto it = ids.end();
+        for(size_t i = 0 ; i < types.size() ; ++i){
+            /// 问题部分与 id 都要对上, 不同类型的问题只差最后的 QTYPE
+            BuildQuery(buf, 0, name, types[i]);
+            question.assign(buf, 12, std::string::npos);
+            if(ParseResponse(rsp, n, question, r)){
+                it = std::find(ids.begin(), ids.end(), r.id);
+                break;
+            }
+        }
+        if(it == ids.end()){
+            continue;
+        }
+        ids.erase(it);
+        if(r.rcode != 0 && r.rcode != 3){
+            return -1;
+        }
+        if(r.rcode == 3){
+            rcode = 3;
+        }
+        found.insert(found.end(), r.addrs.begin(), r.addrs.end());
+        addr_ttl = std::min(addr_ttl, r.ttl);
+        neg_ttl = std::min(neg_ttl, r.negTtl);
+    }
+    if(!found.empty()){
+        addrs.swap(found);
+        ttl = addr_ttl;
+        return 0;
+    }
+    ttl = neg_ttl == UINT32_MAX ? g_dns_negative_ttl->getValue() : neg_ttl;
+    return rcode;
+}
+
+/// 返回新的地址对象, 调用方可以修改端口
+static IPAddress::ptr CopyAddress(IPAddress::ptr addr){
+    return std::dynamic_pointer_cast<IPAddress>(Address::Create(addr->getAddr(), addr->getLen()));
+}
+
+static bool CopyAddresses(const std::vector<IPAddress::ptr>& addrs , int family , std::vector<IPAddress::ptr>& result){
+    bool found = false;
+    for(auto& i : addrs){
+        if(family == AF_UNSPEC || i->getFamily() == family){
+            result.push_back(CopyAddress(i));
+            found = true;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief 数字形式的地址
+ */
+static IPAddress::ptr ParseNumeric(const std::string& host){
+    sockaddr_in addr4;
+    memset(&addr4, 0, sizeof(addr4));
+    if(inet_pton(AF_INET, host.c_str(), &addr4.sin_addr) == 1){
+        addr4.sin_family = AF_INET;
+        return std::make_shared<IPv4Address>(addr4);
+    }
+    uint8_t addr6[16];
+    if(inet_pton(AF_INET6, host.c_str(), addr6) == 1){
+        return std::make_shared<IPv6Address>(addr6);
+    }
+    return nullptr;
+}
+
+Resolver::Resolver()
+    : m_hostsPath(g_dns_hosts->getValue()){
+    for(size_t i = 0 ; i < s_shard_count ; ++i){
+        m_shards.emplace_back(new Shard);
+    }
+}
+
+void Resolver::setNameservers(const std::vector<Address::ptr>& v){
+    RWMutexType::WriteLock lock(m_mutex);
+    m_config.nameservers = v;
+    m_fixedNameservers = true;
+}
+
+void Resolver::setHostsPath(const std::string& v){
+    RWMutexType::WriteLock lock(m_mutex);
+    m_hostsPath = v;
+    m_hostsMtime = 0;
+    m_checkTime = 0;
+    m_hosts.clear();
+}
+
+void Resolver::clearCache(){
+    for(auto& i : m_shards){
+        Mutex::Lock lock(i->mutex);
+        i->entries.clear();
+    }
+}
+
+Resolver::Stats Resolver::getStats(){
+    Stats s;
+    s.requests = m_requests;
+    s.hostsHits = m_hostsHits;
+    s.cacheHits = m_cacheHits;
+    s.coalesced = m_coalesced;
+    s.queries = m_queries;
+    s.timeouts = m_timeouts;
+    s.entries = 0;
+    for(auto& i : m_shards){
+        Mutex::Lock lock(i->mutex);
+        s.entries += i->entries.size();
+    }
+    return s;
+}
+
+void Resolver::loadHosts(const std::string& path){
+    m_hosts.clear();
+    std::ifstream ifs(path);
+    std::string line;
+    while(std::getline(ifs, line)){
+        size_t pos = line.find('#');
+        if(pos != std::string::npos){
+            line.resize(pos);
+        }
+        std::istringstream iss(line);
+        std::string ip;
+        if(!(iss >> ip)){
+            continue;
+        }
+        IPAddress::ptr addr = ParseNumeric(ip);
+        if(!addr){
+            continue;
+        }
+        std::string name;
+        while(iss >> name){
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            m_hosts[name].push_back(addr);
+        }
+    }
+}
+
+void Resolver::loadResolvConf(const std::string& path){
+    ResolvConf config;
+    std::ifstream ifs(path);
+    std::string line;
+    while(std::getline(ifs, line)){
+        std::istringstream iss(line);
+        std::string key;
+        if(!(iss >> key) || key[0] == '#' || key[0] == ';'){
+            continue;
+        }
+        std::string v;
+        if(key == "nameserver"){
+            /// 和 glibc 一样最多使用 3 个
+            if(iss >> v && config.nameservers.size() < 3){
+                IPAddress::ptr addr = ParseNumeric(v);
+                if(addr){
+                    addr->setPort(53);
+                    config.nameservers.push_back(addr);
+                }
+            }
+        }else if(key == "search" || key == "domain"){
+            config.search.clear();
+            while(iss >> v){
+                std::transform(v.begin(), v.end(), v.begin(), ::tolower);
+                config.search.push_back(v);
+            }
+        }else if(key == "options"){
+            while(iss >> v){
+                if(v.compare(0, 6, "ndots:") == 0){
+                    config.ndots = std::min(atoi(v.c_str() + 6), 15);
+                }else if(v.compare(0, 8, "timeout:") == 0){
+                    config.timeout = std::max(atoi(v.c_str() + 8), 1) * 1000;
+                }else if(v.compare(0, 9, "attempts:") == 0){
+                    config.attempts = std::min(std::max(atoi(v.c_str() + 9), 1), 5);
+                }
+            }
+        }
+    }
+    if(m_fixedNameservers){
+        config.nameservers = m_config.nameservers;
+    }else if(config.nameservers.empty()){
+        config.nameservers.push_back(IPv4Address::Create("127.0.0.1", 53));
+    }
+    m_config = config;
+}
+
+void Resolver::reload(){
+    uint64_t now = GetCurrentMS();
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        if(now - m_checkTime < s_check_interval){
+            return;
+        }
+    }
+    RWMutexType::WriteLock lock(m_mutex);
+    if(now - m_checkTime < s_check_interval){
+        return;
+    }
+    m_checkTime = now;
+    struct stat st;
+    if(!m_hostsPath.empty() && stat(m_hostsPath.c_str(), &st) == 0){
+        if(st.st_mtime != m_hostsMtime){
+            loadHosts(m_hostsPath);
+            m_hostsMtime = st.st_mtime;
+        }
+    }else if(!m_hosts.empty()){
+        m_hosts.clear();
+        m_hostsMtime = 0;
+    }
+    const std::string& path = g_dns_resolv_conf->getValue();
+    time_t mtime = stat(path.c_str(), &st) == 0 ? st.st_mtime : 0;
+    if(mtime != m_resolvMtime || m_config.nameservers.empty()){
+        loadResolvConf(path);
+        m_resolvMtime = mtime;
+    }
+}
+
+int Resolver::query(const ResolvConf& config , const std::string& name , int family
+                , std::vector<IPAddress::ptr>& addrs , uint32_t& ttl){
+    std::vector<uint16_t> types;
+    if(family != AF_INET6){
+        types.push_back(s_type_a);
+    }
+    if(family != AF_INET){
+        types.push_back(s_type_aaaa);
+    }
+    for(uint32_t i = 0 ; i < config.attempts ; ++i){
+        for(auto& server : config.nameservers){
+            m_queries += types.size();
+            int rt = QueryServer(server, name, types, config.timeout, addrs, ttl);
+            if(rt >= 0){
+                return rt;
+            }
+            ++m_timeouts;
+            WYZ_LOG_DEBUG(g_logger) << "dns query " << name << " server=" << server->toString()
+                << " fail errno=" << errno;
+        }
+    }
+    return -1;
+}
+
+bool Resolver::lookup(const std::string& name , int family , std::vector<IPAddress::ptr>& addrs , uint32_t& ttl){
+    ResolvConf config;
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        config = m_config;
+    }
+    /// 以 '.' 结尾的是完整域名, 不加 search 后缀
+    std::vector<std::string> candidates;
+    if(name.back() == '.'){
+        candidates.push_back(name.substr(0, name.size() - 1));
+    }else {
+        bool enough = (size_t)std::count(name.begin(), name.end(), '.') >= config.ndots;
+        if(enough){
+            candidates.push_back(name);
+        }
+        for(auto& i : config.search){
+            candidates.push_back(name + "." + i);
+        }
+        if(!enough){
+            candidates.push_back(name);
+        }
+    }
+
+    /// 有候选没有应答时不能确定域名不存在, 不做负缓存
+    bool answered = true;
+    uint32_t neg_ttl = UINT32_MAX;
+    for(auto& i : candidates){
+        std::vector<IPAddress::ptr> found;
+        uint32_t t = 0;
+        int rt = query(config, i, family, found, t);
+        if(rt < 0){
+            answered = false;
+            continue;
+        }
+        if(!found.empty()){
+            addrs.swap(found);
+            ttl = t;
+            return true;
+        }
+        neg_ttl = std::min(neg_ttl, t);
+    }
+    ttl = neg_ttl;
+    return answered;
+}
+
+bool Resolver::resolve(const std::string& host , std::vector<IPAddress::ptr>& result , int family){
+    if(host.empty() || (family != AF_INET && family != AF_INET6 && family != AF_UNSPEC)){
+        return false;
+    }
+    IPAddress::ptr numeric = ParseNumeric(host);
+    if(numeric){
+        if(family != AF_UNSPEC && numeric->getFamily() != family){
+            return false;
+        }
+        result.push_back(numeric);
+        return true;
+    }
+    ++m_requests;
+    std::string name = host;
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    reload();
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        auto it = m_hosts.find(name.back() == '.' ? name.substr(0, name.size() - 1) : name);
+        if(it != m_hosts.end() && CopyAddresses(it->second, family, result)){
+            ++m_hostsHits;
+            return true;
+        }
+    }
+
+    std::string key(1, (char)family);
+    key.append(name);
+    Shard& shard = *m_shards[std::hash<std::string>()(key) % s_shard_count];
+    bool leader = false;
+    Loader::ptr loader;
+    {
+        Mutex::Lock lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        if(it != shard.entries.end()){
+            if(it->second.expire > GetCurrentMS()){
+                ++m_cacheHits;
+                return CopyAddresses(it->second.addrs, family, result);
+            }
+            shard.entries.erase(it);
+        }
+        auto lit = shard.loading.find(key);
+        if(lit == shard.loading.end()){
+            loader.reset(new Loader);
+            shard.loading[key] = loader;
+            leader = true;
+        }else if(isHookEnable() && Scheduler::GetThis()){
+            /// 不在协程中时不能等待, 自己查询
+            loader = lit->second;
+            loader->waiters.push_back(std::make_pair(Scheduler::GetThis(), Fiber::GetThis()));
+        }
+    }
+    if(loader && !leader){
+        ++m_coalesced;
+        Fiber::CallerYieldToHold();
+        return CopyAddresses(loader->addrs, family, result);
+    }
+
+    std::vector<IPAddress::ptr> addrs;
+    uint32_t ttl = 0;
+    bool answered = lookup(name, family, addrs, ttl);
+    if(leader){
+        std::vector<std::pair<Scheduler*, Fiber::ptr> > waiters;
+        {
+            Mutex::Lock lock(shard.mutex);
+            if(answered && ttl > 0){
+                uint64_t now = GetCurrentMS();
+                size_t capacity = std::max(g_dns_cache_size->getValue() / s_shard_count, (size_t)1);
+                if(shard.entries.size() >= capacity){
+                    for(auto it = shard.entries.begin() ; it != shard.entries.end() ;){
+                        if(it->second.expire <= now){
+                            it = shard.entries.erase(it);
+                        }else {
+                            ++it;
+                        }
+                    }
+                    if(shard.entries.size() >= capacity){
+                        shard.entries.erase(shard.entries.begin());
+                    }
+                }
+                Entry& entry = shard.entries[key];
+                entry.addrs = addrs;
+                entry.expire = now + (uint64_t)std::min(ttl, g_dns_max_ttl->getValue()) * 1000;
+            }
+            loader->addrs = addrs;
+            loader->done = true;
+            loader->waiters.swap(waiters);
+            shard.loading.erase(key);
+        }
+        for(auto& i : waiters){
+            i.first->schedule(i.second);
+        }
+    }
+    if(!answered){
+        WYZ_LOG_ERROR(g_logger) << "dns resolve " << host << " no response from nameservers";
+    }
+    return CopyAddresses(addrs, family, result);
+}
+
+}
@@ -0,0 +1,154 @@
+/**
+ * @file dns.h
+ * @brief 协程中不阻塞线程的域名解析
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-29
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#ifndef __WYZ_DNS_H__
+#define __WYZ_DNS_H__
+
+#include "address.h"
+#include "fiber.h"
+#include "mutex.h"
+#include "noncopyable.h"
+#include "scheduler.h"
+#include "singleton.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace wyz {
+
+/**
+ * @brief 域名解析器
+ * @details 先查 /etc/hosts, 再查缓存, 最后按 /etc/resolv.conf 的 nameserver, search, ndots,
+ *          timeout, attempts 通过 UDP 向 DNS 服务器查询. socket 经过 hook, 在协程中等待应答时
+ *          只让出协程, 不阻塞线程. 两个文件每秒最多检查一次是否修改.
+ *          结果按应答中的 TTL 缓存, 不存在的域名按 SOA 的 minimum 缓存(负缓存),
+ *          缓存按域名的哈希分片加锁. 同一个域名同时只有一个查询, 其他协程等待它的结果.
+ *          应答被截断(TC)时使用 UDP 应答中已有的记录, 不改用 TCP 重试
+ */
+class Resolver : Noncopyable {
+public:
+    using ptr = std::shared_ptr<Resolver>;
+    using RWMutexType = RWMutex;
+
+    Resolver();
+
+    /**
+     * @brief 解析域名, 数字地址直接转换
+     * @param  name             域名或数字地址
+     * @param  result           追加解析到的地址, 端口为 0, 每次返回新的对象
+     * @param  family           AF_INET 查 A, AF_INET6 查 AAAA, AF_UNSPEC 两种都查
+     * @return bool             至少有一个地址时返回 true
+     */
+    bool resolve(const std::string& name , std::vector<IPAddress::ptr>& result , int family = AF_INET);
+
+    /**
+     * @brief 指定 DNS 服务器, 之后只从 resolv.conf 读取 search 与 options
+     */
+    void setNameservers(const std::vector<Address::ptr>& v);
+
+    /**
+     * @brief 指定 hosts 文件, 空字符串表示不使用
+     */
+    void setHostsPath(const std::string& v);
+
+    /// 清空缓存
+    void clearCache();
+
+    /**
+     * @brief 解析统计
+     */
+    struct Stats {
+        uint64_t requests;      /// resolve 的次数(不含数字地址)
+        uint64_t hostsHits;     /// 由 hosts 文件返回
+        uint64_t cacheHits;     /// 由缓存返回, 包括负缓存
+        uint64_t coalesced;     /// 等待其他协程的查询结果
+        uint64_t queries;       /// 发送的 DNS 查询报文数
+        uint64_t timeouts;      /// 等待应答超时的次数
+        uint64_t entries;       /// 缓存条目数
+    };
+    Stats getStats();
+
+private:
+    /// resolv.conf 中的配置
+    struct ResolvConf{
+        std::vector<Address::ptr> nameservers;
+        std::vector<std::string> search;
+        uint32_t ndots = 1;
+        uint32_t timeout = 5000;    /// 每次等待应答的时间(ms)
+        uint32_t attempts = 2;      /// 每个服务器的尝试次数
+    };
+
+    /// 缓存的结果, addrs 为空表示域名不存在
+    struct Entry{
+        std::vector<IPAddress::ptr> addrs;
+        uint64_t expire = 0;
+    };
+
+    /// 正在进行的查询与等待它的协程
+    struct Loader{
+        using ptr = std::shared_ptr<Loader>;
+        bool done = false;
+        std::vector<IPAddress::ptr> addrs;
+        std::vector<std::pair<Scheduler*, Fiber::ptr> > waiters;
+    };
+
+    struct Shard{
+        Mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+        std::unordered_map<std::string, Loader::ptr> loading;
+    };
+
+    /// 距上次检查超过 1 秒时重新读取修改过的 hosts 与 resolv.conf
+    void reload();
+    void loadHosts(const std::string& path);
+    void loadResolvConf(const std::string& path);
+
+    /**
+     * @brief 按 search 与 ndots 依次查询候选域名
+     * @param  ttl              返回缓存时间(s)
+     * @return bool             false 表示有候选域名没有得到应答, 结果不缓存
+     */
+    bool lookup(const std::string& name , int family , std::vector<IPAddress::ptr>& addrs , uint32_t& ttl);
+
+    /**
+     * @brief 向服务器查询一个域名
+     * @return int              DNS 应答码, 0 成功, 3 域名不存在; -1 所有服务器都没有应答
+     */
+    int query(const ResolvConf& config , const std::string& name , int family
+                , std::vector<IPAddress::ptr>& addrs , uint32_t& ttl);
+
+private:
+    RWMutexType m_mutex;
+    ResolvConf m_config;
+    bool m_fixedNameservers = false;
+    std::string m_hostsPath;
+    std::unordered_map<std::string, std::vector<IPAddress::ptr> > m_hosts;
+    time_t m_hostsMtime = 0;
+    time_t m_resolvMtime = 0;
+    uint64_t m_checkTime = 0;
+    std::vector<std::unique_ptr<Shard> > m_shards;
+
+    std::atomic<uint64_t> m_requests = {0};
+    std::atomic<uint64_t> m_hostsHits = {0};
+    std::atomic<uint64_t> m_cacheHits = {0};
+    std::atomic<uint64_t> m_coalesced = {0};
+    std::atomic<uint64_t> m_queries = {0};
+    std::atomic<uint64_t> m_timeouts = {0};
+};
+
+using ResolverMgr = Singleton<Resolver>;
+
+}
+
+#endif
@@ -0,0 +1,183 @@
+#include "fcontext.h"
+#include <cstdint>
+
+namespace wyz {
+
+#ifdef WYZ_FIBER_UCONTEXT
+
+bool FiberContext::init() {
+    return getcontext(&m_ctx) == 0;
+}
+
+bool FiberContext::make(void* stack, size_t size, void (*fn)()) {
+    if(getcontext(&m_ctx)) {
+        return false;
+    }
+    m_ctx.uc_link = nullptr;
+    m_ctx.uc_stack.ss_sp = stack;
+    m_ctx.uc_stack.ss_size = size;
+    makecontext(&m_ctx, fn, 0);
+    return true;
+}
+
+const char* FiberContext::Backend() {
+    return "ucontext";
+}
+
+#else
+
+extern "C" void wyz_fcontext_entry();
+
+#if defined(__x86_64__)
+
+/*
+ * 栈布局 (低地址 -> 高地址):
+ *   [mxcsr | x87 cw] r15 r14 r13 r12 rbx rbp [ret]
+ * 新建上下文时 r12 保存入口函数, ret 指向 wyz_fcontext_entry
+ */
+asm(R"(
+    .text
+    .globl  wyz_swap_fcontext
+    .type   wyz_swap_fcontext, @function
+    .align  16
+wyz_swap_fcontext:
+    pushq   %rbp
+    pushq   %rbx
+    pushq   %r12
+    pushq   %r13
+    pushq   %r14
+    pushq   %r15
+    leaq    -8(%rsp), %rsp
+    stmxcsr (%rsp)
+    fnstcw  4(%rsp)
+    movq    %rsp, (%rdi)
+    movq    %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw   4(%rsp)
+    leaq    8(%rsp), %rsp
+    popq    %r15
+    popq    %r14
+    popq    %r13
+    popq    %r12
+    popq    %rbx
+    popq    %rbp
+    ret
+    .size   wyz_swap_fcontext, .-wyz_swap_fcontext
+
+    .globl  wyz_fcontext_entry
+    .hidden wyz_fcontext_entry
+    .type   wyz_fcontext_entry, @function
+    .align  16
+wyz_fcontext_entry:
+    .cfi_startproc
+    .cfi_undefined rip
+    callq   *%r12
+    hlt
+    .cfi_endproc
+    .size   wyz_fcontext_entry, .-wyz_fcontext_entry
+)");
+
+static const size_t s_saved_slots = 8;      // fpu + 6 个寄存器 + 返回地址
+
+bool FiberContext::make(void* stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    /// ret 之后 rsp 16 字节对齐, 满足 call 之前的 ABI 要求
+    uint64_t* sp = (uint64_t*)(top - 16) - s_saved_slots;
+    sp[0] = 0x037F00001F80ULL;              // x87 控制字 0x037F, mxcsr 0x1F80
+    sp[1] = 0;                              // r15
+    sp[2] = 0;                              // r14
+    sp[3] = 0;                              // r13
+    sp[4] = (uint64_t)fn;                   // r12
+    sp[5] = 0;                              // rbx
+    sp[6] = 0;                              // rbp
+    sp[7] = (uint64_t)&wyz_fcontext_entry;  // 返回地址
+    m_sp = sp;
+    return true;
+}
+
+#elif defined(__aarch64__)
+
+/*
+ * 栈布局 (低地址 -> 高地址):
+ *   d8-d15 x19-x28 x29 x30
+ * 新建上下文时 x19 保存入口函数, x30 指向 wyz_fcontext_entry
+ */
+asm(R"(
+    .text
+    .globl  wyz_swap_fcontext
+    .type   wyz_swap_fcontext, %function
+    .align  4
+wyz_swap_fcontext:
+    sub     sp, sp, #0xa0
+    stp     d8,  d9,  [sp, #0x00]
+    stp     d10, d11, [sp, #0x10]
+    stp     d12, d13, [sp, #0x20]
+    stp     d14, d15, [sp, #0x30]
+    stp     x19, x20, [sp, #0x40]
+    stp     x21, x22, [sp, #0x50]
+    stp     x23, x24, [sp, #0x60]
+    stp     x25, x26, [sp, #0x70]
+    stp     x27, x28, [sp, #0x80]
+    stp     x29, x30, [sp, #0x90]
+    mov     x9, sp
+    str     x9, [x0]
+    mov     sp, x1
+    ldp     d8,  d9,  [sp, #0x00]
+    ldp     d10, d11, [sp, #0x10]
+    ldp     d12, d13, [sp, #0x20]
+    ldp     d14, d15, [sp, #0x30]
+    ldp     x19, x20, [sp, #0x40]
+    ldp     x21, x22, [sp, #0x50]
+    ldp     x23, x24, [sp, #0x60]
+    ldp     x25, x26, [sp, #0x70]
+    ldp     x27, x28, [sp, #0x80]
+    ldp     x29, x30, [sp, #0x90]
+    add     sp, sp, #0xa0
+    ret
+    .size   wyz_swap_fcontext, .-wyz_swap_fcontext
+
+    .globl  wyz_fcontext_entry
+    .hidden wyz_fcontext_entry
+    .type   wyz_fcontext_entry, %function
+    .align  4
+wyz_fcontext_entry:
+    .cfi_startproc
+    .cfi_undefined x30
+    blr     x19
+    brk     #0
+    .cfi_endproc
+    .size   wyz_fcontext_entry, .-wyz_fcontext_entry
+)");
+
+static const size_t s_saved_slots = 20;     // d8-d15 + x19-x30
+
+bool FiberContext::make(void* stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)top - s_saved_slots;
+    for(size_t i = 0; i < s_saved_slots; ++i) {
+        sp[i] = 0;
+    }
+    sp[8] = (uint64_t)fn;                   // x19
+    sp[19] = (uint64_t)&wyz_fcontext_entry; // x30
+    m_sp = sp;
+    return true;
+}
+
+#endif
+
+bool FiberContext::init() {
+    m_sp = nullptr;
+    return true;
+}
+
+const char* FiberContext::Backend() {
+#if defined(__x86_64__)
+    return "asm-x86_64";
+#else
+    return "asm-aarch64";
+#endif
+}
+
+#endif
+
+}
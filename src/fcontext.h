@@ -0,0 +1,81 @@
+/*
+ * @Description: 协程上下文切换
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-11-24 10:05:31
+ */
+
+#ifndef __WYZ_FCONTEXT_H__
+#define __WYZ_FCONTEXT_H__
+
+#include <cstddef>
+
+/// 非 x86_64 / aarch64 平台只能使用 ucontext
+#if !defined(WYZ_FIBER_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define WYZ_FIBER_UCONTEXT
+#endif
+
+#ifdef WYZ_FIBER_UCONTEXT
+#include <ucontext.h>
+#else
+extern "C" {
+/**
+ * @brief 保存当前现场(仅被调用者保存寄存器)到 *from_sp, 切换到 to_sp 对应的现场
+ * @details 汇编实现见 fcontext.cpp, 不做 rt_sigprocmask 系统调用
+ */
+void wyz_swap_fcontext(void** from_sp, void* to_sp);
+}
+#endif
+
+namespace wyz {
+
+/**
+ * @brief 协程运行现场
+ * @details 编译期选择后端: 默认 x86_64 / aarch64 使用手写汇编,
+ *          定义 WYZ_FIBER_UCONTEXT (cmake -DFIBER_UCONTEXT=ON) 时使用 getcontext/swapcontext
+ */
+class FiberContext {
+public:
+    /**
+     * @brief 初始化为线程主协程的上下文
+     * @details 主协程没有独立栈, 第一次 Swap 切出时保存现场
+     */
+    bool init();
+
+    /**
+     * @brief 在给定栈上创建上下文, 第一次切入时执行 fn
+     * @param[in] stack 栈低地址
+     * @param[in] size 栈大小
+     * @param[in] fn 入口函数, 不允许返回
+     */
+    bool make(void* stack, size_t size, void (*fn)());
+
+    /**
+     * @brief 保存当前现场到 from, 切换到 to
+     */
+    static bool Swap(FiberContext& from, FiberContext& to) {
+#ifdef WYZ_FIBER_UCONTEXT
+        return swapcontext(&from.m_ctx, &to.m_ctx) == 0;
+#else
+        wyz_swap_fcontext(&from.m_sp, to.m_sp);
+        return true;
+#endif
+    }
+
+    /**
+     * @brief 当前编译使用的切换后端名称
+     */
+    static const char* Backend();
+
+private:
+#ifdef WYZ_FIBER_UCONTEXT
+    ucontext_t m_ctx;
+#else
+    /// 切出时的栈顶, 被调用者保存寄存器都压在这个栈上
+    void* m_sp = nullptr;
+#endif
+};
+
+}
+
+#endif
@@ -27,6 +27,7 @@ public:
     bool isInit()const       {return m_isInit;}
     bool isSocket()const     {return m_isSocket;}
     bool isClosed()const     {return m_isClosed;}
+    void setClosed(bool v)   {m_isClosed = v;}
 
     void setUserNonblock(bool v)     {m_userNonblock = v;}
     bool getUserNonblock()const   {return m_userNonblock;}
@@ -4,6 +4,10 @@
 #include "log.h"
 #include "scheduler.h"
 #include <atomic>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
 
 namespace wyz {
 
@@ -18,18 +22,164 @@ static thread_local Fiber::ptr t_threadFiber = nullptr;
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size =
     Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
 
-class MallocStackAllocator {
+static ConfigVar<uint32_t>::ptr g_stack_pool_size =
+    Config::Lookup<uint32_t>("fiber.stack_pool.size", 16, "fiber stacks preallocated per thread");
+static ConfigVar<uint32_t>::ptr g_stack_pool_high =
+    Config::Lookup<uint32_t>("fiber.stack_pool.high_watermark", 256, "max free fiber stacks cached per thread");
+static ConfigVar<uint32_t>::ptr g_stack_pool_low =
+    Config::Lookup<uint32_t>("fiber.stack_pool.low_watermark", 64, "free fiber stacks kept after trimming");
+static ConfigVar<uint32_t>::ptr g_fiber_cache_size =
+    Config::Lookup<uint32_t>("fiber.stack_pool.fiber_cache", 64, "terminated fiber objects cached per thread");
+
+static std::atomic<uint64_t> s_stack_pool_hits {0};
+static std::atomic<uint64_t> s_stack_pool_misses {0};
+static std::atomic<uint64_t> s_fiber_cache_hits {0};
+
+/**
+ * @brief mmap 分配协程栈, 栈底(低地址)放一页 PROT_NONE 保护页, 栈溢出直接 SIGSEGV
+ */
+class MmapStackAllocator {
 public:
+    static size_t PageSize() {
+        static size_t s_page_size = sysconf(_SC_PAGESIZE);
+        return s_page_size;
+    }
+
     static void* Alloc(size_t size) {
-        return malloc(size);
+        size_t page = PageSize();
+        void* base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE
+                        , MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if(base == MAP_FAILED) {
+            WYZ_LOG_ERROR(g_logger) << "mmap fiber stack size=" << size
+                << " errno=" << errno;
+            return nullptr;
+        }
+        if(mprotect(base, page, PROT_NONE)) {
+            WYZ_LOG_ERROR(g_logger) << "mprotect fiber stack guard errno=" << errno;
+        }
+        return (char*)base + page;
     }
 
     static void Dealloc(void* vp, size_t size) {
-        return free(vp);
+        size_t page = PageSize();
+        munmap((char*)vp - page, size + page);
+    }
+};
+
+/**
+ * @brief 每个线程一个的协程栈池
+ * @details 只缓存 fiber.stack_size 大小的栈, 其他大小直接 mmap/munmap; 空闲栈超过高水位时释放到低水位
+ */
+class StackPool {
+public:
+    ~StackPool() {
+        for(auto vp : m_stacks) {
+            MmapStackAllocator::Dealloc(vp, m_size);
+        }
+    }
+
+    void* alloc(size_t size) {
+        size_t pooled = g_fiber_stack_size->getValue();
+        if(pooled != m_size) {
+            /// 配置的栈大小变了, 旧的栈全部释放
+            trim(0);
+            m_size = pooled;
+            for(uint32_t i = 0; i < g_stack_pool_size->getValue(); ++i) {
+                void* vp = MmapStackAllocator::Alloc(m_size);
+                if(!vp) {
+                    break;
+                }
+                m_stacks.push_back(vp);
+            }
+        }
+        /// 其他大小的栈不进池, 直接 mmap, 不影响池中的栈
+        if(size != m_size) {
+            return MmapStackAllocator::Alloc(size);
+        }
+        if(!m_stacks.empty()) {
+            ++s_stack_pool_hits;
+            void* vp = m_stacks.back();
+            m_stacks.pop_back();
+            return vp;
+        }
+        ++s_stack_pool_misses;
+        return MmapStackAllocator::Alloc(size);
+    }
+
+    void dealloc(void* vp, size_t size) {
+        if(size != m_size) {
+            MmapStackAllocator::Dealloc(vp, size);
+            return;
+        }
+        m_stacks.push_back(vp);
+        if(m_stacks.size() > g_stack_pool_high->getValue()) {
+            trim(g_stack_pool_low->getValue());
+        }
+    }
+
+private:
+    void trim(size_t keep) {
+        while(m_stacks.size() > keep) {
+            MmapStackAllocator::Dealloc(m_stacks.back(), m_size);
+            m_stacks.pop_back();
+        }
     }
+
+private:
+    size_t m_size = 0;
+    std::vector<void*> m_stacks;
+};
+
+/**
+ * @brief 线程局部的栈池与已结束协程对象缓存
+ * @attention 成员逆序析构, 先析构缓存的协程把栈还给 stacks, 再释放 stacks
+ */
+struct FiberPool {
+    StackPool stacks;
+    std::vector<Fiber::ptr> fibers;
+    ~FiberPool();
 };
 
-using StackAllocator = MallocStackAllocator;
+static thread_local FiberPool* t_fiber_pool = nullptr;
+/// 线程退出时 FiberPool 已析构, 之后释放的栈直接 munmap
+static thread_local bool t_fiber_pool_destroyed = false;
+
+FiberPool::~FiberPool() {
+    fibers.clear();
+    t_fiber_pool = nullptr;
+    t_fiber_pool_destroyed = true;
+}
+
+static FiberPool* GetFiberPool() {
+    if(t_fiber_pool || t_fiber_pool_destroyed) {
+        return t_fiber_pool;
+    }
+    static thread_local FiberPool s_pool;
+    t_fiber_pool = &s_pool;
+    return t_fiber_pool;
+}
+
+class PoolStackAllocator {
+public:
+    static void* Alloc(size_t size) {
+        FiberPool* pool = GetFiberPool();
+        if(pool) {
+            return pool->stacks.alloc(size);
+        }
+        return MmapStackAllocator::Alloc(size);
+    }
+
+    static void Dealloc(void* vp, size_t size) {
+        FiberPool* pool = GetFiberPool();
+        if(pool) {
+            pool->stacks.dealloc(vp, size);
+        } else {
+            MmapStackAllocator::Dealloc(vp, size);
+        }
+    }
+};
+
+using StackAllocator = PoolStackAllocator;
 
 uint64_t Fiber::GetFiberId() {
     if(t_fiber) {
@@ -42,8 +192,8 @@ Fiber::Fiber() {
     m_state = EXEC;
     SetThis(this);
 
-    if(getcontext(&m_ctx)) {
-        WYZ_ASSERT2(false, "getcontext");
+    if(!m_ctx.init()) {
+        WYZ_ASSERT2(false, "init context");
     }
 
     ++s_fiber_count;
@@ -58,17 +208,10 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
     m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
 
     m_stack = StackAllocator::Alloc(m_stacksize);
-    if(getcontext(&m_ctx)) {
-        WYZ_ASSERT2(false, "getcontext");
-    }
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
-    if(!use_caller) {
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    } else {
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+    WYZ_ASSERT2(m_stack, "alloc fiber stack size=" << m_stacksize);
+    if(!m_ctx.make(m_stack, m_stacksize
+            , use_caller ? &Fiber::CallerMainFunc : &Fiber::MainFunc)) {
+        WYZ_ASSERT2(false, "make context");
     }
 
     WYZ_LOG_DEBUG(g_logger) << "Fiber::Fiber id=" << m_id;
@@ -95,6 +238,53 @@ Fiber::~Fiber() {
                               << " total=" << s_fiber_count;
 }
 
+Fiber::ptr Fiber::Create(std::function<void()> cb, size_t stacksize, bool use_caller) {
+    size_t size = stacksize ? stacksize : g_fiber_stack_size->getValue();
+    FiberPool* pool = GetFiberPool();
+    if(pool && !pool->fibers.empty() && pool->fibers.back()->m_stacksize == size) {
+        Fiber::ptr fiber = pool->fibers.back();
+        pool->fibers.pop_back();
+        fiber->m_id = ++s_fiber_id;
+        fiber->reset(cb, use_caller);
+        ++s_fiber_cache_hits;
+        return fiber;
+    }
+    return Fiber::ptr(new Fiber(cb, size, use_caller));
+}
+
+void Fiber::Recycle(Fiber::ptr& fiber) {
+    if(!fiber || !fiber->m_stack || fiber.use_count() != 1
+            || (fiber->m_state != TERM
+                && fiber->m_state != EXCEPT
+                && fiber->m_state != INIT)) {
+        return;
+    }
+    /// 与栈池一致, 只缓存默认栈大小的协程
+    if(fiber->m_stacksize != g_fiber_stack_size->getValue()) {
+        return;
+    }
+    FiberPool* pool = GetFiberPool();
+    if(!pool || pool->fibers.size() >= g_fiber_cache_size->getValue()) {
+        return;
+    }
+    /// 释放回调里捕获的资源(socket 等), 不要跟着缓存一起活下去
+    fiber->m_cb = nullptr;
+    pool->fibers.push_back(fiber);
+    fiber.reset();
+}
+
+uint64_t Fiber::StackPoolHits() {
+    return s_stack_pool_hits;
+}
+
+uint64_t Fiber::StackPoolMisses() {
+    return s_stack_pool_misses;
+}
+
+uint64_t Fiber::FiberCacheHits() {
+    return s_fiber_cache_hits;
+}
+
 //重置协程函数，并重置状态
 //INIT，TERM, EXCEPT
 void Fiber::reset(std::function<void()> cb , bool use_caller) {
@@ -103,18 +293,9 @@ void Fiber::reset(std::function<void()> cb , bool use_caller) {
             || m_state == EXCEPT
             || m_state == INIT);
     m_cb = cb;
-    if(getcontext(&m_ctx)) {
-        WYZ_ASSERT2(false, "getcontext");
-    }
-
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
-   if(!use_caller) {
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    } else {
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+    if(!m_ctx.make(m_stack, m_stacksize
+            , use_caller ? &Fiber::CallerMainFunc : &Fiber::MainFunc)) {
+        WYZ_ASSERT2(false, "make context");
     }
     m_state = INIT;
 }
@@ -122,33 +303,45 @@ void Fiber::reset(std::function<void()> cb , bool use_caller) {
 void Fiber::call() {
     SetThis(this);
     m_state = EXEC;
-    if(swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
-        WYZ_ASSERT2(false, "swapcontext");
+    if(!FiberContext::Swap(t_threadFiber->m_ctx, m_ctx)) {
+        WYZ_ASSERT2(false, "swap context");
     }
 }
 
 void Fiber::resume() {
     SetThis(t_threadFiber.get());
-    if(swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-        WYZ_ASSERT2(false, "swapcontext");
+    if(!FiberContext::Swap(m_ctx, t_threadFiber->m_ctx)) {
+        WYZ_ASSERT2(false, "swap context");
     }
 }
 
 //切换到当前协程执行
-void Fiber::swapIn() {
+Fiber::State Fiber::swapIn() {
+    /// 协程先把自己交给 IO 事件/定时器再切出, 其他线程可能在现场保存完之前就唤醒它
+    while(m_switching.load(std::memory_order_acquire)) {
+        sched_yield();
+    }
     SetThis(this);
     WYZ_ASSERT(m_state != EXEC);
     m_state = EXEC;
-    if(swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
-        WYZ_ASSERT2(false, "swapcontext");
+    m_switching.store(true, std::memory_order_relaxed);
+    if(!FiberContext::Swap(Scheduler::GetMainFiber()->m_ctx, m_ctx)) {
+        WYZ_ASSERT2(false, "swap context");
+    }
+    /// 直接 swapOut 的协程状态仍为 EXEC, 视为挂起
+    if(m_state == EXEC) {
+        m_state = HOLD;
     }
+    State state = m_state;
+    m_switching.store(false, std::memory_order_release);
+    return state;
 }
 
 //切换到后台执行
 void Fiber::swapOut() {
     SetThis(Scheduler::GetMainFiber());
-    if(swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
-        WYZ_ASSERT2(false, "swapcontext");
+    if(!FiberContext::Swap(m_ctx, Scheduler::GetMainFiber()->m_ctx)) {
+        WYZ_ASSERT2(false, "swap context");
     }
 }
 
@@ -9,8 +9,9 @@
 #define __WYZ_FIBER_H__
 
 #include <memory>
+#include <atomic>
 #include <functional>
-#include <ucontext.h>
+#include "fcontext.h"
 
 
 namespace wyz {
@@ -46,6 +47,20 @@ public:
     Fiber(std::function<void ()> cb , size_t stacksize = 0 , bool use_caller = false);
     ~Fiber();
 
+    /**
+     * @brief 创建协程, 优先复用当前线程缓存中已结束的协程对象
+     * @param {function<void ()>} cb 协程运行函数
+     * @param {size_t} stacksize    协程栈大小
+     */
+    static Fiber::ptr Create(std::function<void ()> cb , size_t stacksize = 0 , bool use_caller = false);
+
+    /**
+     * @brief 回收已结束的协程对象到当前线程缓存, 供 Create 复用
+     * @details 只有 fiber 是唯一持有者且处于 TERM/EXCEPT/INIT 状态时才会回收
+     * @post 回收成功后 fiber 被置空
+     */
+    static void Recycle(Fiber::ptr& fiber);
+
     /**
      * @description: 重置协程运行函数
      * @param {function<void ()>} cb 
@@ -54,8 +69,10 @@ public:
 
     /**
      * @description: 当前协程切换为运行状态
+     * @details 上一次切出还没在别的线程保存完现场时会先等待
+     * @return 切回调度协程时该协程的状态, 之后协程可能已被其他线程唤醒, 不要再读 getState()
      */    
-    void swapIn();
+    State swapIn();
 
     /**
      * @description: 将当前协程切换至后台 
@@ -120,11 +137,19 @@ public:
      */
     static uint64_t GetFiberId();
 
+    /**
+     * @brief 协程栈池命中/未命中次数, 以及协程对象复用次数
+     */
+    static uint64_t StackPoolHits();
+    static uint64_t StackPoolMisses();
+    static uint64_t FiberCacheHits();
+
 private:
     uint64_t m_id = 0 ;             //  协程id
     uint32_t m_stacksize = 0;       //  协程运行栈大小
     State m_state = INIT;           //  协程状态
-    ucontext_t m_ctx;               //  协程运行现场上下文
+    FiberContext m_ctx;             //  协程运行现场上下文
+    std::atomic<bool> m_switching = {false};   //  切出途中, 现场还没保存完
     void* m_stack = nullptr;        //  协程运行栈指针
     std::function<void ()> m_cb;    //  协程执行函数
 };
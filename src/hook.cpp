@@ -12,10 +12,12 @@
 #include "fdmanager.h"
 #include "log.h"
 #include "config.h"
+#include "uring.h"
 
 #include <dlfcn.h>
 #include <memory>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <stdarg.h>
 
 namespace wyz {
@@ -32,16 +34,20 @@ static thread_local bool t_hook_enable = false;
     XX(socket)\
     XX(connect)\
     XX(accept)\
+    XX(accept4)\
     XX(read)\
     XX(readv)\
     XX(recv)\
     XX(recvfrom)\
     XX(recvmsg)\
+    XX(recvmmsg)\
     XX(write)\
     XX(writev)\
     XX(send)\
     XX(sendto)\
     XX(sendmsg)\
+    XX(sendmmsg)\
+    XX(sendfile)\
     XX(close)\
     XX(fcntl)\
     XX(ioctl)\
@@ -90,6 +96,13 @@ struct timer_info{
     int cancelled = 0;
 };
 
+/// 记一次 hook 发出的 IO 系统调用
+static inline void count_io_call(){
+    if(wyz::IOManager* iom = wyz::IOManager::GetThis()){
+        iom->countIOCall();
+    }
+}
+
 /* 通用的 io 处理函数 */
 template<typename OriginFun , typename... Args>
 static ssize_t do_io(int fd , OriginFun fun , const char* hook_fun_name , uint32_t event , int timeout_so , Args&&... args){
@@ -110,6 +123,7 @@ static ssize_t do_io(int fd , OriginFun fun , const char* hook_fun_name , uint32
     }
     /// 文件不是socket 或者用户主动设置为非阻塞状态
     if(!ctx->isSocket() || ctx->getUserNonblock()){
+        count_io_call();
         return fun(fd , std::forward<Args>(args)...);
     }
     /// 获得超时时间
@@ -117,11 +131,14 @@ static ssize_t do_io(int fd , OriginFun fun , const char* hook_fun_name , uint32
     std::shared_ptr<timer_info> tinfo(new timer_info);
 
 retry:
+    /// 挂起后可能换了线程, 这里之后的 errno 都通过 CurrentErrno 访问
+    count_io_call();
     ssize_t n = fun(fd , std::forward<Args>(args)...);
-    while(n == -1 && errno == EINTR){
+    while(n == -1 && wyz::CurrentErrno() == EINTR){
+        count_io_call();
         n = fun(fd , std::forward<Args>(args)...);
     }
-    if(n == -1 && errno == EAGAIN){
+    if(n == -1 && wyz::CurrentErrno() == EAGAIN){
         /// fun 原函数是阻塞类型的io
         wyz::IOManager* iom = wyz::IOManager::GetThis();
         wyz::Timer::ptr timer;
@@ -148,6 +165,10 @@ retry:
             }
             return -1;
         }else {
+            /// 其他线程在 addEvent 之前已经 close, 它的 cancelAll 没看到这个事件
+            if(ctx->isClosed()){
+                iom->cancelEvent(fd, static_cast<wyz::IOManager::EventType>(event));
+            }
             /// 这里就是当 io 操作是阻塞状态的时候， 出让调度器，等 epoll 唤醒这给
             wyz::Fiber::CallerYieldToHold();
         
@@ -155,7 +176,11 @@ retry:
                 timer->cancel();
             }
             if(tinfo->cancelled){
-                errno = tinfo->cancelled;
+                wyz::CurrentErrno() = tinfo->cancelled;
+                return -1;
+            }
+            if(ctx->isClosed()){
+                wyz::CurrentErrno() = EBADF;
                 return -1;
             }
             goto retry;
@@ -166,6 +191,39 @@ retry:
 
 }
 
+/**
+ * @brief 判断 fd 上的 IO 是否走 io_uring
+ * @return 可以使用的 IOManager, 否则返回 nullptr 走 do_io
+ */
+static wyz::IOManager* uring_iomanager(int fd, wyz::FdCtx::ptr& ctx){
+#ifdef WYZ_HAVE_IO_URING
+    if(!wyz::t_hook_enable){
+        return nullptr;
+    }
+    wyz::IOManager* iom = wyz::IOManager::GetThis();
+    if(!iom || !iom->hasIOUring()){
+        return nullptr;
+    }
+    ctx = wyz::FdMar::GetInstance()->get(fd);
+    if(!ctx || ctx->isClosed() || !ctx->isSocket() || ctx->getUserNonblock()){
+        return nullptr;
+    }
+    return iom;
+#else
+    return nullptr;
+#endif
+}
+
+/**
+ * @brief io_uring 版本的 do_io: 调用方先试一次非阻塞的系统调用, EAGAIN 时才提交,
+ *        数据已经就绪时不需要 io_uring_enter 与一次协程切换
+ */
+static ssize_t do_uring_io(wyz::IOManager* iom, wyz::FdCtx::ptr ctx, int fd, uint8_t opcode, uint32_t event
+                        , int timeout_so, void* addr, uint32_t len, uint64_t off, uint32_t op_flags){
+    return iom->submitIO(fd, static_cast<wyz::IOManager::EventType>(event), opcode
+                        , addr, len, off, op_flags, ctx->getTimeout(timeout_so));
+}
+
 
 extern "C"{
 #define XX(name) name ##_func name ##_f = nullptr;
@@ -239,6 +297,19 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
         return connect_f(sockfd, addr , addrlen);
     }
 
+#ifdef WYZ_HAVE_IO_URING
+    wyz::FdCtx::ptr uctx;
+    wyz::IOManager* uiom = wyz::uring_iomanager(sockfd, uctx);
+    if(uiom){
+        ssize_t rt = uiom->submitIO(sockfd, wyz::IOManager::WRITE, IORING_OP_CONNECT
+                    , (void*)addr, 0, addrlen, 0, timeout_ms);
+        if(rt != wyz::IOManager::IO_NOT_SUBMITTED){
+            return rt;
+        }
+    }
+#endif
+
+    count_io_call();
     int n  = connect_f(sockfd, addr , addrlen);
     if(n == 0){
         return 0;
@@ -274,7 +345,7 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
             timer->cancel();
         }
         if(tinfo->cancelled){
-            errno = tinfo->cancelled;
+            wyz::CurrentErrno() = tinfo->cancelled;
             return -1;
         }
     }
@@ -287,7 +358,7 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
     if(!error){
         return 0;
     }else {
-        errno = error;
+        wyz::CurrentErrno() = error;
         return -1;
     }
 
@@ -298,7 +369,35 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen){
 }
 
 int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen){
-    int fd = do_io(sockfd, accept_f, "accept", wyz::IOManager::READ, SO_RCVTIMEO, addr , addrlen);
+    int fd = wyz::IOManager::IO_NOT_SUBMITTED;
+#ifdef WYZ_HAVE_IO_URING
+    wyz::FdCtx::ptr ctx;
+    if(wyz::IOManager* iom = wyz::uring_iomanager(sockfd, ctx)){
+        fd = wyz::do_uring_io(iom, ctx, sockfd, IORING_OP_ACCEPT, wyz::IOManager::READ, SO_RCVTIMEO
+                    , addr, 0, (uint64_t)addrlen, 0);
+    }
+#endif
+    if(fd == wyz::IOManager::IO_NOT_SUBMITTED){
+        fd = do_io(sockfd, accept_f, "accept", wyz::IOManager::READ, SO_RCVTIMEO, addr , addrlen);
+    }
+    if(fd >= 0){
+        wyz::FdMar::GetInstance()->get(fd ,true);
+    }
+    return fd;
+}
+
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags){
+    int fd = wyz::IOManager::IO_NOT_SUBMITTED;
+#ifdef WYZ_HAVE_IO_URING
+    wyz::FdCtx::ptr ctx;
+    if(wyz::IOManager* iom = wyz::uring_iomanager(sockfd, ctx)){
+        fd = wyz::do_uring_io(iom, ctx, sockfd, IORING_OP_ACCEPT, wyz::IOManager::READ, SO_RCVTIMEO
+                    , addr, 0, (uint64_t)addrlen, flags);
+    }
+#endif
+    if(fd == wyz::IOManager::IO_NOT_SUBMITTED){
+        fd = do_io(sockfd, accept4_f, "accept4", wyz::IOManager::READ, SO_RCVTIMEO, addr , addrlen, flags);
+    }
     if(fd >= 0){
         wyz::FdMar::GetInstance()->get(fd ,true);
     }
@@ -306,6 +405,22 @@ int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen){
 }
 
 ssize_t read(int fd, void *buf, size_t count){
+#ifdef WYZ_HAVE_IO_URING
+    wyz::FdCtx::ptr ctx;
+    if(wyz::IOManager* iom = wyz::uring_iomanager(fd, ctx)){
+        /// 数据通常已经到达, 先直接读, EAGAIN 时才交给 io_uring
+        iom->countIOCall();
+        ssize_t n = read_f(fd, buf, count);
+        if(n >= 0 || errno != EAGAIN){
+            return n;
+        }
+        ssize_t rt = wyz::do_uring_io(iom, ctx, fd, IORING_OP_READ, wyz::IOManager::READ, SO_RCVTIMEO
+                    , buf, count, (uint64_t)-1, 0);
+        if(rt != wyz::IOManager::IO_NOT_SUBMITTED){
+            return rt;
+        }
+    }
+#endif
     return do_io(fd, read_f, "read", wyz::IOManager::READ, SO_RCVTIMEO, buf , count);
 }
 
@@ -314,6 +429,21 @@ ssize_t readv(int fd, const struct iovec *iov, int iovcnt){
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags){
+#ifdef WYZ_HAVE_IO_URING
+    wyz::FdCtx::ptr ctx;
+    if(wyz::IOManager* iom = wyz::uring_iomanager(sockfd, ctx)){
+        iom->countIOCall();
+        ssize_t n = recv_f(sockfd, buf, len, flags);
+        if(n >= 0 || errno != EAGAIN){
+            return n;
+        }
+        ssize_t rt = wyz::do_uring_io(iom, ctx, sockfd, IORING_OP_RECV, wyz::IOManager::READ, SO_RCVTIMEO
+                    , buf, len, 0, flags);
+        if(rt != wyz::IOManager::IO_NOT_SUBMITTED){
+            return rt;
+        }
+    }
+#endif
     return do_io(sockfd, recv_f, "recv", wyz::IOManager::READ, SO_RCVTIMEO, buf ,len ,flags);
 }
 
@@ -325,7 +455,27 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags){
     return do_io(sockfd, recvmsg_f, "recvmsg", wyz::IOManager::READ, SO_RCVTIMEO, msg ,flags);
 }
 
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout){
+    return do_io(sockfd, recvmmsg_f, "recvmmsg", wyz::IOManager::READ, SO_RCVTIMEO, msgvec, vlen, flags, timeout);
+}
+
 ssize_t write(int fd, const void *buf, size_t count){
+#ifdef WYZ_HAVE_IO_URING
+    wyz::FdCtx::ptr ctx;
+    if(wyz::IOManager* iom = wyz::uring_iomanager(fd, ctx)){
+        /// 发送缓冲区通常有空间, 先直接写, EAGAIN 时才交给 io_uring
+        iom->countIOCall();
+        ssize_t n = write_f(fd, buf, count);
+        if(n >= 0 || errno != EAGAIN){
+            return n;
+        }
+        ssize_t rt = wyz::do_uring_io(iom, ctx, fd, IORING_OP_WRITE, wyz::IOManager::WRITE, SO_SNDTIMEO
+                    , (void*)buf, count, (uint64_t)-1, 0);
+        if(rt != wyz::IOManager::IO_NOT_SUBMITTED){
+            return rt;
+        }
+    }
+#endif
     return do_io(fd, write_f, "erite", wyz::IOManager::WRITE, SO_SNDTIMEO, buf , count);
 }
 
@@ -334,6 +484,21 @@ ssize_t writev(int fd, const struct iovec *iov, int iovcnt){
 }
 
 ssize_t send(int sockfd, const void *buf, size_t len, int flags){
+#ifdef WYZ_HAVE_IO_URING
+    wyz::FdCtx::ptr ctx;
+    if(wyz::IOManager* iom = wyz::uring_iomanager(sockfd, ctx)){
+        iom->countIOCall();
+        ssize_t n = send_f(sockfd, buf, len, flags);
+        if(n >= 0 || errno != EAGAIN){
+            return n;
+        }
+        ssize_t rt = wyz::do_uring_io(iom, ctx, sockfd, IORING_OP_SEND, wyz::IOManager::WRITE, SO_SNDTIMEO
+                    , (void*)buf, len, 0, flags);
+        if(rt != wyz::IOManager::IO_NOT_SUBMITTED){
+            return rt;
+        }
+    }
+#endif
     return do_io(sockfd, send_f, "send", wyz::IOManager::WRITE, SO_SNDTIMEO, buf ,len , flags);
 }
 
@@ -345,12 +510,22 @@ ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags){
     return do_io(sockfd, sendmsg_f, "sendmsg", wyz::IOManager::WRITE, SO_SNDTIMEO, msg ,flags);
 }
 
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags){
+    return do_io(sockfd, sendmmsg_f, "sendmmsg", wyz::IOManager::WRITE, SO_SNDTIMEO, msgvec, vlen, flags);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count){
+    return do_io(out_fd, sendfile_f, "sendfile", wyz::IOManager::WRITE, SO_SNDTIMEO, in_fd, offset, count);
+}
+
 int close(int fd){
     if(!wyz::t_hook_enable){
         return close_f(fd);
     }
     wyz::FdCtx::ptr ctx = wyz::FdMar::GetInstance()->get(fd);
     if(ctx){
+        /// 先标记关闭再唤醒等待者, 被唤醒的协程不会在 close_f 之前又挂回 epoll
+        ctx->setClosed(true);
         wyz::IOManager* iom = wyz::IOManager::GetThis();
         iom->cancelAll(fd);
         wyz::FdMar::GetInstance()->del(fd);
@@ -52,6 +52,9 @@ extern connect_func connect_f;
 typedef int (*accept_func)(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 extern accept_func accept_f;
 
+typedef int (*accept4_func)(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+extern accept4_func accept4_f;
+
 /// read
 typedef ssize_t (*read_func)(int fd, void *buf, size_t count);
 extern read_func read_f;
@@ -68,6 +71,9 @@ extern recvfrom_func recvfrom_f;
 typedef ssize_t (*recvmsg_func)(int sockfd, struct msghdr *msg, int flags);
 extern recvmsg_func recvmsg_f;
 
+typedef int (*recvmmsg_func)(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout);
+extern recvmmsg_func recvmmsg_f;
+
 /// write
 typedef ssize_t (*write_func)(int fd, const void *buf, size_t count);
 extern write_func write_f;
@@ -84,6 +90,12 @@ extern sendto_func sendto_f;
 typedef ssize_t (*sendmsg_func)(int sockfd, const struct msghdr *msg, int flags);
 extern sendmsg_func sendmsg_f;
 
+typedef int (*sendmmsg_func)(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+extern sendmmsg_func sendmmsg_f;
+
+typedef ssize_t (*sendfile_func)(int out_fd, int in_fd, off_t *offset, size_t count);
+extern sendfile_func sendfile_f;
+
 typedef int (*close_func)(int fd);
 extern close_func close_f;
 
@@ -0,0 +1,369 @@
+/**
+ * @file cache_servlet.cpp
+ * @brief 缓存响应的 Servlet 实现
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-28
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#include "cache_servlet.h"
+#include "../config.h"
+#include "../log.h"
+#include "../util.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <strings.h>
+
+namespace wyz {
+namespace http {
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_NAME("system");
+
+static wyz::ConfigVar<uint64_t>::ptr g_http_cache_max_bytes = wyz::Config::Lookup("http.cache.max_bytes", (uint64_t)64 * 1024 * 1024, "http response cache max bytes");
+static wyz::ConfigVar<uint64_t>::ptr g_http_cache_max_entry_size = wyz::Config::Lookup("http.cache.max_entry_size", (uint64_t)1024 * 1024, "http response larger than this is not cached");
+
+/// 分片数
+static const size_t s_shard_count = 16;
+/// 分片中记录的 Vary 超过这个数量时清空
+static const size_t s_max_varys = 4096;
+
+static void TrimSpace(StringView& s){
+    while(!s.empty() && (s.front() == ' ' || s.front() == '\t')){
+        s.remove_prefix(1);
+    }
+    while(!s.empty() && (s.back() == ' ' || s.back() == '\t')){
+        s.remove_suffix(1);
+    }
+}
+
+/**
+ * @brief 按逗号拆分头部的值, 去掉空白并转成小写
+ */
+static void SplitTokens(const std::string& v , std::vector<std::string>& tokens){
+    size_t pos = 0;
+    while(pos <= v.size()){
+        size_t end = v.find(',', pos);
+        if(end == std::string::npos){
+            end = v.size();
+        }
+        StringView token = StringView(v).substr(pos, end - pos);
+        TrimSpace(token);
+        if(!token.empty()){
+            std::string t(token.data(), token.size());
+            std::transform(t.begin(), t.end(), t.begin(), ::tolower);
+            tokens.push_back(t);
+        }
+        pos = end + 1;
+    }
+}
+
+/// 64 位 FNV-1a
+static uint64_t Fnv1a(const std::string& s){
+    uint64_t h = 0xcbf29ce484222325ull;
+    for(unsigned char c : s){
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+CacheServlet::CacheServlet(Servlet::ptr servlet , uint64_t ttl)
+    : Servlet("CacheServlet")
+    , m_servlet(servlet)
+    , m_ttl(ttl){
+    for(size_t i = 0 ; i < s_shard_count ; ++i){
+        m_shards.emplace_back(new Shard);
+    }
+}
+
+CacheServlet::~CacheServlet(){
+}
+
+void CacheServlet::clear(){
+    for(auto& i : m_shards){
+        Mutex::Lock lock(i->mutex);
+        i->lru.clear();
+        i->entries.clear();
+        i->varys.clear();
+        i->bytes = 0;
+    }
+}
+
+CacheServlet::Stats CacheServlet::getStats(){
+    Stats s;
+    s.hits = m_hits;
+    s.misses = m_misses;
+    s.coalesced = m_coalesced;
+    s.notModified = m_notModified;
+    s.stores = m_stores;
+    s.evictions = m_evictions;
+    s.entries = 0;
+    s.bytes = 0;
+    for(auto& i : m_shards){
+        Mutex::Lock lock(i->mutex);
+        s.entries += i->entries.size();
+        s.bytes += i->bytes;
+    }
+    return s;
+}
+
+void CacheServlet::makeKey(Shard& shard , const std::string& base , HttpRequest::ptr request , std::string& key){
+    key = base;
+    auto it = shard.varys.find(base);
+    if(it == shard.varys.end()){
+        return;
+    }
+    for(auto& i : it->second){
+        StringView v;
+        key.push_back('\n');
+        key.append(i);
+        key.push_back(':');
+        if(request->getHeaderView(i, v)){
+            key.append(v.data(), v.size());
+        }
+    }
+}
+
+CacheServlet::Entry::ptr CacheServlet::find(Shard& shard , const std::string& key , uint64_t now){
+    auto it = shard.entries.find(key);
+    if(it == shard.entries.end()){
+        return nullptr;
+    }
+    Entry::ptr entry = *it->second;
+    if(entry->expire <= now){
+        shard.bytes -= entry->size;
+        shard.lru.erase(it->second);
+        shard.entries.erase(it);
+        return nullptr;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return entry;
+}
+
+void CacheServlet::insert(Shard& shard , Entry::ptr entry){
+    auto it = shard.entries.find(entry->key);
+    if(it != shard.entries.end()){
+        shard.bytes -= (*it->second)->size;
+        shard.lru.erase(it->second);
+        shard.entries.erase(it);
+    }
+    shard.lru.push_front(entry);
+    shard.entries[entry->key] = shard.lru.begin();
+    shard.bytes += entry->size;
+    uint64_t capacity = g_http_cache_max_bytes->getValue() / s_shard_count;
+    while(shard.bytes > capacity && shard.lru.size() > 1){
+        Entry::ptr& last = shard.lru.back();
+        shard.bytes -= last->size;
+        shard.entries.erase(last->key);
+        shard.lru.pop_back();
+        ++m_evictions;
+    }
+}
+
+CacheServlet::Entry::ptr CacheServlet::makeEntry(HttpResponse::ptr response , uint64_t now , std::vector<std::string>& vary){
+    if(response->getStatus() != HttpStatus::OK || response->isStream()
+            || response->getBody().size() > g_http_cache_max_entry_size->getValue()){
+        return nullptr;
+    }
+    const HttpResponse::MapType& headers = response->getHeader();
+    if(headers.count("set-cookie") || headers.count("transfer-encoding")){
+        return nullptr;
+    }
+    uint64_t ttl = m_ttl;
+    auto it = headers.find("cache-control");
+    if(it != headers.end()){
+        std::vector<std::string> directives;
+        SplitTokens(it->second, directives);
+        for(auto& i : directives){
+            if(i == "no-store" || i == "no-cache" || i == "private"){
+                return nullptr;
+            }
+            if(i.compare(0, 8, "max-age=") == 0){
+                ttl = std::min(ttl, (uint64_t)strtoull(i.c_str() + 8, nullptr, 10) * 1000);
+            }
+        }
+    }
+    if(ttl == 0){
+        return nullptr;
+    }
+    it = headers.find("vary");
+    if(it != headers.end()){
+        SplitTokens(it->second, vary);
+        if(std::find(vary.begin(), vary.end(), "*") != vary.end()){
+            return nullptr;
+        }
+    }
+
+    Entry::ptr entry(new Entry);
+    entry->expire = now + ttl;
+    it = headers.find("etag");
+    if(it != headers.end()){
+        entry->etag = it->second;
+    }else {
+        char etag[48];
+        snprintf(etag, sizeof(etag), "\"%016llx-%zx\"", (unsigned long long)Fnv1a(response->getBody())
+                , response->getBody().size());
+        entry->etag = etag;
+        response->setHeader("ETag", entry->etag);
+    }
+    /// 缓存的响应每次发送时重新生成 Date
+    response->delHeader("Date");
+    response->serializeFields(entry->wire);
+    entry->headLen = entry->wire.size();
+    entry->wire.append(response->getBody());
+
+    /// 304 只带与缓存相关的头部
+    static const char* s_not_modified_headers[] = {"cache-control", "content-location", "etag", "expires", "last-modified", "vary"};
+    for(auto name : s_not_modified_headers){
+        it = headers.find(name);
+        if(it != headers.end()){
+            entry->notModified.append(it->first);
+            entry->notModified.append(": ", 2);
+            entry->notModified.append(it->second);
+            entry->notModified.append("\r\n", 2);
+        }
+    }
+    entry->notModified.append("\r\n", 2);
+    return entry;
+}
+
+int32_t CacheServlet::sendEntry(Entry::ptr entry , HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session){
+    StringView cond;
+    bool not_modified = request->getHeaderView("if-none-match", cond) && EtagMatch(cond, StringView(entry->etag));
+    if(not_modified){
+        ++m_notModified;
+    }
+    response->setStatus(not_modified ? HttpStatus::NOT_MODIFIED : HttpStatus::OK);
+    /// 由这里直接发送, 流水线中排在前面的响应先发出
+    response->setStream(true);
+    if(session->flush() < 0){
+        response->setClose(true);
+        return -1;
+    }
+    std::string head;
+    head.reserve(128);
+    response->serializeStatus(head);
+    iovec iov[2];
+    iov[0].iov_base = &head[0];
+    iov[0].iov_len = head.size();
+    if(not_modified){
+        iov[1].iov_base = &entry->notModified[0];
+        iov[1].iov_len = entry->notModified.size();
+    }else {
+        iov[1].iov_base = &entry->wire[0];
+        iov[1].iov_len = request->getMethod() == HttpMethod::HEAD ? entry->headLen : entry->wire.size();
+    }
+    if(session->writevFixSize(iov, 2) <= 0){
+        response->setClose(true);
+        return -1;
+    }
+    return 0;
+}
+
+CacheServlet::LoadingGuard::~LoadingGuard(){
+    Loader::ptr loader;
+    {
+        Mutex::Lock lock(shard.mutex);
+        auto it = shard.loading.find(key);
+        if(it != shard.loading.end()){
+            loader = it->second;
+            shard.loading.erase(it);
+        }
+    }
+    if(loader){
+        for(auto& i : loader->waiters){
+            i.first->schedule(i.second);
+        }
+    }
+}
+
+int32_t CacheServlet::handle(HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session){
+    HttpMethod method = request->getMethod();
+    StringView v;
+    if((method != HttpMethod::GET && method != HttpMethod::HEAD)
+            || request->getHeaderView("authorization", v) || request->getHeaderView("range", v)){
+        return m_servlet->handle(request, response, session);
+    }
+    StringView path = request->getPathView();
+    StringView query = request->getQueryView();
+    std::string base;
+    base.reserve(path.size() + query.size() + 1);
+    base.append(path.data(), path.size());
+    base.push_back('?');
+    base.append(query.data(), query.size());
+    Shard& shard = *m_shards[std::hash<std::string>()(base) % s_shard_count];
+
+    std::string key;
+    bool waited = false;
+    while(true){
+        Mutex::Lock lock(shard.mutex);
+        /// 生成的响应可能带有新的 Vary, 每次都重新生成键
+        makeKey(shard, base, request, key);
+        Entry::ptr entry = find(shard, key, wyz::GetCurrentMS());
+        if(entry){
+            lock.unlock();
+            ++m_hits;
+            return sendEntry(entry, request, response, session);
+        }
+        /// HEAD 的响应可能没有消息体, 不用来生成缓存. 等待过一次仍然没有说明不能缓存
+        if(method == HttpMethod::HEAD || waited){
+            lock.unlock();
+            ++m_misses;
+            return m_servlet->handle(request, response, session);
+        }
+        auto it = shard.loading.find(key);
+        if(it == shard.loading.end()){
+            shard.loading[key].reset(new Loader);
+            break;
+        }
+        it->second->waiters.push_back(std::make_pair(Scheduler::GetThis(), Fiber::GetThis()));
+        lock.unlock();
+        ++m_coalesced;
+        Fiber::CallerYieldToHold();
+        waited = true;
+    }
+
+    ++m_misses;
+    int32_t rt = 0;
+    Entry::ptr entry;
+    {
+        LoadingGuard guard(shard, key);
+        rt = m_servlet->handle(request, response, session);
+        std::vector<std::string> vary;
+        entry = rt == 0 ? makeEntry(response, wyz::GetCurrentMS(), vary) : nullptr;
+        if(entry){
+            Mutex::Lock lock(shard.mutex);
+            if(vary.empty()){
+                shard.varys.erase(base);
+            }else {
+                if(shard.varys.size() >= s_max_varys){
+                    shard.varys.clear();
+                }
+                shard.varys[base] = vary;
+            }
+            makeKey(shard, base, request, entry->key);
+            entry->size = sizeof(Entry) + entry->key.size() + entry->wire.size() + entry->notModified.size();
+            insert(shard, entry);
+            ++m_stores;
+        }
+    }
+    if(entry){
+        StringView cond;
+        if(request->getHeaderView("if-none-match", cond) && EtagMatch(cond, StringView(entry->etag))){
+            ++m_notModified;
+            response->setStatus(HttpStatus::NOT_MODIFIED);
+            response->setBody("");
+        }
+    }
+    WYZ_LOG_DEBUG(g_logger) << "cache miss key=" << key << " stored=" << (entry != nullptr);
+    return rt;
+}
+
+}
+}
@@ -0,0 +1,150 @@
+/**
+ * @file cache_servlet.h
+ * @brief 缓存响应的 Servlet
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-28
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#ifndef __WYZ_HTTP_CACHE_SERVLET_H__
+#define __WYZ_HTTP_CACHE_SERVLET_H__
+
+#include "servlet.h"
+#include "../fiber.h"
+#include "../mutex.h"
+#include "../scheduler.h"
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace wyz {
+namespace http {
+
+/**
+ * @brief 包装另一个 Servlet, 在内存中缓存它的 GET 响应
+ * @details 以路径, query 与响应 Vary 中列出的请求头部为键, 按键的哈希分成多个分片,
+ *          每个分片独立加锁, 按 LRU 与字节数淘汰. 只缓存 200 且不是流式发送的响应,
+ *          带 Set-Cookie, Vary: *, Cache-Control: no-store/no-cache/private 的不缓存,
+ *          Cache-Control: max-age 小于 ttl 时以它为准.
+ *          缓存的是除状态行, Date, Connection 之外预先序列化好的头部与消息体,
+ *          命中时补上这三行后用一次 writev 发出, 不再生成 HttpResponse 的内容.
+ *          没有 ETag 的响应按消息体生成一个, If-None-Match 匹配时返回 304.
+ *          HEAD 使用 GET 的缓存, 只发送头部. 带 Authorization 或 Range 的请求不经过缓存.
+ *          同一个键同时未命中时只有第一个协程调用被包装的 Servlet, 其他协程等待它的结果
+ */
+class CacheServlet : public Servlet{
+public:
+    using ptr = std::shared_ptr<CacheServlet>;
+
+    /**
+     * @brief Construct a new Cache Servlet object
+     * @param  servlet          被包装的 Servlet
+     * @param  ttl              缓存有效期(ms)
+     */
+    CacheServlet(Servlet::ptr servlet , uint64_t ttl);
+    ~CacheServlet();
+
+    int32_t handle(HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session) override;
+
+    /// 清空缓存
+    void clear();
+
+    /**
+     * @brief 缓存统计
+     */
+    struct Stats {
+        uint64_t hits;          /// 命中的次数
+        uint64_t misses;        /// 未命中, 调用被包装 Servlet 的次数
+        uint64_t coalesced;     /// 未命中时等待其他协程生成结果的次数
+        uint64_t notModified;   /// 返回 304 的次数
+        uint64_t stores;        /// 写入缓存的次数
+        uint64_t evictions;     /// 因为容量淘汰的条目数
+        uint64_t entries;       /// 当前条目数
+        uint64_t bytes;         /// 当前占用的字节数
+    };
+    Stats getStats();
+
+private:
+    /// 缓存的响应
+    struct Entry{
+        using ptr = std::shared_ptr<Entry>;
+        std::string key;
+        std::string wire;           /// 状态行, Date, Connection 之后的头部与消息体
+        size_t headLen = 0;         /// wire 中头部的长度, 包括结束的空行
+        std::string notModified;    /// 304 响应的头部, 同样不包括前三行
+        std::string etag;
+        uint64_t expire = 0;        /// 过期时间(ms)
+        size_t size = 0;            /// 计入容量的字节数
+    };
+
+    /// 正在生成的响应与等待它的协程
+    struct Loader{
+        using ptr = std::shared_ptr<Loader>;
+        std::vector<std::pair<Scheduler*, Fiber::ptr> > waiters;
+    };
+
+    struct Shard{
+        Mutex mutex;
+        std::list<Entry::ptr> lru;      /// 最近使用的在前
+        std::unordered_map<std::string, std::list<Entry::ptr>::iterator> entries;
+        std::unordered_map<std::string, std::vector<std::string> > varys;  /// 路径与 query 对应的 Vary 头部名称
+        std::unordered_map<std::string, Loader::ptr> loading;
+        uint64_t bytes = 0;
+    };
+
+    /**
+     * @brief 析构时去掉 key 的 loader 并唤醒等待它的协程
+     * @details 内层处理函数抛出异常时同样执行, 等待者不会永远挂起
+     */
+    struct LoadingGuard{
+        LoadingGuard(Shard& s , const std::string& k) : shard(s) , key(k) {}
+        ~LoadingGuard();
+        Shard& shard;
+        const std::string& key;
+    };
+
+    /**
+     * @brief 生成键, 调用时持有分片的锁
+     * @param  base             路径与 query
+     */
+    void makeKey(Shard& shard , const std::string& base , HttpRequest::ptr request , std::string& key);
+
+    /// 查找没有过期的条目, 调用时持有分片的锁
+    Entry::ptr find(Shard& shard , const std::string& key , uint64_t now);
+
+    /// 插入条目并按容量淘汰, 调用时持有分片的锁
+    void insert(Shard& shard , Entry::ptr entry);
+
+    /**
+     * @brief 用被包装 Servlet 生成的响应创建条目, 不能缓存时返回 nullptr
+     * @param  vary             返回 Vary 中列出的头部名称(小写)
+     */
+    Entry::ptr makeEntry(HttpResponse::ptr response , uint64_t now , std::vector<std::string>& vary);
+
+    /// 由这里直接发送缓存的响应
+    int32_t sendEntry(Entry::ptr entry , HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session);
+
+private:
+    Servlet::ptr m_servlet;
+    uint64_t m_ttl;
+    std::vector<std::unique_ptr<Shard> > m_shards;
+
+    std::atomic<uint64_t> m_hits = {0};
+    std::atomic<uint64_t> m_misses = {0};
+    std::atomic<uint64_t> m_coalesced = {0};
+    std::atomic<uint64_t> m_notModified = {0};
+    std::atomic<uint64_t> m_stores = {0};
+    std::atomic<uint64_t> m_evictions = {0};
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,375 @@
+/**
+ * @file file_servlet.cpp
+ * @brief 静态文件 Servlet 实现
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-25
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#include "file_servlet.h"
+#include "../config.h"
+#include "../log.h"
+#include "../util.h"
+#include <cstring>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace wyz {
+namespace http {
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_NAME("system");
+
+static wyz::ConfigVar<uint32_t>::ptr g_http_static_cache_size = wyz::Config::Lookup("http.static.cache_size", (uint32_t)1024, "http static file cache size");
+static wyz::ConfigVar<uint64_t>::ptr g_http_static_mmap_size = wyz::Config::Lookup("http.static.mmap_size", (uint64_t)64 * 1024, "http static file smaller than this is mmaped");
+
+/// 文件信息缓存后多久重新 stat (ms)
+static const uint64_t s_check_interval = 1000;
+
+static const struct {
+    const char* ext;
+    const char* type;
+} s_content_types[] = {
+    {"html",  "text/html"},
+    {"htm",   "text/html"},
+    {"css",   "text/css"},
+    {"js",    "application/javascript"},
+    {"json",  "application/json"},
+    {"txt",   "text/plain"},
+    {"xml",   "application/xml"},
+    {"png",   "image/png"},
+    {"jpg",   "image/jpeg"},
+    {"jpeg",  "image/jpeg"},
+    {"gif",   "image/gif"},
+    {"svg",   "image/svg+xml"},
+    {"ico",   "image/x-icon"},
+    {"webp",  "image/webp"},
+    {"woff",  "font/woff"},
+    {"woff2", "font/woff2"},
+    {"wasm",  "application/wasm"},
+    {"pdf",   "application/pdf"},
+    {"mp4",   "video/mp4"},
+};
+
+static const char* GetContentType(const std::string& path){
+    size_t pos = path.rfind('.');
+    if(pos != std::string::npos && path.find('/', pos) == std::string::npos){
+        const char* ext = path.c_str() + pos + 1;
+        for(auto& i : s_content_types){
+            if(strcasecmp(ext, i.ext) == 0){
+                return i.type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+/**
+ * @brief 路径中是否有 ".." 段
+ */
+static bool HasDotDot(const StringView& path){
+    size_t pos = 0;
+    while((pos = path.find("..", pos)) != StringView::npos){
+        bool begin = pos == 0 || path[pos - 1] == '/';
+        bool end = pos + 2 == path.size() || path[pos + 2] == '/';
+        if(begin && end){
+            return true;
+        }
+        pos += 2;
+    }
+    return false;
+}
+
+static bool ParseUInt(const StringView& v , uint64_t& rt){
+    if(v.empty() || v.size() > 18){
+        return false;
+    }
+    rt = 0;
+    for(char c : v){
+        if(c < '0' || c > '9'){
+            return false;
+        }
+        rt = rt * 10 + (c - '0');
+    }
+    return true;
+}
+
+/**
+ * @brief 解析 Range, 只支持单段
+ * @return int              1 有效, [start, end] 为闭区间
+ *                          0 没有或者忽略(多段, 格式错误), 返回整个文件
+ *                          -1 无法满足, 返回 416
+ */
+static int ParseRange(const StringView& header , uint64_t size , uint64_t& start , uint64_t& end){
+    if(header.size() < 6 || strncasecmp(header.data(), "bytes=", 6) != 0){
+        return 0;
+    }
+    StringView v = header.substr(6);
+    while(!v.empty() && v.front() == ' '){
+        v.remove_prefix(1);
+    }
+    while(!v.empty() && v.back() == ' '){
+        v.remove_suffix(1);
+    }
+    size_t dash = v.find('-');
+    if(dash == StringView::npos || v.find(',') != StringView::npos){
+        return 0;
+    }
+    if(dash == 0){
+        /// bytes=-n 最后 n 个字节
+        uint64_t n = 0;
+        if(!ParseUInt(v.substr(1), n)){
+            return 0;
+        }
+        if(n == 0 || size == 0){
+            return -1;
+        }
+        start = n >= size ? 0 : size - n;
+        end = size - 1;
+        return 1;
+    }
+    if(!ParseUInt(v.substr(0, dash), start)){
+        return 0;
+    }
+    if(dash + 1 == v.size()){
+        end = size ? size - 1 : 0;
+    }else if(!ParseUInt(v.substr(dash + 1), end) || end < start){
+        return 0;
+    }
+    if(start >= size){
+        return -1;
+    }
+    if(end >= size){
+        end = size - 1;
+    }
+    return 1;
+}
+
+static std::string HttpDate(time_t t){
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buf[64];
+    size_t n = strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return std::string(buf, n);
+}
+
+FileServlet::File::~File(){
+    if(data){
+        munmap(data, size);
+    }
+    if(fd >= 0){
+        ::close(fd);
+    }
+}
+
+FileServlet::FileServlet(const std::string& root , const std::string& prefix)
+    : Servlet("FileServlet")
+    , m_root(root)
+    , m_prefix(prefix){
+    while(!m_root.empty() && m_root.back() == '/'){
+        m_root.pop_back();
+    }
+    m_notFound.reset(new NotFoundServlet("wyz/1.0"));
+}
+
+FileServlet::~FileServlet(){
+}
+
+size_t FileServlet::getCacheSize(){
+    Mutex::Lock lock(m_mutex);
+    return m_files.size();
+}
+
+FileServlet::File::ptr FileServlet::openFile(const std::string& path){
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0){
+        return nullptr;
+    }
+    File::ptr file(new File);
+    file->fd = fd;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)){
+        return nullptr;
+    }
+    file->path = path;
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+    file->ino = st.st_ino;
+    file->checkTime = wyz::GetCurrentMS();
+    char etag[64];
+    snprintf(etag, sizeof(etag), "\"%lx-%lx\"", (unsigned long)st.st_mtime, (unsigned long)st.st_size);
+    file->etag = etag;
+    file->lastModified = HttpDate(st.st_mtime);
+    file->contentType = GetContentType(path);
+
+    /// 小文件映射到内存并预读, 之后不需要 fd
+    if(file->size > 0 && file->size <= g_http_static_mmap_size->getValue()){
+        void* data = mmap(nullptr, file->size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+        if(data != MAP_FAILED){
+            file->data = data;
+            ::close(file->fd);
+            file->fd = -1;
+        }else {
+            WYZ_LOG_WARN(g_logger) << "mmap " << path << " fail errno=" << errno << " " << strerror(errno);
+        }
+    }
+    return file;
+}
+
+FileServlet::File::ptr FileServlet::getFile(const std::string& path){
+    uint64_t now = wyz::GetCurrentMS();
+    File::ptr cached;
+    {
+        Mutex::Lock lock(m_mutex);
+        auto it = m_files.find(path);
+        if(it != m_files.end()){
+            cached = *it->second;
+            if(now - cached->checkTime < s_check_interval){
+                m_lru.splice(m_lru.begin(), m_lru, it->second);
+                return cached;
+            }
+        }
+    }
+
+    /// stat, open 与 mmap 不持有锁, 不阻塞其他文件的命中
+    if(cached){
+        struct stat st;
+        if(stat(path.c_str(), &st) == 0 && st.st_ino == cached->ino
+                && st.st_mtime == cached->mtime && (uint64_t)st.st_size == cached->size){
+            Mutex::Lock lock(m_mutex);
+            cached->checkTime = now;
+            auto it = m_files.find(path);
+            if(it != m_files.end() && *it->second == cached){
+                m_lru.splice(m_lru.begin(), m_lru, it->second);
+            }
+            return cached;
+        }
+    }
+    File::ptr file = openFile(path);
+
+    Mutex::Lock lock(m_mutex);
+    auto it = m_files.find(path);
+    if(it != m_files.end()){
+        if(*it->second != cached){
+            /// 其他线程已经先放入了新的 File, 用它的
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            return *it->second;
+        }
+        /// 文件已经变化或删除, 正在发送的请求仍然持有旧的 File
+        m_lru.erase(it->second);
+        m_files.erase(it);
+    }
+    if(!file){
+        return nullptr;
+    }
+    m_lru.push_front(file);
+    m_files[path] = m_lru.begin();
+    size_t capacity = g_http_static_cache_size->getValue();
+    while(m_files.size() > capacity && m_lru.size() > 1){
+        m_files.erase(m_lru.back()->path);
+        m_lru.pop_back();
+    }
+    return file;
+}
+
+int32_t FileServlet::handle(HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session){
+    HttpMethod method = request->getMethod();
+    if(method != HttpMethod::GET && method != HttpMethod::HEAD){
+        response->setStatus(HttpStatus::METHOD_NOT_ALLOWED);
+        response->setHeader("Allow", "GET, HEAD");
+        return 0;
+    }
+    StringView path = request->getPathView();
+    if(path.size() < m_prefix.size() || path.compare(0, m_prefix.size(), m_prefix) != 0
+            || HasDotDot(path)){
+        return m_notFound->handle(request, response, session);
+    }
+    path.remove_prefix(m_prefix.size());
+    std::string full = m_root;
+    if(path.empty() || path.front() != '/'){
+        full.push_back('/');
+    }
+    full.append(path.data(), path.size());
+    if(full.back() == '/'){
+        full.append("index.html");
+    }
+
+    File::ptr file = getFile(full);
+    if(!file){
+        return m_notFound->handle(request, response, session);
+    }
+    response->setHeader("ETag", file->etag);
+    response->setHeader("Last-Modified", file->lastModified);
+
+    StringView cond;
+    if(request->getHeaderView("if-none-match", cond)){
+        if(EtagMatch(cond, StringView(file->etag))){
+            response->setStatus(HttpStatus::NOT_MODIFIED);
+            return 0;
+        }
+    }else if(request->getHeaderView("if-modified-since", cond) && cond == StringView(file->lastModified)){
+        response->setStatus(HttpStatus::NOT_MODIFIED);
+        return 0;
+    }
+
+    response->setHeader("Content-Type", file->contentType);
+    response->setHeader("Accept-Ranges", "bytes");
+    uint64_t start = 0;
+    uint64_t length = file->size;
+    StringView range;
+    if(request->getHeaderView("range", range)){
+        uint64_t end = 0;
+        int rt = ParseRange(range, file->size, start, end);
+        if(rt < 0){
+            response->setStatus(HttpStatus::RANGE_NOT_SATISFIABLE);
+            response->setHeader("Content-Range", "bytes */" + std::to_string(file->size));
+            return 0;
+        }
+        if(rt > 0){
+            length = end - start + 1;
+            response->setStatus(HttpStatus::PARTIAL_CONTENT);
+            response->setHeader("Content-Range", "bytes " + std::to_string(start) + "-"
+                    + std::to_string(end) + "/" + std::to_string(file->size));
+        }
+    }
+    response->setHeader("Content-Length", std::to_string(length));
+
+    /// 由这里直接发送, 流水线中排在前面的响应先发出
+    response->setStream(true);
+    if(session->flush() < 0){
+        response->setClose(true);
+        return -1;
+    }
+    std::string head;
+    response->serializeHead(head);
+    iovec iov[2];
+    iov[0].iov_base = &head[0];
+    iov[0].iov_len = head.size();
+    int64_t rt = 0;
+    if(method == HttpMethod::HEAD || length == 0){
+        rt = session->writevFixSize(iov, 1);
+    }else if(file->data){
+        iov[1].iov_base = (char*)file->data + start;
+        iov[1].iov_len = length;
+        rt = session->writevFixSize(iov, 2);
+    }else {
+        rt = session->writevFixSize(iov, 1, MSG_MORE);
+        if(rt > 0){
+            rt = session->sendFileFixSize(file->fd, start, length);
+        }
+    }
+    if(rt <= 0){
+        response->setClose(true);
+        return -1;
+    }
+    return 0;
+}
+
+}
+}
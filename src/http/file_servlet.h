@@ -0,0 +1,89 @@
+/**
+ * @file file_servlet.h
+ * @brief 静态文件 Servlet
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-25
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#ifndef __WYZ_HTTP_FILE_SERVLET_H__
+#define __WYZ_HTTP_FILE_SERVLET_H__
+
+#include "servlet.h"
+#include "../mutex.h"
+#include <ctime>
+#include <list>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+namespace wyz {
+namespace http {
+
+/**
+ * @brief 静态文件 Servlet
+ * @details 请求路径去掉路由前缀后拼在根目录之后. 支持 GET/HEAD, Range(单段),
+ *          If-None-Match / If-Modified-Since 返回 304.
+ *          打开的文件按 LRU 缓存 fd, stat 结果与预先生成的 ETag/Last-Modified,
+ *          每秒最多重新 stat 一次检查文件是否变化.
+ *          小文件 mmap 后常驻内存, 与头部一起 writev 发送; 其他文件用 sendfile 发送
+ */
+class FileServlet : public Servlet{
+public:
+    using ptr = std::shared_ptr<FileServlet>;
+
+    /**
+     * @brief Construct a new File Servlet object
+     * @param  root             文件根目录
+     * @param  prefix           路由前缀, 与注册时的前缀相同
+     */
+    FileServlet(const std::string& root , const std::string& prefix = "/");
+    ~FileServlet();
+
+    int32_t handle(HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session) override;
+
+    /// 缓存的文件数
+    size_t getCacheSize();
+
+private:
+    /// 缓存的文件
+    struct File{
+        using ptr = std::shared_ptr<File>;
+        ~File();
+
+        std::string path;
+        int fd = -1;
+        uint64_t size = 0;
+        time_t mtime = 0;
+        ino_t ino = 0;
+        uint64_t checkTime = 0;     /// 上次 stat 的时间(ms)
+        std::string etag;
+        std::string lastModified;
+        const char* contentType = nullptr;
+        void* data = nullptr;       /// 小文件 mmap 的内容
+    };
+
+    /**
+     * @brief 取得文件, 不存在或不是普通文件返回 nullptr
+     */
+    File::ptr getFile(const std::string& path);
+    File::ptr openFile(const std::string& path);
+
+private:
+    std::string m_root;
+    std::string m_prefix;
+    Servlet::ptr m_notFound;
+
+    Mutex m_mutex;                  /// 只保护 m_lru 与 m_files, 文件 IO 不在锁内
+    std::list<File::ptr> m_lru;     /// 最近使用的在前
+    std::unordered_map<std::string, std::list<File::ptr>::iterator> m_files;
+};
+
+}
+}
+
+#endif
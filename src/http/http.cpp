@@ -2,8 +2,13 @@
 #include "http.h"
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <sstream>
 #include <strings.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace wyz {
 namespace http {
@@ -61,16 +66,121 @@ bool CaseInsensitiveLess::operator() (const std::string& lhs , const std::string
     return strcasecmp(lhs.c_str(), rhs.c_str()) < 0;
 }
 
+uint32_t CaseInsensitiveHash(const char* s , size_t len){
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0 ; i < len ; ++i){
+        uint8_t c = s[i];
+        if(c >= 'A' && c <= 'Z'){
+            c |= 0x20;
+        }
+        hash = (hash ^ c) * 16777619u;
+    }
+    return hash;
+}
+
 
 HttpRequest::HttpRequest(uint8_t version, bool close )
     : m_method(HttpMethod::GET)
     , m_version(version)
     , m_close(close)
-    , m_path("/ "){
+    , m_path("/")
+    , m_rawPath()
+    , m_rawQuery()
+    , m_rawFragment(){
+
+}
+
+void HttpRequest::addRawHeader(const char* base , const HttpSlice& key , const HttpSlice& val){
+    HttpRawHeader header;
+    header.key = key;
+    header.val = val;
+    header.hash = CaseInsensitiveHash(base + key.off, key.len);
+    m_rawHeaders.push_back(header);
+}
+
+StringView HttpRequest::getPathView() const{
+    if(isRaw() && m_rawPath.len){
+        return StringView(m_base + m_rawPath.off, m_rawPath.len);
+    }
+    return StringView(m_path);
+}
+
+StringView HttpRequest::getQueryView() const{
+    if(isRaw()){
+        return StringView(m_base + m_rawQuery.off, m_rawQuery.len);
+    }
+    return StringView(m_query);
+}
 
+bool HttpRequest::getHeaderView(const std::string& key , StringView& val) const{
+    if(!isRaw()){
+        auto it = m_headers.find(key);
+        if(it == m_headers.end()){
+            return false;
+        }
+        val = StringView(it->second);
+        return true;
+    }
+    uint32_t hash = CaseInsensitiveHash(key.c_str(), key.size());
+    for(auto& i : m_rawHeaders){
+        if(i.hash == hash && i.key.len == key.size()
+                && strncasecmp(m_base + i.key.off, key.c_str(), key.size()) == 0){
+            val = StringView(m_base + i.val.off, i.val.len);
+            return true;
+        }
+    }
+    return false;
+}
+
+void HttpRequest::materialize() const{
+    if(!isRaw()){
+        return;
+    }
+    CASLock::Lock lock(m_materializeMutex);
+    if(m_materialized.load(std::memory_order_relaxed)){
+        return;
+    }
+    if(m_rawPath.len){
+        m_path.assign(m_base + m_rawPath.off, m_rawPath.len);
+    }
+    m_query.assign(m_base + m_rawQuery.off, m_rawQuery.len);
+    m_fragment.assign(m_base + m_rawFragment.off, m_rawFragment.len);
+    /// 与 getHeaderView 一样, 重复的头部保留第一个
+    for(auto& i : m_rawHeaders){
+        m_headers.insert(std::make_pair(std::string(m_base + i.key.off, i.key.len)
+                        , std::string(m_base + i.val.off, i.val.len)));
+    }
+    /// 缓冲区由 m_rawOwner 持有, 还在按偏移读取的线程不受影响
+    m_materialized.store(true, std::memory_order_release);
+}
+
+void HttpRequest::reset(){
+    m_method = HttpMethod::GET;
+    m_version = 0x11;
+    m_close = true;
+    m_path = "/";
+    m_query.clear();
+    m_fragment.clear();
+    m_body.clear();
+    m_headers.clear();
+    m_pararms.clear();
+    m_cookies.clear();
+    m_parserParamFlag = 0;
+    m_bodyStream.reset();
+    m_base = nullptr;
+    m_rawOwner.reset();
+    m_materialized = false;
+    m_rawPath = HttpSlice();
+    m_rawQuery = HttpSlice();
+    m_rawFragment = HttpSlice();
+    m_rawHeaders.clear();
 }
 
 std::string HttpRequest::getHeader(const std::string& key , const std::string& def) const{
+    if(isRaw()){
+        StringView val;
+        return getHeaderView(key, val) ? val.to_string() : def;
+    }
     auto it = m_headers.find(key);
     if(it == m_headers.end()){
         return def;
@@ -79,6 +189,8 @@ std::string HttpRequest::getHeader(const std::string& key , const std::string& d
 }
 
 std::string HttpRequest::getPararm(const std::string& key, const std::string& def ) const{
+    initQueryParam();
+    initBodyParam();
     auto it = m_pararms.find(key);
     if(it == m_pararms.end()){
         return def;
@@ -87,6 +199,7 @@ std::string HttpRequest::getPararm(const std::string& key, const std::string& de
 }
 
 std::string HttpRequest::getCookie(const std::string& key, const std::string& def ) const{
+    initCookies();
     auto it = m_cookies.find(key);
     if(it == m_cookies.end()){
         return def;
@@ -95,30 +208,48 @@ std::string HttpRequest::getCookie(const std::string& key, const std::string& de
 }
 
 void HttpRequest::setHeader(const std::string& key , const std::string& val){
+    materialize();
     m_headers[key] = val;
 }
 
 void HttpRequest::setPararm(const std::string& key , const std::string& val){
+    initQueryParam();
+    initBodyParam();
     m_pararms[key] = val;
 }
 
 void HttpRequest::setCookie(const std::string& key , const std::string& val) {
+    initCookies();
     m_cookies[key] = val;
 }
 
 void HttpRequest::delHeader(const std::string& key){
+    materialize();
     m_headers.erase(key);
 }
 
 void HttpRequest::delPararm(const std::string& key){
+    initQueryParam();
+    initBodyParam();
     m_pararms.erase(key);
 }
 
 void HttpRequest::delCookie(const std::string& key){
+    initCookies();
     m_cookies.erase(key);
 }
 
 bool HttpRequest::hasHeader(const std::string& key, std::string* val){
+    if(isRaw()){
+        StringView v;
+        if(!getHeaderView(key, v)){
+            return false;
+        }
+        if(val){
+            val->assign(v.data(), v.size());
+        }
+        return true;
+    }
     auto it = m_headers.find(key);
     if(it == m_headers.end()){
         return false;
@@ -154,37 +285,67 @@ bool HttpRequest::hasCookie(const std::string& key, std::string* val){
     return true;
 }
 
+static void AppendUInt(std::string& buf , uint64_t v){
+    char tmp[24];
+    char* p = tmp + sizeof(tmp);
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while(v);
+    buf.append(p, tmp + sizeof(tmp) - p);
+}
+
 std::ostream& HttpRequest::dump(std::ostream& os) const{
     //GET /uri HTTP/1.1
     //Host: wwww.sylar.top
     //
     //
-    os  << HttpMethodToString(m_method) << " "
-        << m_path 
-        << (m_query.empty() ? "" : "?" )
-        << m_query 
-        << (m_fragment.empty() ? "" : "#")
-        << m_fragment
-        << " HTTP/" 
-        << ((uint32_t)(m_version >> 4))
-        << "."
-        << ((uint32_t)(m_version & 0x0F))
-        << "\r\n";
-
-    os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
-    for(auto i : m_headers){
-        if(strcasecmp(i.first.c_str(), "connection") == 0)
+    std::string head;
+    serializeHead(head);
+    return os << head << m_body;
+}
+
+void HttpRequest::serializeHead(std::string& buf) const{
+    materialize();
+    buf.append(HttpMethodToString(m_method));
+    buf.push_back(' ');
+    buf.append(m_path);
+    if(!m_query.empty()){
+        buf.push_back('?');
+        buf.append(m_query);
+    }
+    if(!m_fragment.empty()){
+        buf.push_back('#');
+        buf.append(m_fragment);
+    }
+    buf.append(" HTTP/");
+    AppendUInt(buf, m_version >> 4);
+    buf.push_back('.');
+    AppendUInt(buf, m_version & 0x0F);
+    buf.append("\r\n", 2);
+
+    buf.append(m_close ? "connection: close\r\n" : "connection: keep-alive\r\n");
+    bool has_length = false;
+    for(auto& i : m_headers){
+        const char* key = i.first.c_str();
+        if(strcasecmp(key, "connection") == 0){
             continue;
-        os << i.first << ": " << i.second << "\r\n";
+        }
+        if(strcasecmp(key, "content-length") == 0
+                || strcasecmp(key, "transfer-encoding") == 0){
+            has_length = true;
+        }
+        buf.append(i.first);
+        buf.append(": ", 2);
+        buf.append(i.second);
+        buf.append("\r\n", 2);
     }
-    
-    if(!m_body.empty()) {
-        os << "content-length: " << m_body.size() << "\r\n\r\n"
-           << m_body;
-    } else {
-        os << "\r\n";
+    if(!has_length && !m_body.empty()){
+        buf.append("content-length: ");
+        AppendUInt(buf, m_body.size());
+        buf.append("\r\n", 2);
     }
-    return os;
+    buf.append("\r\n", 2);
 }
 
 std::string HttpRequest::toString(){
@@ -194,11 +355,194 @@ std::string HttpRequest::toString(){
 }
 
 
-void HttpRequest::init(){}
-void HttpRequest::initParam(){}
-void HttpRequest::initQueryParam(){}
-void HttpRequest::initBodyParam(){}
-void HttpRequest::initCookies(){}
+void HttpRequest::init(){
+    /// HTTP/1.1 默认长连接, HTTP/1.0 默认短连接
+    StringView conn;
+    if(getHeaderView("connection", conn)){
+        if(conn.size() == 5 && strncasecmp(conn.data(), "close", 5) == 0){
+            m_close = true;
+            return;
+        }
+        if(conn.size() == 10 && strncasecmp(conn.data(), "keep-alive", 10) == 0){
+            m_close = false;
+            return;
+        }
+    }
+    m_close = m_version != 0x11;
+}
+
+/**
+ * @brief 第一个 '%' 或 '+' 的位置, 没有返回 len
+ */
+static inline size_t FindUrlEscape(const char* s , size_t len){
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i pct = _mm_set1_epi8('%');
+    const __m128i plus = _mm_set1_epi8('+');
+    for(; i + 16 <= len ; i += 16){
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, pct), _mm_cmpeq_epi8(v, plus)));
+        if(mask){
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for(; i < len ; ++i){
+        if(s[i] == '%' || s[i] == '+'){
+            return i;
+        }
+    }
+    return len;
+}
+
+size_t UrlDecode(const char* src , size_t len , char* dst){
+    size_t i = 0;
+    size_t out = 0;
+    while(i < len){
+        size_t n = FindUrlEscape(src + i, len - i);
+        if(n){
+            if(dst + out != src + i){
+                memmove(dst + out, src + i, n);
+            }
+            out += n;
+            i += n;
+            if(i == len){
+                break;
+            }
+        }
+        if(src[i] == '+'){
+            dst[out++] = ' ';
+            ++i;
+            continue;
+        }
+        int hi, lo;
+        if(i + 2 < len && (hi = HexValue(src[i + 1])) >= 0 && (lo = HexValue(src[i + 2])) >= 0){
+            dst[out++] = (char)(hi << 4 | lo);
+            i += 3;
+        }else {
+            dst[out++] = '%';
+            ++i;
+        }
+    }
+    return out;
+}
+
+bool IsChunked(const StringView& te){
+    size_t end = te.size();
+    while(end > 0 && (te[end - 1] == ' ' || te[end - 1] == '\t')){
+        --end;
+    }
+    return end >= 7 && strncasecmp(te.data() + end - 7, "chunked", 7) == 0;
+}
+
+bool EtagMatch(const StringView& header , const StringView& etag){
+    size_t pos = 0;
+    while(pos < header.size()){
+        while(pos < header.size() && (header[pos] == ' ' || header[pos] == ',')){
+            ++pos;
+        }
+        size_t end = header.find(',', pos);
+        if(end == StringView::npos){
+            end = header.size();
+        }
+        StringView tag = header.substr(pos, end - pos);
+        while(!tag.empty() && tag.back() == ' '){
+            tag.remove_suffix(1);
+        }
+        if(tag.size() > 2 && tag[0] == 'W' && tag[1] == '/'){
+            tag.remove_prefix(2);
+        }
+        if(tag == "*" || tag == etag){
+            return true;
+        }
+        pos = end;
+    }
+    return false;
+}
+
+static inline void TrimSpace(StringView& s){
+    while(!s.empty() && (s.front() == ' ' || s.front() == '\t')){
+        s.remove_prefix(1);
+    }
+    while(!s.empty() && (s.back() == ' ' || s.back() == '\t')){
+        s.remove_suffix(1);
+    }
+}
+
+/**
+ * @brief 解析 key=value 列表, 同名时保留第一个
+ * @param  sep              分隔符, 参数为 '&', cookie 为 ';'
+ * @param  decode           是否 URL 解码, 解码直接写入 map 中的字符串
+ */
+static void ParseParams(StringView s , char sep , HttpRequest::MapType& m , bool decode){
+    std::string key;
+    size_t pos = 0;
+    while(pos < s.size()){
+        size_t end = s.find(sep, pos);
+        if(end == StringView::npos){
+            end = s.size();
+        }
+        StringView item = s.substr(pos, end - pos);
+        pos = end + 1;
+        TrimSpace(item);
+        if(item.empty()){
+            continue;
+        }
+        size_t eq = item.find('=');
+        StringView k = item.substr(0, eq);
+        StringView v = eq == StringView::npos ? StringView() : item.substr(eq + 1);
+        TrimSpace(k);
+        TrimSpace(v);
+        key.resize(k.size());
+        key.resize(decode ? UrlDecode(k.data(), k.size(), &key[0]) : k.copy(&key[0], k.size()));
+        auto rt = m.insert(std::make_pair(key, std::string()));
+        if(!rt.second){
+            continue;
+        }
+        std::string& val = rt.first->second;
+        val.resize(v.size());
+        val.resize(decode ? UrlDecode(v.data(), v.size(), &val[0]) : v.copy(&val[0], v.size()));
+    }
+}
+
+void HttpRequest::initParam() const{
+    initQueryParam();
+    initBodyParam();
+    initCookies();
+}
+
+void HttpRequest::initQueryParam() const{
+    if(m_parserParamFlag & PARAM_QUERY){
+        return;
+    }
+    m_parserParamFlag |= PARAM_QUERY;
+    ParseParams(getQueryView(), '&', m_pararms, true);
+}
+
+void HttpRequest::initBodyParam() const{
+    if(m_parserParamFlag & PARAM_BODY){
+        return;
+    }
+    m_parserParamFlag |= PARAM_BODY;
+    StringView type;
+    static const char s_form[] = "application/x-www-form-urlencoded";
+    if(m_body.empty() || !getHeaderView("content-type", type) || type.size() < sizeof(s_form) - 1
+            || strncasecmp(type.data(), s_form, sizeof(s_form) - 1) != 0){
+        return;
+    }
+    ParseParams(StringView(m_body), '&', m_pararms, true);
+}
+
+void HttpRequest::initCookies() const{
+    if(m_parserParamFlag & PARAM_COOKIE){
+        return;
+    }
+    m_parserParamFlag |= PARAM_COOKIE;
+    StringView cookie;
+    if(getHeaderView("cookie", cookie)){
+        ParseParams(cookie, ';', m_cookies, false);
+    }
+}
 
 
 HttpResponse::HttpResponse(uint8_t version  , bool close )
@@ -226,31 +570,113 @@ void HttpResponse::delHeader(const std::string& key){
     m_headers.erase(key);
 }
 
-std::ostream& HttpResponse::dump(std::ostream& os) const {
-    os << "HTTP/"
-        << ((uint32_t)(m_version >> 4))
-        << "."
-        << ((uint32_t)(m_version & 0x0F))
-        << " "
-        << (uint32_t) m_status
-        << " "
-        << (m_reason.empty() ? HttpStatusToString(m_status) : m_reason)
-        << "\r\n";
-    
-    for(auto i : m_headers){
-        if(strcasecmp(i.second.c_str() , "connection") == 0){
+namespace {
+
+/**
+ * @brief 预先生成的状态行, 下标为 [HTTP/1.0, HTTP/1.1][状态码]
+ */
+struct _StatusLines{
+    _StatusLines(){
+#define XX(code , name , msg) \
+        lines[0][code] = "HTTP/1.0 " #code " " #msg "\r\n"; \
+        lines[1][code] = "HTTP/1.1 " #code " " #msg "\r\n";
+        HTTP_STATUS_MAP(XX);
+#undef XX
+    }
+    std::string lines[2][600];
+};
+
+static _StatusLines s_status_lines;
+
+static const char s_server_header[] = "Server: wyz/1.0\r\n";
+
+/**
+ * @brief 当前时间的 Date 头部, 每个线程每秒生成一次
+ */
+static StringView GetDateHeader(){
+    static thread_local time_t s_sec = 0;
+    static thread_local char s_header[64];
+    static thread_local size_t s_len = 0;
+    time_t now = time(nullptr);
+    if(now != s_sec){
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        s_len = strftime(s_header, sizeof(s_header), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+        s_sec = now;
+    }
+    return StringView(s_header, s_len);
+}
+
+}
+
+void HttpResponse::serializeHead(std::string& buf) const{
+    serializeStatus(buf);
+    serializeFields(buf);
+}
+
+void HttpResponse::serializeStatus(std::string& buf) const{
+    uint32_t code = (uint32_t)m_status;
+    if(m_reason.empty() && code < 600 && (m_version == 0x10 || m_version == 0x11)
+            && !s_status_lines.lines[m_version & 0x01][code].empty()){
+        buf.append(s_status_lines.lines[m_version & 0x01][code]);
+    }else {
+        buf.append("HTTP/");
+        AppendUInt(buf, m_version >> 4);
+        buf.push_back('.');
+        AppendUInt(buf, m_version & 0x0F);
+        buf.push_back(' ');
+        AppendUInt(buf, code);
+        buf.push_back(' ');
+        buf.append(m_reason.empty() ? HttpStatusToString(m_status) : m_reason.c_str());
+        buf.append("\r\n");
+    }
+    if(m_headers.find("date") == m_headers.end()){
+        StringView date = GetDateHeader();
+        buf.append(date.data(), date.size());
+    }
+    if(m_close){
+        buf.append("Connection: close\r\n");
+    }else {
+        buf.append("Connection: keep-alive\r\n");
+    }
+}
+
+void HttpResponse::serializeFields(std::string& buf) const{
+    bool has_server = false;
+    bool has_length = false;
+    for(auto& i : m_headers){
+        const char* key = i.first.c_str();
+        if(strcasecmp(key, "connection") == 0){
             continue;
         }
-        os << i.first << ":" << i.second << "\r\n";
+        if(strcasecmp(key, "server") == 0){
+            has_server = true;
+        }else if(strcasecmp(key, "content-length") == 0
+                || strcasecmp(key, "transfer-encoding") == 0){
+            has_length = true;
+        }
+        buf.append(i.first);
+        buf.append(": ", 2);
+        buf.append(i.second);
+        buf.append("\r\n", 2);
     }
-    os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
-    if(!m_body.empty()) {
-        os << "content-length: " << m_body.size() << "\r\n\r\n"
-           << m_body;
-    } else {
-        os << "\r\n";
+    if(!has_server){
+        buf.append(s_server_header, sizeof(s_server_header) - 1);
     }
-    return os;
+    /// 1xx, 204, 304 没有消息体
+    uint32_t code = (uint32_t)m_status;
+    if(!has_length && !m_stream && code >= 200 && code != 204 && code != 304){
+        buf.append("Content-Length: ");
+        AppendUInt(buf, m_body.size());
+        buf.append("\r\n", 2);
+    }
+    buf.append("\r\n", 2);
+}
+
+std::ostream& HttpResponse::dump(std::ostream& os) const {
+    std::string head;
+    serializeHead(head);
+    return os << head << m_body;
 }
 
 std::string HttpResponse::toString(){
@@ -12,12 +12,17 @@
 #ifndef __WYZ_HTTP__
 #define __WYZ_HTTP__
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <ostream>
 #include <string>
 #include <map>
+#include <vector>
 #include <boost/lexical_cast.hpp>
+#include <boost/utility/string_view.hpp>
+#include "../stream.h"
+#include "../mutex.h"
 
 namespace wyz {
 namespace http {
@@ -151,8 +156,8 @@ enum class HttpStatus {
 
 HttpMethod StringToHttpMethod(const std::string& m);
 HttpMethod CharsToHttpMethod(const char* m , size_t len);
-const char* HttpMethodToString(HttpMethod& m);
-const char* HttpStatusToString(HttpStatus& s);
+const char* HttpMethodToString(const HttpMethod& m);
+const char* HttpStatusToString(const HttpStatus& s);
 
 
 /**
@@ -162,6 +167,64 @@ struct CaseInsensitiveLess{
     bool operator() (const std::string& lhs , const std::string& rhs) const;
 };
 
+/// 指向请求缓冲区的字符串视图
+using StringView = boost::string_view;
+
+/**
+ * @brief 忽略大小写的哈希(FNV-1a), 用于零拷贝请求头的查找
+ */
+uint32_t CaseInsensitiveHash(const char* s , size_t len);
+
+/**
+ * @brief URL 解码, %XX 转成对应字节, '+' 转成空格, 不合法的 % 原样保留
+ * @details 用 SSE2 一次扫描 16 字节查找 '%' 与 '+', 之间的数据整段拷贝.
+ *          解码后不会变长, dst 可以与 src 相同(原地解码)
+ * @return size_t           解码后的长度
+ */
+size_t UrlDecode(const char* src , size_t len , char* dst);
+
+/**
+ * @brief If-None-Match 中是否有与 etag 相同的值, 弱比较, "*" 匹配任意值
+ */
+bool EtagMatch(const StringView& header , const StringView& etag);
+
+/**
+ * @brief Transfer-Encoding 的最后一个编码是否是 chunked
+ */
+bool IsChunked(const StringView& te);
+
+/**
+ * @brief 十六进制字符的值, 不是十六进制字符返回 -1
+ * @details 分块解码与 URL 解码逐字节调用, 放在头文件中内联
+ */
+inline int HexValue(char c){
+    if(c >= '0' && c <= '9'){
+        return c - '0';
+    }
+    c |= 0x20;
+    if(c >= 'a' && c <= 'f'){
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/**
+ * @brief 缓冲区中的一段, 用相对缓冲区起始位置的偏移记录
+ */
+struct HttpSlice{
+    uint32_t off;
+    uint32_t len;
+};
+
+/**
+ * @brief 零拷贝模式下的请求头
+ */
+struct HttpRawHeader{
+    HttpSlice key;
+    HttpSlice val;
+    uint32_t hash;          /// key 转小写后的哈希
+};
+
 /**
  * @brief  获取Map中的key值,并转成对应类型,返回是否成功
  * @tparam MapType  
@@ -231,14 +294,26 @@ public:
     inline uint8_t    getVersion()const             {return m_version;} 
     inline bool isClose() const     {return m_close;}
 
-    inline const std::string& getPath()  const      {return m_path;}
-    inline const std::string& getQuery() const      {return m_query;}
-    inline const std::string& getFragment() const   {return m_fragment;}
+    inline const std::string& getPath()  const      {materialize(); return m_path;}
+    inline const std::string& getQuery() const      {materialize(); return m_query;}
+    inline const std::string& getFragment() const   {materialize(); return m_fragment;}
     inline const std::string& getBody() const       {return m_body;}
+    /**
+     * @brief 流式读取消息体
+     * @details 消息体使用分块编码或超过 http.request.stream_body_size 时不读入 getBody(),
+     *          而是由处理函数从这个流中读取, 其他情况为空
+     */
+    inline Stream::ptr getBodyStream() const        {return m_bodyStream;}
+    inline void setBodyStream(Stream::ptr v)        {m_bodyStream = v;}
 
-    inline const MapType& getHeaders() const        {return m_headers;}
-    inline const MapType& getPararms() const        {return m_pararms;}
-    inline const MapType& getCookies() const        {return m_cookies;}
+    inline const MapType& getHeaders() const        {materialize(); return m_headers;}
+    /**
+     * @brief 请求参数与 cookie 在第一次访问时才解析并缓存
+     * @details 参数来自 query 与 application/x-www-form-urlencoded 消息体, 会做 URL 解码;
+     *          cookie 来自 Cookie 头部, 只去掉空白. 同名时保留第一个
+     */
+    inline const MapType& getPararms() const        {initQueryParam(); initBodyParam(); return m_pararms;}
+    inline const MapType& getCookies() const        {initCookies(); return m_cookies;}
 
     std::string getHeader(const std::string& key , const std::string& def = "") const;
 
@@ -253,14 +328,14 @@ public:
     inline void setVersion(const uint8_t v)         {m_version = v;}
     inline void setClose(bool v)                    {m_close = v;}
 
-    inline void setPath(const std::string & v)      {m_path = v;}
-    inline void setQuery(const std::string& v)      {m_query = v;}
-    inline void setFragment(const std::string& v)   {m_fragment = v;}
+    inline void setPath(const std::string & v)      {materialize(); m_path = v;}
+    inline void setQuery(const std::string& v)      {materialize(); m_query = v;}
+    inline void setFragment(const std::string& v)   {materialize(); m_fragment = v;}
     inline void setBody(const std::string& v)       {m_body = v;}
     
-    inline void setHeaders(const MapType& v)        {m_headers = v;}
-    inline void setPararms(const MapType& v)        {m_pararms = v;}
-    inline void setCookies(const MapType& v)        {m_cookies = v;}
+    inline void setHeaders(const MapType& v)        {materialize(); m_headers = v;}
+    inline void setPararms(const MapType& v)        {m_pararms = v; m_parserParamFlag |= PARAM_QUERY | PARAM_BODY;}
+    inline void setCookies(const MapType& v)        {m_cookies = v; m_parserParamFlag |= PARAM_COOKIE;}
     
     void setHeader(const std::string& key , const std::string& val);
 
@@ -288,12 +363,28 @@ public:
 
     template<typename T>
     bool checkGetHeaderAs(const std::string& key , T& val , const T& def = T()){
+        if(isRaw()){
+            StringView v;
+            if(!getHeaderView(key, v)){
+                val = def;
+                return false;
+            }
+            try {
+                val = boost::lexical_cast<T>(v.data(), v.size());
+                return true;
+            } catch (...) {
+                val = def;
+            }
+            return false;
+        }
         return checkGetAs(m_headers, key, val,def);
     }
 
     template<typename T>
     T getHeaderAs(const std::string& key , const T& def = T()){
-        return getAs(m_headers, key, def);
+        T val;
+        checkGetHeaderAs(key, val, def);
+        return val;
     }
 
 
@@ -301,49 +392,105 @@ public:
     bool checkGetPararmAs(const std::string& key , T& val , const T& def = T()){
         initQueryParam();
         initBodyParam();
-        return checkGetAs(m_headers, key, val,def);
+        return checkGetAs(m_pararms, key, val,def);
     }
 
     template<typename T>
     T getPararmAs(const std::string& key , const T& def = T()){
         initQueryParam();
         initBodyParam();
-        return getAs(m_headers, key,def);
+        return getAs(m_pararms, key,def);
     }
 
     template<typename T>
     bool checkGetCookieAs(const std::string& key , T& val , const T& def = T()){
         initCookies();
-        return checkGetAs(m_headers, key, val,def);
+        return checkGetAs(m_cookies, key, val,def);
     }
 
     template<typename T>
     T getCookieAs(const std::string& key , const T& def = T()){
         initCookies();
-        return getAs(m_headers, key, def);
+        return getAs(m_cookies, key, def);
     }
 
     std::ostream& dump(std::ostream& os)const;
     std::string toString();
+
+    /**
+     * @brief 把请求行与头部追加到 buf 末尾, 不包括消息体
+     * @details 客户端发送请求时使用, 消息体不为空且没有设置时补上 Content-Length
+     */
+    void serializeHead(std::string& buf) const;
     void init();
-    void initParam();
-    void initQueryParam();
-    void initBodyParam();
-    void initCookies();
+    void initParam() const;
+    void initQueryParam() const;
+    void initBodyParam() const;
+    void initCookies() const;
+
+    /**
+     * @brief 零拷贝模式
+     * @details 解析时路径, 参数, fragment 与头部只记录在连接读缓冲区中的偏移,
+     *          头部放在一个平坦的 vector 里并预先算好忽略大小写的哈希.
+     *          需要 std::string 的接口按需一次性转成普通模式(materialize), 多个线程同时读取是安全的.
+     *          owner 持有缓冲区, 请求被处理函数持有时连接换一块新的缓冲区, 不修改请求.
+     *          重复的头部只保留第一个, 两种模式一致
+     */
+    inline bool isRaw() const                       {return m_base && !m_materialized.load(std::memory_order_acquire);}
+    inline void setRawBase(const char* v , std::shared_ptr<const void> owner = nullptr) {m_base = v; m_rawOwner = owner;}
+    inline void setRawPath(const HttpSlice& v)      {m_rawPath = v;}
+    inline void setRawQuery(const HttpSlice& v)     {m_rawQuery = v;}
+    inline void setRawFragment(const HttpSlice& v)  {m_rawFragment = v;}
+    void addRawHeader(const char* base , const HttpSlice& key , const HttpSlice& val);
+
+    StringView getPathView() const;
+    StringView getQueryView() const;
+    /**
+     * @brief 不拷贝地查找头部
+     * @return true             存在, val 指向头部的值
+     */
+    bool getHeaderView(const std::string& key , StringView& val) const;
+
+    /**
+     * @brief 把缓冲区中的数据拷贝出来, 之后不再读取缓冲区; 只执行一次, 可以在多个线程中调用
+     */
+    void materialize() const;
+
+    /**
+     * @brief 清空请求, 保留各容器已分配的内存, 用于同一连接上的下一个请求
+     */
+    void reset();
 
 private:
     HttpMethod m_method;        /// http 方式
     uint8_t m_version;          /// http 版本
     bool m_close;               /// 是否自动关闭
 
-    std::string m_path;         /// 请求路径
-    std::string m_query;        /// 请求参数
-    std::string m_fragment;     /// 请求fragment
-    std::string m_body;         /// 请求消息体
-
-    MapType m_headers;          /// 请求头部
-    MapType m_pararms;          /// 请求参数
-    MapType m_cookies;          /// 请求cookie
+    mutable std::string m_path;         /// 请求路径
+    mutable std::string m_query;        /// 请求参数
+    mutable std::string m_fragment;     /// 请求fragment
+    std::string m_body;                 /// 请求消息体
+
+    mutable MapType m_headers;  /// 请求头部
+    mutable MapType m_pararms;  /// 请求参数
+    mutable MapType m_cookies;  /// 请求cookie
+    /// 已经解析过的部分
+    enum {
+        PARAM_QUERY = 0x1,
+        PARAM_BODY = 0x2,
+        PARAM_COOKIE = 0x4,
+    };
+    mutable uint8_t m_parserParamFlag = 0;
+    Stream::ptr m_bodyStream;   /// 流式读取的消息体
+
+    const char* m_base = nullptr;           /// 零拷贝模式下的缓冲区, 为空表示普通模式
+    std::shared_ptr<const void> m_rawOwner; /// 持有 m_base 所在的缓冲区
+    mutable std::atomic<bool> m_materialized = {false};    /// 已经拷贝到 std::string 中
+    mutable CASLock m_materializeMutex;
+    HttpSlice m_rawPath;
+    HttpSlice m_rawQuery;
+    HttpSlice m_rawFragment;
+    std::vector<HttpRawHeader> m_rawHeaders;
 };
 
 class HttpResponse{
@@ -359,15 +506,19 @@ public:
     inline HttpStatus getStatus() const     {return m_status;}
     inline uint8_t getVersion() const       {return m_version;}
     inline bool isClose() const             {return m_close;}
-    inline std::string getBody() const      {return m_body;}
-    inline std::string getReason() const    {return m_reason;}
-    inline MapType getHeader()  const       {return m_headers;}
+    /// 响应已由处理函数直接发送(HttpBodyWriter/FileServlet), 头部里不自动加 Content-Length
+    inline bool isStream() const            {return m_stream;}
+    inline const std::string& getBody() const       {return m_body;}
+    inline const std::string& getReason() const     {return m_reason;}
+    inline const MapType& getHeader()  const        {return m_headers;}
     std::string getHeader(const std::string& key , const std::string& def = "") const;
 
     inline void setStatus(const HttpStatus& v)      {m_status = v;}
     inline void setVersion(uint8_t v)               {m_version = v;}
     inline void setClose(bool v)                    {m_close = v;}
+    inline void setStream(bool v)                   {m_stream = v;}
     inline void setBody(const std::string& v)       {m_body = v;}
+    inline void setBody(std::string&& v)            {m_body = std::move(v);}
     inline void setReason(const std::string& v)     {m_reason = v;}
     inline void setHeader(const MapType& v)         {m_headers = v;}
 
@@ -386,10 +537,25 @@ public:
 
     std::ostream& dump(std::ostream& os) const;
     std::string toString();
+
+    /**
+     * @brief 把状态行与头部追加到 buf 末尾, 不包括消息体
+     * @details 状态行使用预先生成的文本, 没有设置时补上缓存的 Server, Date(每秒刷新)
+     *          与 Content-Length, 不经过 ostream. 调用方复用 buf 时不分配内存
+     */
+    void serializeHead(std::string& buf) const;
+
+    /**
+     * @brief serializeHead 的两部分: 随请求变化的状态行, Date 与 Connection;
+     *        之后的其他头部与结束的空行. 后一部分可以预先生成后缓存(见 CacheServlet)
+     */
+    void serializeStatus(std::string& buf) const;
+    void serializeFields(std::string& buf) const;
 private:
     HttpStatus m_status;        /// 回应的状态
     uint8_t m_version;          /// http 版本号
     bool m_close;               /// 是否自动关闭
+    bool m_stream = false;      /// 是否流式发送消息体
 
     std::string m_body;         /// 回应消息体
     std::string m_reason;       /// 回应的解释
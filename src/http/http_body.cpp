@@ -0,0 +1,260 @@
+/**
+ * @file http_body.cpp
+ * @brief http 消息体的流式读写实现
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-24
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#include "http_body.h"
+#include "http_session.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace wyz {
+namespace http {
+
+HttpChunkedDecoder::HttpChunkedDecoder(){
+    reset();
+}
+
+void HttpChunkedDecoder::reset(){
+    m_state = SIZE;
+    m_size = 0;
+    m_digits = false;
+}
+
+size_t HttpChunkedDecoder::decode(const char* in , size_t inlen , size_t& consumed , char* out , size_t outlen){
+    size_t i = 0;
+    size_t produced = 0;
+    while(i < inlen && m_state != DONE && m_state != ERROR){
+        if(m_state == DATA){
+            size_t n = std::min(std::min((uint64_t)(inlen - i), m_size), (uint64_t)(outlen - produced));
+            if(n == 0){
+                break;
+            }
+            memcpy(out + produced, in + i, n);
+            produced += n;
+            i += n;
+            m_size -= n;
+            if(m_size == 0){
+                m_state = DATA_CR;
+            }
+            continue;
+        }
+        char c = in[i++];
+        switch(m_state){
+            case SIZE: {
+                int v = HexValue(c);
+                if(v >= 0){
+                    /// 块大小不超过 2^60
+                    if(m_size >> 60){
+                        m_state = ERROR;
+                        break;
+                    }
+                    m_size = (m_size << 4) | v;
+                    m_digits = true;
+                }else if(!m_digits){
+                    m_state = ERROR;
+                }else if(c == ';' || c == ' ' || c == '\t'){
+                    m_state = SIZE_EXT;
+                }else if(c == '\r'){
+                    m_state = SIZE_LF;
+                }else if(c == '\n'){
+                    m_state = m_size ? DATA : TRAILER;
+                }else {
+                    m_state = ERROR;
+                }
+                break;
+            }
+            case SIZE_EXT:
+                if(c == '\n'){
+                    m_state = m_size ? DATA : TRAILER;
+                }
+                break;
+            case SIZE_LF:
+                m_state = c == '\n' ? (m_size ? DATA : TRAILER) : ERROR;
+                break;
+            case DATA_CR:
+                if(c == '\r'){
+                    m_state = DATA_LF;
+                    break;
+                }
+                /// 兼容只有 \n 的块结尾
+                m_state = c == '\n' ? SIZE : ERROR;
+                m_digits = false;
+                break;
+            case DATA_LF:
+                m_state = c == '\n' ? SIZE : ERROR;
+                m_digits = false;
+                break;
+            case TRAILER:
+                if(c == '\r'){
+                    m_state = TRAILER_LF;
+                }else if(c == '\n'){
+                    m_state = DONE;
+                }else {
+                    m_state = TRAILER_LINE;
+                }
+                break;
+            case TRAILER_LINE:
+                if(c == '\n'){
+                    m_state = TRAILER;
+                }
+                break;
+            case TRAILER_LF:
+                m_state = c == '\n' ? DONE : ERROR;
+                break;
+            default:
+                m_state = ERROR;
+                break;
+        }
+    }
+    consumed = i;
+    return produced;
+}
+
+HttpBodyReader::HttpBodyReader(HttpSession* session)
+    : m_session(session){
+}
+
+int HttpBodyReader::read(void * buff , size_t length){
+    if(!m_session){
+        return -1;
+    }
+    return m_session->readBody(buff, length);
+}
+
+int HttpBodyReader::read(ByteArray::ptr ba , size_t length){
+    if(!m_session){
+        return -1;
+    }
+    std::vector<iovec> iovs;
+    ba->getWriteBuffers(iovs, length);
+    if(iovs.empty()){
+        return 0;
+    }
+    int rt = m_session->readBody(iovs[0].iov_base, iovs[0].iov_len);
+    if(rt > 0){
+        ba->setPosition(ba->getPosition() + rt);
+    }
+    return rt;
+}
+
+HttpBodyWriter::HttpBodyWriter(std::shared_ptr<HttpSession> session , HttpResponse::ptr rsp)
+    : m_session(session)
+    , m_response(rsp)
+    , m_chunked(rsp->getVersion() >= 0x11){
+    rsp->setStream(true);
+    if(m_chunked){
+        rsp->setHeader("Transfer-Encoding", "chunked");
+    }else {
+        /// HTTP/1.0 没有分块编码, 以关闭连接表示消息体结束
+        rsp->setClose(true);
+    }
+}
+
+HttpBodyWriter::~HttpBodyWriter(){
+    close();
+}
+
+int HttpBodyWriter::send(const iovec* data , size_t count , size_t length){
+    m_head.clear();
+    if(!m_headSent){
+        /// 流水线中排在前面的响应先发出
+        if(m_session->flush() < 0){
+            return -1;
+        }
+        m_response->serializeHead(m_head);
+        m_headSent = true;
+    }
+    if(m_chunked && length){
+        char tmp[24];
+        int n = snprintf(tmp, sizeof(tmp), "%zx\r\n", length);
+        m_head.append(tmp, n);
+    }
+    /// 头部 + 最多 6 段数据 + 块结尾
+    iovec iovs[8];
+    size_t cnt = 0;
+    if(!m_head.empty()){
+        iovs[cnt].iov_base = &m_head[0];
+        iovs[cnt].iov_len = m_head.size();
+        ++cnt;
+    }
+    for(size_t i = 0 ; i < count && i < 6 ; ++i){
+        iovs[cnt++] = data[i];
+    }
+    if(m_chunked && length){
+        iovs[cnt].iov_base = (void*)"\r\n";
+        iovs[cnt].iov_len = 2;
+        ++cnt;
+    }
+    if(cnt == 0){
+        return 0;
+    }
+    return m_session->writevFixSize(iovs, cnt);
+}
+
+int HttpBodyWriter::write(const void * buff , size_t length){
+    if(m_closed || !m_session->isConnected()){
+        return -1;
+    }
+    /// 长度为 0 的块表示结束, 不发送
+    if(length == 0){
+        return 0;
+    }
+    iovec iov;
+    iov.iov_base = (void*)buff;
+    iov.iov_len = length;
+    int rt = send(&iov, 1, length);
+    return rt <= 0 ? rt : (int)length;
+}
+
+int HttpBodyWriter::write(ByteArray::ptr ba , size_t length){
+    if(m_closed || !m_session->isConnected()){
+        return -1;
+    }
+    std::vector<iovec> iovs;
+    ba->getReadBuffers(iovs, length);
+    /// 一次最多发送 6 段
+    size_t len = 0;
+    size_t count = std::min(iovs.size(), (size_t)6);
+    for(size_t i = 0 ; i < count ; ++i){
+        len += iovs[i].iov_len;
+    }
+    if(len == 0){
+        return 0;
+    }
+    int rt = send(&iovs[0], count, len);
+    if(rt <= 0){
+        return rt;
+    }
+    ba->setPosition(ba->getPosition() + len);
+    return len;
+}
+
+int HttpBodyWriter::close(){
+    if(m_closed){
+        return 0;
+    }
+    m_closed = true;
+    if(!m_session->isConnected()){
+        return -1;
+    }
+    if(!m_chunked){
+        /// 没有写过数据时只发送头部
+        return m_headSent ? 0 : send(nullptr, 0, 0);
+    }
+    iovec iov;
+    iov.iov_base = (void*)"0\r\n\r\n";
+    iov.iov_len = 5;
+    return send(&iov, 1, 0);
+}
+
+}
+}
@@ -0,0 +1,147 @@
+/**
+ * @file http_body.h
+ * @brief http 消息体的流式读写, 分块传输编码(Transfer-Encoding: chunked)
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-24
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#ifndef __WYZ_HTTP_BODY_H__
+#define __WYZ_HTTP_BODY_H__
+
+#include "http.h"
+#include "../stream.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace wyz {
+namespace http {
+
+class HttpSession;
+
+/**
+ * @brief 分块传输编码的增量解码
+ * @details 输入可以在任意位置切开分多次传入, 块大小行的扩展与结尾的 trailer 被丢弃
+ */
+class HttpChunkedDecoder{
+public:
+    HttpChunkedDecoder();
+
+    /**
+     * @brief 解码一段输入
+     * @param  in               输入数据
+     * @param  inlen            输入数据长度
+     * @param  consumed         返回消耗的输入长度
+     * @param  out              解码后的数据
+     * @param  outlen           out 的大小
+     * @return size_t           写入 out 的长度
+     */
+    size_t decode(const char* in , size_t inlen , size_t& consumed , char* out , size_t outlen);
+
+    /// 开始解码下一个消息体
+    void reset();
+
+    inline bool isDone() const      {return m_state == DONE;}
+    inline bool hasError() const    {return m_state == ERROR;}
+
+private:
+    enum State{
+        SIZE,           // 块大小(十六进制)
+        SIZE_EXT,       // 块扩展, 跳到行尾
+        SIZE_LF,
+        DATA,
+        DATA_CR,
+        DATA_LF,
+        TRAILER,        // trailer 行首
+        TRAILER_LINE,   // trailer 行, 跳到行尾
+        TRAILER_LF,     // 最后的空行
+        DONE,
+        ERROR,
+    };
+    State m_state;
+    uint64_t m_size;        /// 当前块剩余的长度
+    bool m_digits;          /// 块大小行是否已有数字
+};
+
+/**
+ * @brief 读取请求消息体的流
+ * @details 由 HttpSession 在消息体较大或使用分块编码时创建, 通过 HttpRequest::getBodyStream() 取得.
+ *          只在处理这个请求期间有效, 连接开始读下一个请求后 read 返回 -1
+ */
+class HttpBodyReader : public Stream{
+public:
+    using ptr = std::shared_ptr<HttpBodyReader>;
+    HttpBodyReader(HttpSession* session);
+
+    /**
+     * @brief 读消息体
+     * @return int  >0 读到的长度
+     *              =0 消息体结束
+     *              <0 出错
+     */
+    int read(void * buff , size_t length) override;
+    int read(ByteArray::ptr ba , size_t length) override;
+
+    /// 只读
+    int write(const void * buff , size_t length) override   {return -1;}
+    int write(ByteArray::ptr ba , size_t length) override   {return -1;}
+    int close() override                                    {return 0;}
+
+    /// 与连接解绑
+    inline void detach()    {m_session = nullptr;}
+
+private:
+    HttpSession* m_session;
+};
+
+/**
+ * @brief 流式发送响应消息体
+ * @details 第一次写时与第一块数据一起发出响应头部, 之后每次 write 发出一块.
+ *          HTTP/1.1 使用分块编码, HTTP/1.0 直接写消息体并在结束后关闭连接.
+ *          close 或析构时结束消息体, 服务器不会再发送这个响应
+ */
+class HttpBodyWriter : public Stream{
+public:
+    using ptr = std::shared_ptr<HttpBodyWriter>;
+    HttpBodyWriter(std::shared_ptr<HttpSession> session , HttpResponse::ptr rsp);
+    ~HttpBodyWriter();
+
+    /// 只写
+    int read(void * buff , size_t length) override          {return -1;}
+    int read(ByteArray::ptr ba , size_t length) override    {return -1;}
+
+    /**
+     * @brief 发送一块数据
+     * @return int  >0 写出的数据长度
+     *              =0 对方关闭
+     *              <0 Socket异常
+     */
+    int write(const void * buff , size_t length) override;
+    int write(ByteArray::ptr ba , size_t length) override;
+
+    /**
+     * @brief 结束消息体
+     */
+    int close() override;
+
+private:
+    /// 发送头部(如果还没有发送), 块大小行, 数据与块结尾
+    int send(const iovec* data , size_t count , size_t length);
+
+private:
+    std::shared_ptr<HttpSession> m_session;
+    HttpResponse::ptr m_response;
+    std::string m_head;         /// 头部与块大小行
+    bool m_chunked;
+    bool m_headSent = false;
+    bool m_closed = false;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,487 @@
+/**
+ * @file http_connection.cpp
+ * @brief http 客户端连接与连接池实现
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-26
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#include "http_connection.h"
+#include "../log.h"
+#include "../util.h"
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <strings.h>
+
+namespace wyz {
+namespace http {
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_NAME("system");
+
+std::string HttpResult::toString() const{
+    std::stringstream ss;
+    ss << "[HttpResult result=" << result
+       << " error=" << error
+       << " response=" << (response ? response->toString() : "nullptr")
+       << "]";
+    return ss.str();
+}
+
+HttpConnection::HttpConnection(Socket::ptr socket , bool owner)
+    : SocketStream(socket, owner)
+    , m_createTime(wyz::GetCurrentMS())
+    , m_lastUseTime(m_createTime){
+}
+
+HttpConnection::~HttpConnection(){
+}
+
+int HttpConnection::sendRequest(HttpRequest::ptr req){
+    std::vector<HttpRequest::ptr> reqs(1, req);
+    return sendRequests(reqs);
+}
+
+int HttpConnection::sendRequests(const std::vector<HttpRequest::ptr>& reqs){
+    if(reqs.empty()){
+        return 0;
+    }
+    /// 头部依次追加到复用的缓冲区, 追加时可能重新分配, 全部追加后再计算各段地址
+    m_sendBuffer.clear();
+    m_heads.clear();
+    for(auto& i : reqs){
+        i->serializeHead(m_sendBuffer);
+        m_heads.push_back(m_sendBuffer.size());
+    }
+    m_iovs.clear();
+    size_t head = 0;
+    for(size_t i = 0 ; i < reqs.size() ; ++i){
+        iovec iov;
+        iov.iov_base = &m_sendBuffer[head];
+        iov.iov_len = m_heads[i] - head;
+        m_iovs.push_back(iov);
+        head = m_heads[i];
+        const std::string& body = reqs[i]->getBody();
+        if(!body.empty()){
+            iov.iov_base = (void*)body.data();
+            iov.iov_len = body.size();
+            m_iovs.push_back(iov);
+        }
+    }
+    /// 一次 writev 最多 IOV_MAX(1024) 段
+    int total = 0;
+    for(size_t i = 0 ; i < m_iovs.size() ; i += 1024){
+        int rt = writevFixSize(&m_iovs[i], std::min(m_iovs.size() - i, (size_t)1024));
+        if(rt <= 0){
+            m_close = true;
+            return rt;
+        }
+        total += rt;
+    }
+    for(auto& i : reqs){
+        m_methods.push_back(i->getMethod());
+        if(i->isClose()){
+            m_close = true;
+        }
+    }
+    m_requestCount += reqs.size();
+    m_lastUseTime = wyz::GetCurrentMS();
+    return total;
+}
+
+HttpResponse::ptr HttpConnection::recvResponse(){
+    if(m_methods.empty()){
+        WYZ_LOG_ERROR(g_logger) << "recvResponse without request";
+        return nullptr;
+    }
+    HttpMethod method = m_methods.front();
+    m_methods.pop_front();
+
+    if(m_consumed){
+        m_bufferLen -= m_consumed;
+        memmove(&m_buffer[0], &m_buffer[m_consumed], m_bufferLen);
+        m_consumed = 0;
+    }
+    uint64_t buffsize = HttpResponseParser::GetHttpResponseBufferSize();
+    if(m_buffer.size() < buffsize + 1){
+        m_buffer.resize(buffsize + 1);
+    }
+    HttpResponse::ptr rsp(new HttpResponse);
+    m_parser.reset(rsp);
+
+    char* data = &m_buffer[0];
+    size_t nparse = 0;
+    while(true){
+        /// 缓冲区里可能已经有流水线中上一个响应读多的数据
+        if(m_bufferLen > nparse){
+            data[m_bufferLen] = '\0';
+            nparse = m_parser.execute(data, m_bufferLen, nparse);
+            if(m_parser.hasError()){
+                m_close = true;
+                return nullptr;
+            }
+            if(m_parser.isFinish()){
+                break;
+            }
+        }
+        if(m_bufferLen == m_buffer.size() - 1){
+            WYZ_LOG_WARN(g_logger) << "http response head too large, buffer_size=" << buffsize;
+            m_close = true;
+            return nullptr;
+        }
+        int len = read(data + m_bufferLen, m_buffer.size() - 1 - m_bufferLen);
+        if(len <= 0){
+            m_close = true;
+            return nullptr;
+        }
+        m_bufferLen += len;
+    }
+    m_consumed = nparse;
+
+    if(!recvBody(rsp, method)){
+        m_close = true;
+        return nullptr;
+    }
+    /// HTTP/1.1 默认长连接, HTTP/1.0 需要 Connection: keep-alive
+    std::string conn = rsp->getHeader("connection");
+    if(strcasecmp(conn.c_str(), "close") == 0
+            || (rsp->getVersion() != 0x11 && strcasecmp(conn.c_str(), "keep-alive") != 0)){
+        m_close = true;
+    }
+    rsp->setClose(m_close);
+    if(m_consumed == m_bufferLen){
+        m_consumed = m_bufferLen = 0;
+    }
+    m_lastUseTime = wyz::GetCurrentMS();
+    return rsp;
+}
+
+bool HttpConnection::recvBody(HttpResponse::ptr rsp , HttpMethod method){
+    int code = (int)rsp->getStatus();
+    /// HEAD, 1xx, 204, 304 没有消息体
+    if(method == HttpMethod::HEAD || code < 200 || code == 204 || code == 304){
+        return true;
+    }
+    std::string body;
+    auto it = rsp->getHeader().find("transfer-encoding");
+    if(it != rsp->getHeader().end() && IsChunked(it->second)){
+        if(!recvChunkedBody(body)){
+            return false;
+        }
+    }else if(rsp->getHeader().count("content-length")){
+        uint64_t length = getAs<HttpResponse::MapType, uint64_t>(rsp->getHeader(), "content-length", (uint64_t)-1);
+        if(length > HttpResponseParser::GetHttpResponseBodySize()){
+            WYZ_LOG_WARN(g_logger) << "http response body too large, content-length=" << length;
+            return false;
+        }
+        body.resize(length);
+        size_t n = std::min((uint64_t)(m_bufferLen - m_consumed), length);
+        memcpy(&body[0], &m_buffer[m_consumed], n);
+        m_consumed += n;
+        if(length > n && readFixSize(&body[n], length - n) <= 0){
+            return false;
+        }
+    }else {
+        /// 没有长度的消息体以关闭连接结束
+        if(!recvUntilClose(body)){
+            return false;
+        }
+        m_close = true;
+    }
+    rsp->setBody(std::move(body));
+    return true;
+}
+
+bool HttpConnection::recvChunkedBody(std::string& body){
+    m_chunked.reset();
+    uint64_t max_size = HttpResponseParser::GetHttpResponseBodySize();
+    char* data = &m_buffer[0];
+    while(true){
+        if(m_bufferLen > m_consumed){
+            /// 解码后的数据不会比输入长, 直接解码到 body 末尾
+            size_t avail = m_bufferLen - m_consumed;
+            size_t old = body.size();
+            body.resize(old + avail);
+            size_t consumed = 0;
+            size_t n = m_chunked.decode(data + m_consumed, avail, consumed, &body[old], avail);
+            body.resize(old + n);
+            m_consumed += consumed;
+            if(m_chunked.hasError()){
+                WYZ_LOG_WARN(g_logger) << "http response chunked body error";
+                return false;
+            }
+            if(m_chunked.isDone()){
+                return true;
+            }
+            if(body.size() > max_size){
+                WYZ_LOG_WARN(g_logger) << "http response body too large, size=" << body.size();
+                return false;
+            }
+        }
+        /// 缓冲区中的数据都已解码, 从头读
+        m_consumed = m_bufferLen = 0;
+        int len = read(data, m_buffer.size() - 1);
+        if(len <= 0){
+            return false;
+        }
+        m_bufferLen = len;
+    }
+}
+
+bool HttpConnection::recvUntilClose(std::string& body){
+    uint64_t max_size = HttpResponseParser::GetHttpResponseBodySize();
+    body.assign(&m_buffer[m_consumed], m_bufferLen - m_consumed);
+    m_consumed = m_bufferLen = 0;
+    char* data = &m_buffer[0];
+    while(true){
+        int len = read(data, m_buffer.size() - 1);
+        if(len < 0){
+            return false;
+        }
+        if(len == 0){
+            return true;
+        }
+        body.append(data, len);
+        if(body.size() > max_size){
+            WYZ_LOG_WARN(g_logger) << "http response body too large, size=" << body.size();
+            return false;
+        }
+    }
+}
+
+HttpConnectionPool::HttpConnectionPool(const std::string& host , const std::string& vhost , uint16_t port
+                        , uint32_t max_size , uint32_t max_idle_time , uint32_t max_request)
+    : m_host(host)
+    , m_vhost(vhost.empty() ? host : vhost)
+    , m_port(port)
+    , m_maxSize(max_size)
+    , m_maxIdleTime(max_idle_time)
+    , m_maxRequest(max_request){
+}
+
+HttpConnectionPool::~HttpConnectionPool(){
+    Mutex::Lock lock(m_mutex);
+    for(auto i : m_conns){
+        delete i;
+    }
+    m_conns.clear();
+}
+
+HttpConnection::ptr HttpConnectionPool::getConnection(uint64_t timeout_ms , bool& hit , HttpResult::Error& error){
+    ++m_requests;
+    uint64_t now = wyz::GetCurrentMS();
+    std::vector<HttpConnection*> invalid;
+    HttpConnection* ptr = nullptr;
+    Address::ptr addr;
+    {
+        Mutex::Lock lock(m_mutex);
+        while(!m_conns.empty()){
+            HttpConnection* conn = m_conns.front();
+            m_conns.pop_front();
+            if(!conn->isConnected() || conn->m_lastUseTime + m_maxIdleTime <= now){
+                invalid.push_back(conn);
+                continue;
+            }
+            ptr = conn;
+            break;
+        }
+        addr = m_address;
+    }
+    /// 在锁外关闭失效的连接
+    for(auto i : invalid){
+        delete i;
+    }
+
+    hit = ptr != nullptr;
+    if(hit){
+        ++m_hits;
+    }else {
+        if(!addr){
+            IPAddress::ptr ip = Address::LookupIPAddress(m_host);
+            if(!ip){
+                WYZ_LOG_ERROR(g_logger) << "get addr fail: " << m_host;
+                error = HttpResult::Error::INVALID_HOST;
+                return nullptr;
+            }
+            ip->setPort(m_port);
+            addr = ip;
+        }
+        Socket::ptr sock = Socket::CreateTCP(addr);
+        if(!sock->connect(addr, timeout_ms)){
+            WYZ_LOG_ERROR(g_logger) << "connect fail: " << addr->toString();
+            /// 下次重新解析
+            Mutex::Lock lock(m_mutex);
+            m_address.reset();
+            error = HttpResult::Error::CONNECT_FAIL;
+            return nullptr;
+        }
+        {
+            Mutex::Lock lock(m_mutex);
+            m_address = addr;
+        }
+        ++m_connects;
+        ptr = new HttpConnection(sock);
+    }
+    ++m_inflight;
+    return HttpConnection::ptr(ptr, std::bind(&HttpConnectionPool::ReleasePtr, std::placeholders::_1, this));
+}
+
+void HttpConnectionPool::ReleasePtr(HttpConnection* ptr , HttpConnectionPool* pool){
+    --pool->m_inflight;
+    /// 还有没收完的响应的连接不能复用
+    if(!ptr->isConnected() || ptr->isClose() || ptr->getPendingCount()
+            || ptr->getRequestCount() >= pool->m_maxRequest){
+        delete ptr;
+        return;
+    }
+    HttpConnection* evict = nullptr;
+    {
+        Mutex::Lock lock(pool->m_mutex);
+        pool->m_conns.push_front(ptr);
+        if(pool->m_conns.size() > pool->m_maxSize){
+            evict = pool->m_conns.back();
+            pool->m_conns.pop_back();
+        }
+    }
+    delete evict;
+}
+
+void HttpConnectionPool::prepare(HttpRequest::ptr req){
+    req->setClose(false);
+    if(req->getHeader("host").empty()){
+        req->setHeader("Host", m_vhost);
+    }
+}
+
+HttpResult::ptr HttpConnectionPool::doGet(const std::string& path , uint64_t timeout_ms
+                        , const MapType& headers , const std::string& body){
+    return doRequest(HttpMethod::GET, path, timeout_ms, headers, body);
+}
+
+HttpResult::ptr HttpConnectionPool::doPost(const std::string& path , uint64_t timeout_ms
+                        , const MapType& headers , const std::string& body){
+    return doRequest(HttpMethod::POST, path, timeout_ms, headers, body);
+}
+
+HttpResult::ptr HttpConnectionPool::doRequest(HttpMethod method , const std::string& path , uint64_t timeout_ms
+                        , const MapType& headers , const std::string& body){
+    HttpRequest::ptr req(new HttpRequest);
+    req->setMethod(method);
+    size_t pos = path.find('?');
+    if(pos == std::string::npos){
+        req->setPath(path);
+    }else {
+        req->setPath(path.substr(0, pos));
+        req->setQuery(path.substr(pos + 1));
+    }
+    for(auto& i : headers){
+        req->setHeader(i.first, i.second);
+    }
+    req->setBody(body);
+    return doRequest(req, timeout_ms);
+}
+
+HttpResult::ptr HttpConnectionPool::doRequest(HttpRequest::ptr req , uint64_t timeout_ms){
+    std::vector<HttpRequest::ptr> reqs(1, req);
+    return doRequests(reqs, timeout_ms)[0];
+}
+
+/**
+ * @brief 重试不会产生副作用的方法
+ */
+static bool IsIdempotent(HttpMethod m){
+    return m == HttpMethod::GET || m == HttpMethod::HEAD || m == HttpMethod::PUT
+        || m == HttpMethod::DELETE || m == HttpMethod::OPTIONS;
+}
+
+std::vector<HttpResult::ptr> HttpConnectionPool::doRequests(const std::vector<HttpRequest::ptr>& reqs , uint64_t timeout_ms){
+    std::vector<HttpResult::ptr> rts;
+    bool idempotent = true;
+    for(auto& i : reqs){
+        prepare(i);
+        idempotent = idempotent && IsIdempotent(i->getMethod());
+    }
+    /// 连接失败时所有请求返回同一个错误
+    auto fail = [&rts, &reqs](HttpResult::Error error , const std::string& msg){
+        HttpResult::ptr rt(new HttpResult((int)error, nullptr, msg));
+        while(rts.size() < reqs.size()){
+            rts.push_back(rt);
+        }
+    };
+    if(reqs.empty()){
+        return rts;
+    }
+
+    for(int attempt = 0 ; attempt < 2 ; ++attempt){
+        bool hit = false;
+        HttpResult::Error error = HttpResult::Error::OK;
+        HttpConnection::ptr conn = getConnection(timeout_ms, hit, error);
+        if(!conn){
+            fail(error, error == HttpResult::Error::INVALID_HOST ? "invalid host: " + m_host
+                        : "connect fail: " + m_host + ":" + std::to_string(m_port));
+            return rts;
+        }
+        Socket::ptr sock = conn->getSocket();
+        sock->setRecvTimeout(timeout_ms);
+        sock->setSendTimeout(timeout_ms);
+        /// 复用的连接可能已被对方关闭, 还没有收到任何响应时在新连接上重试
+        bool retry = hit && idempotent && attempt == 0;
+
+        int rt = conn->sendRequests(reqs);
+        if(rt <= 0){
+            conn->close();
+            if(retry){
+                ++m_retries;
+                continue;
+            }
+            fail(rt == 0 ? HttpResult::Error::SEND_CLOSE_BY_PEER : HttpResult::Error::SEND_SOCKET_ERROR
+                , "send request fail, peer=" + sock->getRemoteAddress()->toString()
+                    + " errno=" + std::to_string(errno) + " " + strerror(errno));
+            return rts;
+        }
+        for(size_t i = 0 ; i < reqs.size() ; ++i){
+            /// 对方关闭时 read 返回 0 不设置 errno, 清掉同一线程上其他协程留下的 ETIMEDOUT
+            CurrentErrno() = 0;
+            HttpResponse::ptr rsp = conn->recvResponse();
+            if(!rsp){
+                bool timeout = CurrentErrno() == ETIMEDOUT;
+                if(retry && i == 0 && !timeout){
+                    break;
+                }
+                fail(timeout ? HttpResult::Error::TIMEOUT : HttpResult::Error::RECV_ERROR
+                    , "recv response fail, peer=" + sock->getRemoteAddress()->toString()
+                        + " timeout_ms=" + std::to_string(timeout_ms));
+                return rts;
+            }
+            rts.push_back(std::make_shared<HttpResult>((int)HttpResult::Error::OK, rsp, "ok"));
+        }
+        if(rts.size() == reqs.size()){
+            return rts;
+        }
+        ++m_retries;
+    }
+    fail(HttpResult::Error::RECV_ERROR, "recv response fail after retry");
+    return rts;
+}
+
+HttpConnectionPool::Stats HttpConnectionPool::getStats(){
+    Stats stats;
+    stats.requests = m_requests;
+    stats.hits = m_hits;
+    stats.connects = m_connects;
+    stats.retries = m_retries;
+    stats.inflight = m_inflight;
+    {
+        Mutex::Lock lock(m_mutex);
+        stats.idle = m_conns.size();
+    }
+    stats.hitRate = stats.requests ? (double)stats.hits / stats.requests : 0;
+    return stats;
+}
+
+}
+}
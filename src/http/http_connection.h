@@ -0,0 +1,218 @@
+/**
+ * @file http_connection.h
+ * @brief http 客户端连接与连接池
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-26
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#ifndef __WYZ_HTTP_CONNECTION_H__
+#define __WYZ_HTTP_CONNECTION_H__
+
+#include "http.h"
+#include "http_parser.h"
+#include "http_body.h"
+#include "../address.h"
+#include "../mutex.h"
+#include "../streams/socket_stream.h"
+#include <atomic>
+#include <deque>
+#include <list>
+#include <map>
+#include <vector>
+
+namespace wyz {
+namespace http {
+
+/**
+ * @brief 一次请求的结果
+ */
+struct HttpResult {
+    using ptr = std::shared_ptr<HttpResult>;
+    enum class Error {
+        OK = 0,
+        INVALID_HOST = 1,       /// 域名解析失败
+        CONNECT_FAIL = 2,       /// 连接失败
+        SEND_CLOSE_BY_PEER = 3, /// 发送时对方关闭
+        SEND_SOCKET_ERROR = 4,  /// 发送时 socket 异常
+        TIMEOUT = 5,            /// 接收响应超时
+        RECV_ERROR = 6,         /// 接收响应时对方关闭或响应格式错误
+    };
+
+    HttpResult(int _result , HttpResponse::ptr _response , const std::string& _error)
+        : result(_result)
+        , response(_response)
+        , error(_error){
+    }
+
+    int result;
+    HttpResponse::ptr response;
+    std::string error;
+
+    std::string toString() const;
+};
+
+/**
+ * @brief http 客户端连接
+ * @details 读缓冲区与响应解析器在长连接的多个响应间复用.
+ *          可以连续发送多个请求(流水线)后按顺序接收响应, 读多的数据留在缓冲区中给下一个响应.
+ *          支持 Content-Length, 分块编码与以关闭连接结束的消息体
+ */
+class HttpConnection : public SocketStream {
+public:
+    using ptr = std::shared_ptr<HttpConnection>;
+    /**
+     * @brief Construct a new Http Connection object
+     * @param  socket           已连接的 socket
+     * @param  owner            是否托管
+     */
+    HttpConnection(Socket::ptr socket , bool owner = true);
+    ~HttpConnection();
+
+    /**
+     * @brief 发送一个请求
+     * @return int              >0 发送成功
+     *                          =0 对方关闭
+     *                          <0 Socket异常
+     */
+    int sendRequest(HttpRequest::ptr req);
+
+    /**
+     * @brief 流水线发送多个请求, 头部与消息体用一次 writev 发出
+     * @return int              同 sendRequest
+     */
+    int sendRequests(const std::vector<HttpRequest::ptr>& reqs);
+
+    /**
+     * @brief 按发送顺序接收下一个响应
+     * @return HttpResponse::ptr 出错返回 nullptr, 之后 isClose() 为 true, 连接不能再使用
+     */
+    HttpResponse::ptr recvResponse();
+
+    inline uint64_t getCreateTime() const       {return m_createTime;}
+    inline uint64_t getLastUseTime() const      {return m_lastUseTime;}
+    inline uint64_t getRequestCount() const     {return m_requestCount;}
+    /// 已发送还没有收到响应的请求数
+    inline size_t getPendingCount() const       {return m_methods.size();}
+    /// 对方要求关闭或者消息体以关闭连接结束, 不能再发送请求
+    inline bool isClose() const                 {return m_close;}
+
+private:
+    /**
+     * @brief 接收消息体
+     * @param  rsp              已经解析完头部的响应
+     * @param  method           对应请求的方法
+     */
+    bool recvBody(HttpResponse::ptr rsp , HttpMethod method);
+    bool recvChunkedBody(std::string& body);
+    bool recvUntilClose(std::string& body);
+
+private:
+    uint64_t m_createTime;
+    uint64_t m_lastUseTime;
+    uint64_t m_requestCount = 0;
+    bool m_close = false;
+    HttpResponseParser m_parser;
+    std::vector<char> m_buffer;     /// 读缓冲区, 末尾多留一个 '\0' 给解析器
+    size_t m_bufferLen = 0;         /// 缓冲区中数据的长度
+    size_t m_consumed = 0;          /// 上一个响应占用的长度, 之后的数据属于下一个响应
+    std::string m_sendBuffer;       /// 序列化请求头部的缓冲区
+    std::vector<size_t> m_heads;    /// 每个请求的头部在 m_sendBuffer 中的结束位置
+    std::vector<iovec> m_iovs;
+    std::deque<HttpMethod> m_methods;   /// 已发送还没有收到响应的请求的方法, HEAD 的响应没有消息体
+    HttpChunkedDecoder m_chunked;
+
+    friend class HttpConnectionPool;
+};
+
+/**
+ * @brief 同一个主机的长连接池
+ * @details 取连接时优先复用最近归还的空闲连接, 空闲超过 max_idle_time 或者
+ *          已发送 max_request 个请求的连接不再复用. 复用的连接发送前可能已被对方关闭,
+ *          此时没有收到任何响应的幂等请求会在新连接上重试一次
+ */
+class HttpConnectionPool {
+public:
+    using ptr = std::shared_ptr<HttpConnectionPool>;
+    using MapType = std::map<std::string, std::string, CaseInsensitiveLess>;
+
+    /**
+     * @brief Construct a new Http Connection Pool object
+     * @param  host             主机名或地址, 用于连接
+     * @param  vhost            Host 头部, 为空时使用 host
+     * @param  port             端口
+     * @param  max_size         最多保留的空闲连接数
+     * @param  max_idle_time    连接最长空闲时间(ms)
+     * @param  max_request      一个连接最多发送的请求数
+     */
+    HttpConnectionPool(const std::string& host , const std::string& vhost , uint16_t port
+                        , uint32_t max_size , uint32_t max_idle_time , uint32_t max_request);
+    ~HttpConnectionPool();
+
+    HttpResult::ptr doGet(const std::string& path , uint64_t timeout_ms
+                        , const MapType& headers = {} , const std::string& body = "");
+    HttpResult::ptr doPost(const std::string& path , uint64_t timeout_ms
+                        , const MapType& headers = {} , const std::string& body = "");
+    HttpResult::ptr doRequest(HttpMethod method , const std::string& path , uint64_t timeout_ms
+                        , const MapType& headers = {} , const std::string& body = "");
+    HttpResult::ptr doRequest(HttpRequest::ptr req , uint64_t timeout_ms);
+
+    /**
+     * @brief 在同一个连接上流水线发送多个请求
+     * @return std::vector<HttpResult::ptr> 与 reqs 一一对应
+     */
+    std::vector<HttpResult::ptr> doRequests(const std::vector<HttpRequest::ptr>& reqs , uint64_t timeout_ms);
+
+    /**
+     * @brief 连接池统计
+     */
+    struct Stats {
+        uint64_t requests;      /// 取连接的次数
+        uint64_t hits;          /// 复用空闲连接的次数
+        uint64_t connects;      /// 新建连接的次数
+        uint64_t retries;       /// 复用的连接失效后重试的次数
+        uint32_t idle;          /// 空闲连接数
+        uint32_t inflight;      /// 正在使用的连接数
+        double hitRate;         /// hits / requests
+    };
+    Stats getStats();
+
+private:
+    /**
+     * @brief 取一个连接, 没有可用的空闲连接时新建
+     * @param  hit              返回是否复用了空闲连接
+     */
+    HttpConnection::ptr getConnection(uint64_t timeout_ms , bool& hit , HttpResult::Error& error);
+
+    /// 连接的 shared_ptr 释放时归还到连接池
+    static void ReleasePtr(HttpConnection* ptr , HttpConnectionPool* pool);
+
+    /// 准备请求, 补上 Host 头部与长连接
+    void prepare(HttpRequest::ptr req);
+
+private:
+    std::string m_host;
+    std::string m_vhost;
+    uint16_t m_port;
+    uint32_t m_maxSize;
+    uint32_t m_maxIdleTime;
+    uint32_t m_maxRequest;
+
+    Mutex m_mutex;
+    std::list<HttpConnection*> m_conns;     /// 空闲连接, 最近归还的在前
+    Address::ptr m_address;                 /// 解析过的地址, 连接失败后重新解析
+
+    std::atomic<uint64_t> m_requests = {0};
+    std::atomic<uint64_t> m_hits = {0};
+    std::atomic<uint64_t> m_connects = {0};
+    std::atomic<uint64_t> m_retries = {0};
+    std::atomic<uint32_t> m_inflight = {0};
+};
+
+}
+}
+
+#endif
@@ -14,6 +14,7 @@
 #include "httpclient_parser.h"
 #include "../log.h"
 #include "../config.h"
+#include <cstdlib>
 #include <cstring>
 #include <string>
 
@@ -101,16 +102,28 @@ void on_request_uri(void *data, const char *at, size_t length){
 
 void on_request_fragment(void *data, const char *at, size_t length){
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
+    if(parser->isZeroCopy()){
+        parser->getData()->setRawFragment(parser->slice(at, length));
+        return;
+    }
     parser->getData()->setFragment(std::string(at,length));
 }
 
 void on_request_path(void *data, const char *at, size_t length){
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
+    if(parser->isZeroCopy()){
+        parser->getData()->setRawPath(parser->slice(at, length));
+        return;
+    }
     parser->getData()->setPath(std::string(at,length));  
 }
 
 void on_request_query_string(void *data, const char *at, size_t length){
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
+    if(parser->isZeroCopy()){
+        parser->getData()->setRawQuery(parser->slice(at, length));
+        return;
+    }
     parser->getData()->setQuery(std::string(at,length));  
 }
 
@@ -139,12 +152,21 @@ void on_request_http_field(void *data, const char *field, size_t flen, const cha
         WYZ_LOG_ERROR(g_logger) << "http request file length == 0";
         return;
     }
-    parser->getData()->setHeader(std::string(field ,flen), std::string(value ,vlen));
+    if(parser->isZeroCopy()){
+        parser->getData()->addRawHeader(parser->getBase(), parser->slice(field, flen), parser->slice(value, vlen));
+        return;
+    }
+    /// 重复的头部保留第一个, 与零拷贝模式一致
+    std::string key(field, flen);
+    if(!parser->getData()->hasHeader(key)){
+        parser->getData()->setHeader(key, std::string(value ,vlen));
+    }
 }
 
 
-HttpRequestParser::HttpRequestParser()
-    :m_error(0){
+HttpRequestParser::HttpRequestParser(bool zero_copy)
+    :m_error(0)
+    ,m_zeroCopy(zero_copy){
     m_data.reset(new HttpRequest());
     http_parser_init(&m_parser);
     m_parser.request_method = on_request_method;
@@ -177,6 +199,19 @@ size_t HttpRequestParser::exectue( char* data , size_t len){
     return offset;
 }
 
+size_t HttpRequestParser::execute(const char* data , size_t len , size_t off){
+    m_base = data;
+    return http_parser_execute(&m_parser, data , len , off);
+}
+
+void HttpRequestParser::reset(HttpRequest::ptr req){
+    m_data = req;
+    m_error = 0;
+    m_base = nullptr;
+    /// 只重置状态机, 回调保持不变
+    http_parser_init(&m_parser);
+}
+
 
 void on_response_reason_phrase(void *data, const char *at, size_t length){
     HttpResponseParser* parser = static_cast<HttpResponseParser*>(data);
@@ -184,7 +219,8 @@ void on_response_reason_phrase(void *data, const char *at, size_t length){
 }
 
 void on_response_status_code(void *data, const char *at, size_t length){
-
+    HttpResponseParser* parser = static_cast<HttpResponseParser*>(data);
+    parser->getData()->setStatus((HttpStatus)atoi(at));
 }
 
 void on_response_chunk_size(void *data, const char *at, size_t length){
@@ -255,5 +291,20 @@ size_t HttpResponseParser::exectue(char* data , size_t len){
     return offset;
 }
 
+size_t HttpResponseParser::execute(const char* data , size_t len , size_t off){
+    int rt = httpclient_parser_execute(&m_parser, data, len, off);
+    if(rt < 0){
+        m_error = 1002;
+        return off;
+    }
+    return rt;
+}
+
+void HttpResponseParser::reset(HttpResponse::ptr rsp){
+    httpclient_parser_init(&m_parser);
+    m_error = 0;
+    m_data = rsp;
+}
+
+}
 }
-}
\ No newline at end of file
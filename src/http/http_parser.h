@@ -23,7 +23,11 @@ namespace http {
 class HttpRequestParser{
 public:
     using ptr = std::shared_ptr<HttpRequestParser>;
-    HttpRequestParser();
+    /**
+     * @brief Construct a new Http Request Parser object
+     * @param  zero_copy        零拷贝模式, 请求中只记录在缓冲区中的偏移, 见 HttpRequest::isRaw()
+     */
+    HttpRequestParser(bool zero_copy = false);
 
     /**
      * @brief 是否解析完成
@@ -45,10 +49,38 @@ public:
      */
     size_t exectue( char* data , size_t len);
 
+    /**
+     * @brief 零拷贝模式下解析, 不移动缓冲区中的数据
+     * @param  data             缓冲区起始位置, 多次调用之间缓冲区起始位置对应的内容不能变
+     * @param  len              缓冲区中数据的长度
+     * @param  off              上次解析到的位置
+     * @return size_t           从缓冲区起始位置算起已解析的长度
+     */
+    size_t execute(const char* data , size_t len , size_t off);
+
+    /**
+     * @brief 重置解析状态, 解析同一连接上的下一个请求
+     * @param  req              保存解析结果的请求
+     */
+    void reset(HttpRequest::ptr req);
+
     inline HttpRequest::ptr getData() const      {return m_data;}
 
     inline void setError(int v) {m_error = v;}
 
+    inline bool isZeroCopy() const              {return m_zeroCopy;}
+
+    /**
+     * @brief 零拷贝模式下 at 相对缓冲区起始位置的一段
+     */
+    inline HttpSlice slice(const char* at , size_t len) const {
+        HttpSlice rt;
+        rt.off = at - m_base;
+        rt.len = len;
+        return rt;
+    }
+    inline const char* getBase() const          {return m_base;}
+
     uint64_t getContentLength();
 
 public:
@@ -58,6 +90,8 @@ private:
     http_parser m_parser;         
     HttpRequest::ptr m_data;    /// 请求数据
     int m_error;
+    bool m_zeroCopy;
+    const char* m_base = nullptr;
 };
 
 class HttpResponseParser{
@@ -85,6 +119,22 @@ public:
      */
     size_t exectue(char* data , size_t len);
 
+    /**
+     * @brief 不移动缓冲区中的数据, 从上次解析到的位置继续解析
+     * @param  data             缓冲区起始位置, 多次调用之间缓冲区起始位置对应的内容不能变,
+     *                          data[len] 必须是 '\0'
+     * @param  len              缓冲区中数据的长度
+     * @param  off              上次解析到的位置
+     * @return size_t           从缓冲区起始位置算起已解析的长度
+     */
+    size_t execute(const char* data , size_t len , size_t off);
+
+    /**
+     * @brief 重置解析状态, 解析同一连接上的下一个响应
+     * @param  rsp              保存解析结果的响应
+     */
+    void reset(HttpResponse::ptr rsp);
+
     inline HttpResponse::ptr getData() const      {return m_data;}
 
     inline void setError(int v) {m_error = v;}
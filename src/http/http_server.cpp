@@ -21,31 +21,47 @@ static wyz::Logger::ptr g_logger = WYZ_LOG_NAME("system");
 HttpServer::HttpServer(bool keepalive , IOManager* worker , IOManager* acceptworker )
     : TCPServer(worker , acceptworker)
     , m_iskeepalive(keepalive){
-
+    m_dispatch.reset(new ServletDispatch);
 }
 
 void HttpServer::handleClient(Socket::ptr client) {
     WYZ_LOG_DEBUG(g_logger) << "handleClient client= " << *client;
     HttpSession::ptr session(new HttpSession(client));
     do {
+        /// 缓冲区中没有流水线的后续请求时, 发出排队的响应后在等待下一个请求, 热重启时可以直接关闭
+        bool idle = !session->hasBufferedData();
+        if(idle && (session->flush() < 0 || !setClientIdle(client, true))){
+            break;
+        }
         HttpRequest::ptr req = session->recvRequest();
+        if(idle){
+            setClientIdle(client, false);
+        }
         if(!req){
             /// 无 http 请求报文打印日志
             WYZ_LOG_ERROR(g_logger) << "recv http request fail, errno= "<< errno << " errstr= " << strerror(errno) << " cliet:" << *client << " keep_alive=" << m_iskeepalive;
             break;
         }
-        HttpResponse::ptr rsp(new HttpResponse(req->getVersion() , req->isClose() || !m_iskeepalive)); 
-        rsp->setBody("wyz httpserver");
+        /// 热重启交出监听 socket 后, 处理完当前请求就关闭连接
+        HttpResponse::ptr rsp(new HttpResponse(req->getVersion() , req->isClose() || !m_iskeepalive || isStop())); 
+        m_dispatch->handle(req, rsp, session);
+        /// HEAD 的响应只有头部, Content-Length 仍是消息体的长度
+        if(req->getMethod() == HttpMethod::HEAD && !rsp->getBody().empty()){
+            rsp->setHeader("Content-Length", std::to_string(rsp->getBody().size()));
+            rsp->setBody("");
+        }
 
-        WYZ_LOG_INFO(g_logger) << "requst:\n" << *req;
-        WYZ_LOG_INFO(g_logger) << "response:\n" << *rsp;
+        WYZ_LOG_DEBUG(g_logger) << "requst:\n" << *req;
+        WYZ_LOG_DEBUG(g_logger) << "response:\n" << *rsp;
 
-        session->sendResponse(rsp);
-        if(!m_iskeepalive || req->isClose()){
+        /// 排队的响应在读下一个请求需要阻塞前一起发出, 流水线的请求只用一次 writev
+        session->queueResponse(rsp);
+        if(!m_iskeepalive || req->isClose() || rsp->isClose()){
             break;
         }
 
     }while (m_iskeepalive);
+    session->flush();
     session->close();
 }
 
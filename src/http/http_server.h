@@ -13,6 +13,7 @@
 #define __WYZ_HTTP_SERVER_H__
 
 #include "../tcpserver.h"
+#include "servlet.h"
 #include <memory>
 
 namespace wyz {
@@ -23,11 +24,16 @@ public:
     using ptr = std::shared_ptr<HttpServer>;
     HttpServer(bool keepalive = false , IOManager* worker = IOManager::GetThis(), IOManager* acceptworker = IOManager::GetThis());
 
+    inline ServletDispatch::ptr getServletDispatch() const    {return m_dispatch;}
+    inline void setServletDispatch(ServletDispatch::ptr v)    {m_dispatch = v;}
+
 protected:
     virtual void handleClient(Socket::ptr client) override;
 
 private:
     bool m_iskeepalive;
+    /// 路由分发
+    ServletDispatch::ptr m_dispatch;
 };
 
 }
@@ -11,16 +11,40 @@
 
 #include "http_session.h"
 #include "http_parser.h"
+#include "../config.h"
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 
 namespace wyz {
 namespace http {
 
+static wyz::ConfigVar<bool>::ptr g_http_request_zero_copy = wyz::Config::Lookup("http.request.zero_copy", true, "http request zero copy parse");
+static wyz::ConfigVar<uint64_t>::ptr g_http_request_stream_body_size = wyz::Config::Lookup("http.request.stream_body_size", (uint64_t)1024 * 1024, "http request body larger than this is streamed");
+
 HttpSession::HttpSession(Socket::ptr socket , bool owner )
-    : SocketStream(socket, owner){}
+    : SocketStream(socket, owner)
+    , m_zeroCopy(g_http_request_zero_copy->getValue())
+    , m_parser(true)
+    , m_buffer(new std::vector<char>)
+    , m_streamBodySize(g_http_request_stream_body_size->getValue()){
+}
+
+HttpSession::~HttpSession(){
+    /// 还被持有的请求与连接共同持有缓冲区, 不用拷贝
+    if(m_bodyReader){
+        m_bodyReader->detach();
+    }
+}
 
 HttpRequest::ptr HttpSession::recvRequest(){
+    if(m_zeroCopy){
+        return recvRequestZeroCopy();
+    }
+    if(flush() < 0){
+        close();
+        return nullptr;
+    }
     HttpRequestParser::ptr parser(new HttpRequestParser);
     uint64_t buffsize = HttpRequestParser::GetHttpRequestBufferSize();
     std::shared_ptr<char> buffer(new char[buffsize] , [](char* ptr){
@@ -78,11 +102,233 @@ HttpRequest::ptr HttpSession::recvRequest(){
     
 }
 
+HttpRequest::ptr HttpSession::recvRequestZeroCopy(){
+    if(m_bodyReader){
+        if(m_bodyState != BODY_NONE && !skipBody()){
+            close();
+            return nullptr;
+        }
+        m_bodyReader->detach();
+        m_bodyReader.reset();
+    }
+    uint64_t buffsize = HttpRequestParser::GetHttpRequestBufferSize();
+    if(m_request && m_request.use_count() > 1){
+        /// 处理函数还持有上一个请求, 可能正在其他线程读取, 不能修改它.
+        /// 旧缓冲区留给请求, 连接换一块新的, 只拷贝还没处理的数据
+        std::shared_ptr<std::vector<char> > fresh(new std::vector<char>(std::max((size_t)buffsize, m_buffer->size())));
+        m_bufferLen -= m_consumed;
+        memcpy(&(*fresh)[0], &(*m_buffer)[m_consumed], m_bufferLen);
+        m_consumed = 0;
+        m_buffer = fresh;
+        m_request.reset();
+    }
+    if(m_consumed){
+        m_bufferLen -= m_consumed;
+        memmove(&(*m_buffer)[0], &(*m_buffer)[m_consumed], m_bufferLen);
+        m_consumed = 0;
+    }
+    if(m_buffer->size() < buffsize){
+        m_buffer->resize(buffsize);
+    }
+    if(m_request){
+        m_request->reset();
+    }else {
+        m_request.reset(new HttpRequest);
+    }
+    m_parser.reset(m_request);
+
+    char* data = &(*m_buffer)[0];
+    size_t nparse = 0;
+    while(true){
+        /// 缓冲区里可能已经有上一次读多的数据
+        if(m_bufferLen > nparse){
+            nparse = m_parser.execute(data, m_bufferLen, nparse);
+            if(m_parser.hasError()){
+                close();
+                return nullptr;
+            }
+            if(m_parser.isFinish()){
+                break;
+            }
+        }
+        if(m_bufferLen == m_buffer->size()){
+            close();
+            return nullptr;
+        }
+        /// 缓冲区中的请求都处理完了, 阻塞读之前先把排队的响应发出去
+        if(!m_pending.empty() && flush() < 0){
+            close();
+            return nullptr;
+        }
+        int len = read(data + m_bufferLen, m_buffer->size() - m_bufferLen);
+        if(len <= 0){
+            close();
+            return nullptr;
+        }
+        m_bufferLen += len;
+    }
+
+    m_request->setRawBase(data, m_buffer);
+    uint64_t length = m_parser.getContentLength();
+    StringView te;
+    bool chunked = m_request->getHeaderView("transfer-encoding", te) && IsChunked(te);
+    if(chunked || length > m_streamBodySize){
+        /// 消息体留在连接中, 由处理函数从 getBodyStream() 读取, 内存占用与消息体大小无关.
+        /// 读消息体时会复用缓冲区, 请求还没有交给处理函数, 先拷贝出来
+        m_request->init();
+        m_request->materialize();
+        m_consumed = nparse;
+        if(chunked){
+            m_bodyState = BODY_CHUNKED;
+            m_chunked.reset();
+        }else {
+            m_bodyState = BODY_LENGTH;
+            m_bodyLeft = length;
+        }
+        m_bodyReader.reset(new HttpBodyReader(this));
+        m_request->setBodyStream(m_bodyReader);
+        return m_request;
+    }
+    if(length > 0){
+        std::string body;
+        body.resize(length);
+        size_t n = std::min((uint64_t)(m_bufferLen - nparse), length);
+        memcpy(&body[0], data + nparse, n);
+        if(length > n && readFixSize(&body[n], length - n) <= 0){
+            close();
+            return nullptr;
+        }
+        m_request->setBody(body);
+        nparse += n;
+    }
+    m_consumed = nparse;
+    m_request->init();
+    return m_request;
+}
+
+int HttpSession::readBody(void* buff , size_t length){
+    if(m_bodyState == BODY_NONE){
+        return 0;
+    }
+    if(m_bodyState == BODY_ERROR){
+        return -1;
+    }
+    /// 不读取也不消耗数据, 否则分块解码原地空转, 定长消息体被当成读完
+    if(length == 0){
+        return 0;
+    }
+    while(true){
+        if(m_consumed == m_bufferLen){
+            m_consumed = m_bufferLen = 0;
+            /// 大块读取时直接读到调用方的内存
+            if(m_bodyState == BODY_LENGTH && length >= m_buffer->size()){
+                int rt = read(buff, std::min((uint64_t)length, m_bodyLeft));
+                if(rt <= 0){
+                    m_bodyState = BODY_ERROR;
+                    return -1;
+                }
+                m_bodyLeft -= rt;
+                if(m_bodyLeft == 0){
+                    m_bodyState = BODY_NONE;
+                }
+                return rt;
+            }
+            int rt = read(&(*m_buffer)[0], m_buffer->size());
+            if(rt <= 0){
+                m_bodyState = BODY_ERROR;
+                return -1;
+            }
+            m_bufferLen = rt;
+        }
+        const char* in = &(*m_buffer)[m_consumed];
+        size_t inlen = m_bufferLen - m_consumed;
+        if(m_bodyState == BODY_LENGTH){
+            size_t n = std::min(std::min((uint64_t)inlen, (uint64_t)length), m_bodyLeft);
+            memcpy(buff, in, n);
+            m_consumed += n;
+            m_bodyLeft -= n;
+            if(m_bodyLeft == 0){
+                m_bodyState = BODY_NONE;
+            }
+            return n;
+        }
+        size_t consumed = 0;
+        size_t n = m_chunked.decode(in, inlen, consumed, (char*)buff, length);
+        m_consumed += consumed;
+        if(m_chunked.hasError()){
+            m_bodyState = BODY_ERROR;
+            return -1;
+        }
+        if(m_chunked.isDone()){
+            m_bodyState = BODY_NONE;
+        }
+        if(n > 0 || m_bodyState == BODY_NONE){
+            return n;
+        }
+    }
+}
+
+bool HttpSession::skipBody(){
+    char tmp[4096];
+    while(true){
+        int rt = readBody(tmp, sizeof(tmp));
+        if(rt == 0){
+            return true;
+        }
+        if(rt < 0){
+            return false;
+        }
+    }
+}
+
+/// 排队响应的上限, 每个响应占两个 iovec, 不超过 IOV_MAX
+static const size_t s_max_pending = 64;
+
 int HttpSession::sendResponse(HttpResponse::ptr rsp){
-    std::stringstream ss;
-    ss << *rsp;
-    std::string data = ss.str();
-    return writeFixSize(data.c_str(), data.size());
+    queueResponse(rsp);
+    return flush();
+}
+
+int HttpSession::queueResponse(HttpResponse::ptr rsp){
+    /// 流式的响应已经由 HttpBodyWriter 发出
+    if(rsp->isStream()){
+        return 0;
+    }
+    /// 头部写入复用的缓冲区, 消息体在发送时作为单独的 iovec, 不拷贝
+    rsp->serializeHead(m_sendBuffer);
+    m_pending.push_back(rsp);
+    m_pendingHeads.push_back(m_sendBuffer.size());
+    if(m_pending.size() >= s_max_pending){
+        return flush();
+    }
+    return 0;
+}
+
+int HttpSession::flush(){
+    if(m_pending.empty()){
+        return 0;
+    }
+    /// m_sendBuffer 追加时可能重新分配, 发送前再计算各段地址
+    m_iovs.clear();
+    size_t head = 0;
+    for(size_t i = 0 ; i < m_pending.size() ; ++i){
+        iovec iov;
+        iov.iov_base = &m_sendBuffer[head];
+        iov.iov_len = m_pendingHeads[i] - head;
+        m_iovs.push_back(iov);
+        head = m_pendingHeads[i];
+        const std::string& body = m_pending[i]->getBody();
+        if(!body.empty()){
+            iov.iov_base = (void*)body.data();
+            iov.iov_len = body.size();
+            m_iovs.push_back(iov);
+        }
+    }
+    int rt = writevFixSize(&m_iovs[0], m_iovs.size());
+    m_sendBuffer.clear();
+    m_pending.clear();
+    m_pendingHeads.clear();
+    return rt;
 }
 
 
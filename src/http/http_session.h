@@ -13,7 +13,10 @@
 #define __WYZ_HTTP_SESSION_H__
 
 #include "http.h"
+#include "http_parser.h"
+#include "http_body.h"
 #include "../streams/socket_stream.h"
+#include <vector>
 
 namespace wyz {
 namespace http {
@@ -27,6 +30,7 @@ public:
      * @param  owner            是否托管
      */
     HttpSession(Socket::ptr socket , bool owner = true);
+    ~HttpSession();
 
     /**
      * @brief 接受客户端发来的 http 请求报文
@@ -43,6 +47,70 @@ public:
      */
     int sendResponse(HttpResponse::ptr rsp);
 
+    /**
+     * @brief 把响应加入发送队列, 暂不发送
+     * @details 流水线(pipelining)时缓冲区中已经有后续请求, 这些请求的响应排队后
+     *          在 recvRequest 需要读 socket 之前或 flush 时用一次 writev 发出
+     * @return int              >=0 成功
+     *                          <0 队列满时发送失败
+     */
+    int queueResponse(HttpResponse::ptr rsp);
+
+    /**
+     * @brief 用一次 writev 发送队列中所有的响应
+     * @return int              >0 发送的字节数, =0 队列为空或对方关闭, <0 Socket异常
+     */
+    int flush();
+
+    /// 读缓冲区中是否还有未处理的数据(流水线的后续请求)
+    inline bool hasBufferedData() const     {return m_bufferLen > m_consumed;}
+
+    /**
+     * @brief 读当前请求流式的消息体, 供 HttpBodyReader 使用
+     * @return int              >0 读到的长度
+     *                          =0 消息体结束
+     *                          <0 出错
+     */
+    int readBody(void* buff , size_t length);
+
+private:
+    /// 流式消息体的状态
+    enum BodyState{
+        BODY_NONE = 0,      // 没有流式消息体或已经读完
+        BODY_LENGTH,        // Content-Length
+        BODY_CHUNKED,       // Transfer-Encoding: chunked
+        BODY_ERROR,
+    };
+
+    /**
+     * @brief 丢弃处理函数没有读完的消息体, 之后的数据属于下一个请求
+     */
+    bool skipBody();
+
+    /**
+     * @brief 零拷贝模式接收请求
+     * @details 读缓冲区与解析器在长连接的多个请求间复用, 请求只记录偏移.
+     *          上一个请求没有被外部持有时直接复用这个请求对象
+     */
+    HttpRequest::ptr recvRequestZeroCopy();
+
+private:
+    bool m_zeroCopy;
+    HttpRequestParser m_parser;
+    /// 连接的读缓冲区, 零拷贝的请求共同持有; 请求被处理函数留住时连接换一块新的
+    std::shared_ptr<std::vector<char> > m_buffer;
+    size_t m_bufferLen = 0;         /// 缓冲区中数据的长度
+    size_t m_consumed = 0;          /// 上一个请求占用的长度, 之后的数据属于下一个请求
+    HttpRequest::ptr m_request;     /// 上一个返回的请求
+    std::string m_sendBuffer;       /// 序列化响应头部的缓冲区, 排队的响应头部依次追加
+    std::vector<HttpResponse::ptr> m_pending;   /// 排队等待发送的响应
+    std::vector<size_t> m_pendingHeads;         /// 每个排队响应的头部在 m_sendBuffer 中的结束位置
+    std::vector<iovec> m_iovs;
+    uint64_t m_streamBodySize;      /// 超过这个长度的消息体不读入内存
+    BodyState m_bodyState = BODY_NONE;
+    uint64_t m_bodyLeft = 0;        /// Content-Length 消息体剩余的长度
+    HttpChunkedDecoder m_chunked;
+    HttpBodyReader::ptr m_bodyReader;
 };
 
 }
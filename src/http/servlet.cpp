@@ -0,0 +1,337 @@
+/**
+ * @file servlet.cpp
+ * @brief http 请求处理与路由分发实现
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-22
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#include "servlet.h"
+#include <algorithm>
+#include <cstring>
+
+namespace wyz {
+namespace http {
+
+FunctionServlet::FunctionServlet(callback cb)
+    : Servlet("FunctionServlet")
+    , m_cb(cb){
+}
+
+int32_t FunctionServlet::handle(HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session){
+    return m_cb(request, response, session);
+}
+
+NotFoundServlet::NotFoundServlet(const std::string& name)
+    : Servlet("NotFoundServlet"){
+    m_content = "<html><head><title>404 Not Found</title></head><body><center><h1>404 Not Found</h1></center>"
+                "<hr><center>" + name + "</center></body></html>";
+}
+
+int32_t NotFoundServlet::handle(HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session){
+    response->setStatus(HttpStatus::NOT_FOUND);
+    response->setHeader("Content-Type", "text/html");
+    response->setBody(m_content);
+    return 0;
+}
+
+MethodNotAllowedServlet::MethodNotAllowedServlet(const std::string& name)
+    : Servlet(name){
+}
+
+int32_t MethodNotAllowedServlet::handle(HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session){
+    response->setStatus(HttpStatus::METHOD_NOT_ALLOWED);
+    response->setHeader("Content-Type", "text/plain");
+    response->setBody("405 Method Not Allowed");
+    return 0;
+}
+
+/**
+ * @brief 通配匹配, '*' 匹配任意多个字符, '?' 匹配一个字符
+ * @details 只记录最近一个 '*' 的位置回溯, 不分配内存
+ */
+static bool GlobMatch(const char* p , size_t plen , const char* s , size_t slen){
+    size_t pi = 0;
+    size_t si = 0;
+    size_t star = std::string::npos;
+    size_t mark = 0;
+    while(si < slen){
+        if(pi < plen && (p[pi] == '?' || p[pi] == s[si])){
+            ++pi;
+            ++si;
+        }else if(pi < plen && p[pi] == '*'){
+            star = pi++;
+            mark = si;
+        }else if(star != std::string::npos){
+            pi = star + 1;
+            si = ++mark;
+        }else {
+            return false;
+        }
+    }
+    while(pi < plen && p[pi] == '*'){
+        ++pi;
+    }
+    return pi == plen;
+}
+
+const Servlet::ptr* ServletDispatch::Handlers::find(HttpMethod method) const{
+    for(auto& i : methods){
+        if(i.first == method){
+            return &i.second;
+        }
+    }
+    return any ? &any : nullptr;
+}
+
+void ServletDispatch::Handlers::set(HttpMethod method , Servlet::ptr slt){
+    if(method == HttpMethod::INVALID_METHOD){
+        any = slt;
+        return;
+    }
+    for(auto& i : methods){
+        if(i.first == method){
+            i.second = slt;
+            return;
+        }
+    }
+    methods.push_back(std::make_pair(method, slt));
+}
+
+ServletDispatch::Node* ServletDispatch::Node::findChild(char c) const{
+    auto it = std::lower_bound(children.begin(), children.end(), c
+            , [](const std::unique_ptr<Node>& n , char v){
+        return (unsigned char)n->label[0] < (unsigned char)v;
+    });
+    if(it != children.end() && (*it)->label[0] == c){
+        return it->get();
+    }
+    return nullptr;
+}
+
+ServletDispatch::ServletDispatch()
+    : Servlet("ServletDispatch")
+    , m_root(new Node){
+    m_default.reset(new NotFoundServlet("wyz/1.0"));
+    m_methodNotAllowed.reset(new MethodNotAllowedServlet("MethodNotAllowedServlet"));
+}
+
+ServletDispatch::~ServletDispatch(){
+}
+
+int32_t ServletDispatch::handle(HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session){
+    StringView path = request->getPathView();
+    Servlet::ptr slt = getMatchedServlet(request->getMethod(), path.data(), path.size());
+    return slt->handle(request, response, session);
+}
+
+ServletDispatch::Node* ServletDispatch::getNode(const std::string& key , bool create){
+    Node* node = m_root.get();
+    size_t pos = 0;
+    while(pos < key.size()){
+        auto it = std::lower_bound(node->children.begin(), node->children.end(), key[pos]
+                , [](const std::unique_ptr<Node>& n , char v){
+            return (unsigned char)n->label[0] < (unsigned char)v;
+        });
+        if(it == node->children.end() || (*it)->label[0] != key[pos]){
+            if(!create){
+                return nullptr;
+            }
+            std::unique_ptr<Node> leaf(new Node);
+            leaf->label = key.substr(pos);
+            Node* rt = leaf.get();
+            node->children.insert(it, std::move(leaf));
+            ++m_nodes;
+            return rt;
+        }
+
+        Node* child = it->get();
+        size_t max = std::min(child->label.size(), key.size() - pos);
+        size_t n = 0;
+        while(n < max && child->label[n] == key[pos + n]){
+            ++n;
+        }
+        if(n == child->label.size()){
+            node = child;
+            pos += n;
+            continue;
+        }
+        if(!create){
+            return nullptr;
+        }
+        /// 在公共前缀处分裂这条边
+        std::unique_ptr<Node> mid(new Node);
+        mid->label = child->label.substr(0, n);
+        child->label.erase(0, n);
+        mid->children.push_back(std::move(*it));
+        *it = std::move(mid);
+        ++m_nodes;
+        node = it->get();
+        pos += n;
+    }
+    return node;
+}
+
+void ServletDispatch::addRoute(MatchType type , HttpMethod method , const std::string& uri , Servlet::ptr slt){
+    RWMutexType::WriteLock lock(m_mutex);
+    if(type == GLOB){
+        size_t literal = uri.find_first_of("*?");
+        if(literal == std::string::npos){
+            literal = uri.size();
+        }
+        Node* node = getNode(uri.substr(0, literal), true);
+        for(auto& i : node->globs){
+            if(i.uri == uri){
+                i.handlers.set(method, slt);
+                return;
+            }
+        }
+        GlobRoute route;
+        route.uri = uri;
+        route.pattern = uri.substr(literal);
+        route.handlers.set(method, slt);
+        node->globs.push_back(route);
+        ++m_routes;
+        return;
+    }
+    Node* node = getNode(uri, true);
+    Handlers& handlers = type == EXACT ? node->exact : node->prefix;
+    if(handlers.empty()){
+        ++m_routes;
+    }
+    handlers.set(method, slt);
+}
+
+void ServletDispatch::delRoute(MatchType type , const std::string& uri){
+    RWMutexType::WriteLock lock(m_mutex);
+    /// 节点保留在树上, 只清空路由
+    if(type == GLOB){
+        size_t literal = uri.find_first_of("*?");
+        if(literal == std::string::npos){
+            literal = uri.size();
+        }
+        Node* node = getNode(uri.substr(0, literal), false);
+        if(!node){
+            return;
+        }
+        for(auto it = node->globs.begin() ; it != node->globs.end() ; ++it){
+            if(it->uri == uri){
+                node->globs.erase(it);
+                --m_routes;
+                return;
+            }
+        }
+        return;
+    }
+    Node* node = getNode(uri, false);
+    if(!node){
+        return;
+    }
+    Handlers& handlers = type == EXACT ? node->exact : node->prefix;
+    if(!handlers.empty()){
+        handlers = Handlers();
+        --m_routes;
+    }
+}
+
+void ServletDispatch::addServlet(const std::string& uri , Servlet::ptr slt){
+    addRoute(EXACT, HttpMethod::INVALID_METHOD, uri, slt);
+}
+
+void ServletDispatch::addServlet(const std::string& uri , FunctionServlet::callback cb){
+    addRoute(EXACT, HttpMethod::INVALID_METHOD, uri, std::make_shared<FunctionServlet>(cb));
+}
+
+void ServletDispatch::addPrefixServlet(const std::string& uri , Servlet::ptr slt){
+    addRoute(PREFIX, HttpMethod::INVALID_METHOD, uri, slt);
+}
+
+void ServletDispatch::addPrefixServlet(const std::string& uri , FunctionServlet::callback cb){
+    addRoute(PREFIX, HttpMethod::INVALID_METHOD, uri, std::make_shared<FunctionServlet>(cb));
+}
+
+void ServletDispatch::addGlobServlet(const std::string& uri , Servlet::ptr slt){
+    addRoute(GLOB, HttpMethod::INVALID_METHOD, uri, slt);
+}
+
+void ServletDispatch::addGlobServlet(const std::string& uri , FunctionServlet::callback cb){
+    addRoute(GLOB, HttpMethod::INVALID_METHOD, uri, std::make_shared<FunctionServlet>(cb));
+}
+
+void ServletDispatch::delServlet(const std::string& uri){
+    delRoute(EXACT, uri);
+}
+
+void ServletDispatch::delPrefixServlet(const std::string& uri){
+    delRoute(PREFIX, uri);
+}
+
+void ServletDispatch::delGlobServlet(const std::string& uri){
+    delRoute(GLOB, uri);
+}
+
+Servlet::ptr ServletDispatch::getMatchedServlet(HttpMethod method , const std::string& path){
+    return getMatchedServlet(method, path.c_str(), path.size());
+}
+
+Servlet::ptr ServletDispatch::getMatchedServlet(HttpMethod method , const char* s , size_t len){
+    RWMutexType::ReadLock lock(m_mutex);
+    const Servlet::ptr* best = nullptr;
+    bool path_matched = false;
+    const Node* node = m_root.get();
+    size_t pos = 0;
+    while(true){
+        /// 走到这里时 path[0, pos) 就是本节点的完整键, 越深的节点越具体
+        if(!node->prefix.empty()){
+            path_matched = true;
+            if(const Servlet::ptr* slt = node->prefix.find(method)){
+                best = slt;
+            }
+        }
+        for(auto& i : node->globs){
+            if(GlobMatch(i.pattern.c_str(), i.pattern.size(), s + pos, len - pos)){
+                path_matched = true;
+                if(const Servlet::ptr* slt = i.handlers.find(method)){
+                    best = slt;
+                    break;
+                }
+            }
+        }
+        if(pos == len){
+            if(!node->exact.empty()){
+                if(const Servlet::ptr* slt = node->exact.find(method)){
+                    return *slt;
+                }
+                path_matched = true;
+            }
+            break;
+        }
+        const Node* child = node->findChild(s[pos]);
+        if(!child || len - pos < child->label.size()
+                || memcmp(child->label.c_str(), s + pos, child->label.size()) != 0){
+            break;
+        }
+        pos += child->label.size();
+        node = child;
+    }
+    if(best){
+        return *best;
+    }
+    return path_matched ? m_methodNotAllowed : m_default;
+}
+
+size_t ServletDispatch::getRouteCount(){
+    RWMutexType::ReadLock lock(m_mutex);
+    return m_routes;
+}
+
+size_t ServletDispatch::getNodeCount(){
+    RWMutexType::ReadLock lock(m_mutex);
+    return m_nodes;
+}
+
+}
+}
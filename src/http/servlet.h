@@ -0,0 +1,205 @@
+/**
+ * @file servlet.h
+ * @brief http 请求处理与路由分发
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-22
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#ifndef __WYZ_HTTP_SERVLET_H__
+#define __WYZ_HTTP_SERVLET_H__
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "http.h"
+#include "http_session.h"
+#include "../mutex.h"
+
+namespace wyz {
+namespace http {
+
+/**
+ * @brief 请求处理基类
+ */
+class Servlet{
+public:
+    using ptr = std::shared_ptr<Servlet>;
+
+    Servlet(const std::string& name)
+        : m_name(name){
+    }
+    virtual ~Servlet(){}
+
+    /**
+     * @brief 处理请求
+     * @param  request          http 请求
+     * @param  response         http 响应
+     * @param  session          http 连接
+     * @return int32_t          0 成功
+     */
+    virtual int32_t handle(HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session) = 0;
+
+    inline const std::string& getName() const   {return m_name;}
+
+protected:
+    std::string m_name;
+};
+
+/**
+ * @brief 回调函数形式的 Servlet
+ */
+class FunctionServlet : public Servlet{
+public:
+    using ptr = std::shared_ptr<FunctionServlet>;
+    using callback = std::function<int32_t (HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session)>;
+
+    FunctionServlet(callback cb);
+    int32_t handle(HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session) override;
+
+private:
+    callback m_cb;
+};
+
+/**
+ * @brief 没有匹配的路由时返回 404
+ */
+class NotFoundServlet : public Servlet{
+public:
+    using ptr = std::shared_ptr<NotFoundServlet>;
+    NotFoundServlet(const std::string& name);
+    int32_t handle(HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session) override;
+
+private:
+    std::string m_content;
+};
+
+/**
+ * @brief 路径匹配但是没有注册该方法时返回 405
+ */
+class MethodNotAllowedServlet : public Servlet{
+public:
+    using ptr = std::shared_ptr<MethodNotAllowedServlet>;
+    MethodNotAllowedServlet(const std::string& name);
+    int32_t handle(HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session) override;
+};
+
+/**
+ * @brief 路由分发
+ * @details 精确, 前缀, 通配(glob) 三种路由放在同一棵基数树(radix tree)中, 按 HttpRequest::getPath() 查找.
+ *          通配路由按第一个 '*' / '?' 之前的字面前缀挂在树上, 剩余部分在查找经过该节点时匹配.
+ *          优先级: 精确 > 字面前缀更长的通配/前缀 > 同一节点上的通配 > 同一节点上的前缀 > 默认.
+ *          每条路由可以按方法注册, 指定了方法的优先于不限方法的.
+ *          查找只沿树走一遍路径, 不分配内存
+ */
+class ServletDispatch : public Servlet{
+public:
+    using ptr = std::shared_ptr<ServletDispatch>;
+    using RWMutexType = RWMutex;
+
+    /// 路由类型
+    enum MatchType{
+        EXACT = 0,      // 路径完全相同
+        PREFIX,         // 路径以 uri 开头
+        GLOB,           // 通配符 '*' (任意多个字符, 包括 '/') 与 '?' (一个字符)
+    };
+
+    ServletDispatch();
+    ~ServletDispatch();
+
+    int32_t handle(HttpRequest::ptr request , HttpResponse::ptr response , HttpSession::ptr session) override;
+
+    /**
+     * @brief 添加路由, 已存在时覆盖
+     * @param  type             路由类型
+     * @param  method           请求方法, INVALID_METHOD 表示不限方法
+     * @param  uri              路径或模式
+     * @param  slt              处理请求的 Servlet
+     */
+    void addRoute(MatchType type , HttpMethod method , const std::string& uri , Servlet::ptr slt);
+
+    /**
+     * @brief 删除路由的所有方法
+     */
+    void delRoute(MatchType type , const std::string& uri);
+
+    /**
+     * @brief 不限方法的精确/前缀/通配路由
+     */
+    void addServlet(const std::string& uri , Servlet::ptr slt);
+    void addServlet(const std::string& uri , FunctionServlet::callback cb);
+    void addPrefixServlet(const std::string& uri , Servlet::ptr slt);
+    void addPrefixServlet(const std::string& uri , FunctionServlet::callback cb);
+    void addGlobServlet(const std::string& uri , Servlet::ptr slt);
+    void addGlobServlet(const std::string& uri , FunctionServlet::callback cb);
+
+    void delServlet(const std::string& uri);
+    void delPrefixServlet(const std::string& uri);
+    void delGlobServlet(const std::string& uri);
+
+    inline Servlet::ptr getDefault() const      {return m_default;}
+    inline void setDefault(Servlet::ptr v)      {m_default = v;}
+
+    /**
+     * @brief 查找路由
+     * @param  method           请求方法
+     * @param  path             请求路径
+     * @return Servlet::ptr     没有匹配的路径返回默认 Servlet, 路径匹配但方法不匹配返回 405 Servlet
+     */
+    Servlet::ptr getMatchedServlet(HttpMethod method , const std::string& path);
+    Servlet::ptr getMatchedServlet(HttpMethod method , const char* path , size_t len);
+
+    /// 路由条数与树的节点数
+    size_t getRouteCount();
+    size_t getNodeCount();
+
+private:
+    /// 一条路由上按方法注册的 Servlet
+    struct Handlers{
+        Servlet::ptr any;
+        std::vector<std::pair<HttpMethod, Servlet::ptr> > methods;
+
+        /// 方法匹配的 Servlet, 没有返回 nullptr
+        const Servlet::ptr* find(HttpMethod method) const;
+        void set(HttpMethod method , Servlet::ptr slt);
+        inline bool empty() const { return !any && methods.empty();}
+    };
+
+    /// 通配路由, pattern 是去掉字面前缀之后的剩余模式
+    struct GlobRoute{
+        std::string uri;
+        std::string pattern;
+        Handlers handlers;
+    };
+
+    struct Node{
+        std::string label;                              // 从父节点到本节点的边
+        std::vector<std::unique_ptr<Node> > children;   // 按 label 首字符排序
+        Handlers exact;
+        Handlers prefix;
+        std::vector<GlobRoute> globs;
+
+        Node* findChild(char c) const;
+    };
+
+    /// 找到 key 对应的节点, create 为 true 时按需插入/分裂
+    Node* getNode(const std::string& key , bool create);
+
+private:
+    RWMutexType m_mutex;
+    std::unique_ptr<Node> m_root;
+    size_t m_routes = 0;
+    size_t m_nodes = 1;
+    Servlet::ptr m_default;
+    Servlet::ptr m_methodNotAllowed;
+};
+
+}
+}
+
+#endif
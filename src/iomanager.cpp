@@ -6,14 +6,21 @@
  */
 
 #include "iomanager.h"
+#include "config.h"
 #include "fiber.h"
 #include "log.h"
 #include "macro.h"
+#include "uring.h"
+#include "util.h"
 #include <algorithm>
 #include <cstdint>
+#include <cstdlib>
 #include <fcntl.h>
 #include <functional>
+#include <new>
+#include <poll.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 #include <error.h>
 #include <string.h>
@@ -22,6 +29,29 @@ namespace wyz {
 
 static wyz::Logger::ptr g_logger = WYZ_LOG_NAME("system");
 
+static wyz::ConfigVar<bool>::ptr g_iomanager_io_uring =
+    wyz::Config::Lookup("iomanager.io_uring", false, "iomanager submit hooked socket io through io_uring");
+static wyz::ConfigVar<uint32_t>::ptr g_iomanager_io_uring_entries =
+    wyz::Config::Lookup("iomanager.io_uring_entries", (uint32_t)256, "iomanager io_uring submission queue size");
+
+/**
+ * @brief 一次 io_uring 请求, 放在发起请求的协程栈上
+ * @details user_data 为请求地址, 链接的超时 sqe 低位置 1
+ */
+struct IOManager::IORequest{
+    Fiber::ptr fiber;
+    Scheduler* scheduler = nullptr;
+    FdContext* fd_ctx = nullptr;
+    IORequest* prev = nullptr;
+    IORequest* next = nullptr;
+    int event = NONE;
+    /// 还未收到的完成事件数量 (请求本身 + 链接的超时)
+    int refs = 1;
+    int result = 0;
+    bool timedout = false;
+    bool cancelled = false;
+};
+
 IOManager::FdContext::EventContext& IOManager::FdContext::getContext(IOManager::EventType event){
     switch (event) {
         case IOManager::READ:
@@ -48,36 +78,48 @@ void IOManager::FdContext::triggerEvent(IOManager::EventType event){
     }else {
         ctx.scheduler->schedule(ctx.fiber);
     }
-    ctx.scheduler = nullptr;
+    /// 清空上下文, 同一个 fd 下次 addEvent 时要求上下文为空
+    resetContext(ctx);
     return ;
 }
 
 
 IOManager::IOManager(size_t threads , bool use_caller , const std::string& name )
     : Scheduler(threads , use_caller , name){
+    for(size_t i = 0; i < FD_SEGMENTS; ++i) {
+        m_fdSegments[i] = nullptr;
+    }
     // 创建 epoll
     m_epfd = epoll_create(1);
     WYZ_ASSERT(m_epfd > 0);
 
-    // 创建管道
-    int rt = pipe(m_tickleFds);
-    WYZ_ASSERT(!rt);
+    // 创建 poller 的 eventfd
+    m_tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    WYZ_ASSERT(m_tickleFd >= 0);
 
     struct epoll_event ev; 
     memset(&ev, 0, sizeof(ev));
     /* EPOLLET -- epoll工作在ET模式的时候，必须使用非阻塞套接口*/
     ev.events = EPOLLIN | EPOLLET;      // (EPOLLIN -- 读 EPOLLET -- 边缘触发事件通知)
-    ev.data.fd = m_tickleFds[0];        // 管道读端
+    ev.data.fd = m_tickleFd;
 
-    // 设置m_tickleFds[0] 为非阻塞状态
-    rt = fcntl(m_tickleFds[0], F_SETFL , O_NONBLOCK); 
+    // 将 eventfd 加入epoll兴趣列表
+    int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFd, &ev);
     WYZ_ASSERT(!rt);
 
-    // 将管道的读端加入epoll兴趣列表
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &ev);
-    WYZ_ASSERT(!rt);
+    /// 每个线程一个 eventfd, 不在 epoll 中, 阻塞等待时只有指定它的 tickle 能唤醒
+    size_t workers = m_threadCount + (m_rootThreadId != -1 ? 1 : 0);
+    for(size_t i = 0; i < workers; ++i) {
+        Waker* waker = new Waker;
+        waker->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        WYZ_ASSERT(waker->fd >= 0);
+        m_wakers.push_back(waker);
+    }
+
+    if(g_iomanager_io_uring->getValue()){
+        initIOUring();
+    }
 
-    contextResize(32);
     Scheduler::start();
 
 }
@@ -85,38 +127,306 @@ IOManager::IOManager(size_t threads , bool use_caller , const std::string& name
 IOManager::~IOManager(){
     Scheduler::stop();
     close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
-    for(size_t i = 0 ; i < m_fdContexts.size() ; ++i){
-        if(m_fdContexts[i]) {
-            delete m_fdContexts[i];
+    close(m_tickleFd);
+    for(auto waker : m_wakers) {
+        close(waker->fd);
+        delete waker;
+    }
+    if(m_uring){
+        delete m_uring;
+        close(m_uringEventFd);
+    }
+    for(size_t i = 0 ; i < FD_SEGMENTS ; ++i){
+        FdContext* segment = m_fdSegments[i];
+        if(!segment) {
+            continue;
         }
+        for(size_t j = 0 ; j < (FD_SEGMENT_BASE << i) ; ++j){
+            segment[j].~FdContext();
+        }
+        free(segment);
     }
-    
+
+}
+
+bool IOManager::initIOUring(){
+    IOUring* uring = new IOUring;
+    if(!uring->init(g_iomanager_io_uring_entries->getValue())){
+        WYZ_LOG_INFO(g_logger) << "name=" << getName() << " io_uring unavailable, fall back to epoll";
+        delete uring;
+        return false;
+    }
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(efd < 0 || !uring->registerEventfd(efd)){
+        WYZ_LOG_ERROR(g_logger) << "io_uring register eventfd errno=" << errno
+            << " " << strerror(errno) << ", fall back to epoll";
+        if(efd >= 0){
+            close(efd);
+        }
+        delete uring;
+        return false;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = efd;
+    int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, efd, &ev);
+    WYZ_ASSERT(!rt);
+    m_uring = uring;
+    m_uringEventFd = efd;
+    WYZ_LOG_INFO(g_logger) << "name=" << getName() << " io_uring enabled";
+    return true;
+}
+
+IOManager::FdContext* IOManager::getFdContext(int fd, bool auto_create){
+    if(fd < 0){
+        return nullptr;
+    }
+    /// 第 i 段的起点为 BASE * (2^i - 1), 即 fd + BASE 的最高位决定段号
+    size_t index = static_cast<size_t>(fd) + FD_SEGMENT_BASE;
+    size_t high = 63 - __builtin_clzll(index);
+    size_t seg = high - FD_SEGMENT_SHIFT;
+    size_t offset = index - ((size_t)1 << high);
+    FdContext* segment = m_fdSegments[seg].load(std::memory_order_acquire);
+    if(segment || !auto_create){
+        return segment ? &segment[offset] : nullptr;
+    }
+
+    /// 整段一次分配, 按缓存行对齐; 并发分配时 CAS 失败的一方释放自己的
+    size_t count = FD_SEGMENT_BASE << seg;
+    void* mem = nullptr;
+    if(posix_memalign(&mem, alignof(FdContext), count * sizeof(FdContext))){
+        WYZ_LOG_ERROR(g_logger) << "alloc fd segment " << seg << " count=" << count << " fail";
+        return nullptr;
+    }
+    FdContext* fresh = static_cast<FdContext*>(mem);
+    size_t first = (FD_SEGMENT_BASE << seg) - FD_SEGMENT_BASE;
+    for(size_t i = 0 ; i < count ; ++i){
+        new (&fresh[i]) FdContext;
+        fresh[i].fd = first + i;
+    }
+    if(!m_fdSegments[seg].compare_exchange_strong(segment, fresh, std::memory_order_acq_rel)){
+        for(size_t i = 0 ; i < count ; ++i){
+            fresh[i].~FdContext();
+        }
+        free(mem);
+        return &segment[offset];
+    }
+    return &fresh[offset];
+}
+
+ssize_t IOManager::submitIO(int fd, EventType event, uint8_t opcode, void* addr
+                , uint32_t len, uint64_t off, uint32_t op_flags, uint64_t timeout_ms){
+#ifdef WYZ_HAVE_IO_URING
+    WYZ_ASSERT(m_uring);
+    FdContext* fd_ctx = getFdContext(fd);
+    if(!fd_ctx){
+        errno = EBADF;
+        return -1;
+    }
+    IORequest req;
+    req.fiber = Fiber::GetThis();
+    req.scheduler = Scheduler::GetThis();
+    req.fd_ctx = fd_ctx;
+    req.event = event;
+    __kernel_timespec ts;
+    {
+        FdContext::MutexTpye::Lock mlock(fd_ctx->mutex);
+        Mutex::Lock ulock(m_uringMutex);
+        uint32_t need = timeout_ms != ~0ull ? 2 : 1;
+        /// 先把环里残留的 sqe 交给内核, 之后 submit 的返回值只算本次填写的 sqe
+        if(m_uring->sqPending() || m_uring->sqSpace() < need){
+            m_uring->submit();
+            ++m_uringEnterCount;
+        }
+        if(m_uring->sqPending() || m_uring->sqSpace() < need){
+            return IO_NOT_SUBMITTED;
+        }
+        io_uring_sqe* sqe = m_uring->getSqe();
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)addr;
+        sqe->len = len;
+        sqe->off = off;
+        sqe->rw_flags = op_flags;
+        sqe->user_data = (uint64_t)&req;
+        if(need == 2){
+            /// 链接超时: 超时后内核取消请求, 请求返回 -ECANCELED, 超时事件返回 -ETIME
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000 * 1000;
+            sqe->flags |= IOSQE_IO_LINK;
+            io_uring_sqe* tsqe = m_uring->getSqe();
+            tsqe->opcode = IORING_OP_LINK_TIMEOUT;
+            tsqe->fd = -1;
+            tsqe->addr = (uint64_t)&ts;
+            tsqe->len = 1;
+            tsqe->user_data = (uint64_t)&req | 1;
+        }
+        uint32_t submitted = 0;
+        int rt = 0;
+        while(submitted < need){
+            rt = m_uring->submit();
+            ++m_uringEnterCount;
+            if(rt <= 0){
+                break;
+            }
+            submitted += rt;
+        }
+        /// sqe 指向本栈帧, 内核没接收的必须撤回, 否则下一次 submit 会把它们交给内核
+        m_uring->discard();
+        if(submitted == 0){
+            WYZ_LOG_ERROR(g_logger) << "io_uring submit fd=" << fd << " opcode=" << (int)opcode
+                << " rt=" << rt << " (" << strerror(-rt) << "), fall back to epoll";
+            return IO_NOT_SUBMITTED;
+        }
+        /// 只接收了请求本身时超时被撤回, 请求照常完成, 只是不再有超时
+        req.refs = submitted;
+        req.next = fd_ctx->requests;
+        if(req.next){
+            req.next->prev = &req;
+        }
+        fd_ctx->requests = &req;
+        ++m_pendingEventCount;
+        ++m_waitCount;
+    }
+    Fiber::CallerYieldToHold();
+
+    if(req.result >= 0){
+        return req.result;
+    }
+    /// 恢复时可能已经换了线程
+    if(req.timedout && req.result == -ECANCELED){
+        CurrentErrno() = ETIMEDOUT;
+    }else {
+        CurrentErrno() = -req.result;
+    }
+    return -1;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+void IOManager::reapIOUring(){
+#ifdef WYZ_HAVE_IO_URING
+    static const size_t MAX_CQES = 64;
+    io_uring_cqe cqes[MAX_CQES];
+    std::vector<IORequest*> done;
+    {
+        Mutex::Lock lock(m_uringMutex);
+        while(true){
+            size_t n = m_uring->peek(cqes, MAX_CQES);
+            for(size_t i = 0 ; i < n ; ++i){
+                uint64_t data = cqes[i].user_data;
+                if(!data){
+                    /// ASYNC_CANCEL 自身的完成事件
+                    continue;
+                }
+                IORequest* req = (IORequest*)(data & ~1ull);
+                if(data & 1){
+                    if(cqes[i].res == -ETIME){
+                        req->timedout = true;
+                    }
+                }else {
+                    req->result = cqes[i].res;
+                }
+                if(--req->refs == 0){
+                    done.push_back(req);
+                }
+            }
+            if(n == MAX_CQES){
+                continue;
+            }
+            if(m_uring->cqOverflow()){
+                m_uring->flushOverflow();
+                ++m_uringEnterCount;
+                continue;
+            }
+            break;
+        }
+    }
+    for(auto req : done){
+        FdContext* fd_ctx = req->fd_ctx;
+        Fiber::ptr fiber;
+        Scheduler* scheduler = nullptr;
+        {
+            FdContext::MutexTpye::Lock lock(fd_ctx->mutex);
+            if(req->prev){
+                req->prev->next = req->next;
+            }else {
+                fd_ctx->requests = req->next;
+            }
+            if(req->next){
+                req->next->prev = req->prev;
+            }
+            fiber.swap(req->fiber);
+            scheduler = req->scheduler;
+        }
+        /// 调度之后 req 随协程栈失效, 不能再访问
+        --m_pendingEventCount;
+        scheduler->schedule(fiber);
+    }
+#endif
 }
 
-void IOManager::contextResize(size_t size){
-    m_fdContexts.resize(size);
-    for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if(!m_fdContexts[i]) {
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
+bool IOManager::cancelIORequests(FdContext* fd_ctx, int events){
+#ifdef WYZ_HAVE_IO_URING
+    if(!m_uring || !fd_ctx->requests){
+        return false;
+    }
+    bool cancelled = false;
+    Mutex::Lock lock(m_uringMutex);
+    for(IORequest* req = fd_ctx->requests ; req ; req = req->next){
+        if(!(req->event & events) || req->cancelled){
+            continue;
         }
+        io_uring_sqe* sqe = m_uring->getSqe();
+        if(!sqe){
+            m_uring->submit();
+            ++m_uringEnterCount;
+            sqe = m_uring->getSqe();
+            if(!sqe){
+                break;
+            }
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)req;
+        sqe->user_data = 0;
+        req->cancelled = true;
+        cancelled = true;
+    }
+    if(cancelled){
+        m_uring->submit();
+        ++m_uringEnterCount;
     }
-}  
+    return cancelled;
+#else
+    return false;
+#endif
+}
+
+IOManager::IOStats IOManager::getStats() const{
+    IOStats stats;
+    stats.epoll_ctl = m_epollCtlCount;
+    stats.epoll_wait = m_epollWaitCount;
+    stats.uring_enter = m_uringEnterCount;
+    stats.wakeups = m_wakeupCount;
+    stats.waits = m_waitCount;
+    stats.tickles = m_tickleCount;
+    stats.tickles_coalesced = m_tickleCoalescedCount;
+    stats.tickles_found_work = m_tickleFoundCount;
+    stats.parks = m_parkCount;
+    stats.eventfd_reads = m_eventfdReadCount;
+    stats.io_calls = m_ioCallCount;
+    return stats;
+}
 
 /* 添加事件 */
 int IOManager::addEvent(int fd , EventType event , std::function<void ()> cb){
-    FdContext* fd_ctx = nullptr;
-    RWMutexType::ReadLock rlock(m_mutex);
-    if(m_fdContexts.size() > static_cast<size_t>(fd)){
-        fd_ctx = m_fdContexts[fd];
-        rlock.unlock();
-    }else {
-        rlock.unlock();
-        RWMutexType::WriteLock wlock(m_mutex);
-        contextResize(fd * 1.5 );
-        fd_ctx = m_fdContexts[fd];
+    FdContext* fd_ctx = getFdContext(fd);
+    if(!fd_ctx){
+        return -1;
     }
 
     FdContext::MutexTpye::Lock mlock(fd_ctx->mutex);
@@ -134,6 +444,7 @@ int IOManager::addEvent(int fd , EventType event , std::function<void ()> cb){
     epevent.events = EPOLLET | fd_ctx->events | event;
     epevent.data.ptr = fd_ctx;
     int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    ++m_epollCtlCount;
     if(rt){
         WYZ_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
             << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
@@ -142,6 +453,7 @@ int IOManager::addEvent(int fd , EventType event , std::function<void ()> cb){
             return -1;
     }
     ++m_pendingEventCount;
+    ++m_waitCount;
     /* 总觉得这里有问题 */
     fd_ctx->events = static_cast<EventType>(fd_ctx->events | event) ;
 
@@ -163,13 +475,9 @@ int IOManager::addEvent(int fd , EventType event , std::function<void ()> cb){
 
       
 bool IOManager::delEvent(int fd , EventType event){
-    FdContext* fd_ctx = nullptr;
-    RWMutexType::ReadLock rlock(m_mutex);
-    if(m_fdContexts.size() <= static_cast<size_t>(fd)){
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx){
         return false;
-    }else {
-        fd_ctx = m_fdContexts[fd];
-        rlock.unlock();
     }
 
     FdContext::MutexTpye::Lock mlock(fd_ctx->mutex);
@@ -186,6 +494,7 @@ bool IOManager::delEvent(int fd , EventType event){
     epevent.data.ptr = fd_ctx;
 
     int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    ++m_epollCtlCount;
     if(rt){
         WYZ_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
             << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
@@ -203,19 +512,16 @@ bool IOManager::delEvent(int fd , EventType event){
 
 /* cancel 作用在 epoll关注的事件列表里删除，并触发掉此事件 */ 
 bool IOManager::cancelEvent(int fd , EventType event){
-    FdContext* fd_ctx = nullptr;
-    RWMutexType::ReadLock rlock(m_mutex);
-    if(m_fdContexts.size() <= static_cast<size_t>(fd)){
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx){
         return false;
-    }else {
-        fd_ctx = m_fdContexts[fd];
-        rlock.unlock();
     }
 
     FdContext::MutexTpye::Lock mlock(fd_ctx->mutex);
     // 任务事件池中的类型与 要删除的类型不同 , 则不删除
+    bool cancelled = cancelIORequests(fd_ctx, event);
     if(!(fd_ctx->events & event)){
-        return false;
+        return cancelled;
     }
 
     EventType new_event = static_cast<EventType>(fd_ctx->events & ~event);
@@ -226,6 +532,7 @@ bool IOManager::cancelEvent(int fd , EventType event){
     epevent.data.ptr = fd_ctx;
 
     int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    ++m_epollCtlCount;
     if(rt){
         WYZ_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
             << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
@@ -240,19 +547,16 @@ bool IOManager::cancelEvent(int fd , EventType event){
 }
    
 bool IOManager::cancelAll(int fd){
-    FdContext* fd_ctx = nullptr;
-    RWMutexType::ReadLock rlock(m_mutex);
-    if(m_fdContexts.size() <= static_cast<size_t>(fd)){
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx){
         return false;
-    }else {
-        fd_ctx = m_fdContexts[fd];
-        rlock.unlock();
     }
 
     FdContext::MutexTpye::Lock mlock(fd_ctx->mutex);
+    bool cancelled = cancelIORequests(fd_ctx, IOManager::READ | IOManager::WRITE);
     // 任务事件池中的类型与 要删除的类型不同 , 则不删除
     if(!(fd_ctx->events)){
-        return false;
+        return cancelled;
     }
 
     int op =  EPOLL_CTL_DEL;
@@ -262,6 +566,7 @@ bool IOManager::cancelAll(int fd){
     epevent.data.ptr = fd_ctx;
 
     int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    ++m_epollCtlCount;
     if(rt){
         WYZ_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
             << op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
@@ -288,13 +593,70 @@ IOManager* IOManager::GetThis(){
 }
 
 
-void IOManager::tickle(){
-    if(hasIdelThreads()){
-        int rt = write(m_tickleFds[1] , "T" , 1);
-        WYZ_ASSERT(rt == 1);
+void IOManager::tickle(int thread){
+    if(!hasIdelThreads()){
+        return;
+    }
+    if(thread != -1){
+        const std::vector<int>& ids = getThreadIds();
+        auto it = std::find(ids.begin(), ids.end(), thread);
+        if(it != ids.end()){
+            wakeWorker(it - ids.begin());
+            return;
+        }
+    }
+    /// 优先唤醒阻塞在 eventfd 上的线程, poller 继续轮询 IO
+    if(!wakeParked()){
+        wakePoller();
     }
 }        // 通知调度器有任务来临
 
+bool IOManager::wakeWorker(size_t index){
+    Waker* waker = m_wakers[index];
+    int state = waker->state;
+    if(state == Waker::PARKED){
+        notify(waker->fd, waker->notified);
+        return true;
+    }
+    if(state == Waker::POLLING){
+        return wakePoller();
+    }
+    /// 正在执行任务, 回到调度循环时自己会看到
+    return false;
+}
+
+bool IOManager::wakePoller(){
+    if(m_poller == -1){
+        return false;
+    }
+    notify(m_tickleFd, m_tickleNotified);
+    return true;
+}
+
+bool IOManager::wakeParked(){
+    size_t count = m_wakers.size();
+    size_t start = m_wakeCursor++;
+    for(size_t i = 0; i < count; ++i){
+        Waker* waker = m_wakers[(start + i) % count];
+        if(waker->state == Waker::PARKED && !waker->notified){
+            notify(waker->fd, waker->notified);
+            return true;
+        }
+    }
+    return false;
+}
+
+void IOManager::notify(int fd, std::atomic<bool>& notified){
+    if(notified.exchange(true)){
+        ++m_tickleCoalescedCount;
+        return;
+    }
+    uint64_t one = 1;
+    int rt = write(fd, &one, sizeof(one));
+    WYZ_ASSERT(rt == sizeof(one));
+    ++m_tickleCount;
+}
+
 bool IOManager::stopping(uint64_t& timeout){
     timeout = getNextTimer();
     return timeout == ~0ull        /// 没有定时器
@@ -310,32 +672,90 @@ bool IOManager::stopping(){
 
 void IOManager::idle(){
     const uint64_t MAX_EVENTS = 256;
+    static const int MAX_TIMEOUT = 3000;
     epoll_event* events = new epoll_event[MAX_EVENTS];
     /* 智能指针初始化可以指定删除器 自动调用删除器来释放对象的内存。删除器也可以是一个lambda表达式*/
     std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr){
         delete[] ptr;
     });
+    int index = getWorkerIndex();
+    WYZ_ASSERT(index >= 0 && index < (int)m_wakers.size());
+    Waker* waker = m_wakers[index];
+    /* 出让调度器时不持有自己的引用 */
+    Fiber* self = Fiber::GetThis().get();
+    /// 上次是被 tickle 唤醒的, 以及当时已执行的任务数
+    bool tickled = false;
+    uint64_t task_count = 0;
     while (true) {
+        if(tickled){
+            if(GetTaskCount() != task_count){
+                ++m_tickleFoundCount;
+            }
+            tickled = false;
+        }
         uint64_t timerout = 0;
         if(stopping(timerout)){
             WYZ_LOG_INFO(g_logger) << "name= "  << getName() << " idle exit";
+            /// 唤醒下一个空闲线程, 让它们依次退出
+            tickle();
             break; 
         }
+
+        int expected = -1;
+        bool poller = m_poller.compare_exchange_strong(expected, index);
+        waker->state = poller ? Waker::POLLING : Waker::PARKED;
+        /// 状态发布后复查: 之前的 tickle 看到的是 RUNNING, 不会唤醒本线程
+        if(hasTask()){
+            waker->state = Waker::RUNNING;
+            if(poller){
+                m_poller = -1;
+                /// 交出 poller, 唤醒一个阻塞在 eventfd 上的线程接着轮询 IO
+                wakeParked();
+            }
+            self->swapOut();
+            continue;
+        }
+
+        if(!poller){
+            pollfd pfd;
+            pfd.fd = waker->fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            poll(&pfd, 1, MAX_TIMEOUT);
+            ++m_parkCount;
+            waker->state = Waker::RUNNING;
+            waker->notified = false;
+            uint64_t dummy;
+            ++m_eventfdReadCount;
+            if(read(waker->fd, &dummy, sizeof(dummy)) == sizeof(dummy)){
+                ++m_wakeupCount;
+                tickled = true;
+                task_count = GetTaskCount();
+            }
+            self->swapOut();
+            continue;
+        }
+
+        /// 成为 poller 之后再取一次, onTimerInsertedAtFront 在此之前看不到 poller
+        timerout = getNextTimer();
         int rt = 0;
         do {
-            static const int MAX_TIMEOUT = 3000;
             if(timerout != ~0ull){
-                timerout = std::min(static_cast<int>(timerout),MAX_TIMEOUT);
+                timerout = std::min(timerout, (uint64_t)MAX_TIMEOUT);
             }else{
                 timerout = MAX_TIMEOUT;
             }
             rt = epoll_wait(m_epfd, events, MAX_EVENTS, static_cast<int>(timerout));
+            ++m_epollWaitCount;
             if(rt < 0 && errno == EINTR){
                 continue;
             }else {
                 break;
             }
         }while (true);
+        /// 让出 poller, 下一个空闲的线程接着轮询 IO
+        waker->state = Waker::RUNNING;
+        m_poller = -1;
 
         std::vector<std::function<void ()>> cbs;
         listExpiredCb(cbs);
@@ -347,11 +767,22 @@ void IOManager::idle(){
         }
         for(int i = 0 ; i < rt ; ++i){
             epoll_event& event = events[i];
-            if(event.data.fd == m_tickleFds[0]){
-                uint8_t dummy[256];
-                while (read(m_tickleFds[0] , dummy , sizeof(dummy)) > 0);
+            if(event.data.fd == m_tickleFd){
+                m_tickleNotified = false;
+                uint64_t dummy;
+                ++m_eventfdReadCount;
+                if(read(m_tickleFd , &dummy , sizeof(dummy)) == sizeof(dummy)){
+                    ++m_wakeupCount;
+                    tickled = true;
+                    task_count = GetTaskCount();
+                }
                 continue;
             }  
+            if(m_uring && event.data.fd == m_uringEventFd){
+                /// 边缘触发下每次 eventfd 计数增加都会重新通知, 不需要读出计数
+                reapIOUring();
+                continue;
+            }
             FdContext* fd_ctx = static_cast<FdContext*>(event.data.ptr);
             FdContext::MutexTpye::Lock lock(fd_ctx->mutex);
             if(event.events & (EPOLLERR | EPOLLHUP)){
@@ -374,6 +805,7 @@ void IOManager::idle(){
             event.events = EPOLLET | left_events;
 
             int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
+            ++m_epollCtlCount;
             if(rt2){
                 WYZ_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
                     << op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
@@ -389,18 +821,20 @@ void IOManager::idle(){
                 --m_pendingEventCount;
             }
         }
+        /// 本线程要去执行任务, 没有线程在 epoll_wait 中时 IO 事件要等 parked 线程 MAX_TIMEOUT 超时才能发现
+        if(hasTask()){
+            wakeParked();
+        }
         /* 出让调度器 */
-        Fiber::ptr cur = Fiber::GetThis();
-        auto raw_ptr = cur.get();
-
-        raw_ptr->swapOut();
+        self->swapOut();
 
     }
 
 }        // 协程无任务可调度时执行idle协程陷入epoll_waite 等待
 
 void IOManager::onTimerInsertedAtFront(){
-    tickle();
+    /// 只有 poller 在按定时器超时等待
+    wakePoller();
 }
 
 
@@ -10,10 +10,14 @@
 
 #include "scheduler.h"
 #include "timer.h"
+#include <atomic>
 #include <functional>
+#include <sys/types.h>
 
 namespace wyz {
 
+class IOUring;
+
 class IOManager : public Scheduler , public TimerManager{
 public:
     using ptr = std::shared_ptr<IOManager>;
@@ -25,10 +29,42 @@ public:
         READ  = 0x001,    // 读事件 = EPOOLIN
         WRITE = 0x004,    // 写事件 = EPOOLOUT    
     };
+
+    /// submitIO 没有把请求交给内核, 调用方应改走 epoll 路径
+    static constexpr ssize_t IO_NOT_SUBMITTED = -2;
+
+    /**
+     * @brief IO 相关系统调用的计数
+     * @details 用于对比 epoll 与 io_uring 每个请求的系统调用次数
+     */
+    struct IOStats{
+        uint64_t epoll_ctl = 0;         // epoll_ctl 次数
+        uint64_t epoll_wait = 0;        // epoll_wait 次数
+        uint64_t uring_enter = 0;       // io_uring_enter 次数
+        uint64_t wakeups = 0;           // 因 tickle 从 epoll_wait / eventfd 醒来的次数
+        uint64_t waits = 0;             // 协程挂起等待 IO 的次数
+        uint64_t tickles = 0;           // 写 eventfd 唤醒空闲线程的次数
+        uint64_t tickles_coalesced = 0; // 目标线程已被通知过而省掉的 tickle
+        uint64_t tickles_found_work = 0;// 被唤醒后确实执行了任务的次数
+        uint64_t parks = 0;             // 空闲线程 poll 自己的 eventfd 的次数
+        uint64_t eventfd_reads = 0;     // 读 eventfd 清除通知的次数, 包括 poll 超时后读空的
+        uint64_t io_calls = 0;          // hook 实际发出的 IO 系统调用次数, 包括返回 EAGAIN 的
+
+        /// 以上计数中的系统调用合计: epoll_ctl, epoll_wait, io_uring_enter, poll, eventfd 读写, IO 调用
+        uint64_t syscalls() const {
+            return epoll_ctl + epoll_wait + uring_enter + parks + eventfd_reads + tickles + io_calls;
+        }
+    };
 private:
-    /* 任务事件上下文类*/
-    struct FdContext{
-        using MutexTpye = Mutex;
+    struct IORequest;
+
+    /**
+     * @brief 任务事件上下文类
+     * @details 按缓存行对齐, 相邻 fd 的上下文不会落在同一缓存行上
+     */
+    struct alignas(64) FdContext{
+        /// 临界区只有几次赋值和 epoll_ctl, 用原子锁代替 pthread_mutex
+        using MutexTpye = CASLock;
 
         /*事件上下文类*/
         struct EventContext{
@@ -50,8 +86,10 @@ private:
         int fd = 0;
         /// 当前的事件
         EventType events = NONE;
-        /// 事件的Mutex
-        MutexType mutex;
+        /// 事件的锁
+        MutexTpye mutex;
+        /// 正在 io_uring 中等待完成的请求
+        IORequest* requests = nullptr;
     };
 
 public:
@@ -96,28 +134,126 @@ public:
      */    
     bool cancelAll(int fd);
 
+    /**
+     * @brief 是否启用了 io_uring (配置 iomanager.io_uring 且内核支持)
+     */
+    inline bool hasIOUring() const { return m_uring != nullptr;}
+
+    /**
+     * @brief 通过 io_uring 提交一次 IO, 挂起当前协程直到完成
+     * @param[in] fd 文件句柄
+     * @param[in] event 请求方向, cancelEvent/cancelAll 按方向取消
+     * @param[in] opcode IORING_OP_*
+     * @param[in] addr/len/off/op_flags 对应 sqe 的同名字段 (off 与 addr2 共用)
+     * @param[in] timeout_ms 超时时间(毫秒), ~0ull 表示不超时
+     * @return 与对应的系统调用一致, 失败返回 -1 并设置 errno, 超时为 ETIMEDOUT;
+     *         SQ 没有空位或内核拒绝提交时返回 IO_NOT_SUBMITTED, 请求没有发出, 调用方改走 epoll
+     * @pre hasIOUring() 为 true, 在协程中调用
+     */
+    ssize_t submitIO(int fd, EventType event, uint8_t opcode, void* addr
+                    , uint32_t len, uint64_t off, uint32_t op_flags, uint64_t timeout_ms);
+
+    /**
+     * @brief 获取系统调用计数
+     */
+    IOStats getStats() const;
+
+    /**
+     * @brief hook 每发出一次 IO 系统调用记一次
+     */
+    inline void countIOCall()       {++m_ioCallCount;}
+
     static IOManager* GetThis();
 
 protected:
-    void tickle() override;        // 通知调度器有任务来临
+    void tickle(int thread = -1) override;        // 通知调度器有任务来临
     bool stopping() override;     // 是否可以正常结束
     void idle() override;        // 协程无任务可调度时执行idle协程
     void onTimerInsertedAtFront() override;  // 定时器容器首有元素通知
 
     bool stopping(uint64_t& timeout);
-    void contextResize(size_t size);
+
+private:
+    /**
+     * @brief 获取 fd 对应的上下文
+     * @param[in] auto_create 所在分段不存在时是否分配
+     * @return fd 非法或分段不存在(auto_create=false)时返回 nullptr
+     * @details 不加锁, 分段一经分配就不会移动或释放, 返回的指针在 IOManager 析构前一直有效
+     */
+    FdContext* getFdContext(int fd, bool auto_create = true);
+    /// 初始化 io_uring, 失败时保持 epoll 模式
+    bool initIOUring();
+    /// 收割 io_uring 完成事件, 唤醒对应协程
+    void reapIOUring();
+    /// 取消 fd 上指定方向的 io_uring 请求, 需持有 fd_ctx->mutex
+    bool cancelIORequests(FdContext* fd_ctx, int events);
+
+    /**
+     * @brief 空闲线程的唤醒句柄
+     * @details 同一时刻最多一个空闲线程在 epoll_wait 上轮询(poller), 由共享的 m_tickleFd 唤醒;
+     *          其他空闲线程阻塞在各自的 eventfd 上, 可以被精确唤醒
+     */
+    struct Waker {
+        enum State {
+            RUNNING = 0,    // 在执行任务
+            PARKED,         // 阻塞在自己的 eventfd 上
+            POLLING,        // 阻塞在 epoll_wait 上
+        };
+        int fd = -1;
+        std::atomic<int> state = {RUNNING};
+        /// 已经写过 eventfd 还没被读走, 合并多余的 tickle
+        std::atomic<bool> notified = {false};
+    };
+    /// 唤醒指定序号的空闲线程, 线程没有空闲返回 false
+    bool wakeWorker(size_t index);
+    /// 唤醒 poller, 让它重新计算定时器超时或去执行任务
+    bool wakePoller();
+    /// 唤醒一个阻塞在自己 eventfd 上的线程
+    bool wakeParked();
+    /// 写 eventfd, notified 已置位时合并
+    void notify(int fd, std::atomic<bool>& notified);
     
 private:
     /// epoll 文件句柄
     int m_epfd = 0;
-    /// pipe 文件句柄 [0] -- read [1]-- write
-    int m_tickleFds[2]; 
+    /// poller 的 eventfd, 注册在 epoll 中
+    int m_tickleFd = -1;
+    std::atomic<bool> m_tickleNotified = {false};
+    /// 当前 poller 的线程序号, -1 表示没有
+    std::atomic<int> m_poller = {-1};
+    /// 每个线程的唤醒句柄, 下标为线程序号
+    std::vector<Waker*> m_wakers;
+    /// 轮流选择被唤醒的线程
+    std::atomic<size_t> m_wakeCursor = {0};
     /// 当前等待执行的事件数量
     std::atomic<size_t> m_pendingEventCount = {0};
-    /// IOManager的Mutex
-    RWMutexType m_mutex;
-    /// 任务事件上下文的容器
-    std::vector<FdContext*> m_fdContexts;
+    /**
+     * 任务事件上下文的分段表: 第 i 段有 FD_SEGMENT_BASE << i 个上下文,
+     * 覆盖 fd [FD_SEGMENT_BASE * (2^i - 1), FD_SEGMENT_BASE * (2^(i+1) - 1)),
+     * 26 段即可覆盖所有非负 int
+     */
+    static const size_t FD_SEGMENT_SHIFT = 6;
+    static const size_t FD_SEGMENT_BASE = 1 << FD_SEGMENT_SHIFT;
+    static const size_t FD_SEGMENTS = 26;
+    std::atomic<FdContext*> m_fdSegments[FD_SEGMENTS];
+    /// io_uring, 未启用时为 nullptr
+    IOUring* m_uring = nullptr;
+    /// io_uring 完成通知, 注册在 epoll 中
+    int m_uringEventFd = -1;
+    /// 保护 io_uring 的 SQ/CQ
+    Mutex m_uringMutex;
+
+    std::atomic<uint64_t> m_epollCtlCount = {0};
+    std::atomic<uint64_t> m_epollWaitCount = {0};
+    std::atomic<uint64_t> m_uringEnterCount = {0};
+    std::atomic<uint64_t> m_wakeupCount = {0};
+    std::atomic<uint64_t> m_waitCount = {0};
+    std::atomic<uint64_t> m_tickleCount = {0};
+    std::atomic<uint64_t> m_tickleCoalescedCount = {0};
+    std::atomic<uint64_t> m_tickleFoundCount = {0};
+    std::atomic<uint64_t> m_parkCount = {0};
+    std::atomic<uint64_t> m_eventfdReadCount = {0};
+    std::atomic<uint64_t> m_ioCallCount = {0};
 };
 
     
@@ -5,11 +5,21 @@
  * @Date: 2021-10-01 11:31:25
  */
 
+#include <algorithm>
 #include <cctype>
 #include <cstddef>
+#include <cstring>
+#include <fcntl.h>
 #include <functional>
+#include <limits.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <time.h>
+#include <unistd.h>
 #include <sstream>
 #include <string>
 #include <tuple>
@@ -21,10 +31,26 @@
 #include "log.h"
 #include "util.h"
 #include "config.h"
+#include "macro.h"
 
 
 namespace wyz {
 
+/// 重新打开日志文件的请求代数, 信号处理函数中只做一次原子加
+static std::atomic<uint64_t> s_reopen_generation = {0};
+
+/**
+ * @brief 文件是否被轮转
+ * @return 路径不存在或已经指向另一个文件
+ */
+static bool FileRotated(const std::string& path, uint64_t dev, uint64_t ino){
+    struct stat st;
+    if(stat(path.c_str(), &st)){
+        return true;
+    }
+    return (uint64_t)st.st_dev != dev || (uint64_t)st.st_ino != ino;
+}
+
 /* 将日志级别 enum 转换为字符串 string*/
 const std::string LogLevel::toString(const LogLevel::Level level){
     switch (level) {
@@ -60,15 +86,168 @@ const LogLevel::Level LogLevel::formString(const std::string& str){
         return LogLevel::UNKNOW;
 }
 
-LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level ,const std::string& file , uint32_t line,uint32_t thread_id ,uint32_t fiber_id,uint32_t time , const std::string& thread_name )
-    : m_logger(logger)
+LogStream::Buffer::Buffer()
+    : m_data(256){
+    reset();
+}
+
+void LogStream::Buffer::reset(){
+    setp(&m_data[0], &m_data[0] + m_data.size());
+}
+
+void LogStream::Buffer::grow(size_t n){
+    size_t used = size();
+    size_t cap = std::max(m_data.size() * 2, used + n);
+    m_data.resize(cap);
+    setp(&m_data[0], &m_data[0] + cap);
+    pbump(used);
+}
+
+LogStream::Buffer::int_type LogStream::Buffer::overflow(int_type c){
+    if(traits_type::eq_int_type(c, traits_type::eof())){
+        return traits_type::not_eof(c);
+    }
+    grow(1);
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+}
+
+std::streamsize LogStream::Buffer::xsputn(const char* s, std::streamsize n){
+    if(epptr() - pptr() < n){
+        grow(n);
+    }
+    memcpy(pptr(), s, n);
+    pbump(n);
+    return n;
+}
+
+LogStream::LogStream()
+    : std::ostream(nullptr){
+    rdbuf(&m_buf);
+}
+
+void LogStream::reset(){
+    m_buf.reset();
+    clear();
+    flags(DEFAULT_FLAGS);
+    precision(6);
+    width(0);
+    fill(' ');
+}
+
+void LogStream::appendUnsigned(unsigned long long v){
+    char tmp[24];
+    char* p = tmp + sizeof(tmp);
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while(v);
+    m_buf.append(p, tmp + sizeof(tmp) - p);
+}
+
+void LogStream::appendSigned(long long v){
+    if(v < 0){
+        m_buf.append("-", 1);
+        appendUnsigned(0ull - (unsigned long long)v);
+    }else {
+        appendUnsigned(v);
+    }
+}
+
+LogStream& LogStream::operator<<(const char* v){
+    if(LIKELY(v && width() == 0)){
+        m_buf.append(v, strlen(v));
+    }else {
+        static_cast<std::ostream&>(*this) << v;
+    }
+    return *this;
+}
+
+LogStream& LogStream::operator<<(const std::string& v){
+    if(LIKELY(width() == 0)){
+        m_buf.append(v.data(), v.size());
+    }else {
+        static_cast<std::ostream&>(*this) << v;
+    }
+    return *this;
+}
+
+LogStream& LogStream::operator<<(char v){
+    if(LIKELY(width() == 0)){
+        m_buf.append(&v, 1);
+    }else {
+        static_cast<std::ostream&>(*this) << v;
+    }
+    return *this;
+}
+
+#define XX(type, append) \
+    LogStream& LogStream::operator<<(type v){ \
+        if(LIKELY(plain())){ \
+            append(v); \
+        }else { \
+            std::ostream::operator<<(v); \
+        } \
+        return *this; \
+    }
+
+XX(int, appendSigned)
+XX(long, appendSigned)
+XX(long long, appendSigned)
+XX(unsigned int, appendUnsigned)
+XX(unsigned long, appendUnsigned)
+XX(unsigned long long, appendUnsigned)
+#undef XX
+
+/**
+ * @brief 线程复用的日志内容流, 正在使用时 busy 为 true
+ * @details 线程退出时不释放, 避免其它线程局部变量析构时写日志访问到已释放的流;
+ *          事件随协程换到别的线程析构时, 也要归还给构造它的线程
+ */
+struct ThreadLogStream{
+    LogStream stream;
+    std::atomic<bool> busy = {false};
+};
+
+static thread_local ThreadLogStream* t_stream = nullptr;
+
+LogEvent::LogEvent(const std::shared_ptr<Logger>& logger, LogLevel::Level level ,const char* file , uint32_t line,uint32_t thread_id ,uint32_t fiber_id,uint64_t time , const std::string& thread_name )
+    : m_logger(logger.get())
     , m_level(level)
     , m_file(file)
     , m_line(line)
     , m_threadId(thread_id)
     , m_fiberId(fiber_id)
     , m_time(time)
+    , m_ss(nullptr)
+    , m_threadStream(nullptr)
     , m_thread_name(thread_name){
+    ThreadLogStream* ts = t_stream;
+    if(UNLIKELY(!ts)){
+        ts = t_stream = new ThreadLogStream;
+    }
+    /// 只有本线程置 busy, 别的线程可能清除它, acquire 之后才能复用流
+    if(LIKELY(!ts->busy.load(std::memory_order_acquire))){
+        ts->busy.store(true, std::memory_order_relaxed);
+        m_threadStream = ts;
+        m_ss = &ts->stream;
+        m_ss->reset();
+    }else {
+        m_ss = new LogStream;
+    }
+}
+
+LogEvent::~LogEvent(){
+    if(m_threadStream){
+        m_threadStream->busy.store(false, std::memory_order_release);
+    }else {
+        delete m_ss;
+    }
+}
+
+std::shared_ptr<Logger> LogEvent::getLogger() const{
+    return m_logger->shared_from_this();
 }
 
 /**
@@ -85,31 +264,40 @@ void LogEvent::format(const char* fmt, ...){
 * @brief 格式化写入日志内容
 */
 void LogEvent::format(const char* fmt, va_list al) {
-    char* buf = nullptr;
-    int len = vasprintf(&buf, fmt, al);
+    char buf[512];
+    va_list copy;
+    va_copy(copy, al);
+    int len = vsnprintf(buf, sizeof(buf), fmt, copy);
+    va_end(copy);
+    if(len < 0){
+        return;
+    }
+    if((size_t)len < sizeof(buf)){
+        m_ss->write(buf, len);
+        return;
+    }
+    char* big = nullptr;
+    len = vasprintf(&big, fmt, al);
     if(len != -1) {
-        m_ss << std::string(buf, len);
-        free(buf);
+        m_ss->write(big, len);
+        free(big);
     }
 }
 
-LogEventWrap::LogEventWrap(LogEvent::ptr e)
-    : m_event(e){
+LogEventWrap::LogEventWrap(const std::shared_ptr<Logger>& logger, LogLevel::Level level ,const char* file , uint32_t line,uint32_t thread_id ,uint32_t fiber_id,uint64_t time , const std::string& thread_name)
+    : m_event(logger, level, file, line, thread_id, fiber_id, time, thread_name){
 }
 // 在析构函数调用打印函数
 LogEventWrap::~LogEventWrap(){
-    m_event->getLogger()->log(m_event->getLevel(), m_event);
-}
-/**
-* @brief 获取日志内容流
-*/
-std::stringstream& LogEventWrap::getSS() {
-    return m_event->getSstream();
+    m_event.getRawLogger()->log(m_event.getLevel(), getEvent());
 }
 
 
+static std::atomic<uint64_t> s_formatter_id = {0};
+
 LogFormatter::LogFormatter(const std::string& pattern)
-    : m_pattern(pattern){
+    : m_pattern(pattern)
+    , m_id(++s_formatter_id){
     init();
 }
     /**
@@ -119,11 +307,14 @@ LogFormatter::LogFormatter(const std::string& pattern)
      * @param[in] event 日志事件
      */
 std::string LogFormatter::format( std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event){
-    std::stringstream ss;
-    for(auto it : m_items){
-        it->format(ss, logger, level, event);
+    char buf[512];
+    size_t len = format(buf, sizeof(buf), level, *event);
+    if(len <= sizeof(buf)){
+        return std::string(buf, len);
     }
-    return ss.str();
+    std::string str(len, '\0');
+    format(&str[0], len, level, *event);
+    return str;
 }
 
 std::ostream& LogFormatter::format(std::ostream& ofs, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event){
@@ -133,11 +324,156 @@ std::ostream& LogFormatter::format(std::ostream& ofs, std::shared_ptr<Logger> lo
     return ofs;
 }
 
+/**
+ * @brief 写入定长缓冲区, 空间不足时只统计长度
+ */
+class LineWriter{
+public:
+    LineWriter(char* buf, size_t size)
+        : m_buf(buf)
+        , m_size(size){
+    }
+
+    inline void append(const char* s, size_t n){
+        if(LIKELY(m_len + n <= m_size)){
+            /// 格式项大多只有几个字节, 直接复制比调用 memcpy 快
+            char* d = m_buf + m_len;
+            if(n <= 16){
+                for(size_t i = 0 ; i < n ; ++i){
+                    d[i] = s[i];
+                }
+            }else {
+                memcpy(d, s, n);
+            }
+        }else if(m_len < m_size){
+            memcpy(m_buf + m_len, s, m_size - m_len);
+        }
+        m_len += n;
+    }
+
+    inline void append(const std::string& s){
+        append(s.data(), s.size());
+    }
+
+    /// 无符号整数转十进制
+    void appendUInt(uint64_t v){
+        char tmp[24];
+        char* p = tmp + sizeof(tmp);
+        do {
+            *--p = '0' + v % 10;
+            v /= 10;
+        } while(v);
+        append(p, tmp + sizeof(tmp) - p);
+    }
+
+    /**
+     * @brief 追加格式化后的时间, 同一秒内相同的格式项只调用一次 localtime_r/strftime
+     * @param[in] key 格式项的键
+     */
+    void appendTime(uint64_t key, const std::string& fmt, uint64_t sec);
+
+    inline size_t length() const { return m_len;}
+private:
+    char* m_buf;
+    size_t m_size;
+    size_t m_len = 0;
+};
+
+/// 线程的时间缓存槽位, 只有平凡成员, 访问时不需要检查初始化
+struct TimeSlot{
+    uint64_t key;
+    uint64_t sec;
+    size_t len;
+    char buf[64];
+};
+static const size_t TIME_SLOTS = 4;
+static thread_local TimeSlot t_time_slots[TIME_SLOTS];
+static thread_local size_t t_time_next = 0;
+
+void LineWriter::appendTime(uint64_t key, const std::string& fmt, uint64_t sec){
+    TimeSlot* slot = nullptr;
+    for(size_t i = 0 ; i < TIME_SLOTS ; ++i){
+        if(t_time_slots[i].key == key){
+            slot = &t_time_slots[i];
+            break;
+        }
+    }
+    if(UNLIKELY(!slot)){
+        slot = &t_time_slots[t_time_next++ % TIME_SLOTS];
+        slot->key = key;
+        slot->sec = ~0ull;
+    }
+    if(UNLIKELY(slot->sec != sec)){
+        time_t t = sec;
+        struct tm tm;
+        localtime_r(&t, &tm);
+        slot->len = strftime(slot->buf, sizeof(slot->buf), fmt.c_str(), &tm);
+        slot->sec = sec;
+    }
+    append(slot->buf, slot->len);
+}
+
+/// 日志级别名称与长度
+static const std::pair<const char*, size_t> s_level_names[] = {
+    {"UNKNOW", 6},
+    {"DEBUG", 5},
+    {"INFO", 4},
+    {"WARN", 4},
+    {"ERROR", 5},
+    {"FATAL", 5},
+};
+
+size_t LogFormatter::format(char* buf, size_t size, LogLevel::Level level, const LogEvent& event) const{
+    LineWriter w(buf, size);
+    for(auto& op : m_ops){
+        switch(op.type){
+            case 0:
+                w.append(op.text);
+                break;
+            case 'm':
+                w.append(event.getContentData(), event.getContentSize());
+                break;
+            case 'p':
+                if(LIKELY(level >= LogLevel::UNKNOW && level <= LogLevel::FATAL)){
+                    w.append(s_level_names[level].first, s_level_names[level].second);
+                }else {
+                    w.append(s_level_names[0].first, s_level_names[0].second);
+                }
+                break;
+            case 'c':
+                w.append(event.getRawLogger()->getName());
+                break;
+            case 't':
+                w.appendUInt(event.getThreadId());
+                break;
+            case 'd':
+                w.appendTime(op.key, op.text, event.getTime());
+                break;
+            case 'f':
+                {
+                    const char* file = event.getFileName();
+                    w.append(file, strlen(file));
+                }
+                break;
+            case 'l':
+                w.appendUInt(event.getLine());
+                break;
+            case 'F':
+                w.appendUInt(event.getFribeId());
+                break;
+            case 'N':
+                w.append(event.getThread_name());
+                break;
+        }
+    }
+    return w.length();
+}
+
 class MessageFormatItem : public LogFormatter::FormatItem{
 public:
     MessageFormatItem(const std::string& str = ""){}
     void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event)override{
-        os << event->getContent();
+        os.write(event->getContentData(), event->getContentSize());
     }
 };  // 消息格式对应的类     %m
 
@@ -346,13 +682,16 @@ void LogFormatter::init(){
     for(auto i : vec) {
         if(std::get<2>(i) == 0) {
             m_items.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
+            addOp(0, std::get<0>(i));
         } else {
             auto it = s_format_items.find(std::get<0>(i));
             if(it == s_format_items.end()) {
                 m_items.push_back(FormatItem::ptr(new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
+                addOp(0, "<<error_format %" + std::get<0>(i) + ">>");
                 m_error = true;
             } else {
                 m_items.push_back(it->second(std::get<1>(i)));
+                addOp(std::get<0>(i)[0], std::get<1>(i));
             }
         }
 
@@ -361,6 +700,27 @@ void LogFormatter::init(){
     // std::cout << m_items.size() << std::endl;
 }       // 解析pattern 各个格式
 
+void LogFormatter::addOp(char type, const std::string& text){
+    Op op{type, text, 0};
+    if(type == 'T') {
+        op.type = 0;
+        op.text = "\t";
+    } else if(type == 'n') {
+        op.type = 0;
+        op.text = "\n";
+    } else if(type == 'd') {
+        if(op.text.empty()) {
+            op.text = "%Y-%m-%d %H:%M:%S";
+        }
+        op.key = (m_id << 16) | m_ops.size();
+    }
+    if(op.type == 0 && !m_ops.empty() && m_ops.back().type == 0) {
+        m_ops.back().text += op.text;
+        return;
+    }
+    m_ops.push_back(op);
+}
+
 const LogFormatter::ptr LogAppender::getFormatter(){
     MutexType::Lock lock(m_mutex);
     return m_formatter;
@@ -377,10 +737,29 @@ void LogAppender::setFormatter(LogFormatter::ptr format){
 }
 
 
+/**
+ * @brief 把日志格式化到线程复用的缓冲区
+ * @param[out] len 日志长度
+ * @return 日志内容, 同一线程下次调用前有效
+ */
+static const char* FormatLine(const LogFormatter& formatter, LogLevel::Level level
+                            , const LogEvent& event, size_t& len){
+    static thread_local std::vector<char> t_line(1024);
+    len = formatter.format(&t_line[0], t_line.size(), level, event);
+    if(UNLIKELY(len > t_line.size())){
+        t_line.resize(len);
+        formatter.format(&t_line[0], len, level, event);
+    }
+    return &t_line[0];
+}
+
 void StdoutLogAppender::log(std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event){
     if(level >= m_level){
+        size_t len = 0;
         MutexType::Lock lock(m_mutex);             // 构造互斥量对象   
-        m_formatter->format(std::cout, logger,level,event);
+        const char* line = FormatLine(*m_formatter, level, *event, len);
+        std::cout.write(line, len);
+        std::cout.flush();
     }
 }
 
@@ -407,19 +786,34 @@ FileLogAppender::FileLogAppender(const std::string& filename)
 void FileLogAppender::log(std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event){
     if(level >= m_level){
         MutexType::Lock lock(m_mutex);
-        reopen();
-        m_formatter->format(m_filestream , logger,level,event);
+        /// 只在收到重新打开请求, 或者(每秒检查一次)文件被轮转时重新打开
+        uint64_t now = time(0);
+        if(m_reopenGen != s_reopen_generation
+                || (now != m_lastCheck && FileRotated(m_filename, m_dev, m_ino))){
+            reopen();
+        }
+        m_lastCheck = now;
+        size_t len = 0;
+        const char* line = FormatLine(*m_formatter, level, *event, len);
+        m_filestream.write(line, len);
+        m_filestream.flush();
     }
 }
 /**
 * @brief 重新打开日志文件
 */
 void FileLogAppender::reopen(){
+    m_reopenGen = s_reopen_generation;
     if(m_filestream.is_open()) {
         m_filestream.close();
     }
     //以追加方式
     m_filestream.open(m_filename,std::ios_base::app); 
+    struct stat st;
+    if(!stat(m_filename.c_str(), &st)){
+        m_dev = st.st_dev;
+        m_ino = st.st_ino;
+    }
 }
 
 std::string FileLogAppender::toYamlString(){
@@ -438,6 +832,460 @@ std::string FileLogAppender::toYamlString(){
 }
 
 
+/**
+ * @brief 单生产者单消费者的字节环形缓冲区
+ * @details 生产者只写 head, 消费者只写 tail, 一行日志完整写入后才发布 head
+ */
+class AsyncLogAppender::Ring{
+public:
+    Ring(size_t size)
+        : m_buf(new char[size])
+        , m_size(size){
+    }
+
+    ~Ring(){
+        delete[] m_buf;
+    }
+
+    /// 生产者: 写入一行, 空间不足返回 false
+    bool push(const char* data, size_t len){
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        uint64_t tail = m_tail.load(std::memory_order_acquire);
+        if(m_size - (head - tail) < len){
+            return false;
+        }
+        size_t pos = head & (m_size - 1);
+        size_t first = std::min(len, m_size - pos);
+        memcpy(m_buf + pos, data, first);
+        memcpy(m_buf, data + first, len - first);
+        m_head.store(head + len, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief 消费者: 取出可读的数据, 回绕时分成两段
+     * @param[out] iov 至少两个元素
+     * @param[out] len 可读的字节数
+     * @return iov 的段数
+     */
+    int peek(iovec* iov, size_t& len){
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        len = m_head.load(std::memory_order_acquire) - tail;
+        if(!len){
+            return 0;
+        }
+        size_t pos = tail & (m_size - 1);
+        size_t first = std::min(len, m_size - pos);
+        iov[0].iov_base = m_buf + pos;
+        iov[0].iov_len = first;
+        if(first == len){
+            return 1;
+        }
+        iov[1].iov_base = m_buf;
+        iov[1].iov_len = len - first;
+        return 2;
+    }
+
+    /// 消费者: 释放已经写出的数据
+    void consume(size_t len){
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+    }
+
+    uint64_t head() const { return m_head.load(std::memory_order_acquire);}
+    uint64_t tail() const { return m_tail.load(std::memory_order_acquire);}
+    bool empty() const { return head() == tail();}
+
+    /// 所属线程已经退出, 写空后由后台线程移除
+    std::atomic<bool> closed = {false};
+    /// 所属 appender 已经析构, 线程缓存中可以清理
+    std::atomic<bool> detached = {false};
+private:
+    /// head/tail 分别由不同线程写, 隔开避免伪共享
+    char m_pad0[64];
+    std::atomic<uint64_t> m_head = {0};
+    char m_pad1[64];
+    std::atomic<uint64_t> m_tail = {0};
+    char m_pad2[64];
+    char* m_buf;
+    size_t m_size;
+};
+
+/// 线程的缓冲区缓存, 线程退出时通知后台线程回收
+struct AsyncLogAppender::RingCache{
+    std::vector<std::pair<uint64_t, std::shared_ptr<Ring> > > rings;
+
+    ~RingCache(){
+        for(auto& i : rings){
+            i.second->closed = true;
+        }
+    }
+};
+
+static std::atomic<uint64_t> s_async_appender_id = {0};
+
+AsyncLogAppender::AsyncLogAppender(const std::string& filename, size_t buffer_size
+                                , OverflowPolicy policy)
+    : m_filename(filename)
+    , m_bufferSize(4096)
+    , m_policy(policy)
+    , m_id(++s_async_appender_id){
+    while(m_bufferSize < buffer_size){
+        m_bufferSize <<= 1;
+    }
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    reopen();
+    m_thread.reset(new Thread(std::bind(&AsyncLogAppender::run, this), "log_async"));
+}
+
+AsyncLogAppender::~AsyncLogAppender(){
+    m_stopping = true;
+    uint64_t one = 1;
+    if(::write(m_wakeFd, &one, sizeof(one)) < 0){
+    }
+    m_thread->join();
+    Mutex::Lock lock(m_ringMutex);
+    for(auto& i : m_rings){
+        i->detached = true;
+    }
+    if(m_fd >= 0){
+        ::close(m_fd);
+    }
+    ::close(m_wakeFd);
+}
+
+AsyncLogAppender::OverflowPolicy AsyncLogAppender::PolicyFromString(const std::string& str){
+    if(str == "drop" || str == "DROP"){
+        return DROP;
+    }
+    if(str == "count" || str == "COUNT"){
+        return COUNT;
+    }
+    return BLOCK;
+}
+
+const char* AsyncLogAppender::ToString(OverflowPolicy policy){
+    switch(policy){
+        case DROP:
+            return "drop";
+        case COUNT:
+            return "count";
+        default:
+            return "block";
+    }
+}
+
+AsyncLogAppender::Ring* AsyncLogAppender::getRing(){
+    static thread_local RingCache t_cache;
+    for(auto& i : t_cache.rings){
+        if(i.first == m_id){
+            return i.second.get();
+        }
+    }
+    /// 清理已经析构的 appender 留下的缓冲区
+    auto it = std::remove_if(t_cache.rings.begin(), t_cache.rings.end()
+            , [](const std::pair<uint64_t, std::shared_ptr<Ring> >& i){
+        return i.second->detached.load();
+    });
+    t_cache.rings.erase(it, t_cache.rings.end());
+
+    std::shared_ptr<Ring> ring(new Ring(m_bufferSize));
+    {
+        Mutex::Lock lock(m_ringMutex);
+        m_rings.push_back(ring);
+        ++m_ringVersion;
+    }
+    t_cache.rings.emplace_back(m_id, ring);
+    return ring.get();
+}
+
+void AsyncLogAppender::log(std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event){
+    if(level < m_level){
+        return;
+    }
+    LogFormatter::ptr formatter;
+    {
+        MutexType::Lock lock(m_mutex);
+        formatter = m_formatter;
+    }
+    size_t len = 0;
+    const char* line = FormatLine(*formatter, level, *event, len);
+    if(len > m_bufferSize / 2){
+        /// 长日志放不进缓冲区, 直接写入
+        writeDirect(line, len);
+    }else {
+        Ring* ring = getRing();
+        if(!ring->push(line, len)){
+            if(m_policy == BLOCK){
+                ++m_blocked;
+                do {
+                    wakeup();
+                    sched_yield();
+                } while(!ring->push(line, len));
+            }else {
+                ++m_dropped;
+                if(m_policy == COUNT){
+                    ++m_unreported;
+                }
+                return;
+            }
+        }
+        ++m_lines;
+        wakeup();
+    }
+    if(level >= LogLevel::FATAL){
+        flush();
+    }
+}
+
+void AsyncLogAppender::wakeup(bool force){
+    /// 与后台线程的 m_sleeping = true; 复查缓冲区 配对, 不会丢失唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(force || (m_sleeping.load(std::memory_order_relaxed) && m_sleeping.exchange(false))){
+        uint64_t one = 1;
+        if(::write(m_wakeFd, &one, sizeof(one)) < 0){
+        }
+    }
+}
+
+void AsyncLogAppender::writeDirect(const char* data, size_t len){
+    Mutex::Lock lock(m_fdMutex);
+    while(len > 0){
+        ssize_t rt = ::write(m_fd, data, len);
+        if(rt < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            ++m_dropped;
+            return;
+        }
+        data += rt;
+        len -= rt;
+        m_bytes += rt;
+    }
+    ++m_lines;
+}
+
+bool AsyncLogAppender::flush(uint64_t timeout_ms){
+    std::vector<std::pair<std::shared_ptr<Ring>, uint64_t> > targets;
+    {
+        Mutex::Lock lock(m_ringMutex);
+        for(auto& i : m_rings){
+            targets.emplace_back(i, i->head());
+        }
+    }
+    uint64_t deadline = GetCurrentMS() + timeout_ms;
+    while(true){
+        bool done = true;
+        for(auto& i : targets){
+            if(i.first->tail() < i.second){
+                done = false;
+                break;
+            }
+        }
+        if(done){
+            return true;
+        }
+        if(GetCurrentMS() >= deadline){
+            return false;
+        }
+        wakeup(true);
+        sched_yield();
+    }
+}
+
+bool AsyncLogAppender::needReopen(){
+    if(m_reopenGen != s_reopen_generation){
+        return true;
+    }
+    uint64_t now = time(0);
+    if(now == m_lastCheck){
+        return false;
+    }
+    m_lastCheck = now;
+    return FileRotated(m_filename, m_dev, m_ino);
+}
+
+bool AsyncLogAppender::reopen(){
+    m_reopenGen = s_reopen_generation;
+    m_lastCheck = time(0);
+    int fd = ::open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0){
+        std::cerr << "AsyncLogAppender open " << m_filename << " errno=" << errno
+                  << " " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st;
+    if(!fstat(fd, &st)){
+        m_dev = st.st_dev;
+        m_ino = st.st_ino;
+    }
+    Mutex::Lock lock(m_fdMutex);
+    if(m_fd >= 0){
+        ::close(m_fd);
+        ++m_reopens;
+    }
+    m_fd = fd;
+    return true;
+}
+
+void AsyncLogAppender::run(){
+    while(true){
+        if(needReopen()){
+            reopen();
+        }
+        if(drain()){
+            continue;
+        }
+        if(m_stopping){
+            /// 停止前写出所有线程的缓冲区
+            if(!drain()){
+                break;
+            }
+            continue;
+        }
+        m_sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool pending = m_unreported > 0;
+        for(auto& i : m_drainRings){
+            if(!i->empty()){
+                pending = true;
+                break;
+            }
+        }
+        /// 新线程的缓冲区不在快照里, 版本变化时也要再 drain 一次
+        if(pending || m_drainVersion != m_ringVersion){
+            m_sleeping = false;
+            continue;
+        }
+        pollfd pfd;
+        pfd.fd = m_wakeFd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        /// 至少每秒醒来一次检查文件轮转
+        poll(&pfd, 1, 1000);
+        m_sleeping = false;
+        uint64_t dummy;
+        if(::read(m_wakeFd, &dummy, sizeof(dummy)) < 0){
+        }
+    }
+}
+
+size_t AsyncLogAppender::drain(){
+    if(m_drainVersion != m_ringVersion){
+        Mutex::Lock lock(m_ringMutex);
+        /// 移除已经退出且写空的线程缓冲区
+        auto it = std::remove_if(m_rings.begin(), m_rings.end(), [](const std::shared_ptr<Ring>& r){
+            return r->closed && r->empty();
+        });
+        m_rings.erase(it, m_rings.end());
+        m_drainRings = m_rings;
+        m_drainVersion = m_ringVersion;
+    }
+
+    static const size_t MAX_IOV = IOV_MAX;
+    iovec iov[MAX_IOV];
+    std::vector<size_t> lens(m_drainRings.size(), 0);
+    size_t n = 0;
+    size_t total = 0;
+    bool has_closed = false;
+    for(size_t i = 0 ; i < m_drainRings.size() && n + 2 < MAX_IOV ; ++i){
+        n += m_drainRings[i]->peek(iov + n, lens[i]);
+        total += lens[i];
+        has_closed = has_closed || m_drainRings[i]->closed;
+    }
+    char report[128];
+    uint64_t dropped = m_unreported.exchange(0);
+    if(dropped){
+        time_t now = time(0);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        size_t len = strftime(report, sizeof(report), "%Y-%m-%d %H:%M:%S", &tm);
+        len += snprintf(report + len, sizeof(report) - len, "\t[AsyncLogAppender] dropped %lu lines\n"
+                        , (unsigned long)dropped);
+        iov[n].iov_base = report;
+        iov[n].iov_len = len;
+        ++n;
+        total += len;
+    }
+    if(!n){
+        if(has_closed){
+            ++m_ringVersion;
+        }
+        return 0;
+    }
+
+    {
+        Mutex::Lock lock(m_fdMutex);
+        iovec* cur = iov;
+        size_t left = total;
+        while(left > 0){
+            ssize_t rt = writev(m_fd, cur, n - (cur - iov));
+            if(rt < 0){
+                if(errno == EINTR){
+                    continue;
+                }
+                /// 写失败(磁盘满/文件打不开)时丢弃这一批, 避免阻塞生产者
+                std::cerr << "AsyncLogAppender writev " << m_filename << " errno=" << errno
+                          << " " << strerror(errno) << std::endl;
+                break;
+            }
+            ++m_writevs;
+            m_bytes += rt;
+            left -= rt;
+            /// 部分写入时跳过已写出的 iov
+            size_t done = rt;
+            while(done > 0){
+                if(done >= cur->iov_len){
+                    done -= cur->iov_len;
+                    ++cur;
+                }else {
+                    cur->iov_base = (char*)cur->iov_base + done;
+                    cur->iov_len -= done;
+                    done = 0;
+                }
+            }
+        }
+    }
+    for(size_t i = 0 ; i < m_drainRings.size() ; ++i){
+        if(lens[i]){
+            m_drainRings[i]->consume(lens[i]);
+        }
+    }
+    if(has_closed){
+        ++m_ringVersion;
+    }
+    return total;
+}
+
+AsyncLogAppender::Stats AsyncLogAppender::getStats() const{
+    Stats stats;
+    stats.lines = m_lines;
+    stats.bytes = m_bytes;
+    stats.writevs = m_writevs;
+    stats.dropped = m_dropped;
+    stats.blocked = m_blocked;
+    stats.reopens = m_reopens;
+    return stats;
+}
+
+std::string AsyncLogAppender::toYamlString(){
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "AsyncFileLogAppender";
+    node["file"] = m_filename;
+    node["overflow"] = ToString(m_policy);
+    node["buffer_size"] = m_bufferSize;
+    if(m_level != LogLevel::UNKNOW)
+        node["level"] = LogLevel::toString(m_level);
+    if(m_hasFormatter && m_formatter){
+        node["formatter"] = m_formatter->getPattern();
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+
 Logger::Logger(const std::string& name) 
     : m_name(name)
     , m_level(LogLevel::DEBUG){
@@ -452,7 +1300,7 @@ void Logger::log(LogLevel::Level level, LogEvent::ptr event){
     if(level >= m_level){
         auto self = shared_from_this();
         if(!m_appenders.empty()){
-            for(auto i : m_appenders){
+            for(auto& i : m_appenders){
                 i->log(self, level, event);
             }
         }else {
@@ -590,15 +1438,21 @@ Logger::ptr LoggerManager::getLogger(const std::string& name){
 
 /* 对应的是 log.yaml 文件中的appenders 下的数据 */
 struct LogAppenderDefine{
-    int type = 0; // 1 -- file  2 -- stdout
+    int type = 0; // 1 -- file  2 -- stdout  3 -- async file
     LogLevel::Level level = LogLevel::UNKNOW;
     std::string file;
     std::string formatter;
+    /// 异步输出的缓冲区满时的处理 block/drop/count
+    std::string overflow;
+    /// 异步输出每个线程的缓冲区大小
+    size_t buffer_size = 0;
     bool operator== (const LogAppenderDefine& oth) const{
         return type == oth.type
             && level == oth.level
             && file == oth.file
-            && formatter == oth.formatter;
+            && formatter == oth.formatter
+            && overflow == oth.overflow
+            && buffer_size == oth.buffer_size;
     }
 };
 
@@ -664,6 +1518,23 @@ public:
                         lad.formatter = a["formatter"].as<std::string>();
                     }
                     
+                }else if(type == "AsyncFileLogAppender"){
+                    lad.type = 3;
+                    if(!a["file"].IsDefined()){
+                        std::cout << "log config error: async fileappender file is null, " << a
+                              << std::endl;
+                        continue;
+                    }
+                    lad.file = a["file"].as<std::string>();
+                    if(a["formatter"].IsDefined()){
+                        lad.formatter = a["formatter"].as<std::string>();
+                    }
+                    if(a["overflow"].IsDefined()){
+                        lad.overflow = a["overflow"].as<std::string>();
+                    }
+                    if(a["buffer_size"].IsDefined()){
+                        lad.buffer_size = a["buffer_size"].as<size_t>();
+                    }
                 }else if(type == "StdoutLogAppender"){
                     lad.type = 2;
                     if(a["formatter"].IsDefined()) {
@@ -701,6 +1572,15 @@ public:
                 na["file"] = a.file;
             }else if (a.type == 2) {
                 na["type"] = "StdoutLogAppender";
+            }else if (a.type == 3) {
+                na["type"] = "AsyncFileLogAppender";
+                na["file"] = a.file;
+                if(!a.overflow.empty()){
+                    na["overflow"] = a.overflow;
+                }
+                if(a.buffer_size){
+                    na["buffer_size"] = a.buffer_size;
+                }
             }
             if(a.level != LogLevel::UNKNOW)
                 na["level"] = LogLevel::toString(a.level);
@@ -752,6 +1632,10 @@ struct LogIniter {
                         ap.reset(new FileLogAppender(a.file));
                     } else if(a.type == 2) {
                         ap.reset(new StdoutLogAppender);
+                    } else if(a.type == 3) {
+                        ap.reset(new AsyncLogAppender(a.file
+                                , a.buffer_size ? a.buffer_size : 64 * 1024
+                                , AsyncLogAppender::PolicyFromString(a.overflow)));
                     }
                     if(a.level != LogLevel::UNKNOW)
                         ap->setLevel(a.level);
@@ -784,6 +1668,27 @@ struct LogIniter {
 static LogIniter __log_init;
 
 
+void LoggerManager::RequestReopen(){
+    ++s_reopen_generation;
+}
+
+uint64_t LoggerManager::GetReopenGeneration(){
+    return s_reopen_generation;
+}
+
+static void OnReopenSignal(int signo){
+    LoggerManager::RequestReopen();
+}
+
+bool LoggerManager::InstallReopenSignal(int signo){
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = OnReopenSignal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    return sigaction(signo, &sa, nullptr) == 0;
+}
+
 std::string LoggerManager::toYamlString(){
     MutexType::Lock lock(m_mutex);
     YAML::Node node;
@@ -9,6 +9,9 @@
 #define __WYZ_LOG_H__
 
 
+#include <atomic>
+#include <csignal>
+#include <cstring>
 #include <list>
 #include <map>
 #include <memory>
@@ -19,13 +22,14 @@
 #include "singleton.h"
 #include "util.h"
 #include "thread.h"
+#include "macro.h"
 
 /**
  * @brief 使用流式方式将日志级别level的日志写入到logger
  */
 #define WYZ_LOG_LEVEL(logger, level) \
     if(logger->getLevel() <= level) \
-        wyz::LogEventWrap(wyz::LogEvent::ptr(new wyz::LogEvent(logger, level, __FILE__, __LINE__, wyz::GetThreadId(),wyz::GetFiberId(), time(0), wyz::Thread::GetName()))).getSS()
+        wyz::LogEventWrap(logger, level, __FILE__, __LINE__, wyz::GetThreadId(),wyz::GetFiberId(), time(0), wyz::Thread::GetName()).getSS()
 
 /**
  * @brief 使用流式方式将日志级别debug的日志写入到logger
@@ -57,7 +61,7 @@
  */
 #define WYZ_LOG_FMT_LEVEL(logger, level, fmt, ...) \
     if(logger->getLevel() <= level) \
-        wyz::LogEventWrap(wyz::LogEvent::ptr(new wyz::LogEvent(logger, level, __FILE__, __LINE__,  wyz::GetThreadId(),wyz::GetFiberId(), time(0) , wyz::Thread::GetName()))).getEvent()->format(fmt, __VA_ARGS__)
+        wyz::LogEventWrap(logger, level, __FILE__, __LINE__,  wyz::GetThreadId(),wyz::GetFiberId(), time(0) , wyz::Thread::GetName()).getEvent()->format(fmt, __VA_ARGS__)
 
 /**
  * @brief 使用格式化方式将日志级别debug的日志写入到logger
@@ -98,6 +102,7 @@ namespace wyz {
 
 class Logger;
 class LoggerManager;
+struct ThreadLogStream;
 
 class LogLevel{
 public:
@@ -118,6 +123,73 @@ public:
 };  // 日志的等级类
 
 
+/**
+ * @brief 日志内容流
+ * @details 每个线程复用一个, 缓冲区容量只增不减, 稳定后写日志内容不再分配内存
+ */
+class LogStream : public std::ostream{
+public:
+    LogStream();
+
+    /// 清空内容并恢复默认的格式标志
+    void reset();
+
+    inline const char* data() const { return m_buf.data();}
+    inline size_t size() const { return m_buf.size();}
+
+    /**
+     * @brief 字符串和整数在默认格式下直接写入缓冲区, 不经过 locale/num_put
+     * @details 设置了宽度或进制等格式时退回 std::ostream 的实现
+     */
+    using std::ostream::operator<<;
+    LogStream& operator<<(const char* v);
+    LogStream& operator<<(const std::string& v);
+    LogStream& operator<<(char v);
+    LogStream& operator<<(signed char v) { return *this << (char)v;}
+    LogStream& operator<<(unsigned char v) { return *this << (char)v;}
+    LogStream& operator<<(int v);
+    LogStream& operator<<(unsigned int v);
+    LogStream& operator<<(long v);
+    LogStream& operator<<(unsigned long v);
+    LogStream& operator<<(long long v);
+    LogStream& operator<<(unsigned long long v);
+
+private:
+    /// 没有设置宽度, 进制等格式
+    inline bool plain() const { return flags() == DEFAULT_FLAGS && width() == 0;}
+    void appendSigned(long long v);
+    void appendUnsigned(unsigned long long v);
+
+private:
+    static const std::ios_base::fmtflags DEFAULT_FLAGS = std::ios_base::dec | std::ios_base::skipws;
+
+    class Buffer : public std::streambuf{
+    public:
+        Buffer();
+        void reset();
+        inline const char* data() const { return pbase();}
+        inline size_t size() const { return pptr() - pbase();}
+        inline void append(const char* s, size_t n){
+            if(UNLIKELY((size_t)(epptr() - pptr()) < n)){
+                grow(n);
+            }
+            memcpy(pptr(), s, n);
+            pbump(n);
+        }
+    protected:
+        int_type overflow(int_type c) override;
+        std::streamsize xsputn(const char* s, std::streamsize n) override;
+    private:
+        /// 扩容到至少还能写 n 个字节
+        void grow(size_t n);
+    private:
+        std::vector<char> m_data;
+    };
+
+private:
+    Buffer m_buf;
+};
+
 class LogEvent{
 public:
     using ptr = std::shared_ptr<LogEvent>;
@@ -125,26 +197,30 @@ public:
      * @brief 构造函数
      * @param[in] logger 日志器
      * @param[in] level 日志级别
-     * @param[in] file 文件名
+     * @param[in] file 文件名(__FILE__, 不复制)
      * @param[in] line 文件行号
-     * @param[in] elapse 程序启动依赖的耗时(毫秒)
      * @param[in] thread_id 线程id
      * @param[in] fiber_id 协程id
      * @param[in] time 日志事件(秒)
-     * @param[in] thread_name 线程名称
+     * @param[in] thread_name 线程名称(引用, 需要比事件活得长, 一般是 Thread::GetName())
      */
-    LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level ,const std::string& file , uint32_t line,uint32_t thread_id ,uint32_t fiber_id,uint32_t time , const std::string& thread_name);
+    LogEvent(const std::shared_ptr<Logger>& logger, LogLevel::Level level ,const char* file , uint32_t line,uint32_t thread_id ,uint32_t fiber_id,uint64_t time , const std::string& thread_name);
+    ~LogEvent();
+
+    LogEvent(const LogEvent&) = delete;
+    LogEvent& operator=(const LogEvent&) = delete;
 
     /* 一系列的get/set 方法 */
     // get 日志器
-    inline std::shared_ptr<Logger> getLogger() {return m_logger;}
+    std::shared_ptr<Logger> getLogger() const;
+    inline Logger* getRawLogger() const { return m_logger;}
 
     // get/set 优先级
     inline const LogLevel::Level getLevel()const  { return m_level;}
     inline void setLevel(const LogLevel::Level level) { m_level = level;}
 
     // get文件名
-    inline const std::string& getFileName()const { return m_file;};
+    inline const char* getFileName()const { return m_file;};
     
     // get 行号
     inline const uint32_t getLine()const    {return m_line;}
@@ -159,10 +235,12 @@ public:
     inline const uint64_t getTime()const    {return m_time;}
 
     // get文件流
-    inline std::stringstream& getSstream()   {return m_ss;};
+    inline LogStream& getSstream()   {return *m_ss;};
 
     // get 内容
-    inline std::string  getContent()const   {return m_ss.str();}
+    inline std::string  getContent()const   {return std::string(m_ss->data(), m_ss->size());}
+    inline const char* getContentData() const { return m_ss->data();}
+    inline size_t getContentSize() const { return m_ss->size();}
 
     //get 线程名称
     inline const std::string& getThread_name()const {return m_thread_name;}
@@ -178,34 +256,40 @@ public:
     void format(const char* fmt, va_list al);
 
 private:
-    std::shared_ptr<Logger> m_logger;   // 日志器
+    Logger* m_logger;                   // 日志器
     LogLevel::Level m_level ;           // 事件优先级
-    const std::string m_file;           // 文件名
+    const char* m_file;                 // 文件名
     uint32_t m_line;                    // 行号
     uint32_t m_threadId;                // 线程号
     uint32_t m_fiberId;                 // 协程号
     uint64_t m_time;                    // 时间
-    std::stringstream m_ss;             // 输出文件流
-    std::string m_thread_name;          // 线程名称
+    LogStream* m_ss;                    // 输出文件流, 线程的流正在使用时(嵌套写日志)单独分配
+    ThreadLogStream* m_threadStream;    // 借用的构造线程的流, nullptr 表示 m_ss 单独分配. 协程换了线程后在别的线程析构也能归还
+    const std::string& m_thread_name;   // 线程名称
 
 };  // 日志事件类
 
+/**
+ * @brief 日志事件包装器
+ * @details 事件直接放在栈上, 交给日志器的 LogEvent::ptr 不拥有事件,
+ *          只在 LogAppender::log 调用期间有效
+ */
 class LogEventWrap{
 public:
-    LogEventWrap(LogEvent::ptr e);
+    LogEventWrap(const std::shared_ptr<Logger>& logger, LogLevel::Level level ,const char* file , uint32_t line,uint32_t thread_id ,uint32_t fiber_id,uint64_t time , const std::string& thread_name);
     ~LogEventWrap();    // 在析构函数调用打印函数
     /**
      * @brief 获取日志事件
      */
-    inline LogEvent::ptr getEvent() const { return m_event;}
+    inline LogEvent::ptr getEvent() { return LogEvent::ptr(LogEvent::ptr(), &m_event);}
 
     /**
      * @brief 获取日志内容流
      */
-    std::stringstream& getSS();
+    inline LogStream& getSS() { return m_event.getSstream();}
 
 private:
-    LogEvent::ptr m_event;
+    LogEvent m_event;
 
 };  // 日志事件包装器
 
@@ -223,6 +307,16 @@ public:
     std::string format( std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event);
     std::ostream& format(std::ostream& ofs, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event);
 
+    /**
+     * @brief 按解析好的格式项把日志直接写入 buf, 不经过流也不分配内存
+     * @param[out] buf 输出缓冲区
+     * @param[in] size 缓冲区大小
+     * @param[in] level 日志级别
+     * @param[in] event 日志事件
+     * @return 日志长度, 大于 size 时 buf 中只有前 size 个字节, 需要更大的缓冲区重新格式化
+     */
+    size_t format(char* buf, size_t size, LogLevel::Level level, const LogEvent& event) const;
+
     void init();        // 解析pattern 各个格式
     inline bool IsError() const     {return m_error;}
 
@@ -246,10 +340,23 @@ public:
         virtual void format(std::ostream& os, std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) = 0;
     };
 
+private:
+    /// 解析后的格式项, format(char*, ...) 按顺序直接写入
+    struct Op{
+        char type;          // 格式字符 m p c t d f l F N, 0 表示原样文本
+        std::string text;   // 原样文本或时间格式
+        uint64_t key;       // 时间格式项在线程时间缓存中的键
+    };
+
+    /// 添加格式项, 相邻的原样文本(包括 %T %n)合并成一项
+    void addOp(char type, const std::string& text);
+
 private:
     std::string m_pattern;          // 给定的输出格式
     bool m_error = false;           // 解析的格式是否有错误
     std::vector<FormatItem::ptr> m_items;  // 解析出来的各个对应的格式
+    std::vector<Op> m_ops;          // 解析出来的格式项, 与 m_items 输出相同
+    uint64_t m_id;                  // 区分格式器, 线程的时间缓存按 id 查找
 
 };  // 日志格式类
 
@@ -265,7 +372,7 @@ public:
      * @brief 写入日志
      * @param[in] logger 日志器
      * @param[in] level 日志级别
-     * @param[in] event 日志事件
+     * @param[in] event 日志事件, 只在调用期间有效, 不能保存
      */
     virtual void log(std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) = 0;
 
@@ -318,8 +425,134 @@ private:
     std::string m_filename ;
     /// 文件流
     std::ofstream m_filestream;
+    /// 打开的文件, 用来发现文件被轮转(改名/删除)
+    uint64_t m_dev = 0;
+    uint64_t m_ino = 0;
+    /// 上次检查轮转的时间(秒)
+    uint64_t m_lastCheck = 0;
+    /// 已处理的重新打开请求代数
+    uint64_t m_reopenGen = 0;
 };  // 文件输出类 公有继承LogAppenden
 
+/**
+ * @brief 异步文件输出
+ * @details 每个写日志的线程有自己的无锁环形缓冲区(单生产者单消费者),
+ *          后台线程把所有缓冲区的数据用 writev 批量写入文件.
+ *          只在文件被轮转或收到重新打开请求(LoggerManager::RequestReopen)时重新打开文件.
+ *          不同线程的日志在同一批次内不保证按时间排序
+ */
+class AsyncLogAppender : public LogAppender{
+public:
+    using ptr = std::shared_ptr<AsyncLogAppender>;
+
+    /// 缓冲区写满时的处理
+    enum OverflowPolicy{
+        BLOCK = 0,      // 等待后台线程写出
+        DROP,           // 丢弃, 只在统计中计数
+        COUNT,          // 丢弃, 并在日志中写入丢弃的行数
+    };
+
+    struct Stats{
+        uint64_t lines = 0;         // 进入缓冲区的行数
+        uint64_t bytes = 0;         // 写入文件的字节数
+        uint64_t writevs = 0;       // writev 调用次数
+        uint64_t dropped = 0;       // 丢弃的行数
+        uint64_t blocked = 0;       // BLOCK 策略下等待的次数
+        uint64_t reopens = 0;       // 重新打开文件的次数
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] filename 文件名
+     * @param[in] buffer_size 每个线程缓冲区大小, 向上取整为 2 的幂
+     * @param[in] policy 缓冲区满时的处理
+     */
+    AsyncLogAppender(const std::string& filename, size_t buffer_size = 64 * 1024
+                    , OverflowPolicy policy = BLOCK);
+    ~AsyncLogAppender();
+
+    /**
+     * @brief 写入线程缓冲区, 不做系统调用; FATAL 日志会等待写入文件后返回
+     */
+    void log(std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event)override;
+
+    /**
+     * @brief 等待调用之前的日志全部写入文件
+     * @param[in] timeout_ms 最长等待时间
+     * @return 是否全部写完
+     */
+    bool flush(uint64_t timeout_ms = 1000);
+
+    std::string toYamlString()override;
+
+    Stats getStats() const;
+
+    inline const std::string& getFilename() const { return m_filename;}
+    inline size_t getBufferSize() const { return m_bufferSize;}
+    inline OverflowPolicy getPolicy() const { return m_policy;}
+
+    static OverflowPolicy PolicyFromString(const std::string& str);
+    static const char* ToString(OverflowPolicy policy);
+
+private:
+    class Ring;
+    struct RingCache;
+    /// 获取当前线程的缓冲区, 第一次调用时创建
+    Ring* getRing();
+    /**
+     * @brief 唤醒后台线程
+     * @param[in] force 后台线程没有睡眠时也写 eventfd
+     */
+    void wakeup(bool force = false);
+    /// 后台线程
+    void run();
+    /// 把所有缓冲区写入文件, 返回写出的字节数
+    size_t drain();
+    /// 直接写入(超过缓冲区的长日志, 丢弃计数)
+    void writeDirect(const char* data, size_t len);
+    bool reopen();
+    /// 是否需要重新打开: 收到请求或文件被轮转
+    bool needReopen();
+
+private:
+    std::string m_filename;
+    size_t m_bufferSize;
+    OverflowPolicy m_policy;
+    /// 区分 appender, 线程缓存中按 id 查找
+    uint64_t m_id;
+
+    /// 所有线程的缓冲区
+    Mutex m_ringMutex;
+    std::vector<std::shared_ptr<Ring> > m_rings;
+    std::atomic<uint32_t> m_ringVersion = {0};
+    /// 后台线程持有的缓冲区快照, 版本变化时更新
+    std::vector<std::shared_ptr<Ring> > m_drainRings;
+    uint32_t m_drainVersion = 0;
+
+    /// 保护文件句柄, 后台线程 writev 与直接写入/重新打开互斥
+    Mutex m_fdMutex;
+    int m_fd = -1;
+    uint64_t m_dev = 0;
+    uint64_t m_ino = 0;
+    uint64_t m_lastCheck = 0;
+    uint64_t m_reopenGen = 0;
+
+    /// 后台线程空闲时阻塞在 eventfd 上
+    int m_wakeFd = -1;
+    std::atomic<bool> m_sleeping = {false};
+    std::atomic<bool> m_stopping = {false};
+    std::shared_ptr<Thread> m_thread;
+
+    std::atomic<uint64_t> m_lines = {0};
+    std::atomic<uint64_t> m_bytes = {0};
+    std::atomic<uint64_t> m_writevs = {0};
+    std::atomic<uint64_t> m_dropped = {0};
+    std::atomic<uint64_t> m_blocked = {0};
+    std::atomic<uint64_t> m_reopens = {0};
+    /// COUNT 策略下还没报告的丢弃行数
+    std::atomic<uint64_t> m_unreported = {0};
+};
+
 class Logger : public std::enable_shared_from_this<Logger>{
 friend class LoggerManager;
 public:
@@ -412,6 +645,20 @@ public:
      */
     std::string toYamlString();
 
+    /**
+     * @brief 请求所有文件输出重新打开文件(logrotate 之后), 可以在信号处理函数中调用
+     */
+    static void RequestReopen();
+
+    /// 重新打开请求的代数, 文件输出与自己记录的代数不同时重新打开
+    static uint64_t GetReopenGeneration();
+
+    /**
+     * @brief 安装信号处理, 收到信号时 RequestReopen
+     * @param[in] signo 信号, 默认 SIGHUP
+     */
+    static bool InstallReopenSignal(int signo = SIGHUP);
+
 private:
     /* 日志管理容器 */
     std::map<std::string, Logger::ptr> m_loggers;
@@ -8,6 +8,7 @@
 #ifndef __WYZ_MUTEX_H__
 #define __WYZ_MUTEX_H__
 
+#include <atomic>
 #include <pthread.h>
 #include <thread>
 #include <semaphore.h>
@@ -248,6 +249,39 @@ private:
     pthread_spinlock_t m_mutex;
 };
 
+/**
+ * @brief 原子锁
+ * @details 只占一个字节, 短暂自旋后让出 CPU; 持有者被抢占时不会像 pthread 自旋锁那样空转整个时间片
+ */
+class CASLock : Noncopyable{
+public:
+    using Lock = ScopedLockImpl<CASLock>;
+
+    CASLock(){
+        m_mutex.clear();
+    }
+
+    void lock(){
+        int spins = 0;
+        while(m_mutex.test_and_set(std::memory_order_acquire)){
+            if(++spins < 64){
+#if defined(__x86_64__) || defined(__i386__)
+                __builtin_ia32_pause();
+#endif
+            }else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void unlock(){
+        m_mutex.clear(std::memory_order_release);
+    }
+
+private:
+    std::atomic_flag m_mutex;
+};
+
 
 }
 #endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "scheduler.h"
+#include "config.h"
 #include "hook.h"
 #include "log.h"
 #include "macro.h"
@@ -8,13 +9,30 @@ namespace wyz {
 
 static wyz::Logger::ptr g_logger = WYZ_LOG_NAME("system");
 
+static wyz::ConfigVar<bool>::ptr g_scheduler_work_stealing =
+    wyz::Config::Lookup("scheduler.work_stealing", false, "scheduler use per-thread work stealing queues");
+static wyz::ConfigVar<uint32_t>::ptr g_scheduler_local_queue_size =
+    wyz::Config::Lookup("scheduler.local_queue_size", (uint32_t)256, "scheduler per-thread queue capacity");
+
 static thread_local Scheduler* t_scheduler = nullptr;
 static thread_local Fiber* t_scheduler_fiber = nullptr;
+/// 当前线程在所属调度器中的序号, 用于定位本地队列
+static thread_local int t_worker_index = -1;
+/// 当前线程执行过的任务数
+static thread_local uint64_t t_task_count = 0;
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
-    :m_name(name) {
+    :m_name(name)
+    ,m_workStealing(g_scheduler_work_stealing->getValue()) {
     WYZ_ASSERT(threads > 0);
 
+    if(m_workStealing) {
+        uint32_t queue_size = g_scheduler_local_queue_size->getValue();
+        for(size_t i = 0; i < threads; ++i) {
+            m_localQueues.push_back(new LocalQueue(queue_size));
+        }
+    }
+
     if(use_caller) {
         wyz::Fiber::GetThis();
         --threads;
@@ -26,6 +44,7 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
         wyz::Thread::SetName(m_name);
 
         t_scheduler_fiber = m_rootFiber.get();
+        t_worker_index = 0;
         m_rootThreadId = wyz::GetThreadId();
         m_threadIds.push_back(m_rootThreadId);
     } else {
@@ -36,8 +55,16 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
 
 Scheduler::~Scheduler() {
     WYZ_ASSERT(m_stopping);
+    for(auto queue : m_localQueues) {
+        while(Task* task = queue->pop()) {
+            delete task;
+        }
+        delete queue;
+    }
+    m_localQueues.clear();
     if(GetThis() == this) {
         t_scheduler = nullptr;
+        t_worker_index = -1;
     }
 }
 
@@ -58,8 +85,13 @@ void Scheduler::start() {
     WYZ_ASSERT(m_threads.empty());
 
     m_threads.resize(m_threadCount);
+    int base = m_rootThreadId != -1 ? 1 : 0;
     for(size_t i = 0; i < m_threadCount; ++i) {
-        m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
+        int index = base + i;
+        m_threads[i].reset(new Thread([this, index](){
+            t_worker_index = index;
+            run();
+        }, m_name + "_" + std::to_string(i)));
         m_threadIds.push_back(m_threads[i]->getId());
     }
     
@@ -123,67 +155,65 @@ void Scheduler::run() {
 
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this), 0 , true));
     Fiber::ptr cb_fiber;
+    LocalQueue* local_queue = getLocalQueue();
+    uint32_t schedule_tick = 0;
 
     Task ft;
     while(true) {
         ft.reset();
         bool tickle_me = false;
+        int tickle_thread = -1;
         bool is_active = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            
-            for(auto it = m_fibers.begin() ; it != m_fibers.end() ; ++it) {
-                if(it->threadId != -1 && it->threadId != wyz::GetThreadId()) {
-                    tickle_me = true;
-                    continue;
-                }
-
-                WYZ_ASSERT(it->fiber || it->cb);
-                if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    continue;
-                }
-
-                ft = *it;
-                m_fibers.erase(it);
-                ++m_activeThreadCount;
-                is_active = true;
-                break;
+        if(local_queue) {
+            /// 定期先看一眼全局队列, 避免本地任务过多时全局/指定线程的任务饿死
+            if(++schedule_tick % 61 == 0) {
+                is_active = takeGlobalTask(ft, tickle_me, tickle_thread)
+                        || takeLocalTask(local_queue, ft);
+            } else {
+                is_active = takeLocalTask(local_queue, ft)
+                        || takeGlobalTask(ft, tickle_me, tickle_thread);
             }
+        } else {
+            is_active = takeGlobalTask(ft, tickle_me, tickle_thread);
         }
 
         if(tickle_me) {
-            tickle();
+            tickle(tickle_thread);
+        }
+        if(ft.fiber || ft.cb) {
+            ++t_task_count;
         }
 
         if(ft.fiber && (ft.fiber->getState() != Fiber::TERM
                         && ft.fiber->getState() != Fiber::EXCEPT)) {
-            ft.fiber->swapIn();
+            Fiber::State state = ft.fiber->swapIn();
             --m_activeThreadCount;
 
-            if(ft.fiber->getState() == Fiber::READY) {
+            if(state == Fiber::READY) {
                 schedule(ft.fiber);
-            } else if(ft.fiber->getState() != Fiber::TERM
-                    && ft.fiber->getState() != Fiber::EXCEPT) {
-                ft.fiber->m_state = Fiber::HOLD;
+            } else if(state == Fiber::HOLD) {
+                /// 挂起的协程可能已经被其他线程唤醒, 不能再动它
+            } else {
+                /// 结束的协程放回线程缓存, 下一个回调任务直接复用
+                Fiber::Recycle(ft.fiber);
             }
             ft.reset();
         } else if(ft.cb) {
             if(cb_fiber) {
                 cb_fiber->reset(ft.cb,true);
             } else {
-                cb_fiber.reset(new Fiber(ft.cb , 0 , true));
+                cb_fiber = Fiber::Create(ft.cb , 0 , true);
             }
             ft.reset();
-            cb_fiber->swapIn();
+            Fiber::State state = cb_fiber->swapIn();
             --m_activeThreadCount;
-            if(cb_fiber->getState() == Fiber::READY) {
+            if(state == Fiber::READY) {
                 schedule(cb_fiber);
                 cb_fiber.reset();
-            } else if(cb_fiber->getState() == Fiber::EXCEPT
-                    || cb_fiber->getState() == Fiber::TERM) {
+            } else if(state == Fiber::EXCEPT
+                    || state == Fiber::TERM) {
                 cb_fiber->reset(nullptr);
             } else {
-                cb_fiber->m_state = Fiber::HOLD;
                 cb_fiber.reset();
             }
         } else {
@@ -199,22 +229,129 @@ void Scheduler::run() {
             ++m_idleThreadCount;
             idle_fiber->swapIn();
             --m_idleThreadCount;
-            if(idle_fiber->getState() != Fiber::TERM
-                    && idle_fiber->getState() != Fiber::EXCEPT) {
-                idle_fiber->m_state = Fiber::HOLD;
+        }
+    }
+}
+
+Scheduler::LocalQueue* Scheduler::getLocalQueue() {
+    if(!m_workStealing || t_scheduler != this || t_worker_index < 0
+            || t_worker_index >= (int)m_localQueues.size()) {
+        return nullptr;
+    }
+    return m_localQueues[t_worker_index];
+}
+
+bool Scheduler::pushLocal(LocalQueue* queue, Task* task) {
+    /// 先计数再入队, 保证 stopping() 不会在任务可见前误判为空
+    ++m_localTaskCount;
+    if(!queue->push(task)) {
+        --m_localTaskCount;
+        return false;
+    }
+    return true;
+}
+
+bool Scheduler::takeGlobalTask(Task& ft, bool& tickle_me, int& tickle_thread) {
+    MutexType::Lock lock(m_mutex);
+    for(auto it = m_fibers.begin() ; it != m_fibers.end() ; ++it) {
+        if(it->threadId != -1 && it->threadId != wyz::GetThreadId()) {
+            if(!tickle_me) {
+                tickle_me = true;
+                tickle_thread = it->threadId;
             }
+            continue;
         }
+
+        WYZ_ASSERT(it->fiber || it->cb);
+        if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
+            continue;
+        }
+
+        ft = *it;
+        m_fibers.erase(it);
+        ++m_activeThreadCount;
+        return true;
     }
+    return false;
 }
 
-void Scheduler::tickle() {
+bool Scheduler::takeLocalTask(LocalQueue* queue, Task& ft) {
+    Task* task = queue->pop();
+    if(!task) {
+        /// 本地为空, 从其他线程队列窃取一半, 第一个直接执行, 其余放入本地队列
+        size_t count = m_localQueues.size();
+        size_t start = (size_t)t_worker_index + 1;
+        for(size_t i = 0; i < count - 1 && !task; ++i) {
+            LocalQueue* victim = m_localQueues[(start + i) % count];
+            size_t n = (victim->size() + 1) / 2;
+            for(size_t j = 0; j < n; ++j) {
+                Task* stolen = victim->steal();
+                if(!stolen) {
+                    break;
+                }
+                if(!task) {
+                    task = stolen;
+                } else if(!queue->push(stolen)) {
+                    /// 本地放不下时直接放回全局队列
+                    MutexType::Lock lock(m_mutex);
+                    m_fibers.emplace_back(*stolen);
+                    --m_localTaskCount;
+                    delete stolen;
+                }
+            }
+        }
+        if(!task) {
+            return false;
+        }
+    }
+
+    if(task->fiber && task->fiber->getState() == Fiber::EXEC) {
+        /// 协程还在切出途中, 交给全局队列稍后再调度
+        MutexType::Lock lock(m_mutex);
+        m_fibers.emplace_back(*task);
+        --m_localTaskCount;
+        delete task;
+        return false;
+    }
+
+    ft = *task;
+    delete task;
+    ++m_activeThreadCount;
+    --m_localTaskCount;
+    return true;
+}
+
+void Scheduler::tickle(int thread) {
     WYZ_LOG_INFO(g_logger) << "tickle";
 }
 
+bool Scheduler::hasTask() {
+    if(m_localTaskCount > 0) {
+        return true;
+    }
+    int thread = wyz::GetThreadId();
+    MutexType::Lock lock(m_mutex);
+    for(auto& task : m_fibers) {
+        if(task.threadId == -1 || task.threadId == thread) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int Scheduler::getWorkerIndex() const {
+    return t_scheduler == this ? t_worker_index : -1;
+}
+
+uint64_t Scheduler::GetTaskCount() {
+    return t_task_count;
+}
+
 bool Scheduler::stopping() {
     MutexType::Lock lock(m_mutex);
     return m_autostop && m_stopping
-        && m_fibers.empty() && m_activeThreadCount == 0;
+        && m_fibers.empty() && m_localTaskCount == 0
+        && m_activeThreadCount == 0;
 }
 
 void Scheduler::idle() {
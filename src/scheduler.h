@@ -22,6 +22,7 @@
 #include "mutex.h"
 #include "thread.h"
 #include "fiber.h"
+#include "workqueue.h"
 
 namespace wyz {
 
@@ -57,12 +58,12 @@ public:
     template<typename FiberOrCb>
     void schedule(FiberOrCb fc , int thread = -1){
         bool need_tickle = false;
-        {
+        if(!scheduleLocal(fc , thread , need_tickle)){
             MutexType::Lock lock(m_mutex);
             need_tickle = scheduleNoLock(fc , thread);
         }
         if(need_tickle){
-            tickle();
+            tickle(thread);
         }
     }
 
@@ -70,7 +71,18 @@ public:
     template<typename  InputIterator>
     void schedule(InputIterator begin , InputIterator end){
         bool need_tickle = false;
-        {
+        if(m_workStealing){
+            /// 工作窃取模式下逐个压入本线程队列, 放不下的进入全局队列
+            while(begin != end){
+                bool tickle_one = false;
+                if(!scheduleLocal(*begin , -1 , tickle_one)){
+                    MutexType::Lock lock(m_mutex);
+                    tickle_one = scheduleNoLock(*begin , -1);
+                }
+                need_tickle = tickle_one || need_tickle;
+                ++ begin;
+            }
+        }else {
             MutexType::Lock lock(m_mutex);
             while(begin != end){
                 need_tickle = scheduleNoLock(*begin, -1) || need_tickle;
@@ -82,17 +94,34 @@ public:
         }
     }
 
+    /// 是否使用工作窃取模式
+    inline bool isWorkStealing() const  {return m_workStealing;}
+
+    /// 调度器各线程的id (use_caller 时第一个为调用线程), 可用于 schedule 指定线程
+    inline const std::vector<int>& getThreadIds() const {return m_threadIds;}
+
 protected:
-    virtual void tickle();          // 通知调度器有任务来临
+    /**
+     * @brief 通知调度器有任务来临
+     * @param[in] thread 任务指定的线程id, -1 表示任意空闲线程
+     */
+    virtual void tickle(int thread = -1);
     void setThis();         // 设置当前的协程调度器
     void run();             // 协程调度函数
     virtual bool stopping();        // 是否可以正常结束
     virtual void idle();            // 协程无任务可调度时执行idle协程
     inline bool hasIdelThreads() {return m_idleThreadCount > 0;}
+    /// 是否有当前线程可以执行的任务, 空闲线程挂起前用来复查
+    bool hasTask();
+    /// 当前线程在本调度器中的序号(与 m_threadIds 下标一致), 非本调度器线程返回 -1
+    int getWorkerIndex() const;
+    /// 当前线程执行过的任务数
+    static uint64_t GetTaskCount();
 private:
     template<typename FiberOrCb>
     bool scheduleNoLock(FiberOrCb fc , int threadid){
-        bool need_tickle = m_fibers.empty();
+        /// 指定线程的任务总是通知, 其他线程不会替它执行
+        bool need_tickle = m_fibers.empty() || threadid != -1;
         Task ft(fc , threadid);
         if(ft.fiber || ft.cb){
             m_fibers.emplace_back(ft);
@@ -100,6 +129,34 @@ private:
         return need_tickle;
     }
 
+    /**
+     * @brief 工作窃取模式下将任务压入当前线程的本地队列
+     * @param[out] need_tickle 是否需要通知空闲线程来窃取
+     * @return false 不满足条件(未开启/指定了线程/非本调度器线程/队列已满), 需要走全局队列
+     */
+    template<typename FiberOrCb>
+    bool scheduleLocal(FiberOrCb fc , int threadid , bool& need_tickle){
+        if(!m_workStealing || threadid != -1){
+            return false;
+        }
+        LocalQueue* queue = getLocalQueue();
+        if(!queue){
+            return false;
+        }
+        Task* task = new Task(fc , -1);
+        if(!task->fiber && !task->cb){
+            delete task;
+            need_tickle = false;
+            return true;
+        }
+        if(!pushLocal(queue , task)){
+            delete task;
+            return false;
+        }
+        need_tickle = hasIdelThreads();
+        return true;
+    }
+
 private:
     /* 需要被调度的协程或者协程执行函数类型 */
     struct Task{
@@ -126,6 +183,20 @@ private:
 
     };
 
+    using LocalQueue = WorkStealingQueue<Task>;
+
+    /// 获取当前线程在本调度器中的本地队列, 非本调度器线程返回 nullptr
+    LocalQueue* getLocalQueue();
+    /// 压入本地队列
+    bool pushLocal(LocalQueue* queue , Task* task);
+    /**
+     * @brief 从全局队列中取出当前线程可执行的任务
+     * @param[out] tickle_me 遇到了指定给其他线程的任务, 需要通知 tickle_thread
+     */
+    bool takeGlobalTask(Task& ft , bool& tickle_me , int& tickle_thread);
+    /// 从本地队列取任务, 本地为空时从其他线程队列窃取一半
+    bool takeLocalTask(LocalQueue* queue , Task& ft);
+
 private:
     // 互斥量
     MutexType m_mutex;
@@ -137,6 +208,12 @@ private:
     Fiber::ptr m_rootFiber;
     // 协程器名称
     std::string m_name;
+    /// 是否使用工作窃取模式(构造时由配置 scheduler.work_stealing 决定)
+    bool m_workStealing = false;
+    /// 每个工作线程的本地队列, 下标为线程序号(use_caller 时 0 为调用线程)
+    std::vector<LocalQueue*> m_localQueues;
+    /// 本地队列中的任务总数
+    std::atomic<size_t> m_localTaskCount = {0};
 
 protected:
     std::vector<int> m_threadIds;       // 协程下的线程id数组
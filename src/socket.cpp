@@ -6,14 +6,22 @@
  */
 
 #include "socket.h"
+#include "config.h"
 #include "fdmanager.h"
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
 #include "iomanager.h"
+#include "mutex.h"
+#include "util.h"
+#include <atomic>
 #include <cstdint>
 #include <cstring>
+#include <deque>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -21,6 +29,125 @@ namespace wyz {
 
 static wyz::Logger::ptr g_logger = WYZ_LOG_NAME("system");
 
+static wyz::ConfigVar<uint64_t>::ptr g_socket_zerocopy_threshold = wyz::Config::Lookup("socket.zerocopy_threshold", (uint64_t)128 * 1024, "sendZeroCopy uses MSG_ZEROCOPY at or above this size");
+static wyz::ConfigVar<uint64_t>::ptr g_socket_zerocopy_close_timeout = wyz::Config::Lookup("socket.zerocopy_close_timeout", (uint64_t)1000, "close waits this long(ms) for pending MSG_ZEROCOPY sends, then resets the connection");
+/// IOManager 遇到 EPOLLERR 时把 fd 上等待的读写都唤醒, 完成通知不走 epoll, 用定时器轮询错误队列
+static wyz::ConfigVar<uint64_t>::ptr g_socket_zerocopy_reap_interval = wyz::Config::Lookup("socket.zerocopy_reap_interval", (uint64_t)1, "interval(ms) for polling the error queue for MSG_ZEROCOPY completions while sends are pending");
+
+static std::atomic<uint64_t> s_zerocopy_bytes = {0};
+static std::atomic<uint64_t> s_copied_bytes = {0};
+static std::atomic<uint64_t> s_pending_bytes = {0};
+static std::atomic<uint64_t> s_zerocopy_fallbacks = {0};
+
+/**
+ * @brief socket 的零拷贝发送状态, 收取定时器只持有弱引用
+ */
+struct ZeroCopyState {
+    using ptr = std::shared_ptr<ZeroCopyState>;
+    /// 等待完成通知的发送
+    struct Pending {
+        uint32_t seq;
+        size_t len;                         /// send 返回之前为 0
+        std::shared_ptr<const void> owner;
+        bool sending;                       /// send 还没有返回
+        bool completed;                     /// send 返回前已经收到完成通知
+        bool copied;
+    };
+
+    /// 统计并释放完成的发送
+    std::deque<Pending>::iterator complete(std::deque<Pending>::iterator it , bool copied){
+        s_pending_bytes -= it->len;
+        (copied ? s_copied_bytes : s_zerocopy_bytes) += it->len;
+        return pending.erase(it);
+    }
+
+    ~ZeroCopyState(){
+        for(auto& i : pending){
+            s_pending_bytes -= i.len;
+        }
+    }
+
+    /// 从错误队列取回完成通知, 释放完成的缓冲区. 需要持有 mutex
+    void reap();
+
+    Mutex mutex;
+    int fd = -1;                /// socket 关闭后为 -1
+    bool enabled = true;        /// 内核做了拷贝后关闭
+    bool timer = false;         /// 是否有收取定时器
+    uint32_t next = 0;          /// 下一次 MSG_ZEROCOPY 发送的序号, 与内核的计数一致
+    std::deque<Pending> pending;
+};
+
+void ZeroCopyState::reap(){
+    char control[128];
+    while(fd >= 0 && !pending.empty()){
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        /// 错误队列为空时不能挂起, 直接调用原始的 recvmsg
+        if(recvmsg_f(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0){
+            break;
+        }
+        for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg) ; cmsg ; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+            if(!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                    && !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)){
+                continue;
+            }
+            sock_extended_err err;
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if(err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0){
+                continue;
+            }
+            /// 内核做了拷贝时零拷贝没有收益, 之后拷贝发送
+            bool copied = err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED;
+            if(copied && enabled){
+                enabled = false;
+                ++s_zerocopy_fallbacks;
+            }
+            /// 通知的是 [ee_info, ee_data] 范围内的发送
+            uint32_t lo = err.ee_info;
+            uint32_t count = err.ee_data - lo;
+            for(auto it = pending.begin() ; it != pending.end() ;){
+                if(it->seq - lo > count){
+                    ++it;
+                }else if(it->sending){
+                    /// 其他线程的定时器先收到了通知, 由发送方在 send 返回后释放
+                    it->completed = true;
+                    it->copied = copied;
+                    ++it;
+                }else {
+                    it = complete(it, copied);
+                }
+            }
+        }
+    }
+}
+
+static void ScheduleZeroCopyReap(ZeroCopyState::ptr state);
+
+static void OnZeroCopyReap(std::weak_ptr<ZeroCopyState> weak){
+    ZeroCopyState::ptr state = weak.lock();
+    if(!state){
+        return;
+    }
+    Mutex::Lock lock(state->mutex);
+    state->timer = false;
+    state->reap();
+    ScheduleZeroCopyReap(state);
+}
+
+/// 还有未完成的发送时添加收取定时器, 需要持有 mutex
+static void ScheduleZeroCopyReap(ZeroCopyState::ptr state){
+    IOManager* iom = IOManager::GetThis();
+    if(state->timer || state->fd < 0 || state->pending.empty() || !iom){
+        return;
+    }
+    state->timer = true;
+    std::weak_ptr<ZeroCopyState> weak(state);
+    iom->addTimer(g_socket_zerocopy_reap_interval->getValue(), std::bind(&OnZeroCopyReap, weak));
+}
+
 Socket::ptr Socket::CreateTCP(wyz::Address::ptr address){
     Socket::ptr sock(new Socket(address->getFamily(), wyz::Socket::TCP, 0));
     return sock;
@@ -64,6 +191,25 @@ Socket::ptr Socket::CreateUnixUDPSock(){
     return sock;
 }
 
+Socket::ptr Socket::Attach(int fd){
+    int family = 0;
+    int type = 0;
+    int protocol = 0;
+    socklen_t len = sizeof(int);
+    if(getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &family, &len)
+            || getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len)
+            || getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &protocol, &len)){
+        WYZ_LOG_ERROR(g_logger) << "Socket::Attach(" << fd << ") errno=" << errno << " strerr=" << strerror(errno);
+        return nullptr;
+    }
+    FdMar::GetInstance()->get(fd, true);
+    Socket::ptr sock(new Socket(family, type, protocol));
+    if(sock->init(fd)){
+        return sock;
+    }
+    return nullptr;
+}
+
 Socket::Socket(int family , int type , int protocol)
     : m_sock(-1)
     , m_family(family)
@@ -127,7 +273,8 @@ bool Socket::setOption(int level , int option , const void* val , socklen_t len)
 
 Socket::ptr Socket::accept(){
     Socket::ptr sock (new Socket(m_family,m_type,m_protocol));
-    int newsock = ::accept(m_sock, nullptr,nullptr);
+    /// 新连接直接带上 O_NONBLOCK, FdCtx 初始化时省掉一次 F_SETFL
+    int newsock = ::accept4(m_sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if(newsock == -1){
         WYZ_LOG_ERROR(g_logger) << "Socket::accept error sockfd=" << newsock << " errno=" << errno << " strerr=" << strerror(errno);
         return nullptr; 
@@ -138,6 +285,39 @@ Socket::ptr Socket::accept(){
     return nullptr;
 }
 
+size_t Socket::accept(std::vector<Socket::ptr>& socks, size_t max){
+    size_t count = 0;
+    /// 监听 socket 在 FdCtx 中已被设为系统非阻塞时, 直接调用原始 accept4 不会挂起
+    FdCtx::ptr ctx = FdMar::GetInstance()->get(m_sock);
+    bool drain = ctx && ctx->getSysNonblock();
+    while(drain && count < max){
+        int newsock = accept4_f(m_sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(newsock == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            break;
+        }
+        FdMar::GetInstance()->get(newsock, true);
+        Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
+        if(sock->init(newsock)){
+            socks.emplace_back(sock);
+            ++count;
+        }else {
+            ::close(newsock);
+        }
+    }
+    if(count == 0){
+        /// 队列为空, 走 hook 挂起等待
+        Socket::ptr sock = accept();
+        if(sock){
+            socks.emplace_back(sock);
+            ++count;
+        }
+    }
+    return count;
+}
+
 bool Socket::init(int sock){
     FdCtx::ptr ctx = FdMar::GetInstance()->get(sock);
     if(ctx && ctx->isSocket() && !ctx->isClosed()){
@@ -155,7 +335,7 @@ bool Socket::init(int sock){
 void Socket::initSocket(){
     int val = 1;
     setOption(SOL_SOCKET,SO_REUSEADDR,val);
-    if(m_type == SOCK_STREAM){
+    if(m_type == SOCK_STREAM && m_family != AF_UNIX){
         setOption(IPPROTO_TCP,TCP_NODELAY,val);
     }
 }
@@ -171,6 +351,17 @@ void Socket::newSocket(){
     }
 }
 
+bool Socket::reusePort(){
+    if(!isvaild()){
+        newSocket();
+        if(UNLIKELY(!isvaild())){
+            return false;
+        }
+    }
+    int val = 1;
+    return setOption(SOL_SOCKET, SO_REUSEPORT, val);
+}
+
 bool Socket::bind( const Address::ptr address){
     if(!isvaild()){
         newSocket();
@@ -243,6 +434,9 @@ bool Socket::close(){
     if(!isvaild() && !m_isConnected){
         return true;
     }
+    if(m_zeroCopy){
+        closeZeroCopy();
+    }
     m_isConnected = false;
     if(isvaild()){
         ::close(m_sock);
@@ -289,6 +483,141 @@ int Socket::sendto(const iovec * buf, size_t len, Address::ptr to, int flags){
     return -1;
 }
 
+int Socket::sendFile(int fd, off_t* offset, size_t count){
+    if(isConnected()){
+        return ::sendfile(m_sock, fd, offset, count);
+    }
+    return -1;
+}
+
+int Socket::sendBatch(mmsghdr* msgs, unsigned int count, int flags){
+    if(isConnected()){
+        return ::sendmmsg(m_sock, msgs, count, flags);
+    }
+    return -1;
+}
+
+bool Socket::setZeroCopy(bool v){
+    if(!v){
+        if(m_zeroCopy){
+            Mutex::Lock lock(m_zeroCopy->mutex);
+            m_zeroCopy->enabled = false;
+        }
+        return true;
+    }
+    int val = 1;
+    if(!isvaild() || m_type != SOCK_STREAM || !setOption(SOL_SOCKET, SO_ZEROCOPY, val)){
+        return false;
+    }
+    if(!m_zeroCopy){
+        m_zeroCopy.reset(new ZeroCopyState);
+        m_zeroCopy->fd = m_sock;
+    }else {
+        Mutex::Lock lock(m_zeroCopy->mutex);
+        m_zeroCopy->enabled = true;
+    }
+    return true;
+}
+
+bool Socket::isZeroCopy() const{
+    if(!m_zeroCopy){
+        return false;
+    }
+    Mutex::Lock lock(m_zeroCopy->mutex);
+    return m_zeroCopy->enabled;
+}
+
+int Socket::sendZeroCopy(std::shared_ptr<const void> owner, const void* data, size_t len, int flags){
+    if(!isConnected()){
+        return -1;
+    }
+    ZeroCopyState::ptr state = m_zeroCopy;
+    bool zerocopy = false;
+    if(state && len >= g_socket_zerocopy_threshold->getValue()){
+        Mutex::Lock lock(state->mutex);
+        state->reap();
+        zerocopy = state->enabled;
+    }
+    if(zerocopy){
+        /// 先登记序号, 其他线程的定时器可能在 send 返回前就收到这次发送的完成通知.
+        /// send 可能让出协程, 不能持有 mutex
+        uint32_t seq = 0;
+        {
+            Mutex::Lock lock(state->mutex);
+            seq = state->next++;
+            state->pending.push_back(ZeroCopyState::Pending{seq, 0, owner, true, false, false});
+        }
+        int rt = ::send(m_sock, data, len, flags | MSG_ZEROCOPY);
+        int error = errno;
+        {
+            Mutex::Lock lock(state->mutex);
+            auto it = state->pending.end();
+            while(it != state->pending.begin() && (--it)->seq != seq);
+            if(rt > 0){
+                it->sending = false;
+                it->len = rt;
+                s_pending_bytes += rt;
+                if(it->completed){
+                    state->complete(it, it->copied);
+                }
+                ScheduleZeroCopyReap(state);
+                return rt;
+            }
+            /// 失败的发送内核不计数, 收回序号. 同一个 socket 不能在多个协程中同时发送
+            state->pending.erase(it);
+            --state->next;
+        }
+        errno = error;
+        /// ENOBUFS: 未完成的通知太多, 超过了 optmem 限制, 这次拷贝发送
+        if(rt == 0 || errno != ENOBUFS){
+            return rt;
+        }
+    }
+    int rt = ::send(m_sock, data, len, flags);
+    if(rt > 0){
+        s_copied_bytes += rt;
+    }
+    return rt;
+}
+
+void Socket::closeZeroCopy(){
+    ZeroCopyState::ptr state = m_zeroCopy;
+    /// 关闭后内核仍在从 owner 的内存发送, 等到完成通知全部取回再释放
+    uint64_t deadline = GetCurrentMS() + g_socket_zerocopy_close_timeout->getValue();
+    while(true){
+        {
+            Mutex::Lock lock(state->mutex);
+            state->reap();
+            if(state->pending.empty() || state->fd < 0){
+                state->fd = -1;
+                return;
+            }
+        }
+        if(GetCurrentMS() >= deadline){
+            break;
+        }
+        usleep(g_socket_zerocopy_reap_interval->getValue() * 1000);
+    }
+    /// 超时: 复位连接, 内核丢弃发送队列, 不再使用这些内存
+    linger lg;
+    lg.l_onoff = 1;
+    lg.l_linger = 0;
+    setOption(SOL_SOCKET, SO_LINGER, lg);
+    Mutex::Lock lock(state->mutex);
+    WYZ_LOG_WARN(g_logger) << "Socket::close(" << m_sock << ") zerocopy pending=" << state->pending.size()
+        << " after " << g_socket_zerocopy_close_timeout->getValue() << "ms, reset";
+    state->fd = -1;
+}
+
+Socket::ZeroCopyStats Socket::GetZeroCopyStats(){
+    ZeroCopyStats stats;
+    stats.zeroCopyBytes = s_zerocopy_bytes;
+    stats.copiedBytes = s_copied_bytes;
+    stats.pendingBytes = s_pending_bytes;
+    stats.fallbacks = s_zerocopy_fallbacks;
+    return stats;
+}
+
     /// 接受数据部分
 int Socket::recv(void *buf, size_t len, int flags){
     if(isConnected()){
@@ -310,8 +639,8 @@ int Socket::recv(iovec *buf, size_t len, int flags ){
 
 int Socket::recvfrom(void *buf, size_t len, Address::ptr from ,int flags ){
     if(isConnected()){
-        socklen_t len = from->getLen();
-        return ::recvfrom(m_sock, buf, len, flags, (sockaddr *)(from->getAddr()),&len);
+        socklen_t addrlen = from->getLen();
+        return ::recvfrom(m_sock, buf, len, flags, (sockaddr *)(from->getAddr()), &addrlen);
     }
     return -1;
 }
@@ -329,6 +658,13 @@ int Socket::recvfrom(iovec *buf, size_t len, Address::ptr from ,int flags ){
     return -1;
 }
 
+int Socket::recvBatch(mmsghdr* msgs, unsigned int count, int flags){
+    if(isConnected()){
+        return ::recvmmsg(m_sock, msgs, count, flags, nullptr);
+    }
+    return -1;
+}
+
 bool Socket::isvaild()const{
     return m_sock != -1 ;
 }
@@ -439,6 +775,10 @@ std::string Socket::toString()const{
     return ss.str();
 }
 
+std::ostream& operator<<(std::ostream& os, const Socket& sock){
+    return sock.dump(os);
+}
+
 bool Socket::cancelRead(){
     return IOManager::GetThis()->cancelEvent(m_sock, wyz::IOManager::READ);
 }
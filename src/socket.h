@@ -15,10 +15,13 @@
 #include <memory>
 #include <ostream>
 #include <sys/socket.h>
+#include <vector>
 
 
 namespace wyz {
 
+struct ZeroCopyState;
+
 class Socket : public std::enable_shared_from_this<Socket> , Noncopyable{
 public:
     using ptr = std::shared_ptr<Socket>;
@@ -50,6 +53,12 @@ public:
     static Socket::ptr CreateUnixTCPSock();
     static Socket::ptr CreateUnixUDPSock();
 
+    /**
+     * @brief 接管一个已有的 socket 描述符, 例如从其他进程收到的监听 socket
+     * @return Socket::ptr      fd 不是 socket 时返回 nullptr
+     */
+    static Socket::ptr Attach(int fd);
+
     Socket(int family , int type , int protocol = 0);
     ~Socket();
 
@@ -80,9 +89,21 @@ public:
     *   对这个socket进行读写操作
     */
     Socket::ptr accept();
+    /**
+     * @brief 批量接受连接: 先把全连接队列里已有的连接一次取完, 队列为空时才挂起等待
+     * @param[out] socks 新连接追加到末尾
+     * @param[in] max 最多接受的数量
+     * @return 本次接受的数量, 0 表示出错(errno 有效)
+     */
+    size_t accept(std::vector<Socket::ptr>& socks, size_t max);
     bool connect(const Address::ptr address, uint64_t timeout_ms = -1);
+    /**
+     * @brief 设置 SO_REUSEPORT, 多个 socket 可以监听同一地址, 由内核分发连接
+     * @pre 在 bind 之前调用, socket 还没创建时会先创建
+     */
+    bool reusePort();
     bool bind( const Address::ptr address);
-    bool listen(int backlog);
+    bool listen(int backlog = SOMAXCONN);
     bool close();
 
     /// 发送数据部分
@@ -90,12 +111,59 @@ public:
     int send(const iovec * buf, size_t len, int flags = 0);
     int sendto(const void * buf, size_t len, Address::ptr to, int flags = 0);
     int sendto(const iovec * buf, size_t len, Address::ptr to, int flags = 0);
+    /**
+     * @brief 用 sendfile 发送文件内容
+     * @param  fd               文件描述符
+     * @param  offset           文件中的起始位置, 返回时更新为发送结束的位置
+     * @param  count            发送的长度
+     * @return int              >0 发送的长度, =0 对方关闭, <0 Socket异常
+     */
+    int sendFile(int fd, off_t* offset, size_t count);
+    /**
+     * @brief 用 sendmmsg 一次发送多个数据报
+     * @return int              >0 发送的数据报个数, <0 Socket异常
+     */
+    int sendBatch(mmsghdr* msgs, unsigned int count, int flags = 0);
+
+    /**
+     * @brief 开启 SO_ZEROCOPY, 之后 sendZeroCopy 中不小于 socket.zerocopy_threshold 的数据用 MSG_ZEROCOPY 发送
+     * @return bool             内核拒绝时返回 false, sendZeroCopy 仍然拷贝发送
+     */
+    bool setZeroCopy(bool v);
+    bool isZeroCopy() const;
+
+    /**
+     * @brief 零拷贝发送
+     * @details owner 由 socket 持有, 直到内核的完成通知从错误队列取回(发送时, 以及有未完成发送时每隔 socket.zerocopy_reap_interval 由 IOManager 的定时器收取).
+     *          close 最多等待 socket.zerocopy_close_timeout 取回剩下的通知, 超时则复位连接丢弃未发出的数据.
+     *          完成通知表明内核做了拷贝(例如回环)时, 这个 socket 之后退回拷贝发送.
+     *          同一个 socket 不能在多个协程中同时调用
+     * @param  owner            持有 data 所在的内存, 完成之前不能修改
+     * @return int              >0 发送的长度, =0 对方关闭, <0 Socket异常
+     */
+    int sendZeroCopy(std::shared_ptr<const void> owner, const void* data, size_t len, int flags = 0);
+
+    /**
+     * @brief 零拷贝发送统计, 所有 socket 合计
+     */
+    struct ZeroCopyStats {
+        uint64_t zeroCopyBytes;     /// 内核确认没有拷贝的字节数
+        uint64_t copiedBytes;       /// sendZeroCopy 拷贝发送的字节数, 包括内核做了拷贝的
+        uint64_t pendingBytes;      /// 等待完成通知的字节数
+        uint64_t fallbacks;         /// 退回拷贝发送的 socket 数
+    };
+    static ZeroCopyStats GetZeroCopyStats();
 
     /// 接受数据部分
     int recv(void *buf, size_t len, int flags = 0);
     int recv(iovec *buf, size_t len, int flags = 0);
     int recvfrom(void *buf, size_t len, Address::ptr from ,int flags = 0);
     int recvfrom(iovec *buf, size_t len, Address::ptr from ,int flags = 0);
+    /**
+     * @brief 用 recvmmsg 一次接收多个数据报, 没有数据时挂起等待
+     * @return int              >0 收到的数据报个数, <0 Socket异常
+     */
+    int recvBatch(mmsghdr* msgs, unsigned int count, int flags = 0);
 
     
     /* 获取远程地址*/
@@ -126,6 +194,8 @@ protected:
     void initSocket();
     void newSocket();
     bool init(int sock);
+    /// close 时等待零拷贝发送完成
+    void closeZeroCopy();
 private:
     int m_sock;
     int m_family;
@@ -135,8 +205,11 @@ private:
 
     Address::ptr m_remoteAddress;
     Address::ptr m_localAddress;
+    std::shared_ptr<ZeroCopyState> m_zeroCopy;  /// 开启 SO_ZEROCOPY 后创建
 };
 
+std::ostream& operator<<(std::ostream& os, const Socket& sock);
+
 }
 
 
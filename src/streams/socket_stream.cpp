@@ -0,0 +1,303 @@
+/**
+ * @file socket_stream.cpp
+ * @brief socket 流封装实现
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-19
+ * 
+ * @copyright Copyright (c) 2021  wyz
+ * 
+ */
+
+#include "socket_stream.h"
+#include <algorithm>
+#include <cstring>
+#include <sys/socket.h>
+#include <vector>
+
+namespace wyz {
+
+SocketStream::SocketStream(Socket::ptr socket , bool owner)
+    : m_socket(socket)
+    , m_owner(owner){
+}
+
+SocketStream::~SocketStream(){
+    if(m_owner && m_socket){
+        m_socket->close();
+    }
+}
+
+bool SocketStream::isConnected() const{
+    return m_socket && m_socket->isConnected();
+}
+
+void SocketStream::setReadBufferSize(size_t v){
+    size_t buffered = getReadBuffered();
+    if(buffered && m_readPos){
+        memmove(&m_readBuffer[0], &m_readBuffer[m_readPos], buffered);
+    }
+    m_readPos = 0;
+    m_readLen = buffered;
+    m_readBuffer.resize(std::max(v, buffered));
+    m_readBuffer.shrink_to_fit();
+}
+
+void SocketStream::setWriteBufferSize(size_t v){
+    if(v == 0){
+        flushWrite();
+    }
+    m_writeBufferSize = v;
+    m_writeBuffer.reserve(v);
+}
+
+size_t SocketStream::readBuffered(void* buff , size_t length){
+    size_t n = std::min(length, m_readLen - m_readPos);
+    if(n){
+        memcpy(buff, &m_readBuffer[m_readPos], n);
+        m_readPos += n;
+    }
+    return n;
+}
+
+int SocketStream::read(void * buff , size_t length){
+    if(!isConnected()){
+        return -1;
+    }
+    if(!m_writeBuffer.empty()){
+        int rt = flushWrite();
+        if(rt <= 0){
+            return rt;
+        }
+    }
+    size_t n = readBuffered(buff, length);
+    if(n){
+        return n;
+    }
+    /// 没有开启读缓冲或者要读的比缓冲区大, 直接读到调用方的内存
+    if(length >= m_readBuffer.size()){
+        return m_socket->recv(buff, length);
+    }
+    int rt = m_socket->recv(&m_readBuffer[0], m_readBuffer.size());
+    if(rt <= 0){
+        return rt;
+    }
+    m_readPos = 0;
+    m_readLen = rt;
+    return readBuffered(buff, length);
+}
+
+int SocketStream::read(ByteArray::ptr ba , size_t length){
+    if(!isConnected()){
+        return -1;
+    }
+    if(!length){
+        return 0;
+    }
+    if(!m_writeBuffer.empty()){
+        int rt = flushWrite();
+        if(rt <= 0){
+            return rt;
+        }
+    }
+    size_t n = std::min(length, getReadBuffered());
+    if(n){
+        ba->write(&m_readBuffer[m_readPos], n);
+        m_readPos += n;
+        return n;
+    }
+    /// ByteArray 本身就是缓冲区, 用 readv 直接读到它的内存块中
+    std::vector<iovec> iovs;
+    ba->getWriteBuffers(iovs, length);
+    int rt = m_socket->recv(&iovs[0], iovs.size());
+    if(rt > 0){
+        ba->setPosition(ba->getPosition() + rt);
+    }
+    return rt;
+}
+
+int SocketStream::write(const void * buff , size_t length){
+    if(!isConnected()){
+        return -1;
+    }
+    if(!m_writeBufferSize){
+        return m_socket->send(buff, length);
+    }
+    if(m_writeBuffer.size() + length <= m_writeBufferSize){
+        m_writeBuffer.append((const char*)buff, length);
+        return length;
+    }
+    if(length < m_writeBufferSize){
+        int rt = flushWrite();
+        if(rt <= 0){
+            return rt;
+        }
+        m_writeBuffer.append((const char*)buff, length);
+        return length;
+    }
+    /// 大块数据与缓冲区中的数据用一次 writev 发出
+    iovec iov[2];
+    size_t iovcnt = 0;
+    if(!m_writeBuffer.empty()){
+        iov[iovcnt].iov_base = &m_writeBuffer[0];
+        iov[iovcnt++].iov_len = m_writeBuffer.size();
+    }
+    iov[iovcnt].iov_base = (void*)buff;
+    iov[iovcnt++].iov_len = length;
+    int rt = sendAll(iov, iovcnt, 0);
+    m_writeBuffer.clear();
+    return rt <= 0 ? rt : length;
+}
+
+int SocketStream::write(ByteArray::ptr ba , size_t length){
+    if(!isConnected()){
+        return -1;
+    }
+    std::vector<iovec> iovs;
+    length = ba->getReadBuffers(iovs, length);
+    if(length == 0){
+        return 0;
+    }
+    if(!m_writeBufferSize){
+        int rt = m_socket->send(&iovs[0], iovs.size());
+        if(rt > 0){
+            ba->setPosition(ba->getPosition() + rt);
+        }
+        return rt;
+    }
+    if(length < m_writeBufferSize){
+        if(m_writeBuffer.size() + length > m_writeBufferSize){
+            int rt = flushWrite();
+            if(rt <= 0){
+                return rt;
+            }
+        }
+        for(auto& i : iovs){
+            m_writeBuffer.append((const char*)i.iov_base, i.iov_len);
+        }
+        ba->setPosition(ba->getPosition() + length);
+        return length;
+    }
+    if(!m_writeBuffer.empty()){
+        iovec iov;
+        iov.iov_base = &m_writeBuffer[0];
+        iov.iov_len = m_writeBuffer.size();
+        iovs.insert(iovs.begin(), iov);
+    }
+    int rt = sendAll(&iovs[0], iovs.size(), 0);
+    m_writeBuffer.clear();
+    if(rt <= 0){
+        return rt;
+    }
+    ba->setPosition(ba->getPosition() + length);
+    return length;
+}
+
+int SocketStream::flushWrite(){
+    if(m_writeBuffer.empty()){
+        return 0;
+    }
+    if(!isConnected()){
+        m_writeBuffer.clear();
+        return -1;
+    }
+    iovec iov;
+    iov.iov_base = &m_writeBuffer[0];
+    iov.iov_len = m_writeBuffer.size();
+    int rt = sendAll(&iov, 1, 0);
+    m_writeBuffer.clear();
+    return rt;
+}
+
+int SocketStream::writevFixSize(iovec* iov , size_t iovcnt , int flags){
+    if(!isConnected()){
+        return -1;
+    }
+    if(!m_writeBuffer.empty()){
+        int rt = flushWrite();
+        if(rt <= 0){
+            return rt;
+        }
+    }
+    return sendAll(iov, iovcnt, flags);
+}
+
+int SocketStream::sendAll(iovec* iov , size_t iovcnt , int flags){
+    size_t total = 0;
+    while(iovcnt > 0){
+        int rt = m_socket->send(iov, iovcnt, flags);
+        if(rt <= 0){
+            return rt;
+        }
+        total += rt;
+        size_t n = rt;
+        while(iovcnt > 0 && n >= iov->iov_len){
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if(iovcnt > 0){
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return total;
+}
+
+int SocketStream::writeZeroCopy(std::shared_ptr<const void> owner , const void* data , size_t length){
+    if(!isConnected()){
+        return -1;
+    }
+    if(!m_writeBuffer.empty()){
+        int rt = flushWrite();
+        if(rt <= 0){
+            return rt;
+        }
+    }
+    size_t offset = 0;
+    while(offset < length){
+        int rt = m_socket->sendZeroCopy(owner, (const char*)data + offset, length - offset);
+        if(rt <= 0){
+            return rt;
+        }
+        offset += rt;
+    }
+    return length;
+}
+
+int64_t SocketStream::sendFileFixSize(int fd , uint64_t offset , uint64_t length){
+    if(!isConnected()){
+        return -1;
+    }
+    if(!m_writeBuffer.empty()){
+        iovec iov;
+        iov.iov_base = &m_writeBuffer[0];
+        iov.iov_len = m_writeBuffer.size();
+        int rt = sendAll(&iov, 1, MSG_MORE);
+        m_writeBuffer.clear();
+        if(rt <= 0){
+            return rt;
+        }
+    }
+    off_t off = offset;
+    uint64_t left = length;
+    while(left > 0){
+        /// 返回值是 int, 每次最多发送 1GB
+        int rt = m_socket->sendFile(fd, &off, std::min(left, (uint64_t)1 << 30));
+        if(rt <= 0){
+            return rt;
+        }
+        left -= rt;
+    }
+    return length;
+}
+
+int SocketStream::close(){
+    flushWrite();
+    if(m_socket){
+        m_socket->close();
+    }
+    return 0;
+}
+
+}
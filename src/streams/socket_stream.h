@@ -0,0 +1,144 @@
+/**
+ * @file socket_stream.h
+ * @brief socket 流封装
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-19
+ * 
+ * @copyright Copyright (c) 2021  wyz
+ * 
+ */
+
+#ifndef __WYZ_SOCKET_STREAM_H__
+#define __WYZ_SOCKET_STREAM_H__
+
+#include "../stream.h"
+#include "../socket.h"
+#include <string>
+#include <vector>
+
+namespace wyz {
+
+/**
+ * @brief socket 流
+ * @details 默认每次 read/write 直接对应一次 recv/send. 可以分别开启:
+ *          读缓冲: 小于缓冲区的读先 recv 一整块到缓冲区, 之后的读从缓冲区取, 减少系统调用;
+ *          写合并: 小的写先追加到缓冲区, 在 flushWrite, 缓冲区满, 写大块数据,
+ *          writevFixSize/sendFileFixSize 或者 read 之前用一次 writev 发出.
+ *          HttpSession/HttpConnection 自己管理读缓冲区, 不需要开启
+ */
+class SocketStream : public Stream {
+public:
+    using ptr = std::shared_ptr<SocketStream>;
+
+    /**
+     * @brief Construct a new Socket Stream object
+     * @param  socket           socket套接字封装类
+     * @param  owner            是否托管(析构时关闭 socket)
+     */
+    SocketStream(Socket::ptr socket , bool owner = true);
+    ~SocketStream();
+
+    /**
+     * @brief 读数据, 开启写合并时先发出缓冲的数据, 避免对方等不到请求
+     * @return int  >0 读到的长度
+     *              =0 对方关闭
+     *              <0 Socket异常
+     */
+    int read(void * buff , size_t length) override;
+    int read(ByteArray::ptr ba , size_t length) override;
+
+    /**
+     * @brief 写数据, 开启写合并时小的写只追加到缓冲区, 返回 length
+     * @return int  >0 写出的长度
+     *              =0 对方关闭
+     *              <0 Socket异常
+     */
+    int write(const void * buff , size_t length) override;
+    int write(ByteArray::ptr ba , size_t length) override;
+
+    /**
+     * @brief 用 writev 写出全部 iovec, 部分写出时调整 iov 继续写
+     * @param  iov              要写出的数据, 会被修改
+     * @param  iovcnt           iovec 个数
+     * @param  flags            send 的标志, 例如后面还有数据时用 MSG_MORE
+     * @return int  >0 写出的总长度
+     *              =0 对方关闭
+     *              <0 Socket异常
+     */
+    int writevFixSize(iovec* iov , size_t iovcnt , int flags = 0);
+
+    /**
+     * @brief 用 sendfile 发送文件中的一段, 直到全部发送
+     * @param  fd               文件描述符
+     * @param  offset           起始位置
+     * @param  length           长度
+     * @return int64_t  >0 发送的长度
+     *                  =0 对方关闭
+     *                  <0 Socket异常
+     */
+    int64_t sendFileFixSize(int fd , uint64_t offset , uint64_t length);
+
+    /**
+     * @brief 用 Socket::sendZeroCopy 写出全部数据, 先发出写合并缓冲区中的数据
+     * @details 需要先对 socket 调用 setZeroCopy, 否则与 writeFixSize 相同
+     * @param  owner            持有 data 所在的内存, 内核发送完成后释放
+     * @return int  >0 写出的长度
+     *              =0 对方关闭
+     *              <0 Socket异常
+     */
+    int writeZeroCopy(std::shared_ptr<const void> owner , const void* data , size_t length);
+
+    /**
+     * @brief 发出写合并缓冲区中的数据
+     * @return int  >0 写出的长度
+     *              =0 缓冲区为空或对方关闭
+     *              <0 Socket异常
+     */
+    int flushWrite();
+
+    /**
+     * @brief 关闭前发出写合并缓冲区中的数据
+     */
+    int close() override;
+
+    inline Socket::ptr getSocket() const    {return m_socket;}
+    bool isConnected() const;
+
+    /**
+     * @brief 设置读缓冲区大小, 0 关闭读缓冲. 缓冲区中还有数据时不能缩小到数据长度以下
+     */
+    void setReadBufferSize(size_t v);
+    inline size_t getReadBufferSize() const     {return m_readBuffer.size();}
+    /// 读缓冲区中还没有读走的数据长度
+    inline size_t getReadBuffered() const       {return m_readLen - m_readPos;}
+
+    /**
+     * @brief 设置写合并缓冲区大小, 0 关闭写合并. 关闭时先发出缓冲区中的数据
+     */
+    void setWriteBufferSize(size_t v);
+    inline size_t getWriteBufferSize() const    {return m_writeBufferSize;}
+    /// 写合并缓冲区中还没有发出的数据长度
+    inline size_t getWriteBuffered() const      {return m_writeBuffer.size();}
+
+private:
+    /// 从读缓冲区取数据, 返回取到的长度
+    size_t readBuffered(void* buff , size_t length);
+    /// writevFixSize 不先发出写合并缓冲区的版本
+    int sendAll(iovec* iov , size_t iovcnt , int flags);
+
+protected:
+    Socket::ptr m_socket;
+    bool m_owner;
+
+private:
+    std::vector<char> m_readBuffer;
+    size_t m_readPos = 0;           /// 读缓冲区中下一个未读字节的位置
+    size_t m_readLen = 0;           /// 读缓冲区中数据的结束位置
+    std::string m_writeBuffer;
+    size_t m_writeBufferSize = 0;
+};
+
+}
+
+#endif
@@ -12,8 +12,12 @@
 #include "tcpserver.h"
 #include "log.h"
 #include "config.h"
+#include "util.h"
 #include <cstring>
 #include <functional>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <vector>
 
 
@@ -22,6 +26,34 @@ namespace wyz {
 static wyz::Logger::ptr g_logger = WYZ_LOG_NAME("system");
 
 static wyz::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout = Config::Lookup("tcp_server.read_timeout", (uint64_t) (60 * 1000 * 2),"tcp server read timeout");
+static wyz::ConfigVar<bool>::ptr g_tcp_server_reuse_port = Config::Lookup("tcp_server.reuse_port", false, "tcp server one SO_REUSEPORT listener per accept thread");
+static wyz::ConfigVar<uint32_t>::ptr g_tcp_server_accept_batch = Config::Lookup("tcp_server.accept_batch", (uint32_t)1, "tcp server max connections accepted per wakeup");
+static wyz::ConfigVar<uint64_t>::ptr g_tcp_server_drain_timeout = Config::Lookup("tcp_server.drain_timeout", (uint64_t)30000, "tcp server hot restart max wait(ms) for in-flight connections");
+static wyz::ConfigVar<uint64_t>::ptr g_tcp_server_handoff_timeout = Config::Lookup("tcp_server.handoff_timeout", (uint64_t)10000, "tcp server hot restart max wait(ms) for the new process to ack");
+
+/// 交接监听 socket 的报文头
+struct HandoffHeader {
+    uint32_t magic;
+    uint32_t count;     /// 后面 SCM_RIGHTS 中的描述符个数
+};
+static const uint32_t s_handoff_magic = 0x57595a48;
+/// 一次最多交接的监听 socket 数
+static const size_t s_max_handoff_fds = 64;
+
+/// 交接的对方必须与本进程是同一个用户
+static bool CheckHandoffPeer(Socket::ptr sock){
+    ucred cred;
+    socklen_t len = sizeof(cred);
+    if(getsockopt(sock->getSocket(), SOL_SOCKET, SO_PEERCRED, &cred, &len)){
+        WYZ_LOG_ERROR(g_logger) << "tcpserver handoff SO_PEERCRED errno= " << errno << "strerrno = " << strerror(errno);
+        return false;
+    }
+    if(cred.uid != geteuid()){
+        WYZ_LOG_ERROR(g_logger) << "tcpserver handoff reject peer pid=" << cred.pid << " uid=" << cred.uid;
+        return false;
+    }
+    return true;
+}
 
 
 TCPServer::TCPServer(IOManager* worker, IOManager* acceptworker )
@@ -29,15 +61,20 @@ TCPServer::TCPServer(IOManager* worker, IOManager* acceptworker )
     , m_acceptworker(acceptworker)
     , m_recvTimeout(g_tcp_server_read_timeout->getValue())
     , m_name("wyz/1.0.0")
-    , m_isStop(true){
+    , m_isStop(true)
+    , m_reusePort(g_tcp_server_reuse_port->getValue())
+    , m_acceptBatch(g_tcp_server_accept_batch->getValue())
+    , m_drainTimeout(g_tcp_server_drain_timeout->getValue())
+    , m_handoffTimeout(g_tcp_server_handoff_timeout->getValue()){
 
 }
 
 TCPServer::~TCPServer(){
-    for(auto& i : m_socks) {
-        i->close();
+    Mutex::Lock lock(m_listenersMutex);
+    for(auto& i : m_listeners) {
+        i->sock->close();
     }
-    m_socks.clear();
+    m_listeners.clear();
 }
 
 bool TCPServer::bind(const Address::ptr addr){
@@ -48,42 +85,85 @@ bool TCPServer::bind(const Address::ptr addr){
 }
 
 bool TCPServer::bind(std::vector<Address::ptr>& addrs , std::vector<Address::ptr>& failedaddress){
+    Mutex::Lock lock(m_listenersMutex);
     bool rt = true;
+    std::vector<int> threads;
+    if(m_reusePort){
+        threads = m_acceptworker->getThreadIds();
+    }
+    if(threads.empty()){
+        threads.push_back(-1);
+    }
     for(auto addr : addrs){
-        Socket::ptr sock = Socket::CreateTCP(addr);
-        if(!sock->bind(addr)){
-            /// 没bind 成功
-            WYZ_LOG_ERROR(g_logger) << "tcpserver bind errno= " << errno << "strerrno = " << strerror(errno) << " addr=[" << addr->toString() << "]";
-            rt = false;
-            failedaddress.emplace_back(addr);
-            continue;
+        /// 端口为 0 时, 后面的 socket 绑定到第一个 socket 分到的端口上
+        Address::ptr bind_addr = addr;
+        for(size_t i = 0 ; i < threads.size() ; ++i){
+            Socket::ptr sock = Socket::CreateTCP(addr);
+            if(m_reusePort && !sock->reusePort()){
+                WYZ_LOG_ERROR(g_logger) << "tcpserver reuseport errno= " << errno << "strerrno = " << strerror(errno) << " addr=[" << addr->toString() << "]";
+                rt = false;
+                failedaddress.emplace_back(addr);
+                break;
+            }
+            if(!sock->bind(bind_addr)){
+                /// 没bind 成功
+                WYZ_LOG_ERROR(g_logger) << "tcpserver bind errno= " << errno << "strerrno = " << strerror(errno) << " addr=[" << addr->toString() << "]";
+                rt = false;
+                failedaddress.emplace_back(addr);
+                break;
+            }
+            if(!sock->listen()){
+                WYZ_LOG_ERROR(g_logger) << "tcpserver listen errno= " << errno << "strerrno = " << strerror(errno) << " addr=[" << addr->toString() << "]";
+                rt = false;
+                failedaddress.emplace_back(addr);
+                break;
+            }
+            bind_addr = sock->getLocalAddress();
+            Listener::ptr listener(new Listener);
+            listener->sock = sock;
+            listener->address = bind_addr;
+            listener->thread = threads[i];
+            m_listeners.emplace_back(listener);
         }
-        if(!sock->listen()){
-            WYZ_LOG_ERROR(g_logger) << "tcpserver listen errno= " << errno << "strerrno = " << strerror(errno) << " addr=[" << addr->toString() << "]";
-            rt = false;
-            failedaddress.emplace_back(addr);
-            continue;
-        }
-        m_socks.emplace_back(sock);
     }
     if(!failedaddress.empty()){
-        m_socks.clear();
+        m_listeners.clear();
     }
-    for(auto i : m_socks) {
-        WYZ_LOG_INFO(g_logger) << " name=" << m_name << " server bind success: " << i->toString();
+    for(auto& i : m_listeners) {
+        WYZ_LOG_INFO(g_logger) << " name=" << m_name << " server bind success: " << *i->sock
+            << " thread=" << i->thread;
     }
 
     return rt;
 }
 
-void TCPServer::startAccept(Socket::ptr sock){
+void TCPServer::startAccept(Listener::ptr listener){
+    Socket::ptr sock = listener->sock;
+    /// 同一个调度器时, 连接留在接受它的线程上处理
+    int thread = m_worker == m_acceptworker ? listener->thread : -1;
+    std::vector<Socket::ptr> clients;
     while(!m_isStop){
-        Socket::ptr client = sock->accept();
-        if(client){
-            client->setRecvTimeout(m_recvTimeout);
-            m_worker->schedule(std::bind(&TCPServer::handleClient , shared_from_this() , client));
-        }else {
+        clients.clear();
+        if(m_acceptBatch > 1){
+            sock->accept(clients, m_acceptBatch);
+        }else if(Socket::ptr client = sock->accept()){
+            clients.emplace_back(client);
+        }
+        if(clients.empty()){
+            if(m_isStop){
+                break;
+            }
             WYZ_LOG_ERROR(g_logger) << "accept errno=" << errno << "errstr= " << strerror(errno);
+            continue;
+        }
+        listener->accepted += clients.size();
+        for(auto& client : clients){
+            client->setRecvTimeout(m_recvTimeout);
+            {
+                Mutex::Lock lock(m_clientsMutex);
+                m_clients[client] = false;
+            }
+            m_worker->schedule(std::bind(&TCPServer::serveClient , shared_from_this() , client), thread);
         }
     }
 
@@ -94,8 +174,22 @@ bool TCPServer::start(){
         return true;
     }
     m_isStop = false;
-    for(auto sock : m_socks){
-        m_acceptworker->schedule(std::bind(&TCPServer::startAccept, shared_from_this() , sock));
+    m_startTime = GetCurrentMS();
+    Mutex::Lock lock(m_listenersMutex);
+    for(auto& listener : m_listeners){
+        /// stop 之后再 start, 已关闭的 socket 不再 accept
+        if(!listener->sock->isvaild()){
+            continue;
+        }
+        m_acceptworker->schedule(std::bind(&TCPServer::startAccept, shared_from_this() , listener)
+                , listener->thread);
+    }
+    /// 已经开始 accept, 通知旧进程停止
+    if(m_handoffPeer){
+        char ack = 1;
+        m_handoffPeer->send(&ack, 1);
+        m_handoffPeer->close();
+        m_handoffPeer.reset();
     }
     return true;
 }
@@ -104,14 +198,241 @@ void TCPServer::stop(){
     m_isStop = true;
     auto self = shared_from_this();
     m_acceptworker->schedule([this , self]() {
-        for(auto sock : m_socks){
-            sock->cancelAll();
-            sock->close();
+        {
+            Mutex::Lock lock(m_listenersMutex);
+            for(auto& listener : m_listeners){
+                listener->sock->cancelAll();
+                listener->sock->close();
+            }
+        }
+        if(m_handoffListener){
+            m_handoffListener->cancelAll();
+            m_handoffListener->close();
+            m_handoffListener.reset();
         }
-        m_socks.clear();
     });
 }
 
+bool TCPServer::listenHandoff(const std::string& path , std::function<void (bool)> cb){
+    Address::ptr addr(new UnixAddress(path));
+    Socket::ptr sock = Socket::CreateUnixTCPSock();
+    unlink(path.c_str());
+    /// listen 之前改权限, 其他用户连不上
+    if(!sock->bind(addr) || chmod(path.c_str(), 0600) || !sock->listen()){
+        WYZ_LOG_ERROR(g_logger) << "tcpserver handoff bind errno= " << errno << "strerrno = " << strerror(errno) << " path=" << path;
+        return false;
+    }
+    m_handoffListener = sock;
+    m_acceptworker->schedule(std::bind(&TCPServer::serveHandoff, shared_from_this(), sock, path, cb));
+    return true;
+}
+
+bool TCPServer::sendListeners(Socket::ptr peer){
+    std::vector<int> listen_fds;
+    {
+        Mutex::Lock lock(m_listenersMutex);
+        for(auto& listener : m_listeners){
+            if(listener->sock->isvaild()){
+                listen_fds.push_back(listener->sock->getSocket());
+            }
+        }
+    }
+    if(listen_fds.empty() || listen_fds.size() > s_max_handoff_fds){
+        WYZ_LOG_ERROR(g_logger) << "tcpserver handoff listeners=" << listen_fds.size();
+        return false;
+    }
+    HandoffHeader header;
+    header.magic = s_handoff_magic;
+    header.count = listen_fds.size();
+    iovec iov;
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * header.count));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * header.count);
+    int* fds = (int*)CMSG_DATA(cmsg);
+    for(size_t i = 0 ; i < listen_fds.size() ; ++i){
+        fds[i] = listen_fds[i];
+    }
+    return ::sendmsg(peer->getSocket(), &msg, 0) == (ssize_t)sizeof(header);
+}
+
+void TCPServer::serveHandoff(Socket::ptr sock , std::string path , std::function<void (bool)> cb){
+    bool handed = false;
+    /// 可以在 start 之前调用, stop 关闭 sock 后退出
+    while(!handed){
+        Socket::ptr peer = sock->accept();
+        if(!peer){
+            if(!sock->isvaild()){
+                break;
+            }
+            continue;
+        }
+        if(!CheckHandoffPeer(peer)){
+            continue;
+        }
+        if(!sendListeners(peer)){
+            WYZ_LOG_ERROR(g_logger) << "tcpserver handoff send errno= " << errno << "strerrno = " << strerror(errno);
+            continue;
+        }
+        /// 新进程 start 之后才确认, 断开或超时说明新进程启动失败
+        peer->setRecvTimeout(m_handoffTimeout);
+        char ack = 0;
+        handed = peer->recv(&ack, 1) == 1;
+        WYZ_LOG_INFO(g_logger) << " name=" << m_name << " handoff " << (handed ? "done" : "fail, keep serving");
+    }
+    sock->close();
+    unlink(path.c_str());
+    if(!handed){
+        return;
+    }
+    /// 只关闭本进程的描述符, 监听 socket 仍在新进程中
+    stop();
+    drain(cb);
+}
+
+bool TCPServer::bindHandoff(const std::string& path , uint64_t timeout_ms){
+    Address::ptr addr(new UnixAddress(path));
+    Socket::ptr sock = Socket::CreateUnixTCPSock();
+    if(!sock->connect(addr, timeout_ms)){
+        WYZ_LOG_ERROR(g_logger) << "tcpserver handoff connect errno= " << errno << "strerrno = " << strerror(errno) << " path=" << path;
+        return false;
+    }
+    if(!CheckHandoffPeer(sock)){
+        return false;
+    }
+    sock->setRecvTimeout(timeout_ms);
+    HandoffHeader header;
+    iovec iov;
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * s_max_handoff_fds));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    ssize_t n = ::recvmsg(sock->getSocket(), &msg, MSG_CMSG_CLOEXEC);
+    std::vector<int> fds;
+    for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg) ; n > 0 && cmsg ; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int* data = (int*)CMSG_DATA(cmsg);
+            fds.insert(fds.end(), data, data + count);
+        }
+    }
+    if(n != (ssize_t)sizeof(header) || header.magic != s_handoff_magic
+            || header.count != fds.size() || (msg.msg_flags & MSG_CTRUNC)){
+        WYZ_LOG_ERROR(g_logger) << "tcpserver handoff recv fail n=" << n << " errno= " << errno
+            << " fds=" << fds.size();
+        for(int fd : fds){
+            ::close(fd);
+        }
+        return false;
+    }
+
+    std::vector<int> threads;
+    if(m_reusePort){
+        threads = m_acceptworker->getThreadIds();
+    }
+    Mutex::Lock lock(m_listenersMutex);
+    for(size_t i = 0 ; i < fds.size() ; ++i){
+        Listener::ptr listener(new Listener);
+        listener->sock = Socket::Attach(fds[i]);
+        if(!listener->sock){
+            ::close(fds[i]);
+            continue;
+        }
+        listener->address = listener->sock->getLocalAddress();
+        listener->thread = threads.empty() ? -1 : threads[i % threads.size()];
+        m_listeners.emplace_back(listener);
+        WYZ_LOG_INFO(g_logger) << " name=" << m_name << " server handoff success: " << *listener->sock
+            << " thread=" << listener->thread;
+    }
+    m_handoffPeer = sock;
+    return !m_listeners.empty();
+}
+
+void TCPServer::drain(std::function<void (bool)> cb){
+    /// 阻塞在读上的协程只能靠 shutdown 唤醒, cancelAll 之后 hook 会重新等待
+    {
+        Mutex::Lock lock(m_clientsMutex);
+        m_draining = true;
+        for(auto& i : m_clients){
+            if(i.second && i.first->getSocket() >= 0){
+                ::shutdown(i.first->getSocket(), SHUT_RDWR);
+            }
+        }
+    }
+    uint64_t deadline = GetCurrentMS() + m_drainTimeout;
+    while(getClientCount() > 0 && GetCurrentMS() < deadline){
+        usleep(10 * 1000);
+    }
+    bool drained = true;
+    {
+        Mutex::Lock lock(m_clientsMutex);
+        if(!m_clients.empty()){
+            WYZ_LOG_WARN(g_logger) << " name=" << m_name << " drain timeout, close " << m_clients.size() << " connections";
+            drained = false;
+            for(auto& i : m_clients){
+                if(i.first->getSocket() >= 0){
+                    ::shutdown(i.first->getSocket(), SHUT_RDWR);
+                }
+            }
+        }
+    }
+    if(cb){
+        cb(drained);
+    }
+}
+
+bool TCPServer::setClientIdle(Socket::ptr client , bool idle){
+    Mutex::Lock lock(m_clientsMutex);
+    if(idle && m_draining){
+        return false;
+    }
+    auto it = m_clients.find(client);
+    if(it != m_clients.end()){
+        it->second = idle;
+    }
+    return true;
+}
+
+size_t TCPServer::getClientCount() const{
+    Mutex::Lock lock(m_clientsMutex);
+    return m_clients.size();
+}
+
+void TCPServer::serveClient(Socket::ptr client){
+    handleClient(client);
+    Mutex::Lock lock(m_clientsMutex);
+    m_clients.erase(client);
+}
+
+std::vector<TCPServer::AcceptStat> TCPServer::getAcceptStats() const{
+    std::vector<AcceptStat> stats;
+    uint64_t used = m_startTime ? GetCurrentMS() - m_startTime : 0;
+    Mutex::Lock lock(m_listenersMutex);
+    for(auto& listener : m_listeners){
+        AcceptStat stat;
+        stat.address = listener->address ? listener->address->toString() : "";
+        stat.thread = listener->thread;
+        stat.accepted = listener->accepted;
+        stat.rate = used ? stat.accepted * 1000.0 / used : 0;
+        stats.emplace_back(stat);
+    }
+    return stats;
+}
+
 void TCPServer::handleClient(Socket::ptr client){
     WYZ_LOG_INFO(g_logger) << "handleClient: " << *client;
 }
@@ -12,11 +12,16 @@
 #ifndef __TCP_SERVER_H__
 #define __TCP_SERVER_H__
 
+#include <atomic>
 #include <memory>
 #include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include "iomanager.h"
 #include "address.h"
 #include "socket.h"
+#include "mutex.h"
 #include "noncopyable.h"
 
 namespace wyz {
@@ -31,25 +36,106 @@ public:
     virtual bool bind(std::vector<Address::ptr>& addrs , std::vector<Address::ptr>& failedaddress);
 
     virtual bool start();
+    /// 关闭监听 socket, 监听记录与接受计数保留到析构, 之后 getAcceptStats 仍然有效
     virtual void stop();
 
+    /**
+     * @brief 热重启, 旧进程调用: 在 Unix socket path 上等待新进程, 用 SCM_RIGHTS 把监听 socket 交给它
+     * @details path 的权限为 0600, 只接受同一用户的进程. 新进程 start 之后停止 accept, 全连接队列中的连接由新进程接受.
+     *          然后关闭空闲(setClientIdle)的连接, 等待正在处理的连接结束, 超过 drain_timeout 时关闭剩下的连接,
+     *          最后调用 cb(是否全部正常结束), 一般在 cb 中退出进程.
+     *          新进程没有在 handoff_timeout 内确认就断开时继续服务, 等待下一个新进程
+     */
+    bool listenHandoff(const std::string& path , std::function<void (bool)> cb = nullptr);
+
+    /**
+     * @brief 热重启, 新进程调用: 代替 bind, 从旧进程接收监听 socket, start 时通知旧进程停止 accept
+     */
+    bool bindHandoff(const std::string& path , uint64_t timeout_ms = 5000);
+
+    /**
+     * @brief 单个监听 socket 的接受统计
+     */
+    struct AcceptStat {
+        std::string address;    /// 监听地址
+        int thread;             /// 固定在哪个线程上 accept, -1 表示不固定
+        uint64_t accepted;      /// 已接受的连接数
+        double rate;            /// start 以来平均每秒接受的连接数
+    };
+
+    /// 每个监听 socket 的接受统计
+    std::vector<AcceptStat> getAcceptStats() const;
+
     inline uint64_t getReadTimeout()const       {return m_recvTimeout;}
     inline std::string getName()    const       {return m_name;}
+    inline bool isReusePort()   const           {return m_reusePort;}
+    inline uint32_t getAcceptBatch() const      {return m_acceptBatch;}
+    inline uint64_t getDrainTimeout() const     {return m_drainTimeout;}
+    inline uint64_t getHandoffTimeout() const   {return m_handoffTimeout;}
+    /// 正在处理的连接数
+    size_t getClientCount() const;
 
     inline void setReadTimeout(uint64_t v)      {m_recvTimeout = v;}
     inline void setName(const std::string& v)   {m_name = v;}
+    /// 需要在 bind 之前设置
+    inline void setReusePort(bool v)            {m_reusePort = v;}
+    inline void setAcceptBatch(uint32_t v)      {m_acceptBatch = v;}
+    inline void setDrainTimeout(uint64_t v)     {m_drainTimeout = v;}
+    inline void setHandoffTimeout(uint64_t v)   {m_handoffTimeout = v;}
 
     inline bool isStop()    const               {return m_isStop;}
 protected:
+    /**
+     * @brief 监听 socket
+     */
+    struct Listener {
+        using ptr = std::shared_ptr<Listener>;
+        Socket::ptr sock;                       /// 监听 socket
+        Address::ptr address;                   /// 本地地址, socket 关闭后统计仍然可用
+        int thread = -1;                        /// reuseport 模式下固定的 accept 线程
+        std::atomic<uint64_t> accepted = {0};   /// 已接受的连接数
+    };
+
     virtual void handleClient(Socket::ptr client);            /// 服务器连接上一个 socket 后触发的回调
-    virtual void startAccept(Socket::ptr sock);             /// 接受客户端连接
+    virtual void startAccept(Listener::ptr listener);       /// 接受客户端连接
+
+    /**
+     * @brief 标记连接是否在两个请求之间空闲, 由 handleClient 在等待下一个请求前后调用
+     * @details 热重启 drain 开始时直接关闭空闲的连接, 不等待它们的读超时
+     * @return bool             false 表示正在 drain, 调用方应当关闭连接
+     */
+    bool setClientIdle(Socket::ptr client , bool idle);
 private:
-    std::vector<Socket::ptr> m_socks;       /// 存放已经accpect 的socket
+    /// 调用 handleClient, 返回后从正在处理的连接中去掉
+    void serveClient(Socket::ptr client);
+    /// 旧进程: 等待新进程连接并交出监听 socket
+    void serveHandoff(Socket::ptr sock , std::string path , std::function<void (bool)> cb);
+    bool sendListeners(Socket::ptr peer);
+    /// 等待正在处理的连接结束
+    void drain(std::function<void (bool)> cb);
+
+    /// 保护 m_listeners: stop 在 accept 线程上关闭 socket 时其他线程可能在读统计
+    mutable Mutex m_listenersMutex;
+    /// 监听 socket, stop 只关闭 socket, 连同计数保留到析构
+    std::vector<Listener::ptr> m_listeners;
     IOManager* m_worker;                    /// 主工作线程 
     IOManager* m_acceptworker;              /// (每接受一个socket，突发一个回调函数，m_acceptworker 调度下)
     uint64_t m_recvTimeout;                 /// 服务器接受数据超时时间
     std::string m_name;                     /// tcpserver name
     bool m_isStop;                          /// tcpserver 是否停止
+    /// 每个地址为 m_acceptworker 的每个线程各开一个 SO_REUSEPORT 监听 socket,
+    /// 连接在接受它的线程上处理 (m_worker 与 m_acceptworker 相同时)
+    bool m_reusePort;
+    /// 一次唤醒最多接受的连接数, 大于 1 时先把全连接队列取空再挂起
+    uint32_t m_acceptBatch;
+    uint64_t m_startTime = 0;               /// start 的时间(ms), 用于计算接受速率
+    uint64_t m_drainTimeout;                /// 热重启时等待连接结束的最长时间(ms)
+    uint64_t m_handoffTimeout;              /// 旧进程等待新进程确认的最长时间(ms)
+    mutable Mutex m_clientsMutex;
+    std::unordered_map<Socket::ptr, bool> m_clients;    /// 正在处理的连接, 值表示是否空闲
+    bool m_draining = false;
+    Socket::ptr m_handoffListener;          /// 旧进程: 等待新进程的 Unix socket
+    Socket::ptr m_handoffPeer;              /// 新进程: 与旧进程的连接, start 时发送确认
 };
 
 }
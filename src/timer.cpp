@@ -6,12 +6,250 @@
  */
 
 #include "timer.h"
+#include "config.h"
 #include "util.h"
 #include <functional>
 #include <memory>
 
 namespace wyz {
 
+static wyz::ConfigVar<bool>::ptr g_timer_wheel =
+    wyz::Config::Lookup("timer.wheel", false, "timer manager use hierarchical timing wheel");
+
+/**
+ * @brief 分层时间轮, 精度 1ms
+ * @details 第 0 层 256 个槽, 之上 4 层各 64 个槽, 覆盖 2^32 ms,
+ *          更远的定时器挂在最高层, 到期时重新放入
+ *          插入/删除 O(1), 低层转完一圈时把上一层对应槽的定时器重新分配(cascade)
+ * @attention 不加锁, 由 TimerManager 的锁保护
+ */
+class TimerWheel {
+public:
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int LEVELS = 4;
+    static const uint64_t ROOT_SIZE = 1ull << ROOT_BITS;
+    static const uint64_t ROOT_MASK = ROOT_SIZE - 1;
+    static const uint64_t LEVEL_SIZE = 1ull << LEVEL_BITS;
+    static const uint64_t LEVEL_MASK = LEVEL_SIZE - 1;
+    static const uint64_t MAX_DELTA = (1ull << (ROOT_BITS + LEVELS * LEVEL_BITS)) - 1;
+
+    TimerWheel(uint64_t now_ms)
+        :m_time(now_ms) {
+    }
+
+    ~TimerWheel() {
+        std::vector<Timer::ptr> timers;
+        clear(timers);
+    }
+
+    inline size_t size() const { return m_count;}
+
+    void add(const Timer::ptr& timer) {
+        if(m_count == 0) {
+            /// 空闲期间没有推进, 直接对齐到当前时间
+            uint64_t now_ms = wyz::GetCurrentMS();
+            if(now_ms > m_time) {
+                m_time = now_ms;
+            }
+        }
+        link(timer.get());
+        timer->m_wheelRef = timer;
+        ++m_count;
+    }
+
+    bool remove(Timer* timer) {
+        if(!timer->m_wheelSlot) {
+            return false;
+        }
+        unlink(timer);
+        --m_count;
+        timer->m_wheelRef.reset();
+        return true;
+    }
+
+    /**
+     * @brief 最近可能到期的时间
+     * @details 第 0 层没有定时器时返回下一次 cascade 的时间
+     */
+    uint64_t nextExpire() const {
+        if(m_count == 0) {
+            return ~0ull;
+        }
+        uint64_t idx = m_time & ROOT_MASK;
+        int next = findRoot(idx);
+        if(next >= 0) {
+            return m_time - idx + next;
+        }
+        if(idx == 0) {
+            /// 停在一圈的起点, 上层还没有 cascade 下来
+            return m_time;
+        }
+        return (m_time | ROOT_MASK) + 1;
+    }
+
+    /**
+     * @brief 推进时间轮到 now_ms, 取出所有到期的定时器
+     */
+    void expire(uint64_t now_ms, std::vector<Timer::ptr>& expired) {
+        while(m_time <= now_ms) {
+            if(m_count == 0) {
+                m_time = now_ms + 1;
+                break;
+            }
+            uint64_t idx = m_time & ROOT_MASK;
+            if(idx == 0) {
+                for(int i = 0; i < LEVELS; ++i) {
+                    uint64_t slot = (m_time >> (ROOT_BITS + i * LEVEL_BITS)) & LEVEL_MASK;
+                    cascade(i, slot);
+                    if(slot != 0) {
+                        break;
+                    }
+                }
+            }
+            int next = findRoot(idx);
+            uint64_t target = next >= 0 ? m_time - idx + next : (m_time | ROOT_MASK) + 1;
+            if(target > now_ms) {
+                m_time = now_ms + 1;
+                break;
+            }
+            m_time = target;
+            if(next < 0) {
+                continue;
+            }
+            Timer* timer = m_root[next];
+            m_root[next] = nullptr;
+            m_rootBits[next >> 6] &= ~(1ull << (next & 63));
+            while(timer) {
+                Timer* t = timer;
+                timer = timer->m_wheelNext;
+                t->m_wheelPrev = t->m_wheelNext = nullptr;
+                t->m_wheelSlot = nullptr;
+                if(t->m_next > now_ms) {
+                    /// 超出时间轮范围的定时器, 重新放入
+                    link(t);
+                    continue;
+                }
+                --m_count;
+                expired.push_back(std::move(t->m_wheelRef));
+            }
+            ++m_time;
+        }
+    }
+
+    /**
+     * @brief 取出所有定时器
+     */
+    void clear(std::vector<Timer::ptr>& timers) {
+        for(uint64_t i = 0; i < ROOT_SIZE; ++i) {
+            take(m_root[i], timers);
+        }
+        for(int i = 0; i < LEVELS; ++i) {
+            for(uint64_t j = 0; j < LEVEL_SIZE; ++j) {
+                take(m_levels[i][j], timers);
+            }
+        }
+        for(auto& bits : m_rootBits) {
+            bits = 0;
+        }
+        m_count = 0;
+    }
+
+private:
+    void link(Timer* timer) {
+        uint64_t expires = timer->m_next < m_time ? m_time : timer->m_next;
+        uint64_t delta = expires - m_time;
+        Timer** slot = nullptr;
+        if(delta < ROOT_SIZE) {
+            uint64_t idx = expires & ROOT_MASK;
+            slot = &m_root[idx];
+            m_rootBits[idx >> 6] |= 1ull << (idx & 63);
+        } else {
+            if(delta > MAX_DELTA) {
+                expires = m_time + MAX_DELTA;
+                delta = MAX_DELTA;
+            }
+            int level = 0;
+            int shift = ROOT_BITS;
+            while(level < LEVELS - 1 && delta >= (1ull << (shift + LEVEL_BITS))) {
+                ++level;
+                shift += LEVEL_BITS;
+            }
+            slot = &m_levels[level][(expires >> shift) & LEVEL_MASK];
+        }
+        timer->m_wheelSlot = slot;
+        timer->m_wheelPrev = nullptr;
+        timer->m_wheelNext = *slot;
+        if(*slot) {
+            (*slot)->m_wheelPrev = timer;
+        }
+        *slot = timer;
+    }
+
+    void unlink(Timer* timer) {
+        Timer** slot = timer->m_wheelSlot;
+        if(timer->m_wheelPrev) {
+            timer->m_wheelPrev->m_wheelNext = timer->m_wheelNext;
+        } else {
+            *slot = timer->m_wheelNext;
+        }
+        if(timer->m_wheelNext) {
+            timer->m_wheelNext->m_wheelPrev = timer->m_wheelPrev;
+        }
+        if(!*slot && slot >= m_root && slot < m_root + ROOT_SIZE) {
+            uint64_t idx = slot - m_root;
+            m_rootBits[idx >> 6] &= ~(1ull << (idx & 63));
+        }
+        timer->m_wheelPrev = timer->m_wheelNext = nullptr;
+        timer->m_wheelSlot = nullptr;
+    }
+
+    /// 上层槽中的定时器按当前时间重新分配
+    void cascade(int level, uint64_t idx) {
+        Timer* timer = m_levels[level][idx];
+        m_levels[level][idx] = nullptr;
+        while(timer) {
+            Timer* t = timer;
+            timer = timer->m_wheelNext;
+            link(t);
+        }
+    }
+
+    void take(Timer*& head, std::vector<Timer::ptr>& timers) {
+        Timer* timer = head;
+        head = nullptr;
+        while(timer) {
+            Timer* t = timer;
+            timer = timer->m_wheelNext;
+            t->m_wheelPrev = t->m_wheelNext = nullptr;
+            t->m_wheelSlot = nullptr;
+            timers.push_back(std::move(t->m_wheelRef));
+        }
+    }
+
+    /// 第 0 层从 from 开始第一个非空槽, 没有返回 -1
+    int findRoot(uint64_t from) const {
+        for(uint64_t w = from >> 6; w < ROOT_SIZE / 64; ++w) {
+            uint64_t bits = m_rootBits[w];
+            if(w == (from >> 6)) {
+                bits &= ~0ull << (from & 63);
+            }
+            if(bits) {
+                return w * 64 + __builtin_ctzll(bits);
+            }
+        }
+        return -1;
+    }
+
+private:
+    /// 已经推进到的时间, 小于它的定时器都已取出
+    uint64_t m_time;
+    size_t m_count = 0;
+    Timer* m_root[ROOT_SIZE] = {nullptr};
+    uint64_t m_rootBits[ROOT_SIZE / 64] = {0};
+    Timer* m_levels[LEVELS][LEVEL_SIZE] = {{nullptr}};
+};
+
 Timer::Timer(uint64_t ms , std::function<void ()> cb , bool circular , TimerManager* manager)
     : m_ms(ms)
     , m_cb(cb)
@@ -28,8 +266,7 @@ bool Timer::cancel(){
     TimerManager::RWMutexType::WriteLock wlock(m_manager->m_mutex);
     if(m_cb){
         m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        m_manager->m_timers.erase(it);
+        m_manager->removeTimer(shared_from_this());
         return true;
     }
     return false;
@@ -41,13 +278,12 @@ bool Timer::refresh(){
     if(!m_cb) {
         return false;
     } 
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
+    Timer::ptr self = shared_from_this();
+    if(!m_manager->removeTimer(self)) {
         return false;
     }
-    m_manager->m_timers.erase(it);
     m_next = wyz::GetCurrentMS() + m_ms;
-    m_manager->m_timers.insert(shared_from_this());
+    m_manager->insertTimer(self);
 
     return true;
 }
@@ -65,11 +301,10 @@ bool Timer::reset(uint64_t ms, bool from_now){
     if(!m_cb) {
         return false;
     } 
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
+    Timer::ptr self = shared_from_this();
+    if(!m_manager->removeTimer(self)) {
         return false;
     }
-    m_manager->m_timers.erase(it);
     uint64_t start = 0;
     if(from_now){
         start = wyz::GetCurrentMS();
@@ -78,7 +313,7 @@ bool Timer::reset(uint64_t ms, bool from_now){
     }
     m_ms = ms;
     m_next = start + m_ms;  
-    m_manager->addTimer(shared_from_this(),wlock);
+    m_manager->addTimer(self,wlock);
 
     return true;
 }
@@ -101,8 +336,15 @@ bool Timer::Comparator::operator() (const Timer::ptr& lhs , const Timer::ptr& rh
 
 TimerManager::TimerManager(){
     m_previouseTime = wyz::GetCurrentMS();
+    if(g_timer_wheel->getValue()){
+        m_wheel = new TimerWheel(m_previouseTime);
+    }
+}
+TimerManager::~TimerManager(){
+    if(m_wheel){
+        delete m_wheel;
+    }
 }
-TimerManager::~TimerManager(){}
 
 Timer::ptr TimerManager::addTimer(uint64_t ms , std::function<void ()> cb , bool circular ){
     Timer::ptr timer(new Timer(ms , cb ,circular , this));
@@ -112,8 +354,7 @@ Timer::ptr TimerManager::addTimer(uint64_t ms , std::function<void ()> cb , bool
 }
 
 void TimerManager::addTimer(Timer::ptr timer , RWMutexType::WriteLock& lock){
-    auto it = m_timers.insert(timer).first;
-    bool at_front = (it == m_timers.begin()) && !m_titckled;
+    bool at_front = insertTimer(timer) && !m_titckled;
     if(at_front){
         m_titckled = true;
     }
@@ -123,6 +364,27 @@ void TimerManager::addTimer(Timer::ptr timer , RWMutexType::WriteLock& lock){
     }
 }
 
+bool TimerManager::insertTimer(const Timer::ptr& timer){
+    if(m_wheel){
+        m_wheel->add(timer);
+        return timer->m_next < m_nextDeadline;
+    }
+    auto it = m_timers.insert(timer).first;
+    return it == m_timers.begin();
+}
+
+bool TimerManager::removeTimer(const Timer::ptr& timer){
+    if(m_wheel){
+        return m_wheel->remove(timer.get());
+    }
+    auto it = m_timers.find(timer);
+    if(it == m_timers.end()){
+        return false;
+    }
+    m_timers.erase(it);
+    return true;
+}
+
 /* weak_ptr 不会添加 shared_ptr 的计数器的个数*/
 static void OnTimer(std::weak_ptr<void> weak_cond , std::function<void()> cb){
     /* weak_ptr 与 shared_ptr 关联的智能指针存在则返回一个 shared_ptr 否则返回 nullptr */
@@ -138,6 +400,21 @@ Timer::ptr TimerManager::addConditionTimer(uint64_t ms , std::function<void ()>
 
 /* 距离下一个定时器任务的时间间隔 */
 uint64_t TimerManager::getNextTimer(){
+    if(m_wheel){
+        RWMutexType::WriteLock wlock(m_mutex);
+        m_titckled = false;
+        uint64_t next = m_wheel->nextExpire();
+        m_nextDeadline = next;
+        if(next == ~0ull){
+            return ~0ull;
+        }
+        uint64_t now_ms = wyz::GetCurrentMS();
+        if(now_ms >= next){
+            m_nextDeadline = now_ms;
+            return 0;
+        }
+        return next - now_ms;
+    }
     RWMutexType::ReadLock rlock(m_mutex);
     m_titckled = false;
     if(m_timers.empty()){
@@ -157,37 +434,46 @@ void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs){
     /// 当前的时间
     uint64_t now_ms = wyz::GetCurrentMS();
     std::vector<Timer::ptr> expired;        // 超时的计时器
-    {
-        RWMutexType::ReadLock rlock(m_mutex);
-        if(m_timers.empty()){
-            return;
-        }
+    if(!hasTimer()){
+        return;
     }
     RWMutexType::WriteLock wlock(m_mutex);
     /// 最近的定时器 时间都小于当前时间
     bool rollover = detectClockRollover(now_ms);
-    if( !rollover && (*m_timers.begin())->m_next > now_ms){
-        return ;
-    }
-    /// 找到m_timers 中超时的定时器
-    Timer::ptr now_timer(new Timer(now_ms));
-    auto it = rollover? m_timers.end() :m_timers.lower_bound(now_timer);
-    while(it != m_timers.end() && (*it)->m_next < now_ms){
-        ++it;
-    }
-    expired.insert(expired.begin() , m_timers.begin() , it);
+    if(m_wheel){
+        if(rollover){
+            m_wheel->clear(expired);
+        }else {
+            m_wheel->expire(now_ms, expired);
+        }
+    }else {
+        /// 读锁释放后其他线程可能已经取走了定时器
+        if(m_timers.empty()){
+            return ;
+        }
+        if( !rollover && (*m_timers.begin())->m_next > now_ms){
+            return ;
+        }
+        /// 找到m_timers 中超时的定时器
+        Timer::ptr now_timer(new Timer(now_ms));
+        auto it = rollover? m_timers.end() :m_timers.lower_bound(now_timer);
+        while(it != m_timers.end() && (*it)->m_next < now_ms){
+            ++it;
+        }
+        expired.insert(expired.begin() , m_timers.begin() , it);
 
-    /// 清除 m_timers 中超时的定时器
-    m_timers.erase(m_timers.begin() , it);
+        /// 清除 m_timers 中超时的定时器
+        m_timers.erase(m_timers.begin() , it);
+    }
 
     /// 存起超时定时器的回调函数
-    cbs.resize(expired.size());
-    for(auto timer : expired){
+    cbs.reserve(cbs.size() + expired.size());
+    for(auto& timer : expired){
         cbs.emplace_back(timer->m_cb);
         /// 环形定时器
         if(timer->m_circular){
             timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
+            insertTimer(timer);
         }else {
             timer->m_cb = nullptr;
         }
@@ -206,6 +492,9 @@ bool TimerManager::detectClockRollover(uint64_t now_ms){
 
 bool TimerManager::hasTimer(){
     RWMutexType::ReadLock rlock(m_mutex);
+    if(m_wheel){
+        return m_wheel->size() > 0;
+    }
     return !m_timers.empty();
 }
 
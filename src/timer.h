@@ -18,10 +18,13 @@ namespace wyz {
 
 /// 定时器管理类
 class TimerManager;
+/// 分层时间轮
+class TimerWheel;
 
 /// 定时器类
 class Timer : public std::enable_shared_from_this<Timer>{
 friend class TimerManager;
+friend class TimerWheel;
 public:
     using ptr = std::shared_ptr<Timer>;
     /**
@@ -60,6 +63,12 @@ private:
     TimerManager* m_manager = nullptr;
     uint64_t m_next = 0 ;           // 精确的执行时间
 
+    /// 时间轮侵入式双向链表节点, 挂在时间轮上时 m_wheelRef 持有自身
+    Timer* m_wheelPrev = nullptr;
+    Timer* m_wheelNext = nullptr;
+    Timer** m_wheelSlot = nullptr;
+    Timer::ptr m_wheelRef;
+
 private:
     /**
      * @brief 定时器比较仿函数  ( 学习一下这样的操作 )
@@ -100,7 +109,19 @@ protected:
 
     void addTimer(Timer::ptr timer , RWMutexType::WriteLock& lock);
 
-private:    
+private:
+    /**
+     * @brief 定时器放入容器(集合或时间轮)
+     * @return 是否成为最先到期的定时器
+     */
+    bool insertTimer(const Timer::ptr& timer);
+
+    /**
+     * @brief 从容器中移除定时器
+     * @return 定时器不在容器中返回 false
+     */
+    bool removeTimer(const Timer::ptr& timer);
+
     /**
      * @brief 检测服务器时间是否被调后了
      */
@@ -111,6 +132,10 @@ private:
     RWMutexType m_mutex;
     /// 定时器集合
     std::set<Timer::ptr , Timer::Comparator> m_timers;
+    /// 时间轮, 配置 timer.wheel 开启时代替 m_timers
+    TimerWheel* m_wheel = nullptr;
+    /// 时间轮模式下 idle 线程预计的唤醒时间
+    uint64_t m_nextDeadline = ~0ull;
     /// 触发onTimerInsertedAtFront
     bool m_titckled = false;
     /// 上次执行的时间
@@ -0,0 +1,360 @@
+/**
+ * @file udpserver.cpp
+ * @brief udp 服务端封装实现
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-30
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#include "udpserver.h"
+#include "log.h"
+#include "config.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+namespace wyz {
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_NAME("system");
+
+static wyz::ConfigVar<uint32_t>::ptr g_udp_server_batch = Config::Lookup("udp_server.batch", (uint32_t)32, "udp server max datagrams per recvmmsg/sendmmsg");
+static wyz::ConfigVar<uint32_t>::ptr g_udp_server_buffer_size = Config::Lookup("udp_server.buffer_size", (uint32_t)2048, "udp server max datagram size");
+static wyz::ConfigVar<bool>::ptr g_udp_server_gro = Config::Lookup("udp_server.gro", false, "udp server receive with UDP_GRO");
+static wyz::ConfigVar<bool>::ptr g_udp_server_gso = Config::Lookup("udp_server.gso", false, "udp server merge replies with UDP_SEGMENT");
+
+/// GRO 合并后的数据报最大长度
+static const uint32_t s_gro_slot_size = 65536;
+/// UDP_SEGMENT 一次最多的段数与总长度
+static const uint16_t s_max_gso_segments = 64;
+static const size_t s_max_gso_bytes = 65000;
+
+UDPBatch::UDPBatch(Socket::ptr sock, uint32_t batch, uint32_t bufferSize, bool gro, bool gso)
+    : m_sock(sock)
+    , m_batch(batch)
+    , m_bufferSize(bufferSize)
+    , m_slotSize(gro ? std::max(s_gro_slot_size, bufferSize) : bufferSize)
+    , m_gro(gro)
+    , m_gso(gso){
+    m_recvData.resize((size_t)m_batch * m_slotSize);
+    m_recvMsgs.resize(m_batch);
+    m_recvIovs.resize(m_batch);
+    m_recvAddrs.resize(m_batch);
+    m_recvControl.resize(m_gro ? m_batch * CMSG_SPACE(sizeof(int)) : 0);
+    m_messages.reserve(m_batch);
+
+    m_sendData.resize((size_t)m_batch * m_bufferSize);
+    m_sendMsgs.resize(m_batch);
+    m_sendIovs.resize(m_batch);
+    m_sendAddrs.resize(m_batch);
+    m_sendControl.resize(m_gso ? m_batch * CMSG_SPACE(sizeof(uint16_t)) : 0);
+    m_sendSegSize.resize(m_batch);
+    m_sendSegs.resize(m_batch);
+    memset(m_sendMsgs.data(), 0, m_batch * sizeof(mmsghdr));
+    for(uint32_t i = 0 ; i < m_batch ; ++i){
+        msghdr& hdr = m_sendMsgs[i].msg_hdr;
+        hdr.msg_name = &m_sendAddrs[i];
+        hdr.msg_iov = &m_sendIovs[i];
+        hdr.msg_iovlen = 1;
+    }
+}
+
+Address::ptr UDPBatch::getAddress(const Message& msg) const{
+    return Address::Create(msg.addr, msg.addrLen);
+}
+
+void UDPBatch::prepare(){
+    size_t control = CMSG_SPACE(sizeof(int));
+    for(uint32_t i = 0 ; i < m_batch ; ++i){
+        m_recvIovs[i].iov_base = &m_recvData[(size_t)i * m_slotSize];
+        m_recvIovs[i].iov_len = m_slotSize;
+        msghdr& hdr = m_recvMsgs[i].msg_hdr;
+        hdr.msg_name = &m_recvAddrs[i];
+        hdr.msg_namelen = sizeof(sockaddr_storage);
+        hdr.msg_iov = &m_recvIovs[i];
+        hdr.msg_iovlen = 1;
+        hdr.msg_control = m_gro ? &m_recvControl[i * control] : nullptr;
+        hdr.msg_controllen = m_gro ? control : 0;
+        hdr.msg_flags = 0;
+        m_recvMsgs[i].msg_len = 0;
+    }
+}
+
+void UDPBatch::collect(int count){
+    m_messages.clear();
+    for(int i = 0 ; i < count ; ++i){
+        msghdr& hdr = m_recvMsgs[i].msg_hdr;
+        /// 超出接收槽的部分已被内核丢掉, 不把残缺的数据报交给处理函数
+        if(UNLIKELY(hdr.msg_flags & MSG_TRUNC)){
+            ++m_truncated;
+            continue;
+        }
+        char* data = (char*)m_recvIovs[i].iov_base;
+        uint32_t len = m_recvMsgs[i].msg_len;
+        uint32_t seg = len;
+        if(m_gro){
+            for(cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr) ; cmsg ; cmsg = CMSG_NXTHDR(&hdr, cmsg)){
+                if(cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO){
+                    int size = 0;
+                    memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+                    if(size > 0){
+                        seg = size;
+                    }
+                }
+            }
+        }
+        Message msg;
+        msg.addr = (const sockaddr*)&m_recvAddrs[i];
+        msg.addrLen = hdr.msg_namelen;
+        uint32_t off = 0;
+        do {
+            msg.data = data + off;
+            msg.len = std::min(seg, len - off);
+            m_messages.push_back(msg);
+            off += msg.len;
+        }while(off < len);
+    }
+}
+
+bool UDPBatch::reply(const Message& msg, const void* data, size_t len){
+    return sendto(msg.addr, msg.addrLen, data, len);
+}
+
+bool UDPBatch::sendto(const sockaddr* addr, socklen_t addrLen, const void* data, size_t len){
+    if(len > m_bufferSize || addrLen > sizeof(sockaddr_storage)){
+        ++m_sendFails;
+        return false;
+    }
+    if(m_gso && m_sendCount > 0 && len > 0){
+        /// 发往同一地址, 长度不超过前面的段, 接在上一个消息后面. 短的段只能是最后一段
+        uint32_t last = m_sendCount - 1;
+        iovec& iov = m_sendIovs[last];
+        uint16_t seg = m_sendSegSize[last];
+        if(seg > 0 && len <= seg && iov.iov_len % seg == 0
+                && m_sendSegs[last] < s_max_gso_segments && iov.iov_len + len <= s_max_gso_bytes
+                && m_sendUsed + len <= m_sendData.size()
+                && m_sendMsgs[last].msg_hdr.msg_namelen == addrLen
+                && memcmp(&m_sendAddrs[last], addr, addrLen) == 0){
+            memcpy(&m_sendData[m_sendUsed], data, len);
+            m_sendUsed += len;
+            iov.iov_len += len;
+            ++m_sendSegs[last];
+            return true;
+        }
+    }
+    if(m_sendCount == m_batch || m_sendUsed + len > m_sendData.size()){
+        flush();
+    }
+    uint32_t i = m_sendCount++;
+    memcpy(&m_sendData[m_sendUsed], data, len);
+    m_sendIovs[i].iov_base = &m_sendData[m_sendUsed];
+    m_sendIovs[i].iov_len = len;
+    m_sendUsed += len;
+    memcpy(&m_sendAddrs[i], addr, addrLen);
+    m_sendMsgs[i].msg_hdr.msg_namelen = addrLen;
+    m_sendSegSize[i] = len;
+    m_sendSegs[i] = 1;
+    return true;
+}
+
+int UDPBatch::flush(){
+    if(m_sendCount == 0){
+        return 0;
+    }
+    if(m_gso){
+        size_t control = CMSG_SPACE(sizeof(uint16_t));
+        for(uint32_t i = 0 ; i < m_sendCount ; ++i){
+            msghdr& hdr = m_sendMsgs[i].msg_hdr;
+            if(m_sendSegs[i] < 2){
+                hdr.msg_control = nullptr;
+                hdr.msg_controllen = 0;
+                continue;
+            }
+            hdr.msg_control = &m_sendControl[i * control];
+            hdr.msg_controllen = control;
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            memcpy(CMSG_DATA(cmsg), &m_sendSegSize[i], sizeof(uint16_t));
+        }
+    }
+    int sent = 0;
+    bool error = false;
+    uint32_t done = 0;
+    while(done < m_sendCount){
+        int n = m_sock->sendBatch(&m_sendMsgs[done], m_sendCount - done);
+        ++m_sendCalls;
+        if(n <= 0){
+            /// 第一个消息发送失败, 丢弃后继续发送后面的
+            WYZ_LOG_DEBUG(g_logger) << "UDPBatch::flush sendmmsg errno=" << errno << " errstr=" << strerror(errno);
+            m_sendFails += m_sendSegs[done];
+            ++done;
+            error = true;
+            continue;
+        }
+        for(int i = 0 ; i < n ; ++i){
+            sent += m_sendSegs[done + i];
+        }
+        done += n;
+    }
+    m_sent += sent;
+    m_sendCount = 0;
+    m_sendUsed = 0;
+    return error ? -1 : sent;
+}
+
+UDPServer::UDPServer(IOManager* worker)
+    : m_worker(worker)
+    , m_name("wyz/1.0.0")
+    , m_isStop(true)
+    , m_batchSize(g_udp_server_batch->getValue())
+    , m_bufferSize(g_udp_server_buffer_size->getValue())
+    , m_gro(g_udp_server_gro->getValue())
+    , m_gso(g_udp_server_gso->getValue()){
+}
+
+UDPServer::~UDPServer(){
+    Mutex::Lock lock(m_mutex);
+    for(auto& i : m_workers){
+        i->sock->close();
+    }
+    m_workers.clear();
+}
+
+bool UDPServer::bind(const Address::ptr addr){
+    std::vector<Address::ptr> addrs;
+    std::vector<Address::ptr> fails;
+    addrs.emplace_back(addr);
+    return bind(addrs , fails);
+}
+
+bool UDPServer::bind(std::vector<Address::ptr>& addrs , std::vector<Address::ptr>& failedaddress){
+    Mutex::Lock lock(m_mutex);
+    bool rt = true;
+    std::vector<int> threads = m_worker->getThreadIds();
+    if(threads.empty()){
+        threads.push_back(-1);
+    }
+    m_batchSize = std::max(m_batchSize, (uint32_t)1);
+    for(auto addr : addrs){
+        /// 端口为 0 时, 后面的 socket 绑定到第一个 socket 分到的端口上
+        Address::ptr bind_addr = addr;
+        for(size_t i = 0 ; i < threads.size() ; ++i){
+            Socket::ptr sock;
+            if(addr->getFamily() == AF_INET){
+                sock = Socket::CreateUDPSock();
+            }else if(addr->getFamily() == AF_INET6){
+                sock = Socket::CreateUDPSock6();
+            }
+            if(!sock || !sock->isvaild() || !sock->reusePort()){
+                WYZ_LOG_ERROR(g_logger) << "udpserver socket errno= " << errno << "strerrno = " << strerror(errno) << " addr=[" << addr->toString() << "]";
+                rt = false;
+                failedaddress.emplace_back(addr);
+                break;
+            }
+            if(!sock->bind(bind_addr)){
+                WYZ_LOG_ERROR(g_logger) << "udpserver bind errno= " << errno << "strerrno = " << strerror(errno) << " addr=[" << addr->toString() << "]";
+                rt = false;
+                failedaddress.emplace_back(addr);
+                break;
+            }
+            /// 内核不支持时关闭 GRO/GSO
+            int val = 1;
+            if(m_gro && !sock->setOption(SOL_UDP, UDP_GRO, val)){
+                WYZ_LOG_WARN(g_logger) << "udpserver UDP_GRO not supported, disabled";
+                m_gro = false;
+            }
+            val = 0;
+            if(m_gso && !sock->setOption(SOL_UDP, UDP_SEGMENT, val)){
+                WYZ_LOG_WARN(g_logger) << "udpserver UDP_SEGMENT not supported, disabled";
+                m_gso = false;
+            }
+            bind_addr = sock->getLocalAddress();
+            Worker::ptr worker(new Worker);
+            worker->sock = sock;
+            worker->thread = threads[i];
+            m_workers.emplace_back(worker);
+        }
+    }
+    if(!failedaddress.empty()){
+        m_workers.clear();
+    }
+    for(auto& i : m_workers){
+        i->batch.reset(new UDPBatch(i->sock, m_batchSize, m_bufferSize, m_gro, m_gso));
+        WYZ_LOG_INFO(g_logger) << " name=" << m_name << " udp server bind success: " << *i->sock
+            << " thread=" << i->thread;
+    }
+    return rt;
+}
+
+void UDPServer::startReceive(Worker::ptr worker){
+    UDPBatch& batch = *worker->batch;
+    while(!m_isStop){
+        batch.prepare();
+        int n = worker->sock->recvBatch(batch.m_recvMsgs.data(), m_batchSize);
+        if(n <= 0){
+            if(m_isStop || errno == EBADF){
+                break;
+            }
+            WYZ_LOG_ERROR(g_logger) << "recvmmsg errno=" << errno << "errstr= " << strerror(errno);
+            continue;
+        }
+        batch.collect(n);
+        ++batch.m_recvCalls;
+        batch.m_received += batch.size();
+        handleBatch(batch);
+        batch.flush();
+    }
+}
+
+bool UDPServer::start(){
+    if(!m_isStop){
+        return true;
+    }
+    m_isStop = false;
+    Mutex::Lock lock(m_mutex);
+    for(auto& worker : m_workers){
+        m_worker->schedule(std::bind(&UDPServer::startReceive, shared_from_this() , worker)
+                , worker->thread);
+    }
+    return true;
+}
+
+void UDPServer::stop(){
+    m_isStop = true;
+    auto self = shared_from_this();
+    m_worker->schedule([this , self]() {
+        Mutex::Lock lock(m_mutex);
+        for(auto& worker : m_workers){
+            worker->sock->cancelAll();
+            worker->sock->close();
+        }
+    });
+}
+
+UDPServer::Stats UDPServer::getStats() const{
+    Stats s;
+    memset(&s, 0, sizeof(s));
+    Mutex::Lock lock(m_mutex);
+    for(auto& worker : m_workers){
+        UDPBatch& batch = *worker->batch;
+        s.received += batch.m_received;
+        s.recvCalls += batch.m_recvCalls;
+        s.truncated += batch.m_truncated;
+        s.sent += batch.m_sent;
+        s.sendCalls += batch.m_sendCalls;
+        s.sendFails += batch.m_sendFails;
+    }
+    return s;
+}
+
+void UDPServer::handleBatch(UDPBatch& batch){
+    WYZ_LOG_DEBUG(g_logger) << "handleBatch: " << *batch.getSocket() << " datagrams=" << batch.size();
+}
+
+}
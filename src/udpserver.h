@@ -0,0 +1,191 @@
+/**
+ * @file udpserver.h
+ * @brief udp 服务端封装, 批量收发数据报
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-30
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#ifndef __UDP_SERVER_H__
+#define __UDP_SERVER_H__
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+#include "iomanager.h"
+#include "address.h"
+#include "socket.h"
+#include "mutex.h"
+#include "noncopyable.h"
+
+namespace wyz {
+
+class UDPServer;
+
+/**
+ * @brief 一次 recvmmsg 收到的一批数据报
+ * @details 数据与地址都在预先分配的缓冲区中, 只在 handleBatch 返回前有效.
+ *          处理时用 reply/sendto 追加应答, handleBatch 返回后一次 sendmmsg 发出,
+ *          应答缓冲区满时先发出已有的应答
+ */
+class UDPBatch : Noncopyable {
+friend class UDPServer;
+public:
+    /**
+     * @brief 收到的一个数据报
+     */
+    struct Message {
+        char* data;             /// 数据
+        uint32_t len;           /// 长度
+        const sockaddr* addr;   /// 发送方地址
+        socklen_t addrLen;      /// 地址长度
+    };
+
+    inline Message* begin()                         {return m_messages.data();}
+    inline Message* end()                           {return m_messages.data() + m_messages.size();}
+    inline size_t size() const                      {return m_messages.size();}
+    inline Message& operator[](size_t i)            {return m_messages[i];}
+
+    /// 发送方地址
+    Address::ptr getAddress(const Message& msg) const;
+
+    /**
+     * @brief 追加发给 msg 发送方的应答
+     * @return bool             长度超过 buffer_size 或者发送失败时返回 false
+     */
+    bool reply(const Message& msg, const void* data, size_t len);
+
+    /// 追加发给任意地址的数据报
+    bool sendto(const sockaddr* addr, socklen_t addrLen, const void* data, size_t len);
+
+    /**
+     * @brief 发出追加的应答
+     * @return int              发出的数据报个数, <0 发送失败
+     */
+    int flush();
+
+    inline const Socket::ptr& getSocket() const     {return m_sock;}
+private:
+    UDPBatch(Socket::ptr sock, uint32_t batch, uint32_t bufferSize, bool gro, bool gso);
+
+    /// recvmmsg 之前重置消息头
+    void prepare();
+    /// 把收到的数据报整理到 m_messages, GRO 合并的数据报按段拆开, 丢弃被截断的数据报
+    void collect(int count);
+
+private:
+    Socket::ptr m_sock;
+    uint32_t m_batch;
+    uint32_t m_bufferSize;
+    uint32_t m_slotSize;                    /// 每个接收槽的大小, 开启 GRO 时为 64KB
+    bool m_gro;
+    bool m_gso;
+
+    /// 接收
+    std::vector<char> m_recvData;
+    std::vector<mmsghdr> m_recvMsgs;
+    std::vector<iovec> m_recvIovs;
+    std::vector<sockaddr_storage> m_recvAddrs;
+    std::vector<char> m_recvControl;
+    std::vector<Message> m_messages;
+
+    /// 发送, 开启 GSO 时发往同一地址的等长应答合并成一个消息
+    std::vector<char> m_sendData;
+    std::vector<mmsghdr> m_sendMsgs;
+    std::vector<iovec> m_sendIovs;
+    std::vector<sockaddr_storage> m_sendAddrs;
+    std::vector<char> m_sendControl;
+    std::vector<uint16_t> m_sendSegSize;    /// 消息中每段的长度
+    std::vector<uint16_t> m_sendSegs;       /// 消息中的段数
+    uint32_t m_sendCount = 0;
+    size_t m_sendUsed = 0;
+
+    std::atomic<uint64_t> m_received = {0};
+    std::atomic<uint64_t> m_recvCalls = {0};
+    std::atomic<uint64_t> m_truncated = {0};
+    std::atomic<uint64_t> m_sent = {0};
+    std::atomic<uint64_t> m_sendCalls = {0};
+    std::atomic<uint64_t> m_sendFails = {0};
+};
+
+/**
+ * @brief udp 服务器
+ * @details 每个地址为 worker 的每个线程各开一个 SO_REUSEPORT socket, 由内核按四元组分散数据报.
+ *          每个 socket 在固定的线程上循环 recvmmsg, 每批数据报交给 handleBatch 处理
+ */
+class UDPServer : public std::enable_shared_from_this<UDPServer>
+                , Noncopyable {
+public:
+    using ptr = std::shared_ptr<UDPServer>;
+    UDPServer(IOManager* worker = IOManager::GetThis());
+    virtual ~UDPServer();
+    virtual bool bind(const Address::ptr addr);
+    virtual bool bind(std::vector<Address::ptr>& addrs , std::vector<Address::ptr>& failedaddress);
+
+    virtual bool start();
+    /// 关闭 socket, 接收缓冲区与统计保留到析构, 之后 getStats 仍然有效
+    virtual void stop();
+
+    /**
+     * @brief 收发统计
+     */
+    struct Stats {
+        uint64_t received;      /// 收到的数据报数, 不包括截断丢弃的
+        uint64_t recvCalls;     /// recvmmsg 次数
+        uint64_t truncated;     /// 超过 buffer_size 被截断而丢弃的数据报数
+        uint64_t sent;          /// 发出的数据报数, GSO 合并的按段计
+        uint64_t sendCalls;     /// sendmmsg 次数
+        uint64_t sendFails;     /// 发送失败丢弃的数据报数
+    };
+    Stats getStats() const;
+
+    inline std::string getName()    const       {return m_name;}
+    inline uint32_t getBatchSize()  const       {return m_batchSize;}
+    inline uint32_t getBufferSize() const       {return m_bufferSize;}
+    inline bool isGro()             const       {return m_gro;}
+    inline bool isGso()             const       {return m_gso;}
+
+    inline void setName(const std::string& v)   {m_name = v;}
+    /// 以下需要在 bind 之前设置
+    inline void setBatchSize(uint32_t v)        {m_batchSize = v;}
+    inline void setBufferSize(uint32_t v)       {m_bufferSize = v;}
+    inline void setGro(bool v)                  {m_gro = v;}
+    inline void setGso(bool v)                  {m_gso = v;}
+
+    inline bool isStop()    const               {return m_isStop;}
+protected:
+    /**
+     * @brief 绑定的 socket 与它的缓冲区
+     */
+    struct Worker {
+        using ptr = std::shared_ptr<Worker>;
+        Socket::ptr sock;
+        int thread = -1;                /// 固定的接收线程
+        std::unique_ptr<UDPBatch> batch;
+    };
+
+    /// 处理一批数据报, 在接收它的线程上调用
+    virtual void handleBatch(UDPBatch& batch);
+    /// 循环接收数据报
+    virtual void startReceive(Worker::ptr worker);
+private:
+    /// 保护 m_workers: stop 在 worker 线程上关闭 socket 时其他线程可能在读统计
+    mutable Mutex m_mutex;
+    std::vector<Worker::ptr> m_workers;
+    IOManager* m_worker;
+    std::string m_name;
+    bool m_isStop;
+    uint32_t m_batchSize;               /// 一次 recvmmsg 最多接收的数据报数
+    uint32_t m_bufferSize;              /// 单个数据报的最大长度
+    bool m_gro;                         /// 接收时开启 UDP_GRO
+    bool m_gso;                         /// 发送时用 UDP_SEGMENT 合并应答
+};
+
+}
+
+#endif
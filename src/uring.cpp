@@ -0,0 +1,257 @@
+#include "uring.h"
+#include "log.h"
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+namespace wyz {
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_NAME("system");
+
+#ifdef WYZ_HAVE_IO_URING
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/// IOManager 用到的 opcode
+static const uint8_t s_required_ops[] = {
+    IORING_OP_READ,
+    IORING_OP_WRITE,
+    IORING_OP_RECV,
+    IORING_OP_SEND,
+    IORING_OP_ACCEPT,
+    IORING_OP_CONNECT,
+    IORING_OP_LINK_TIMEOUT,
+    IORING_OP_ASYNC_CANCEL,
+};
+
+IOUring::~IOUring() {
+    if(m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if(m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if(m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+bool IOUring::init(uint32_t entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_fd = sys_io_uring_setup(entries, &p);
+    if(m_fd < 0) {
+        WYZ_LOG_INFO(g_logger) << "io_uring_setup(" << entries << ") errno="
+            << errno << " " << strerror(errno);
+        return false;
+    }
+    /// 挂起的请求数量不受 CQ 大小限制, 需要内核保证完成事件不丢
+    if(!(p.features & IORING_FEAT_NODROP)) {
+        WYZ_LOG_INFO(g_logger) << "io_uring without IORING_FEAT_NODROP";
+        return false;
+    }
+
+    m_sqEntries = p.sq_entries;
+    m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap && m_cqRingSize > m_sqRingSize) {
+        m_sqRingSize = m_cqRingSize;
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE
+                    , MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if(m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        return false;
+    }
+    if(single_mmap) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE
+                        , MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if(m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            return false;
+        }
+    }
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE
+                    , MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        return false;
+    }
+    m_sqes = (io_uring_sqe*)sqes;
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead = (unsigned*)(sq + p.sq_off.head);
+    m_sqTail = (unsigned*)(sq + p.sq_off.tail);
+    m_sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+    m_sqFlags = (unsigned*)(sq + p.sq_off.flags);
+    m_sqArray = (unsigned*)(sq + p.sq_off.array);
+    m_sqeHead = m_sqeTail = *m_sqTail;
+
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (unsigned*)(cq + p.cq_off.head);
+    m_cqTail = (unsigned*)(cq + p.cq_off.tail);
+    m_cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    size_t probe_size = sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op);
+    std::vector<char> probe_buf(probe_size, 0);
+    io_uring_probe* probe = (io_uring_probe*)&probe_buf[0];
+    if(sys_io_uring_register(m_fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0) {
+        WYZ_LOG_INFO(g_logger) << "io_uring probe errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+    for(auto op : s_required_ops) {
+        if(op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            WYZ_LOG_INFO(g_logger) << "io_uring opcode " << (int)op << " not supported";
+            return false;
+        }
+    }
+    return true;
+}
+
+io_uring_sqe* IOUring::getSqe() {
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if(m_sqeTail - head >= m_sqEntries) {
+        return nullptr;
+    }
+    io_uring_sqe* sqe = &m_sqes[m_sqeTail & *m_sqMask];
+    ++m_sqeTail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+uint32_t IOUring::sqSpace() const {
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    return m_sqEntries - (m_sqeTail - head);
+}
+
+uint32_t IOUring::sqPending() const {
+    return m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+}
+
+int IOUring::submit() {
+    unsigned mask = *m_sqMask;
+    unsigned tail = *m_sqTail;
+    while(m_sqeHead != m_sqeTail) {
+        m_sqArray[tail & mask] = m_sqeHead & mask;
+        ++tail;
+        ++m_sqeHead;
+    }
+    __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+    unsigned to_submit = tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if(to_submit == 0) {
+        return 0;
+    }
+    int rt = 0;
+    do {
+        rt = sys_io_uring_enter(m_fd, to_submit, 0, 0);
+    } while(rt < 0 && errno == EINTR);
+    if(rt < 0) {
+        rt = -errno;
+        /// 内核没有接收, 撤回这些 sqe
+        discard();
+    }
+    return rt;
+}
+
+uint32_t IOUring::discard() {
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    uint32_t n = m_sqeTail - head;
+    __atomic_store_n(m_sqTail, head, __ATOMIC_RELEASE);
+    m_sqeHead = m_sqeTail = head;
+    return n;
+}
+
+size_t IOUring::peek(io_uring_cqe* cqes, size_t max) {
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    unsigned mask = *m_cqMask;
+    size_t n = 0;
+    while(head != tail && n < max) {
+        cqes[n++] = m_cqes[head & mask];
+        ++head;
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+bool IOUring::cqOverflow() const {
+    return __atomic_load_n(m_sqFlags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW;
+}
+
+int IOUring::flushOverflow() {
+    int rt = sys_io_uring_enter(m_fd, 0, 0, IORING_ENTER_GETEVENTS);
+    return rt < 0 ? -errno : rt;
+}
+
+bool IOUring::registerEventfd(int efd) {
+    return sys_io_uring_register(m_fd, IORING_REGISTER_EVENTFD, &efd, 1) == 0;
+}
+
+#else
+
+IOUring::~IOUring() {
+}
+
+bool IOUring::init(uint32_t entries) {
+    WYZ_LOG_INFO(g_logger) << "io_uring not available at build time";
+    return false;
+}
+
+io_uring_sqe* IOUring::getSqe() {
+    return nullptr;
+}
+
+uint32_t IOUring::sqSpace() const {
+    return 0;
+}
+
+uint32_t IOUring::sqPending() const {
+    return 0;
+}
+
+int IOUring::submit() {
+    return -ENOSYS;
+}
+
+uint32_t IOUring::discard() {
+    return 0;
+}
+
+size_t IOUring::peek(io_uring_cqe* cqes, size_t max) {
+    return 0;
+}
+
+bool IOUring::cqOverflow() const {
+    return false;
+}
+
+int IOUring::flushOverflow() {
+    return -ENOSYS;
+}
+
+bool IOUring::registerEventfd(int efd) {
+    return false;
+}
+
+#endif
+
+}
@@ -0,0 +1,119 @@
+/*
+ * @Description: io_uring 封装
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-11-26 09:41:12
+ */
+
+#ifndef __WYZ_URING_H__
+#define __WYZ_URING_H__
+
+#include "noncopyable.h"
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define WYZ_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifndef WYZ_HAVE_IO_URING
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+namespace wyz {
+
+/**
+ * @brief 直接基于系统调用的 io_uring 封装 (不依赖 liburing)
+ * @details 不使用 SQPOLL, 提交与收割都由调用者加锁保护
+ */
+class IOUring : Noncopyable {
+public:
+    IOUring() = default;
+    ~IOUring();
+
+    /**
+     * @brief 创建 ring 并检查所需的 opcode
+     * @param[in] entries SQ 大小
+     * @return 内核不支持(或编译时没有头文件)返回 false
+     */
+    bool init(uint32_t entries);
+
+    /**
+     * @brief 获取一个空闲 sqe, 已清零
+     * @return SQ 已满返回 nullptr, 需要先 submit
+     */
+    io_uring_sqe* getSqe();
+
+    /// SQ 剩余空位
+    uint32_t sqSpace() const;
+
+    /// 已填写但内核还没有接收的 sqe 数量
+    uint32_t sqPending() const;
+
+    /**
+     * @brief 提交所有已填写的 sqe
+     * @return 内核接收的数量, 失败返回 -errno (此时未提交的 sqe 被丢弃)
+     */
+    int submit();
+
+    /**
+     * @brief 撤回内核还没有接收的 sqe
+     * @return 撤回的数量
+     */
+    uint32_t discard();
+
+    /**
+     * @brief 从 CQ 取出已完成的事件
+     * @param[out] cqes 输出数组
+     * @param[in] max 最多取出的数量
+     */
+    size_t peek(io_uring_cqe* cqes, size_t max);
+
+    /// CQ 溢出到内核的积压队列, 需要 flushOverflow
+    bool cqOverflow() const;
+
+    /// 让内核把积压的完成事件搬到 CQ
+    int flushOverflow();
+
+    /// 注册完成通知的 eventfd
+    bool registerEventfd(int efd);
+
+    inline int getFd() const { return m_fd;}
+
+private:
+    int m_fd = -1;
+    uint32_t m_sqEntries = 0;
+
+    /// SQ ring 映射
+    void* m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned* m_sqMask = nullptr;
+    unsigned* m_sqFlags = nullptr;
+    unsigned* m_sqArray = nullptr;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+    /// 本地已分配但还没有提交给内核的 sqe
+    unsigned m_sqeHead = 0;
+    unsigned m_sqeTail = 0;
+
+    /// CQ ring 映射 (IORING_FEAT_SINGLE_MMAP 时与 SQ 共用)
+    void* m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned* m_cqMask = nullptr;
+    io_uring_cqe* m_cqes = nullptr;
+};
+
+}
+
+#endif
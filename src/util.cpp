@@ -5,6 +5,8 @@
  * @Date: 2021-09-23 10:28:05
  */
 
+#include <cerrno>
+#include <pthread.h>
 #include <sched.h>
 #include <string>
 #include <sys/syscall.h>
@@ -13,18 +15,43 @@
 #include "util.h"
 #include "log.h"
 #include "fiber.h"
+#include "macro.h"
 
 namespace wyz {
     
     static Logger::ptr g_logger = WYZ_LOG_NAME("system");
 
+    /// 线程号缓存, 每条日志都要取, 避免每次都做系统调用
+    static thread_local pid_t t_thread_id = 0;
+
+    /// fork 出的子进程只有调用 fork 的线程, 清掉它继承的缓存
+    static void ResetThreadIdCache(){
+        t_thread_id = 0;
+    }
+
+    struct ThreadIdCacheIniter{
+        ThreadIdCacheIniter(){
+            pthread_atfork(nullptr, nullptr, &ResetThreadIdCache);
+        }
+    };
+    static ThreadIdCacheIniter s_thread_id_initer;
+
     pid_t GetThreadId(){   // 系统线程号
-        return (pid_t)syscall(SYS_gettid);
+        if(UNLIKELY(!t_thread_id)){
+            t_thread_id = (pid_t)syscall(SYS_gettid);
+        }
+        return t_thread_id;
     }
     uint32_t GetFiberId(){     // 等用到协程号时候在重构此代码
         return Fiber::GetFiberId();           
     }
 
+    int& CurrentErrno(){
+        /// 防止编译器把本函数推断为 const 后合并多次调用
+        asm volatile("");
+        return errno;
+    }
+
     /* 该函数获取当前线程的调用堆栈，获取的信息将会被存放在bt中，*/
     void Backtrace(std::vector<std::string>& bt,int size , int skip){
         void** buffer = (void **)malloc(sizeof(void*) * size);
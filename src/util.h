@@ -28,6 +28,13 @@ namespace wyz {
     uint64_t GetCurrentMS();
     uint64_t GetCurrentUS();
 
+    /**
+     * @brief 当前线程的 errno
+     * @details 协程挂起后可能在另一个线程上恢复, 而 __errno_location 被声明为 const,
+     *          编译器会复用挂起前算出的地址; 挂起之后读写 errno 要通过这里
+     */
+    int& CurrentErrno();
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,142 @@
+/**
+ * @file workqueue.h
+ * @brief 工作窃取调度使用的有界无锁双端队列
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-22
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#ifndef __WYZ_WORKQUEUE_H__
+#define __WYZ_WORKQUEUE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "noncopyable.h"
+
+namespace wyz {
+
+/**
+ * @brief 有界无锁双端队列 (Chase-Lev)
+ * @details 只有队列所属线程可以调用 push / pop (操作队尾)
+ *          其他线程通过 steal 从队首窃取任务
+ *          队列中保存的是 T* 指针, 元素的生命周期由调用者管理
+ */
+template<class T>
+class WorkStealingQueue : Noncopyable{
+public:
+    /**
+     * @brief 构造函数
+     * @param  capacity         队列容量, 向上取整为 2 的幂
+     */
+    WorkStealingQueue(size_t capacity = 256)
+        : m_top(0)
+        , m_bottom(0){
+        size_t cap = 2;
+        while(cap < capacity){
+            cap <<= 1;
+        }
+        m_mask = cap - 1;
+        m_buffer = new std::atomic<T*>[cap];
+        for(size_t i = 0 ; i < cap ; ++i){
+            m_buffer[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~WorkStealingQueue(){
+        delete [] m_buffer;
+    }
+
+    /**
+     * @brief 队尾压入元素 (仅所属线程调用)
+     * @return false 队列已满
+     */
+    bool push(T* item){
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        if(b - t > static_cast<int64_t>(m_mask)){
+            return false;
+        }
+        m_buffer[b & m_mask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @brief 队尾弹出元素 (仅所属线程调用)
+     * @return 队列为空返回 nullptr
+     */
+    T* pop(){
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        if(t > b){
+            /// 队列为空
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = m_buffer[b & m_mask].load(std::memory_order_relaxed);
+        if(t == b){
+            /// 只剩最后一个元素, 与窃取者竞争
+            if(!m_top.compare_exchange_strong(t, t + 1
+                    , std::memory_order_seq_cst, std::memory_order_relaxed)){
+                item = nullptr;
+            }
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    /**
+     * @brief 从队首窃取一个元素 (任意线程调用)
+     * @return 队列为空或竞争失败返回 nullptr
+     */
+    T* steal(){
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if(t >= b){
+            return nullptr;
+        }
+        T* item = m_buffer[t & m_mask].load(std::memory_order_relaxed);
+        if(!m_top.compare_exchange_strong(t, t + 1
+                , std::memory_order_seq_cst, std::memory_order_relaxed)){
+            return nullptr;
+        }
+        return item;
+    }
+
+    /**
+     * @brief 队列中元素的近似数量
+     */
+    size_t size() const{
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? static_cast<size_t>(b - t) : 0;
+    }
+
+    inline bool empty() const       {return size() == 0;}
+    inline size_t capacity() const  {return m_mask + 1;}
+
+private:
+    /// 队首 (窃取端)
+    std::atomic<int64_t> m_top;
+    /// 填充, 避免队首与队尾伪共享
+    char m_pad[64 - sizeof(std::atomic<int64_t>)];
+    /// 队尾 (所属线程端)
+    std::atomic<int64_t> m_bottom;
+    /// 环形缓冲区
+    std::atomic<T*>* m_buffer;
+    /// 容量掩码
+    size_t m_mask;
+};
+
+}
+
+#endif
@@ -0,0 +1,337 @@
+/*
+ * @Description: http 压测工具, 可以在同一进程内启动 HttpServer 压测回环地址
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-11-27 14:20:35
+ *
+ * 用法: bench_http [-H host] [-p port] [-u path] [-c clients] [-t threads] [-s server_threads]
+ *                  [-d seconds] [-w warmup_seconds] [-C] [-P pipeline] [-r rate] [-b body_size] [-T timeout_ms]
+ *   -H  压测已有的服务器, 不指定时在进程内启动 HttpServer 并压测 127.0.0.1
+ *   -C  每个请求新建连接(Connection: close), 默认长连接
+ *   -P  流水线深度, 一次发送多个请求后再按顺序接收
+ *   -r  固定速率(所有客户端合计每秒请求数), 延迟从计划发送时间算起以修正协调遗漏(coordinated omission);
+ *       0 为闭环模式, 每个客户端收到响应后立即发送下一批
+ */
+
+#include "../src/log.h"
+#include "../src/util.h"
+#include "../src/iomanager.h"
+#include "../src/address.h"
+#include "../src/socket.h"
+#include "../src/http/http_server.h"
+#include "../src/http/http_connection.h"
+#include <algorithm>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <signal.h>
+#include <unistd.h>
+#include <vector>
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
+
+using namespace wyz::http;
+
+struct Options {
+    std::string host;
+    uint16_t port = 18660;
+    std::string path = "/";
+    uint32_t clients = 64;
+    uint32_t threads = 1;
+    uint32_t serverThreads = 1;
+    uint32_t duration = 5;
+    uint32_t warmup = 0;
+    bool keepalive = true;
+    uint32_t pipeline = 1;
+    uint64_t rate = 0;
+    uint32_t bodySize = 64;
+    uint64_t timeout = 5000;
+};
+
+static Options g_opts;
+static wyz::Address::ptr g_addr;
+
+/**
+ * @brief 延迟直方图(us)
+ * @details 对数线性分桶: 小于 64 每个值一个桶, 之后每个 2 的幂区间分 64 个桶, 相对误差小于 1.6%
+ */
+class Histogram {
+public:
+    Histogram()
+        : m_buckets(59 * 64, 0){
+    }
+
+    void add(uint64_t v){
+        ++m_buckets[Index(v)];
+        ++m_count;
+        m_sum += v;
+        m_max = std::max(m_max, v);
+    }
+
+    void merge(const Histogram& o){
+        for(size_t i = 0 ; i < m_buckets.size() ; ++i){
+            m_buckets[i] += o.m_buckets[i];
+        }
+        m_count += o.m_count;
+        m_sum += o.m_sum;
+        m_max = std::max(m_max, o.m_max);
+    }
+
+    /// p 在 [0, 1] 之间
+    uint64_t percentile(double p) const{
+        uint64_t target = p * m_count;
+        if(target >= m_count){
+            return m_max;
+        }
+        uint64_t n = 0;
+        for(size_t i = 0 ; i < m_buckets.size() ; ++i){
+            n += m_buckets[i];
+            if(n > target){
+                return std::min(Value(i), m_max);
+            }
+        }
+        return m_max;
+    }
+
+    inline uint64_t getCount() const    {return m_count;}
+    inline uint64_t getMax() const      {return m_max;}
+    inline double getMean() const       {return m_count ? (double)m_sum / m_count : 0;}
+
+private:
+    static size_t Index(uint64_t v){
+        if(v < 64){
+            return v;
+        }
+        int b = 63 - __builtin_clzll(v);
+        return (b - 5) * 64 + ((v >> (b - 6)) & 63);
+    }
+
+    /// 桶的上界
+    static uint64_t Value(size_t idx){
+        if(idx < 64){
+            return idx;
+        }
+        size_t b = idx / 64 + 5;
+        return ((64 + idx % 64 + 1) << (b - 6)) - 1;
+    }
+
+private:
+    std::vector<uint64_t> m_buckets;
+    uint64_t m_count = 0;
+    uint64_t m_sum = 0;
+    uint64_t m_max = 0;
+};
+
+/**
+ * @brief 每个客户端的统计, 结束后合并
+ */
+struct ClientStat {
+    Histogram hist;
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    uint64_t connects = 0;
+    uint64_t bytes = 0;
+};
+
+static HttpConnection::ptr connect(ClientStat& stat){
+    wyz::Socket::ptr sock = wyz::Socket::CreateTCP(g_addr);
+    if(!sock->connect(g_addr, g_opts.timeout)){
+        return nullptr;
+    }
+    sock->setRecvTimeout(g_opts.timeout);
+    sock->setSendTimeout(g_opts.timeout);
+    ++stat.connects;
+    return std::make_shared<HttpConnection>(sock);
+}
+
+static void run_client(ClientStat* stat , uint32_t id , uint64_t start , uint64_t end){
+    std::vector<HttpRequest::ptr> reqs;
+    for(uint32_t i = 0 ; i < g_opts.pipeline ; ++i){
+        HttpRequest::ptr req(new HttpRequest(0x11, !g_opts.keepalive));
+        req->setPath(g_opts.path);
+        req->setHeader("Host", g_opts.host.empty() ? "127.0.0.1" : g_opts.host);
+        reqs.push_back(req);
+    }
+    uint64_t record_from = start + g_opts.warmup * 1000000ull;
+    /// 固定速率时每个客户端的发送间隔, 各客户端错开
+    uint64_t interval = 0;
+    uint64_t next = start;
+    if(g_opts.rate){
+        /// 超过每微秒一次时按 1us 计, 否则 next 不再前进
+        interval = std::max(1000000ull * g_opts.clients * g_opts.pipeline / g_opts.rate, 1ull);
+        next = start + interval * id / g_opts.clients;
+    }
+
+    HttpConnection::ptr conn;
+    while(true){
+        uint64_t now = wyz::GetCurrentUS();
+        if(g_opts.rate){
+            if(next >= end){
+                break;
+            }
+            if(now < next){
+                usleep(next - now);
+            }
+        }else if(now >= end){
+            break;
+        }
+        /// 固定速率时延迟从计划发送时间算起, 服务器变慢时不会少算排队时间.
+        /// 定时器精度是毫秒, 提前醒来时从实际发送时间算起
+        uint64_t send_time = wyz::GetCurrentUS();
+        if(g_opts.rate){
+            send_time = std::min(send_time, next);
+        }
+        next += interval;
+
+        if(!conn || conn->isClose() || !conn->isConnected()){
+            conn = connect(*stat);
+            if(!conn){
+                stat->errors += reqs.size();
+                continue;
+            }
+        }
+        if(conn->sendRequests(reqs) <= 0){
+            stat->errors += reqs.size();
+            conn.reset();
+            continue;
+        }
+        for(size_t i = 0 ; i < reqs.size() ; ++i){
+            HttpResponse::ptr rsp = conn->recvResponse();
+            if(!rsp){
+                stat->errors += reqs.size() - i;
+                conn.reset();
+                break;
+            }
+            uint64_t now = wyz::GetCurrentUS();
+            if(send_time >= record_from){
+                ++stat->requests;
+                stat->bytes += rsp->getBody().size();
+                stat->hist.add(now - send_time);
+            }
+        }
+        if(!g_opts.keepalive){
+            conn.reset();
+        }
+    }
+}
+
+static void usage(const char* prog){
+    std::cout << "usage: " << prog << " [-H host] [-p port] [-u path] [-c clients] [-t threads]"
+              << " [-s server_threads] [-d seconds] [-w warmup_seconds] [-C] [-P pipeline]"
+              << " [-r rate] [-b body_size] [-T timeout_ms]" << std::endl;
+}
+
+int main(int argc , char** argv){
+    int opt;
+    while((opt = getopt(argc, argv, "H:p:u:c:t:s:d:w:CP:r:b:T:h")) != -1){
+        switch(opt){
+            case 'H': g_opts.host = optarg; break;
+            case 'p': g_opts.port = atoi(optarg); break;
+            case 'u': g_opts.path = optarg; break;
+            case 'c': g_opts.clients = std::max(1, atoi(optarg)); break;
+            case 't': g_opts.threads = std::max(1, atoi(optarg)); break;
+            case 's': g_opts.serverThreads = std::max(1, atoi(optarg)); break;
+            case 'd': g_opts.duration = std::max(1, atoi(optarg)); break;
+            case 'w': g_opts.warmup = atoi(optarg); break;
+            case 'C': g_opts.keepalive = false; break;
+            case 'P': g_opts.pipeline = std::max(1, atoi(optarg)); break;
+            case 'r': g_opts.rate = atoll(optarg); break;
+            case 'b': g_opts.bodySize = atoi(optarg); break;
+            case 'T': g_opts.timeout = atoll(optarg); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    /// 短连接每个连接只有一个请求
+    if(!g_opts.keepalive){
+        g_opts.pipeline = 1;
+    }
+    /// 发送间隔以微秒计, 每个客户端每微秒最多发一批
+    if(g_opts.rate > 1000000ull * g_opts.clients * g_opts.pipeline){
+        std::cerr << "rate " << g_opts.rate << "/s exceeds 1000000 * clients * pipeline" << std::endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    WYZ_LOG_NAME("system")->setLevel(wyz::LogLevel::FATAL);
+
+    /// 进程内的服务器使用单独的 IOManager
+    std::shared_ptr<wyz::IOManager> server_iom;
+    HttpServer::ptr server;
+    if(g_opts.host.empty()){
+        g_addr = wyz::IPv4Address::Create("127.0.0.1", g_opts.port);
+        server_iom.reset(new wyz::IOManager(g_opts.serverThreads, false, "server"));
+        server.reset(new HttpServer(true, server_iom.get(), server_iom.get()));
+        std::string body(g_opts.bodySize, 'x');
+        server->getServletDispatch()->addPrefixServlet("/", [body](HttpRequest::ptr , HttpResponse::ptr rsp , HttpSession::ptr){
+            rsp->setBody(body);
+            return 0;
+        });
+        /// 监听 socket 要在启用 hook 的线程里创建
+        bool ok = false;
+        wyz::Semaphore sem;
+        server_iom->schedule([&server, &ok, &sem](){
+            ok = server->bind(g_addr) && server->start();
+            sem.post();
+        });
+        sem.wait();
+        if(!ok){
+            WYZ_LOG_ERROR(g_logger) << "bind " << g_addr->toString() << " fail";
+            return 1;
+        }
+    }else {
+        wyz::IPAddress::ptr ip = wyz::Address::LookupIPAddress(g_opts.host);
+        if(!ip){
+            WYZ_LOG_ERROR(g_logger) << "invalid host " << g_opts.host;
+            return 1;
+        }
+        ip->setPort(g_opts.port);
+        g_addr = ip;
+    }
+
+    std::vector<ClientStat> stats(g_opts.clients);
+    uint64_t start = wyz::GetCurrentUS();
+    uint64_t end = start + (g_opts.warmup + g_opts.duration) * 1000000ull;
+    {
+        wyz::IOManager iom(g_opts.threads, false, "client");
+        for(uint32_t i = 0 ; i < g_opts.clients ; ++i){
+            ClientStat* stat = &stats[i];
+            iom.schedule([stat, i, start, end](){
+                run_client(stat, i, start, end);
+            });
+        }
+    }
+    double seconds = (wyz::GetCurrentUS() - start) / 1000000.0 - g_opts.warmup;
+
+    if(server){
+        server->stop();
+    }
+
+    ClientStat total;
+    for(auto& i : stats){
+        total.hist.merge(i.hist);
+        total.requests += i.requests;
+        total.errors += i.errors;
+        total.connects += i.connects;
+        total.bytes += i.bytes;
+    }
+    std::cout << "target " << g_addr->toString() << g_opts.path
+              << (g_opts.host.empty() ? " (in-process, server_threads=" + std::to_string(g_opts.serverThreads) + ")" : "")
+              << std::endl;
+    std::cout << "clients=" << g_opts.clients << " threads=" << g_opts.threads
+              << " mode=" << (g_opts.keepalive ? "keep-alive" : "close")
+              << " pipeline=" << g_opts.pipeline
+              << " rate=" << (g_opts.rate ? std::to_string(g_opts.rate) + "/s" : "closed-loop")
+              << " duration=" << g_opts.duration << "s warmup=" << g_opts.warmup << "s" << std::endl;
+    std::cout << std::fixed << std::setprecision(1)
+              << "requests=" << total.requests << " errors=" << total.errors << " connects=" << total.connects
+              << " throughput=" << total.requests / seconds << " req/s"
+              << " transfer=" << total.bytes / seconds / 1024 / 1024 << " MB/s" << std::endl;
+    std::cout << "latency(us) mean=" << total.hist.getMean()
+              << " p50=" << total.hist.percentile(0.5)
+              << " p90=" << total.hist.percentile(0.9)
+              << " p99=" << total.hist.percentile(0.99)
+              << " p999=" << total.hist.percentile(0.999)
+              << " max=" << total.hist.getMax() << std::endl;
+    return 0;
+}
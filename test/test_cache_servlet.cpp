@@ -0,0 +1,223 @@
+/*
+ * @Description: 测试响应缓存 Servlet, 包括 304, Vary, 过期与并发未命中的合并
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-11-28 15:06:21
+ */
+
+#include "../src/log.h"
+#include "../src/util.h"
+#include "../src/iomanager.h"
+#include "../src/address.h"
+#include "../src/http/http_server.h"
+#include "../src/http/http_connection.h"
+#include "../src/http/cache_servlet.h"
+#include "test_check.h"
+#include <atomic>
+#include <signal.h>
+#include <stdexcept>
+#include <unistd.h>
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
+
+using namespace wyz::http;
+
+static const uint16_t s_port = 18670;
+static std::atomic<int> s_calls(0);
+static CacheServlet::ptr g_cache;
+
+/// 生成较慢, 内容只与路径, query 和 Accept-Language 有关
+static int32_t slow_page(HttpRequest::ptr req , HttpResponse::ptr rsp , HttpSession::ptr){
+    ++s_calls;
+    usleep(50 * 1000);
+    std::string body = "page " + req->getPath() + "?" + req->getQuery();
+    if(req->getPath() == "/vary"){
+        rsp->setHeader("Vary", "Accept-Language");
+        body += " lang=" + req->getHeader("accept-language");
+    }else if(req->getPath() == "/private"){
+        rsp->setHeader("Cache-Control", "private");
+    }else if(req->getPath() == "/short"){
+        rsp->setHeader("Cache-Control", "max-age=0");
+    }
+    rsp->setHeader("Content-Type", "text/plain");
+    rsp->setBody(body);
+    return 0;
+}
+
+static void print_stats(){
+    CacheServlet::Stats s = g_cache->getStats();
+    WYZ_LOG_INFO(g_logger) << "cache hits=" << s.hits << " misses=" << s.misses << " coalesced=" << s.coalesced
+        << " not_modified=" << s.notModified << " stores=" << s.stores << " evictions=" << s.evictions
+        << " entries=" << s.entries << " bytes=" << s.bytes;
+}
+
+void test_cache(){
+    HttpConnectionPool::ptr pool(new HttpConnectionPool("127.0.0.1", "test", s_port, 16, 10000, 10000));
+
+    HttpResult::ptr rt = pool->doGet("/page?a=1", 1000);
+    CHECK(rt->result == 0 && rt->response->getBody() == "page /page?a=1");
+    std::string etag = rt->response->getHeader("etag");
+    CHECK(!etag.empty() && s_calls == 1);
+    rt = pool->doGet("/page?a=1", 1000);
+    CHECK(rt->result == 0 && rt->response->getBody() == "page /page?a=1" && s_calls == 1);
+    CHECK(rt->response->getHeader("etag") == etag && rt->response->getHeader("content-type") == "text/plain");
+    CHECK(!rt->response->getHeader("date").empty() && rt->response->getHeader("connection") == "keep-alive");
+    rt = pool->doGet("/page?a=2", 1000);
+    CHECK(rt->result == 0 && rt->response->getBody() == "page /page?a=2" && s_calls == 2);
+
+    rt = pool->doRequest(HttpMethod::HEAD, "/page?a=1", 1000);
+    CHECK(rt->result == 0 && rt->response->getBody().empty()
+        && rt->response->getHeader("content-length") == "14" && s_calls == 2);
+    rt = pool->doGet("/page?a=1", 1000, {{"If-None-Match", "\"x\", " + etag}});
+    CHECK(rt->result == 0 && rt->response->getStatus() == HttpStatus::NOT_MODIFIED
+        && rt->response->getHeader("etag") == etag && s_calls == 2);
+    rt = pool->doGet("/page?a=3", 1000, {{"If-None-Match", "\"x\""}});
+    CHECK(rt->result == 0 && rt->response->getStatus() == HttpStatus::OK && s_calls == 3);
+
+    /// Vary 的头部不同时分别缓存
+    rt = pool->doGet("/vary", 1000, {{"Accept-Language", "en"}});
+    CHECK(rt->result == 0 && rt->response->getBody() == "page /vary? lang=en");
+    rt = pool->doGet("/vary", 1000, {{"Accept-Language", "zh"}});
+    CHECK(rt->result == 0 && rt->response->getBody() == "page /vary? lang=zh");
+    rt = pool->doGet("/vary", 1000, {{"Accept-Language", "en"}});
+    CHECK(rt->result == 0 && rt->response->getBody() == "page /vary? lang=en" && s_calls == 5);
+
+    /// 不能缓存的响应
+    int calls = s_calls;
+    pool->doGet("/private", 1000);
+    pool->doGet("/private", 1000);
+    pool->doGet("/short", 1000);
+    pool->doGet("/short", 1000);
+    pool->doPost("/page?a=1", 1000);
+    pool->doGet("/page?a=1", 1000, {{"Authorization", "x"}});
+    CHECK(s_calls == calls + 6);
+
+    /// 同时未命中只生成一次
+    calls = s_calls;
+    std::atomic<int> done(0);
+    std::atomic<int> ok(0);
+    const int n = 20;
+    for(int i = 0 ; i < n ; ++i){
+        wyz::IOManager::GetThis()->schedule([pool, &done, &ok](){
+            HttpResult::ptr rt = pool->doGet("/page?a=coalesce", 2000);
+            if(rt->result == 0 && rt->response->getBody() == "page /page?a=coalesce"){
+                ++ok;
+            }
+            ++done;
+        });
+    }
+    while(done < n){
+        usleep(10 * 1000);
+    }
+    CHECK(ok == n && s_calls == calls + 1);
+
+    /// 过期后重新生成
+    usleep(600 * 1000);
+    calls = s_calls;
+    rt = pool->doGet("/page?a=1", 1000);
+    CHECK(rt->result == 0 && s_calls == calls + 1);
+    print_stats();
+    WYZ_LOG_INFO(g_logger) << "test_cache fails=" << fails;
+}
+
+void bench(){
+    const int n = 2000;
+    HttpConnectionPool::ptr pool(new HttpConnectionPool("127.0.0.1", "test", s_port, 4, 60000, 100000));
+    uint64_t start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < n ; ++i){
+        pool->doGet("/bench/cached", 1000);
+    }
+    uint64_t used = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << "cached n=" << n << " used=" << used << "us per=" << used / n << "us";
+
+    start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < n ; ++i){
+        pool->doGet("/bench/direct", 1000);
+    }
+    used = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << "direct n=" << n << " used=" << used << "us per=" << used / n << "us";
+}
+
+/// 内层处理函数抛出异常: 等待同一个键的请求被唤醒, 之后的请求不会挂起
+void test_loader_throw(){
+    std::atomic<int> calls(0);
+    CacheServlet::ptr cache(new CacheServlet(std::make_shared<FunctionServlet>(
+        [&calls](HttpRequest::ptr, HttpResponse::ptr rsp, HttpSession::ptr) -> int32_t {
+            if(++calls == 1){
+                usleep(50 * 1000);
+                throw std::runtime_error("render fail");
+            }
+            rsp->setBody("ok");
+            return 0;
+        }), 500));
+    std::atomic<int> done(0);
+    std::atomic<int> thrown(0);
+    auto request = [cache, &done, &thrown](){
+        HttpRequest::ptr req(new HttpRequest);
+        req->setPath("/throw");
+        HttpResponse::ptr rsp(new HttpResponse);
+        try{
+            cache->handle(req, rsp, nullptr);
+        }catch(std::exception&){
+            ++thrown;
+        }
+        ++done;
+    };
+    wyz::IOManager::GetThis()->schedule(request);
+    usleep(10 * 1000);
+    wyz::IOManager::GetThis()->schedule(request);
+    usleep(10 * 1000);
+    wyz::IOManager::GetThis()->schedule(request);
+    for(int i = 0 ; i < 100 && done < 3 ; ++i){
+        usleep(10 * 1000);
+    }
+    CHECK(done == 3 && thrown == 1);
+    CHECK(cache->getStats().coalesced == 2);
+    WYZ_LOG_INFO(g_logger) << "test_loader_throw done=" << done << " calls=" << calls;
+}
+
+void run(){
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", s_port);
+    HttpServer::ptr server(new HttpServer(true));
+    if(!server->bind(addr)){
+        WYZ_LOG_ERROR(g_logger) << "bind " << addr->toString() << " fail";
+        ++fails;
+        return;
+    }
+    ServletDispatch::ptr sd = server->getServletDispatch();
+    g_cache.reset(new CacheServlet(std::make_shared<FunctionServlet>(&slow_page), 500));
+    sd->addServlet("/page", g_cache);
+    sd->addServlet("/vary", g_cache);
+    sd->addServlet("/private", g_cache);
+    sd->addServlet("/short", g_cache);
+
+    /// 生成响应需要做一些工作的页面
+    FunctionServlet::callback render = [](HttpRequest::ptr req , HttpResponse::ptr rsp , HttpSession::ptr){
+        std::string body;
+        for(int i = 0 ; i < 200 ; ++i){
+            body += "<tr><td>" + std::to_string(i) + "</td><td>" + std::to_string(i * i) + "</td></tr>\n";
+        }
+        rsp->setHeader("Content-Type", "text/html");
+        rsp->setBody(body);
+        return 0;
+    };
+    sd->addServlet("/bench/cached", std::make_shared<CacheServlet>(std::make_shared<FunctionServlet>(render), 60000));
+    sd->addServlet("/bench/direct", render);
+    server->start();
+
+    test_cache();
+    test_loader_throw();
+    bench();
+    server->stop();
+}
+
+int main(int argc, char const *argv[])
+{
+    signal(SIGPIPE, SIG_IGN);
+    WYZ_LOG_NAME("system")->setLevel(wyz::LogLevel::FATAL);
+    {
+        wyz::IOManager iom(2, false, "cache");
+        iom.schedule(&run);
+    }
+    return fails != 0;
+}
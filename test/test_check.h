@@ -0,0 +1,30 @@
+/**
+ * @file test_check.h
+ * @brief 测试共用的检查宏: 失败时记录日志并计数, main 返回 fails != 0
+ * @author wyz (501826086@qq.com)
+ * @version 1.0
+ * @date 2021-11-22
+ *
+ * @copyright Copyright (c) 2021  wyz
+ *
+ */
+
+#ifndef __WYZ_TEST_CHECK_H__
+#define __WYZ_TEST_CHECK_H__
+
+#include <atomic>
+#include "../src/log.h"
+
+/// 所有检查失败的次数, 不为 0 时进程返回 1
+static std::atomic<int> fails(0);
+
+/// 检查失败时写到使用处的 g_logger, 可以放在 if/else 中
+#define CHECK(x) \
+    do { \
+        if(!(x)){ \
+            WYZ_LOG_ERROR(g_logger) << "check fail: " #x; \
+            ++fails; \
+        } \
+    } while(0)
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * @Description: 测试协程域名解析, 本机回环上跑一个简单的 DNS 服务器
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-11-29 16:12:45
+ */
+
+#include "../src/log.h"
+#include "../src/util.h"
+#include "../src/config.h"
+#include "../src/iomanager.h"
+#include "../src/address.h"
+#include "../src/socket.h"
+#include "../src/dns.h"
+#include "test_check.h"
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <signal.h>
+#include <unistd.h>
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
+
+static const uint16_t s_port = 18690;
+/// 服务器收到的每个域名的查询次数
+static std::map<std::string, int> s_queries;
+static wyz::Socket::ptr s_server;
+
+static void append16(std::string& buf , uint16_t v){
+    buf.push_back((char)(v >> 8));
+    buf.push_back((char)(v & 0xff));
+}
+
+static void append32(std::string& buf , uint32_t v){
+    append16(buf, v >> 16);
+    append16(buf, v & 0xffff);
+}
+
+/// 回答记录, 名字用指向问题的压缩指针
+static void append_record(std::string& buf , uint16_t type , uint32_t ttl , const std::string& rdata){
+    append16(buf, 0xC00C);
+    append16(buf, type);
+    append16(buf, 1);
+    append32(buf, ttl);
+    append16(buf, rdata.size());
+    buf.append(rdata);
+}
+
+/**
+ * @brief 按域名给出不同的应答
+ * @details a.test 的 TTL 为 1 秒; slow.test 与 co.test 延迟应答; v6.test 只有 AAAA;
+ *          missing.test 不存在, SOA minimum 为 60; drop.test 不应答; short.test 用于 search;
+ *          其他域名没有记录
+ */
+static void answer(std::string query , wyz::Address::ptr from){
+    size_t pos = 12;
+    std::string name;
+    while(pos < query.size() && query[pos]){
+        if(!name.empty()){
+            name.push_back('.');
+        }
+        name.append(query, pos + 1, (uint8_t)query[pos]);
+        pos += 1 + (uint8_t)query[pos];
+    }
+    pos += 1;
+    uint16_t type = (uint8_t)query[pos] << 8 | (uint8_t)query[pos + 1];
+    pos += 4;
+    ++s_queries[name];
+
+    if(name == "drop.test"){
+        return;
+    }
+    if(name == "slow.test"){
+        usleep(300 * 1000);
+    }else if(name == "co.test"){
+        usleep(100 * 1000);
+    }
+
+    std::string rsp = query.substr(0, 2);
+    uint16_t rcode = name == "missing.test" ? 3 : 0;
+    std::string records;
+    int answers = 0;
+    int authority = 0;
+    if(rcode == 0 && type == 1 && (name == "a.test" || name == "co.test" || name == "slow.test" || name == "short.test"
+                || name == "qtype.test")){
+        std::string ip("\x0a\x00\x00", 3);
+        ip.push_back(name == "a.test" ? 1 : name == "short.test" ? 3 : name == "qtype.test" ? 4 : 2);
+        append_record(records, 1, name == "a.test" ? 1 : 300, ip);
+        ++answers;
+    }else if(rcode == 0 && type == 28 && name == "v6.test"){
+        std::string ip(15, '\0');
+        ip.push_back(1);
+        append_record(records, 28, 300, ip);
+        ++answers;
+    }else {
+        /// mname "a", rname "b", 接着 5 个 32 位的数
+        std::string soa("\x01" "a" "\x00\x01" "b" "\x00", 6);
+        for(int i = 0 ; i < 5 ; ++i){
+            append32(soa, 60);
+        }
+        append_record(records, 6, 3600, soa);
+        ++authority;
+    }
+    append16(rsp, 0x8180 | rcode);
+    append16(rsp, 1);
+    append16(rsp, answers);
+    append16(rsp, authority);
+    append16(rsp, 0);
+    rsp.append(query, 12, pos - 12);
+    rsp.append(records);
+    if(name == "qtype.test"){
+        /// 先发一个 QTYPE 不同的应答, 客户端要丢弃它
+        std::string bad = rsp;
+        bad[pos - 3] = 28;
+        bad.back() = 9;
+        s_server->sendto(bad.data(), bad.size(), from);
+    }
+    s_server->sendto(rsp.data(), rsp.size(), from);
+}
+
+static void serve(){
+    char buf[512];
+    while(true){
+        wyz::Address::ptr from(new wyz::IPv4Address());
+        int n = s_server->recvfrom(buf, sizeof(buf), from);
+        if(n <= 0){
+            break;
+        }
+        wyz::IOManager::GetThis()->schedule(std::bind(&answer, std::string(buf, n), from));
+    }
+}
+
+static int queries(const std::string& name){
+    auto it = s_queries.find(name);
+    return it == s_queries.end() ? 0 : it->second;
+}
+
+static std::string first(const std::vector<wyz::IPAddress::ptr>& addrs){
+    return addrs.empty() ? "" : addrs[0]->toString();
+}
+
+void test_resolve(wyz::Resolver::ptr resolver){
+    std::vector<wyz::IPAddress::ptr> addrs;
+    CHECK(resolver->resolve("127.0.0.1", addrs) && first(addrs) == "127.0.0.1:0" && queries("127.0.0.1") == 0);
+
+    /// hosts 文件
+    addrs.clear();
+    CHECK(resolver->resolve("MyHost", addrs) && first(addrs) == "10.1.1.1:0");
+    addrs.clear();
+    CHECK(resolver->resolve("myhost6", addrs, AF_INET6) && first(addrs) == "[::2]:0" && queries("myhost6") == 0);
+
+    /// 缓存, 返回的地址可以修改端口
+    addrs.clear();
+    CHECK(resolver->resolve("a.test", addrs) && first(addrs) == "10.0.0.1:0" && queries("a.test") == 1);
+    addrs[0]->setPort(80);
+    addrs.clear();
+    CHECK(resolver->resolve("A.TEST", addrs) && first(addrs) == "10.0.0.1:0" && queries("a.test") == 1);
+
+    /// search 后缀, ndots 为 1 时先查 short.test
+    addrs.clear();
+    CHECK(resolver->resolve("short", addrs) && first(addrs) == "10.0.0.3:0" && queries("short.test") == 1);
+
+    /// 问题部分的 QTYPE 不同的应答不接受
+    addrs.clear();
+    CHECK(resolver->resolve("qtype.test", addrs) && first(addrs) == "10.0.0.4:0");
+
+    /// AAAA
+    addrs.clear();
+    CHECK(resolver->resolve("v6.test", addrs, AF_INET6) && first(addrs) == "[::1]:0");
+    addrs.clear();
+    CHECK(resolver->resolve("v6.test", addrs, AF_UNSPEC) && first(addrs) == "[::1]:0" && queries("v6.test") == 3);
+
+    /// 负缓存
+    addrs.clear();
+    CHECK(!resolver->resolve("missing.test", addrs) && !resolver->resolve("missing.test", addrs));
+    CHECK(queries("missing.test") == 1 && addrs.empty());
+
+    /// 超时不缓存
+    uint64_t start = wyz::GetCurrentMS();
+    CHECK(!resolver->resolve("drop.test", addrs) && !resolver->resolve("drop.test", addrs));
+    CHECK(queries("drop.test") == 2 && wyz::GetCurrentMS() - start >= 2000);
+
+    /// 同时解析同一个域名只发一次查询
+    std::atomic<int> done(0);
+    std::atomic<int> ok(0);
+    const int n = 20;
+    for(int i = 0 ; i < n ; ++i){
+        wyz::IOManager::GetThis()->schedule([resolver, &done, &ok](){
+            std::vector<wyz::IPAddress::ptr> addrs;
+            if(resolver->resolve("co.test", addrs) && first(addrs) == "10.0.0.2:0"){
+                ++ok;
+            }
+            ++done;
+        });
+    }
+    while(done < n){
+        usleep(10 * 1000);
+    }
+    CHECK(ok == n && queries("co.test") == 1);
+
+    /// 等待慢的应答时其他协程照常运行
+    std::atomic<int> ticks(0);
+    std::atomic<bool> waiting(true);
+    wyz::IOManager::GetThis()->schedule([&ticks, &waiting](){
+        while(waiting){
+            ++ticks;
+            usleep(20 * 1000);
+        }
+    });
+    addrs.clear();
+    CHECK(resolver->resolve("slow.test", addrs) && first(addrs) == "10.0.0.2:0");
+    waiting = false;
+    CHECK(ticks >= 5);
+    WYZ_LOG_INFO(g_logger) << "ticks while resolving slow.test: " << ticks;
+
+    /// TTL 过期后重新查询
+    usleep(1100 * 1000);
+    addrs.clear();
+    CHECK(resolver->resolve("a.test", addrs) && queries("a.test") == 2);
+
+    wyz::Resolver::Stats s = resolver->getStats();
+    WYZ_LOG_INFO(g_logger) << "dns requests=" << s.requests << " hosts_hits=" << s.hostsHits
+        << " cache_hits=" << s.cacheHits << " coalesced=" << s.coalesced << " queries=" << s.queries
+        << " timeouts=" << s.timeouts << " entries=" << s.entries;
+}
+
+/// Address::Lookup 在协程中使用全局的解析器
+void test_lookup(){
+    std::vector<wyz::Address::ptr> addrs;
+    CHECK(wyz::Address::Lookup(addrs, "co.test:8080") && addrs.size() == 1
+        && addrs[0]->toString() == "10.0.0.2:8080");
+    wyz::IPAddress::ptr addr = wyz::Address::LookupIPAddress("myhost:80");
+    CHECK(addr && addr->toString() == "10.1.1.1:80");
+
+    uint64_t start = wyz::GetCurrentUS();
+    const int n = 10000;
+    for(int i = 0 ; i < n ; ++i){
+        addr = wyz::Address::LookupIPAddress("co.test:80");
+    }
+    uint64_t used = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << "cached lookup n=" << n << " used=" << used << "us per=" << used * 1000 / n << "ns";
+}
+
+void run(){
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", s_port);
+    s_server = wyz::Socket::CreateUDPSock();
+    if(!s_server->bind(addr)){
+        WYZ_LOG_ERROR(g_logger) << "bind " << addr->toString() << " fail";
+        ++fails;
+        return;
+    }
+    wyz::IOManager::GetThis()->schedule(&serve);
+
+    std::ofstream("/tmp/wyz_test_hosts") << "# test\n10.1.1.1  myhost myhost.local\n::2 myhost6\n";
+    std::ofstream("/tmp/wyz_test_resolv.conf") << "nameserver 10.255.255.1\nsearch test\noptions ndots:1 timeout:1 attempts:1\n";
+    wyz::Config::Lookup("dns.hosts", std::string(), "")->setValue("/tmp/wyz_test_hosts");
+    wyz::Config::Lookup("dns.resolv_conf", std::string(), "")->setValue("/tmp/wyz_test_resolv.conf");
+
+    wyz::Resolver::ptr resolver(new wyz::Resolver);
+    resolver->setNameservers({addr});
+    test_resolve(resolver);
+
+    wyz::ResolverMgr::GetInstance()->setNameservers({addr});
+    test_lookup();
+
+    s_server->close();
+    unlink("/tmp/wyz_test_hosts");
+    unlink("/tmp/wyz_test_resolv.conf");
+    WYZ_LOG_INFO(g_logger) << "test_dns fails=" << fails;
+}
+
+int main(int argc, char const *argv[])
+{
+    signal(SIGPIPE, SIG_IGN);
+    WYZ_LOG_NAME("system")->setLevel(wyz::LogLevel::FATAL);
+    {
+        wyz::IOManager iom(1, false, "dns");
+        iom.schedule(&run);
+    }
+    return fails != 0;
+}
@@ -7,8 +7,10 @@
 
 #include "../src/log.h"
 #include "../src/fiber.h"
+#include "test_check.h"
 #include <string>
 #include <vector>
+#include <ucontext.h>
 
 static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
 void run_fiber(){
@@ -33,6 +35,94 @@ void test_fiber(){
     WYZ_LOG_INFO(g_logger) << "main end 2";
 }
 
+/// 协程栈池: 对比每次 new Fiber 与 Create/Recycle 复用的耗时
+void test_stack_pool(){
+    wyz::Fiber::GetThis();
+    const int n = 100000;
+    uint64_t hits = wyz::Fiber::StackPoolHits();
+    uint64_t misses = wyz::Fiber::StackPoolMisses();
+    uint64_t start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < n ; ++i){
+        wyz::Fiber::ptr fiber(new wyz::Fiber([](){}));
+        fiber->call();
+    }
+    uint64_t used_new = wyz::GetCurrentUS() - start;
+    /// 释放的栈回到池中, 之后的协程都复用它, 最多第一次需要新分配
+    CHECK(wyz::Fiber::StackPoolHits() - hits >= (uint64_t)n - 1);
+    CHECK(wyz::Fiber::StackPoolMisses() - misses <= 1);
+
+    uint64_t cache_hits = wyz::Fiber::FiberCacheHits();
+
+    start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < n ; ++i){
+        wyz::Fiber::ptr fiber = wyz::Fiber::Create([](){});
+        fiber->call();
+        wyz::Fiber::Recycle(fiber);
+    }
+    uint64_t used_cache = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << "fibers=" << n
+        << " new=" << used_new << "us cache=" << used_cache << "us"
+        << " stack_pool hits=" << wyz::Fiber::StackPoolHits()
+        << " misses=" << wyz::Fiber::StackPoolMisses()
+        << " fiber_cache hits=" << wyz::Fiber::FiberCacheHits();
+    CHECK(wyz::Fiber::FiberCacheHits() - cache_hits >= (uint64_t)n - 1);
+
+    /// 默认大小与其他大小交替创建, 其他大小直接 mmap, 不冲掉池中的栈
+    misses = wyz::Fiber::StackPoolMisses();
+    start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < n ; ++i){
+        wyz::Fiber::ptr fiber = wyz::Fiber::Create([](){}, i % 2 ? 64 * 1024 : 0);
+        fiber->call();
+        wyz::Fiber::Recycle(fiber);
+    }
+    WYZ_LOG_INFO(g_logger) << "mixed sizes fibers=" << n
+        << " used=" << wyz::GetCurrentUS() - start << "us"
+        << " stack_pool misses=" << wyz::Fiber::StackPoolMisses() - misses;
+    CHECK(wyz::Fiber::StackPoolMisses() == misses);
+}
+
+/// 上下文切换速度: 当前编译的 Fiber 后端 与 直接 swapcontext 对比
+static const int s_switches = 1000000;
+static ucontext_t s_main_uctx;
+static ucontext_t s_fiber_uctx;
+
+static void uctx_func(){
+    while(true){
+        swapcontext(&s_fiber_uctx, &s_main_uctx);
+    }
+}
+
+void test_switch(){
+    wyz::Fiber::GetThis();
+    wyz::Fiber::ptr fiber(new wyz::Fiber([](){
+        for(int i = 0 ; i < s_switches ; ++i){
+            wyz::Fiber::YieldToHold();
+        }
+    }));
+    uint64_t start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < s_switches ; ++i){
+        fiber->call();
+    }
+    uint64_t used = wyz::GetCurrentUS() - start;
+    fiber->call();
+    WYZ_LOG_INFO(g_logger) << "backend=" << wyz::FiberContext::Backend()
+        << " switches/s=" << (uint64_t)(s_switches * 2 * 1000000.0 / (used ? used : 1));
+
+    std::vector<char> stack(128 * 1024);
+    getcontext(&s_fiber_uctx);
+    s_fiber_uctx.uc_link = nullptr;
+    s_fiber_uctx.uc_stack.ss_sp = &stack[0];
+    s_fiber_uctx.uc_stack.ss_size = stack.size();
+    makecontext(&s_fiber_uctx, &uctx_func, 0);
+    start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < s_switches ; ++i){
+        swapcontext(&s_main_uctx, &s_fiber_uctx);
+    }
+    used = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << "backend=ucontext(raw) switches/s="
+        << (uint64_t)(s_switches * 2 * 1000000.0 / (used ? used : 1));
+}
+
 int main(int argc , char** argv){
     wyz::Thread::SetName("main");
     std::vector<wyz::Thread::ptr> thrs;
@@ -43,5 +133,12 @@ int main(int argc , char** argv){
     for(auto i : thrs){
         i->join();
     }
-    return 0;
+
+    wyz::LoggerMgr::GetInstance()->getLogger("system")->setLevel(wyz::LogLevel::INFO);
+    wyz::Thread::ptr thr(new wyz::Thread(test_stack_pool, "stack_pool"));
+    thr->join();
+
+    thr.reset(new wyz::Thread(test_switch, "switch"));
+    thr->join();
+    return fails != 0;
 }
\ No newline at end of file
@@ -0,0 +1,202 @@
+/*
+ * @Description: 测试静态文件 Servlet, 对比 sendfile/mmap 与读文件到 body
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-11-25 21:12:40
+ */
+
+#include "../src/log.h"
+#include "../src/util.h"
+#include "../src/iomanager.h"
+#include "../src/address.h"
+#include "../src/socket.h"
+#include "../src/http/http_server.h"
+#include "../src/http/file_servlet.h"
+#include "test_check.h"
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <signal.h>
+#include <sstream>
+#include <strings.h>
+#include <unistd.h>
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
+
+using namespace wyz::http;
+
+static std::string g_root = "/tmp/wyz_file_servlet";
+static const size_t s_big_size = 3 * 1024 * 1024 + 17;
+static wyz::Address::ptr g_addr;
+static HttpServer::ptr g_server;
+
+struct Response{
+    int status = 0;
+    std::string head;
+    std::string body;
+};
+
+static std::string header(const Response& rsp , const std::string& key){
+    std::string k = "\r\n" + key + ": ";
+    const char* p = strcasestr(rsp.head.c_str(), k.c_str());
+    if(!p){
+        return "";
+    }
+    p += k.size();
+    return std::string(p, strstr(p, "\r\n") - p);
+}
+
+/// 读一个响应, HEAD 与 304 没有消息体
+static bool request(wyz::Socket::ptr sock , const std::string& req , Response& rsp , std::string& buf , bool head = false){
+    if(!req.empty() && sock->send(req.c_str(), req.size()) <= 0){
+        return false;
+    }
+    char tmp[65536];
+    size_t pos;
+    while((pos = buf.find("\r\n\r\n")) == std::string::npos){
+        int rt = sock->recv(tmp, sizeof(tmp));
+        if(rt <= 0){
+            return false;
+        }
+        buf.append(tmp, rt);
+    }
+    rsp.head = buf.substr(0, pos + 2);
+    buf.erase(0, pos + 4);
+    rsp.status = atoi(rsp.head.c_str() + 9);
+    size_t length = head ? 0 : atoll(header(rsp, "Content-Length").c_str());
+    while(buf.size() < length){
+        int rt = sock->recv(tmp, sizeof(tmp));
+        if(rt <= 0){
+            return false;
+        }
+        buf.append(tmp, rt);
+    }
+    rsp.body = buf.substr(0, length);
+    buf.erase(0, length);
+    return true;
+}
+
+static wyz::Socket::ptr connect(){
+    wyz::Socket::ptr sock = wyz::Socket::CreateTCP(g_addr);
+    if(!sock->connect(g_addr)){
+        WYZ_LOG_ERROR(g_logger) << "connect " << g_addr->toString() << " fail";
+        ++fails;
+        return nullptr;
+    }
+    return sock;
+}
+
+void test_file(FileServlet::ptr fs , const std::string& big){
+    wyz::Socket::ptr sock = connect();
+    if(!sock){
+        return;
+    }
+    std::string buf;
+    Response rsp;
+    CHECK(request(sock, "GET /static/a.txt HTTP/1.1\r\n\r\n", rsp, buf) && rsp.status == 200 && rsp.body == "hello wyz\n");
+    CHECK(header(rsp, "Content-Type") == "text/plain" && !header(rsp, "ETag").empty());
+    std::string etag = header(rsp, "ETag");
+    std::string last = header(rsp, "Last-Modified");
+
+    CHECK(request(sock, "GET /static/big.bin HTTP/1.1\r\n\r\n", rsp, buf) && rsp.status == 200 && rsp.body == big);
+    CHECK(request(sock, "GET /static/big.bin HTTP/1.1\r\nRange: bytes=100-199\r\n\r\n", rsp, buf)
+            && rsp.status == 206 && rsp.body == big.substr(100, 100));
+    CHECK(header(rsp, "Content-Range") == "bytes 100-199/" + std::to_string(big.size()));
+    CHECK(request(sock, "GET /static/big.bin HTTP/1.1\r\nRange: bytes=-10\r\n\r\n", rsp, buf)
+            && rsp.status == 206 && rsp.body == big.substr(big.size() - 10));
+    CHECK(request(sock, "GET /static/a.txt HTTP/1.1\r\nRange: bytes=3-\r\n\r\n", rsp, buf)
+            && rsp.status == 206 && rsp.body == "lo wyz\n");
+    CHECK(request(sock, "GET /static/a.txt HTTP/1.1\r\nRange: bytes=100-\r\n\r\n", rsp, buf)
+            && rsp.status == 416 && header(rsp, "Content-Range") == "bytes */10");
+
+    CHECK(request(sock, "GET /static/a.txt HTTP/1.1\r\nIf-None-Match: \"x\", W/" + etag + "\r\n\r\n", rsp, buf, true)
+            && rsp.status == 304);
+    CHECK(request(sock, "GET /static/a.txt HTTP/1.1\r\nIf-Modified-Since: " + last + "\r\n\r\n", rsp, buf, true)
+            && rsp.status == 304);
+    CHECK(request(sock, "HEAD /static/big.bin HTTP/1.1\r\n\r\n", rsp, buf, true)
+            && rsp.status == 200 && header(rsp, "Content-Length") == std::to_string(big.size()) && rsp.body.empty());
+    CHECK(request(sock, "GET / HTTP/1.1\r\n\r\n", rsp, buf) && rsp.status == 404);
+    CHECK(request(sock, "GET /static/ HTTP/1.1\r\n\r\n", rsp, buf) && rsp.status == 200 && rsp.body == "<html>index</html>");
+    CHECK(request(sock, "GET /static/none HTTP/1.1\r\n\r\n", rsp, buf) && rsp.status == 404);
+    CHECK(request(sock, "GET /static/../file_servlet/a.txt HTTP/1.1\r\n\r\n", rsp, buf) && rsp.status == 404);
+    CHECK(request(sock, "POST /static/a.txt HTTP/1.1\r\nContent-Length: 0\r\n\r\n", rsp, buf) && rsp.status == 405);
+
+    /// 流水线: 文件响应排在普通响应之后
+    std::string pipeline = "GET /static/none HTTP/1.1\r\n\r\nGET /static/a.txt HTTP/1.1\r\n\r\n";
+    CHECK(request(sock, pipeline, rsp, buf) && rsp.status == 404);
+    CHECK(request(sock, "", rsp, buf) && rsp.status == 200 && rsp.body == "hello wyz\n");
+    CHECK(fs->getCacheSize() == 3);
+
+    WYZ_LOG_INFO(g_logger) << "test_file fails=" << fails;
+}
+
+void bench(const std::string& path , size_t size , int n){
+    wyz::Socket::ptr sock = connect();
+    if(!sock){
+        return;
+    }
+    std::string req = "GET " + path + " HTTP/1.1\r\n\r\n";
+    std::string buf;
+    Response rsp;
+    uint64_t start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < n ; ++i){
+        if(!request(sock, req, rsp, buf) || rsp.body.size() != size){
+            WYZ_LOG_ERROR(g_logger) << "bench " << path << " fail";
+            return;
+        }
+    }
+    uint64_t used = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << path << " size=" << size << " n=" << n
+        << " used=" << used << "us per=" << used / n << "us";
+}
+
+void run(){
+    g_addr = wyz::IPv4Address::Create("127.0.0.1", 18640);
+    g_server.reset(new HttpServer(true));
+    if(!g_server->bind(g_addr)){
+        WYZ_LOG_ERROR(g_logger) << "bind " << g_addr->toString() << " fail";
+        ++fails;
+        return;
+    }
+    system(("rm -rf " + g_root + " && mkdir -p " + g_root).c_str());
+    std::string big(s_big_size, 0);
+    for(size_t i = 0 ; i < big.size() ; ++i){
+        big[i] = (char)(i * 7);
+    }
+    std::ofstream(g_root + "/a.txt") << "hello wyz\n";
+    std::ofstream(g_root + "/index.html") << "<html>index</html>";
+    std::ofstream(g_root + "/big.bin", std::ios::binary) << big;
+
+    FileServlet::ptr fs(new FileServlet(g_root, "/static"));
+    ServletDispatch::ptr sd = g_server->getServletDispatch();
+    sd->addPrefixServlet("/static/", fs);
+    /// 对比: 每次把文件读到 body 里
+    sd->addPrefixServlet("/read/", [](HttpRequest::ptr req , HttpResponse::ptr rsp , HttpSession::ptr){
+        std::ifstream ifs(g_root + req->getPath().substr(5), std::ios::binary);
+        std::stringstream ss;
+        ss << ifs.rdbuf();
+        rsp->setBody(ss.str());
+        return 0;
+    });
+    g_server->start();
+
+    test_file(fs, big);
+    bench("/static/a.txt", 10, 2000);
+    bench("/read/a.txt", 10, 2000);
+    bench("/static/big.bin", s_big_size, 50);
+    bench("/read/big.bin", s_big_size, 50);
+
+    g_server->stop();
+    system(("rm -rf " + g_root).c_str());
+}
+
+int main(int argc, char const *argv[])
+{
+    signal(SIGPIPE, SIG_IGN);
+    WYZ_LOG_NAME("system")->setLevel(wyz::LogLevel::ERROR);
+    {
+        wyz::IOManager iom(2, false, "file");
+        iom.schedule(&run);
+    }
+    return fails != 0;
+}
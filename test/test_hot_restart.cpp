@@ -0,0 +1,150 @@
+/*
+ * @Description: 测试热重启, 父进程是旧服务器, 子进程接过监听 socket, 客户端请求不中断
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-12-02 15:40:12
+ */
+
+#include "../src/log.h"
+#include "../src/util.h"
+#include "../src/iomanager.h"
+#include "../src/address.h"
+#include "../src/http/http_server.h"
+#include "../src/http/http_connection.h"
+#include "test_check.h"
+#include <atomic>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
+
+static const uint16_t s_port = 18720;
+static const char* s_path = "/tmp/wyz_hot_restart.sock";
+
+/// 处理 50ms, 返回处理请求的进程号
+static wyz::http::HttpServer::ptr make_server(wyz::IOManager* iom){
+    wyz::http::HttpServer::ptr server(new wyz::http::HttpServer(true, iom, iom));
+    server->getServletDispatch()->addServlet("/pid", [](wyz::http::HttpRequest::ptr req
+                , wyz::http::HttpResponse::ptr rsp , wyz::http::HttpSession::ptr session){
+        usleep(50 * 1000);
+        rsp->setBody(std::to_string(getpid()));
+        return 0;
+    });
+    return server;
+}
+
+/// 旧进程: 服务到新进程接过监听 socket, 等正在处理的请求结束
+static std::atomic<bool> s_drained(false);
+void run_old(wyz::IOManager* iom){
+    wyz::http::HttpServer::ptr server = make_server(iom);
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", s_port);
+    /// 空闲的长连接没有直接关闭时 drain 会超时
+    server->setDrainTimeout(3000);
+    server->setHandoffTimeout(300);
+    if(!server->bind(addr) || !server->listenHandoff(s_path, [](bool drained){
+        WYZ_LOG_INFO(g_logger) << "old pid=" << getpid() << " drained=" << drained;
+        s_drained = drained;
+    })){
+        WYZ_LOG_ERROR(g_logger) << "old server bind fail";
+        ++fails;
+        return;
+    }
+    server->start();
+}
+
+static std::atomic<bool> s_stop(false);
+static std::atomic<int> s_done(0);
+static std::atomic<int> s_old(0);
+static std::atomic<int> s_new(0);
+
+static void client_loop(wyz::http::HttpConnectionPool::ptr pool){
+    std::string old_pid = std::to_string(getppid());
+    std::string new_pid = std::to_string(getpid());
+    while(!s_stop){
+        wyz::http::HttpResult::ptr rt = pool->doGet("/pid", 1000);
+        if(rt->result != (int)wyz::http::HttpResult::Error::OK || !rt->response){
+            WYZ_LOG_ERROR(g_logger) << "request fail: " << rt->toString();
+            ++fails;
+            continue;
+        }
+        const std::string& body = rt->response->getBody();
+        if(body == old_pid){
+            ++s_old;
+        }else if(body == new_pid){
+            ++s_new;
+        }else {
+            ++fails;
+        }
+    }
+    ++s_done;
+}
+
+/// 新进程: 客户端持续请求, 中途接过监听 socket
+void run_new(wyz::IOManager* iom){
+    const int clients = 4;
+    wyz::http::HttpConnectionPool::ptr pool(new wyz::http::HttpConnectionPool("127.0.0.1", "", s_port, 8, 5000, 100));
+    for(int i = 0 ; i < clients ; ++i){
+        iom->schedule(std::bind(&client_loop, pool));
+    }
+    /// 只发一个请求之后一直空闲的长连接, 旧进程 drain 开始时直接关闭它
+    wyz::http::HttpConnectionPool::ptr idle(new wyz::http::HttpConnectionPool("127.0.0.1", "", s_port, 1, 60000, 100));
+    wyz::http::HttpResult::ptr rt = idle->doGet("/pid", 1000);
+    CHECK(rt->result == 0 && rt->response->getBody() == std::to_string(getppid()));
+    usleep(300 * 1000);
+
+    /// 连上之后不确认, 旧进程等待确认超时后接着交给下一个连接
+    wyz::Socket::ptr rogue = wyz::Socket::CreateUnixTCPSock();
+    CHECK(rogue->connect(wyz::Address::ptr(new wyz::UnixAddress(s_path))));
+
+    wyz::http::HttpServer::ptr server = make_server(iom);
+    uint64_t start = wyz::GetCurrentMS();
+    CHECK(server->bindHandoff(s_path));
+    rogue->close();
+    CHECK(server->start());
+    WYZ_LOG_INFO(g_logger) << "new pid=" << getpid() << " handoff used=" << wyz::GetCurrentMS() - start
+        << "ms served by old=" << s_old;
+
+    usleep(300 * 1000);
+    s_stop = true;
+    while(s_done < clients){
+        usleep(10 * 1000);
+    }
+    CHECK(s_old > 0 && s_new > 0);
+    /// 空闲连接已被旧进程关闭, 在新连接上重试
+    rt = idle->doGet("/pid", 1000);
+    CHECK(rt->result == 0 && rt->response->getBody() == std::to_string(getpid()));
+    CHECK(idle->getStats().retries == 1);
+    WYZ_LOG_INFO(g_logger) << "served by old=" << s_old << " new=" << s_new << " fails=" << fails;
+    server->stop();
+}
+
+int main(int argc, char const *argv[])
+{
+    signal(SIGPIPE, SIG_IGN);
+    WYZ_LOG_NAME("system")->setLevel(wyz::LogLevel::ERROR);
+    pid_t pid = fork();
+    if(pid < 0){
+        return 1;
+    }
+    if(pid == 0){
+        /// 等旧进程开始监听
+        usleep(100 * 1000);
+        {
+            wyz::IOManager iom(2, false, "new");
+            iom.schedule(std::bind(&run_new, &iom));
+        }
+        return fails != 0;
+    }
+
+    {
+        wyz::IOManager iom(2, false, "old");
+        iom.schedule(std::bind(&run_old, &iom));
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    CHECK(s_drained);
+    WYZ_LOG_INFO(g_logger) << "test_hot_restart fails=" << fails;
+    return fails != 0;
+}
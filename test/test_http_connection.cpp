@@ -0,0 +1,179 @@
+/*
+ * @Description: 测试 http 客户端连接池, 对比复用连接与每次新建连接
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-11-26 20:41:12
+ */
+
+#include "../src/log.h"
+#include "../src/util.h"
+#include "../src/iomanager.h"
+#include "../src/address.h"
+#include "../src/http/http_server.h"
+#include "../src/http/http_connection.h"
+#include "test_check.h"
+#include <atomic>
+#include <signal.h>
+#include <unistd.h>
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
+
+using namespace wyz::http;
+
+static const uint16_t s_port = 18650;
+static HttpServer::ptr g_server;
+
+static std::string make_data(size_t size){
+    std::string data(size, 0);
+    for(size_t i = 0 ; i < size ; ++i){
+        data[i] = (char)(i * 13);
+    }
+    return data;
+}
+
+static void print_stats(HttpConnectionPool::ptr pool){
+    HttpConnectionPool::Stats s = pool->getStats();
+    WYZ_LOG_INFO(g_logger) << "pool requests=" << s.requests << " hits=" << s.hits
+        << " connects=" << s.connects << " retries=" << s.retries << " idle=" << s.idle
+        << " inflight=" << s.inflight << " hit_rate=" << s.hitRate;
+}
+
+void test_pool(){
+    HttpConnectionPool::ptr pool(new HttpConnectionPool("127.0.0.1", "test", s_port, 4, 1000, 50));
+
+    HttpResult::ptr rt = pool->doGet("/echo?a=1", 1000);
+    CHECK(rt->result == 0 && rt->response->getBody() == "GET /echo a=1 test");
+    rt = pool->doPost("/echo", 1000, {{"X-Test", "1"}}, "hello");
+    CHECK(rt->result == 0 && rt->response->getBody() == "POST /echo  test hello");
+    rt = pool->doRequest(HttpMethod::HEAD, "/echo", 1000);
+    CHECK(rt->result == 0 && rt->response->getBody().empty());
+
+    /// 分块编码的响应
+    std::string big = make_data(1024 * 1024 + 3);
+    rt = pool->doGet("/chunked", 3000);
+    CHECK(rt->result == 0 && rt->response->getBody() == big);
+    rt = pool->doGet("/notfound", 1000);
+    CHECK(rt->result == 0 && rt->response->getStatus() == HttpStatus::NOT_FOUND);
+
+    /// 流水线
+    std::vector<HttpRequest::ptr> reqs;
+    for(int i = 0 ; i < 40 ; ++i){
+        HttpRequest::ptr req(new HttpRequest);
+        req->setPath(i % 10 == 9 ? "/chunked" : "/echo");
+        req->setQuery("i=" + std::to_string(i));
+        reqs.push_back(req);
+    }
+    std::vector<HttpResult::ptr> rts = pool->doRequests(reqs, 3000);
+    CHECK(rts.size() == reqs.size());
+    for(size_t i = 0 ; i < rts.size() ; ++i){
+        CHECK(rts[i]->result == 0 && rts[i]->response->getBody()
+                == (i % 10 == 9 ? big : "GET /echo i=" + std::to_string(i) + " test"));
+    }
+    /// 一个连接最多 50 个请求
+    for(int i = 0 ; i < 20 ; ++i){
+        rt = pool->doGet("/echo", 1000);
+        CHECK(rt->result == 0);
+    }
+    HttpConnectionPool::Stats s = pool->getStats();
+    CHECK(s.connects == 2 && s.inflight == 0 && s.idle == 1);
+
+    /// 服务端先关闭空闲连接, 重试一次
+    usleep(400 * 1000);
+    rt = pool->doGet("/echo", 1000);
+    CHECK(rt->result == 0 && rt->response->getBody() == "GET /echo  test");
+    CHECK(pool->getStats().retries == 1);
+
+    rt = pool->doGet("/sleep", 100);
+    CHECK(rt->result == (int)HttpResult::Error::TIMEOUT);
+    HttpConnectionPool::ptr bad(new HttpConnectionPool("127.0.0.1", "", s_port + 1, 4, 1000, 50));
+    rt = bad->doGet("/", 100);
+    CHECK(rt->result == (int)HttpResult::Error::CONNECT_FAIL);
+    print_stats(pool);
+    WYZ_LOG_INFO(g_logger) << "test_pool fails=" << fails;
+}
+
+void bench(){
+    const int n = 2000;
+    HttpConnectionPool::ptr pool(new HttpConnectionPool("127.0.0.1", "test", s_port, 4, 60000, 100000));
+    uint64_t start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < n ; ++i){
+        pool->doGet("/echo", 1000);
+    }
+    uint64_t used = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << "pool n=" << n << " used=" << used << "us per=" << used / n << "us";
+    print_stats(pool);
+
+    /// 每次新建连接
+    start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < n ; ++i){
+        HttpConnectionPool pool("127.0.0.1", "test", s_port, 0, 60000, 100000);
+        pool.doGet("/echo", 1000);
+    }
+    used = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << "connect n=" << n << " used=" << used << "us per=" << used / n << "us";
+
+    /// 流水线 100 个请求一批
+    std::vector<HttpRequest::ptr> reqs;
+    for(int i = 0 ; i < 100 ; ++i){
+        HttpRequest::ptr req(new HttpRequest);
+        req->setPath("/echo");
+        reqs.push_back(req);
+    }
+    start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < n / 100 ; ++i){
+        pool->doRequests(reqs, 1000);
+    }
+    used = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << "pipeline n=" << n << " used=" << used << "us per=" << used / n << "us";
+}
+
+void run(){
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", s_port);
+    g_server.reset(new HttpServer(true));
+    /// 空闲连接 300ms 后由服务端关闭
+    g_server->setReadTimeout(300);
+    if(!g_server->bind(addr)){
+        WYZ_LOG_ERROR(g_logger) << "bind " << addr->toString() << " fail";
+        ++fails;
+        return;
+    }
+    ServletDispatch::ptr sd = g_server->getServletDispatch();
+    sd->addServlet("/echo", [](HttpRequest::ptr req , HttpResponse::ptr rsp , HttpSession::ptr){
+        std::string body = HttpMethodToString(req->getMethod()) + std::string(" ") + req->getPath()
+            + " " + req->getQuery() + " " + req->getHeader("host");
+        if(!req->getBody().empty()){
+            body += " " + req->getBody();
+        }
+        rsp->setBody(body);
+        return 0;
+    });
+    sd->addServlet("/chunked", [](HttpRequest::ptr req , HttpResponse::ptr rsp , HttpSession::ptr session){
+        std::string data = make_data(1024 * 1024 + 3);
+        HttpBodyWriter writer(session, rsp);
+        size_t size = 1;
+        for(size_t pos = 0 ; pos < data.size() ; pos += size, size = size * 3 + 1){
+            writer.write(&data[pos], std::min(size, data.size() - pos));
+        }
+        return 0;
+    });
+    sd->addServlet("/sleep", [](HttpRequest::ptr req , HttpResponse::ptr rsp , HttpSession::ptr){
+        usleep(300 * 1000);
+        return 0;
+    });
+    g_server->start();
+
+    test_pool();
+    bench();
+    g_server->stop();
+}
+
+int main(int argc, char const *argv[])
+{
+    signal(SIGPIPE, SIG_IGN);
+    WYZ_LOG_NAME("system")->setLevel(wyz::LogLevel::FATAL);
+    {
+        wyz::IOManager iom(2, false, "client");
+        iom.schedule(&run);
+    }
+    return fails != 0;
+}
@@ -0,0 +1,656 @@
+/*
+ * @Description: 测试 http 请求解析, 对比每个请求新建解析器与零拷贝复用缓冲区
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-11-23 21:05:12
+ */
+
+#include "../src/log.h"
+#include "../src/address.h"
+#include "../src/socket.h"
+#include "../src/iomanager.h"
+#include "../src/util.h"
+#include "../src/http/http_body.h"
+#include "../src/http/http_parser.h"
+#include "../src/http/http_session.h"
+#include "test_check.h"
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
+
+using namespace wyz::http;
+
+/// 统计堆分配次数
+static std::atomic<uint64_t> s_allocs(0);
+
+void* operator new(size_t size){
+    ++s_allocs;
+    void* p = malloc(size);
+    if(!p){
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept{
+    free(p);
+}
+
+static const char s_request[] =
+    "GET /api/v1/user/info?id=1234&name=wyz HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: bench_http/1.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Cookie: session=abcdef0123456789; theme=dark\r\n"
+    "X-Request-Id: 0123456789abcdef\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+/// 原来 HttpSession::recvRequest 的做法: 每个请求新建解析器与缓冲区
+void bench_copy(int n){
+    uint64_t allocs = s_allocs;
+    uint64_t start = wyz::GetCurrentUS();
+    size_t total = 0;
+    for(int i = 0 ; i < n ; ++i){
+        HttpRequestParser::ptr parser(new HttpRequestParser);
+        uint64_t buffsize = HttpRequestParser::GetHttpRequestBufferSize();
+        std::shared_ptr<char> buffer(new char[buffsize] , [](char* ptr){
+            delete [] ptr;
+        });
+        memcpy(buffer.get(), s_request, sizeof(s_request) - 1);
+        parser->exectue(buffer.get(), sizeof(s_request) - 1);
+        HttpRequest::ptr req = parser->getData();
+        req->init();
+        total += req->getPath().size() + req->getHeader("host").size();
+    }
+    uint64_t used = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << "copy:      " << used * 1000 / n << "ns/request "
+        << (double)(s_allocs - allocs) / n << " allocs/request check=" << total;
+}
+
+/// 零拷贝: 解析器, 缓冲区, 请求对象都复用
+void bench_zero_copy(int n){
+    HttpRequestParser parser(true);
+    HttpRequest::ptr req(new HttpRequest);
+    std::vector<char> buffer(HttpRequestParser::GetHttpRequestBufferSize());
+    uint64_t allocs = s_allocs;
+    uint64_t start = wyz::GetCurrentUS();
+    size_t total = 0;
+    for(int i = 0 ; i < n ; ++i){
+        req->reset();
+        parser.reset(req);
+        memcpy(&buffer[0], s_request, sizeof(s_request) - 1);
+        parser.execute(&buffer[0], sizeof(s_request) - 1, 0);
+        req->setRawBase(&buffer[0]);
+        req->init();
+        StringView host;
+        req->getHeaderView("host", host);
+        total += req->getPathView().size() + host.size();
+    }
+    uint64_t used = wyz::GetCurrentUS() - start;
+    uint64_t count = s_allocs - allocs;
+    WYZ_LOG_INFO(g_logger) << "zero_copy: " << used * 1000 / n << "ns/request "
+        << (double)count / n << " allocs/request check=" << total;
+    /// 只有前几个请求时头部数组扩容, 之后不再分配, 与请求数无关
+    CHECK(count <= 8);
+}
+
+static HttpResponse::ptr make_response(){
+    HttpResponse::ptr rsp(new HttpResponse(0x11, false));
+    rsp->setHeader("Content-Type", "application/json");
+    rsp->setHeader("Cache-Control", "no-cache");
+    rsp->setBody(std::string(1024, 'x'));
+    return rsp;
+}
+
+/// 原来的 HttpResponse::dump, 每个字段经过 ostream 格式化, 消息体拷贝在头部后面
+static std::ostream& dump_stream(std::ostream& os, const HttpResponse& rsp){
+    os << "HTTP/"
+        << ((uint32_t)(rsp.getVersion() >> 4))
+        << "."
+        << ((uint32_t)(rsp.getVersion() & 0x0F))
+        << " "
+        << (uint32_t)rsp.getStatus()
+        << " "
+        << (rsp.getReason().empty() ? HttpStatusToString(rsp.getStatus()) : rsp.getReason())
+        << "\r\n";
+    for(auto i : rsp.getHeader()){
+        if(strcasecmp(i.first.c_str(), "connection") == 0){
+            continue;
+        }
+        os << i.first << ":" << i.second << "\r\n";
+    }
+    os << "connection: " << (rsp.isClose() ? "close" : "keep-alive") << "\r\n";
+    if(!rsp.getBody().empty()){
+        os << "content-length: " << rsp.getBody().size() << "\r\n\r\n"
+           << rsp.getBody();
+    }else {
+        os << "\r\n";
+    }
+    return os;
+}
+
+/// 原来 HttpSession::sendResponse 的做法: 经过 stringstream 再拷贝成 std::string
+void bench_response_stream(int n){
+    HttpResponse::ptr rsp = make_response();
+    uint64_t allocs = s_allocs;
+    uint64_t start = wyz::GetCurrentUS();
+    size_t total = 0;
+    for(int i = 0 ; i < n ; ++i){
+        std::stringstream ss;
+        dump_stream(ss, *rsp);
+        std::string data = ss.str();
+        total += data.size();
+    }
+    uint64_t used = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << "response stream:   " << used * 1000 / n << "ns/response "
+        << (double)(s_allocs - allocs) / n << " allocs/response bytes=" << total / n;
+}
+
+/// 头部写入复用的缓冲区, 消息体单独发送
+void bench_response_vectored(int n){
+    HttpResponse::ptr rsp = make_response();
+    std::string buf;
+    uint64_t allocs = s_allocs;
+    uint64_t start = wyz::GetCurrentUS();
+    size_t total = 0;
+    for(int i = 0 ; i < n ; ++i){
+        buf.clear();
+        rsp->serializeHead(buf);
+        total += buf.size() + rsp->getBody().size();
+    }
+    uint64_t used = wyz::GetCurrentUS() - start;
+    uint64_t count = s_allocs - allocs;
+    WYZ_LOG_INFO(g_logger) << "response vectored: " << used * 1000 / n << "ns/response "
+        << (double)count / n << " allocs/response bytes=" << total / n;
+    /// 缓冲区只在第一次序列化时扩容, 之后不再分配
+    CHECK(count <= 8);
+    WYZ_LOG_INFO(g_logger) << "\n" << buf;
+}
+
+/// serializeHead 逐字节与期望的头部一致, 消息体不在头部中
+void test_serialize_head(){
+    HttpResponse::ptr rsp = make_response();
+    std::string buf;
+    rsp->serializeHead(buf);
+    size_t date_pos = buf.find("Date: ");
+    size_t date_end = buf.find("\r\n", date_pos);
+    CHECK(date_pos != std::string::npos && date_end != std::string::npos);
+    if(date_pos == std::string::npos || date_end == std::string::npos){
+        return;
+    }
+    /// Date 的格式: "Date: Sun, 17 Oct 2021 08:00:00 GMT"
+    std::string date = buf.substr(date_pos, date_end + 2 - date_pos);
+    CHECK(date.size() == 37 && date.compare(date.size() - 6, 6, " GMT\r\n") == 0);
+    std::string expect = "HTTP/1.1 200 OK\r\n"
+        + date
+        + "Connection: keep-alive\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Content-Type: application/json\r\n"
+        "Server: wyz/1.0\r\n"
+        "Content-Length: 1024\r\n"
+        "\r\n";
+    CHECK(buf == expect);
+    CHECK(rsp->getBody() == std::string(1024, 'x'));
+
+    /// 设置了的 Date, Server, Connection 不重复, 204 没有 Content-Length
+    rsp.reset(new HttpResponse(0x10, true));
+    rsp->setStatus(HttpStatus::NO_CONTENT);
+    rsp->setHeader("Date", "Sun, 17 Oct 2021 08:00:00 GMT");
+    rsp->setHeader("Server", "test");
+    rsp->setHeader("Connection", "keep-alive");
+    buf.clear();
+    rsp->serializeHead(buf);
+    CHECK(buf == "HTTP/1.0 204 No Content\r\n"
+        "Connection: close\r\n"
+        "Date: Sun, 17 Oct 2021 08:00:00 GMT\r\n"
+        "Server: test\r\n"
+        "\r\n");
+
+    /// 自定义原因短语走格式化路径
+    rsp.reset(new HttpResponse(0x11, false));
+    rsp->setStatus(HttpStatus::NOT_FOUND);
+    rsp->setReason("Gone Fishing");
+    rsp->setHeader("Date", "x");
+    buf.clear();
+    rsp->serializeHead(buf);
+    CHECK(buf == "HTTP/1.1 404 Gone Fishing\r\n"
+        "Connection: keep-alive\r\n"
+        "Date: x\r\n"
+        "Server: wyz/1.0\r\n"
+        "Content-Length: 0\r\n"
+        "\r\n");
+    WYZ_LOG_INFO(g_logger) << "test_serialize_head fails=" << fails;
+}
+
+/// 参数与 cookie 在访问时才解析
+void test_params(){
+    HttpRequestParser parser(true);
+    HttpRequest::ptr req(new HttpRequest);
+    std::string buf = "POST /form?a=1&b=hello+world&c=%E4%BD%A0%e5%a5%bd&a=2&&empty= HTTP/1.1\r\n"
+        "Host: test\r\n"
+        "Content-Type: application/x-www-form-urlencoded; charset=utf-8\r\n"
+        "Cookie: sid=abc%20def;  theme = dark ;flag\r\n"
+        "Content-Length: 30\r\n"
+        "\r\n";
+    size_t head = buf.size();
+    buf += "d=x%26y&a=3&e=%3D&bad=%zz%4";
+    req->reset();
+    parser.reset(req);
+    parser.execute(&buf[0], head, 0);
+    req->setRawBase(&buf[0]);
+    req->init();
+    req->setBody(buf.substr(head));
+
+    uint64_t allocs = s_allocs;
+    CHECK(req->getPararm("a") == "1");
+    CHECK(req->getPararm("b") == "hello world");
+    CHECK(req->getPararm("c") == "\xe4\xbd\xa0\xe5\xa5\xbd");
+    CHECK(req->getPararm("bad") == "%zz%4");
+    CHECK(req->hasPararm("empty") && req->getPararm("empty").empty());
+    CHECK(req->getPararm("d") == "x&y" && req->getPararm("e") == "=");
+    CHECK(req->getPararmAs<int>("a") == 1);
+    CHECK(req->getPararms().size() == 7);
+    CHECK(s_allocs > allocs);
+
+    CHECK(req->getCookie("sid") == "abc%20def");
+    CHECK(req->getCookie("theme") == "dark");
+    CHECK(req->hasCookie("flag"));
+    CHECK(req->getCookies().size() == 3);
+
+    req->setPararm("f", "6");
+    req->delPararm("b");
+    CHECK(req->getPararm("f") == "6" && !req->hasPararm("b"));
+
+    /// 不是表单的消息体不解析
+    req->reset();
+    parser.reset(req);
+    std::string json = "POST /json?x=1 HTTP/1.1\r\nContent-Type: application/json\r\n\r\n";
+    parser.execute(&json[0], json.size(), 0);
+    req->setRawBase(&json[0]);
+    req->init();
+    req->setBody("y=2");
+    CHECK(req->getPararm("x") == "1" && !req->hasPararm("y") && req->getCookies().empty());
+
+    char inplace[] = "a%2Bb+c%";
+    CHECK(std::string(inplace, wyz::http::UrlDecode(inplace, sizeof(inplace) - 1, inplace)) == "a+b c%");
+    WYZ_LOG_INFO(g_logger) << "test_params fails=" << fails;
+}
+
+/// 重复的头部: 零拷贝与普通模式都保留第一个, materialize 前后一致
+void test_duplicate_header(){
+    std::string buf = "GET /dup HTTP/1.1\r\nX-Dup: first\r\nx-dup: second\r\n\r\n";
+    HttpRequestParser zero(true);
+    HttpRequest::ptr req(new HttpRequest);
+    zero.reset(req);
+    zero.execute(&buf[0], buf.size(), 0);
+    req->setRawBase(&buf[0]);
+    req->init();
+    StringView dup;
+    CHECK(req->getHeaderView("x-dup", dup) && dup == StringView("first"));
+    CHECK(req->getHeader("X-DUP") == "first");
+    req->materialize();
+    CHECK(!req->isRaw() && req->getHeader("x-dup") == "first");
+
+    HttpRequestParser copy;
+    std::string data = buf;
+    copy.exectue(&data[0], data.size());
+    CHECK(copy.getData()->getHeader("x-dup") == "first");
+    WYZ_LOG_INFO(g_logger) << "test_duplicate_header fails=" << fails;
+}
+
+static int hex(char c){
+    return isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10);
+}
+
+/// 逐字节解码, 用于对比
+static size_t naive_url_decode(const char* src , size_t len , char* dst){
+    size_t out = 0;
+    for(size_t i = 0 ; i < len ; ++i){
+        if(src[i] == '+'){
+            dst[out++] = ' ';
+        }else if(src[i] == '%' && i + 2 < len && isxdigit(src[i + 1]) && isxdigit(src[i + 2])){
+            dst[out++] = (char)(hex(src[i + 1]) << 4 | hex(src[i + 2]));
+            i += 2;
+        }else {
+            dst[out++] = src[i];
+        }
+    }
+    return out;
+}
+
+void bench_url_decode(int n){
+    /// 典型的参数值大部分是不需要转义的字符
+    std::string src;
+    for(int i = 0 ; i < 16 ; ++i){
+        src += "token_" + std::to_string(i * 7919) + "_abcdefghijklmnopqrstuvwxyz%2F";
+    }
+    std::string dst(src.size(), 0);
+    size_t total = 0;
+    uint64_t start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < n ; ++i){
+        total += naive_url_decode(src.data(), src.size(), &dst[0]);
+    }
+    uint64_t naive = wyz::GetCurrentUS() - start;
+    std::string expect = dst;
+    start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < n ; ++i){
+        total += wyz::http::UrlDecode(src.data(), src.size(), &dst[0]);
+    }
+    uint64_t fast = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << "url_decode len=" << src.size() << " naive: " << naive * 1000 / n
+        << "ns fast: " << fast * 1000 / n << "ns same=" << (dst == expect) << " check=" << total;
+}
+
+/// 长连接上分多次写入的流水线请求, 包括跨两次读取的头部与消息体
+void test_session(){
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", 18630);
+    wyz::Socket::ptr listener = wyz::Socket::CreateTCP(addr);
+    if(!listener->bind(addr) || !listener->listen()){
+        WYZ_LOG_ERROR(g_logger) << "bind " << addr->toString() << " fail";
+        ++fails;
+        return;
+    }
+    const int count = 100;
+    wyz::IOManager::GetThis()->schedule([addr, count](){
+        wyz::Socket::ptr sock = wyz::Socket::CreateTCP(addr);
+        if(!sock->connect(addr)){
+            ++fails;
+            return;
+        }
+        std::string data;
+        for(int i = 0 ; i < count ; ++i){
+            std::string body = "body-" + std::to_string(i);
+            data += "POST /item/" + std::to_string(i) + "?q=" + std::to_string(i) + " HTTP/1.1\r\n"
+                "Host: test\r\nX-Index: " + std::to_string(i) + "\r\nContent-Length: "
+                + std::to_string(body.size()) + "\r\n\r\n" + body;
+        }
+        /// 用奇数长度分片写, 让头部和消息体跨越多次读取
+        for(size_t off = 0 ; off < data.size() ; off += 333){
+            sock->send(data.c_str() + off, std::min((size_t)333, data.size() - off));
+            usleep(100);
+        }
+        /// 流水线的响应按顺序返回
+        std::string rsp;
+        char buf[4096];
+        int recvs = 0;
+        size_t pos = 0;
+        int responses = 0;
+        while(responses < count){
+            int rt = sock->recv(buf, sizeof(buf));
+            if(rt <= 0){
+                break;
+            }
+            ++recvs;
+            rsp.append(buf, rt);
+            while(true){
+                size_t head = rsp.find("\r\n\r\n", pos);
+                size_t cl = rsp.find("Content-Length: ", pos);
+                if(head == std::string::npos || cl == std::string::npos){
+                    break;
+                }
+                size_t length = atoi(rsp.c_str() + cl + 16);
+                if(rsp.size() < head + 4 + length){
+                    break;
+                }
+                if(rsp.compare(head + 4, length, "ok-" + std::to_string(responses)) != 0){
+                    WYZ_LOG_ERROR(g_logger) << "response out of order index=" << responses;
+                    ++fails;
+                }
+                ++responses;
+                pos = head + 4 + length;
+            }
+        }
+        CHECK(responses == count);
+        WYZ_LOG_INFO(g_logger) << "client responses=" << responses << " recvs=" << recvs << " fails=" << fails;
+        sock->close();
+    });
+
+    wyz::Socket::ptr conn = listener->accept();
+    HttpSession::ptr session(new HttpSession(conn));
+    HttpRequest::ptr kept;
+    for(int i = 0 ; i < count ; ++i){
+        HttpRequest::ptr req = session->recvRequest();
+        if(!req){
+            WYZ_LOG_ERROR(g_logger) << "recvRequest fail index=" << i;
+            ++fails;
+            break;
+        }
+        CHECK(req->getMethod() == HttpMethod::POST);
+        CHECK(req->getPathView() == StringView("/item/" + std::to_string(i)));
+        CHECK(req->getQueryView() == StringView("q=" + std::to_string(i)));
+        CHECK(req->getHeaderAs<int>("x-index", -1) == i);
+        CHECK(req->getHeader("HOST") == "test");
+        CHECK(req->getBody() == "body-" + std::to_string(i));
+        CHECK(!req->isClose());
+        if(i == 10){
+            /// 被外部持有的请求留住旧的缓冲区, 连接换一块新的继续读
+            kept = req;
+        }
+        HttpResponse::ptr rsp(new HttpResponse(req->getVersion(), false));
+        rsp->setBody("ok-" + std::to_string(i));
+        session->queueResponse(rsp);
+    }
+    session->flush();
+    CHECK(kept && kept->getPathView() == StringView("/item/10") && kept->getHeader("x-index") == "10");
+    CHECK(kept && kept->getBody() == "body-10");
+    WYZ_LOG_INFO(g_logger) << "test_session fails=" << fails;
+}
+
+/**
+ * @brief 读一个响应, 支持 Content-Length 与分块编码, 消息体只计算长度与校验和
+ */
+static bool read_response(wyz::Socket::ptr sock , std::string& buf , uint64_t& length , uint64_t& sum){
+    length = 0;
+    sum = 0;
+    char tmp[65536];
+    size_t head;
+    while((head = buf.find("\r\n\r\n")) == std::string::npos){
+        int rt = sock->recv(tmp, sizeof(tmp));
+        if(rt <= 0){
+            return false;
+        }
+        buf.append(tmp, rt);
+    }
+    std::string header = buf.substr(0, head + 4);
+    buf.erase(0, head + 4);
+    if(header.find("Transfer-Encoding: chunked") != std::string::npos){
+        HttpChunkedDecoder decoder;
+        while(true){
+            size_t consumed = 0;
+            size_t n = decoder.decode(buf.c_str(), buf.size(), consumed, tmp, sizeof(tmp));
+            for(size_t i = 0 ; i < n ; ++i){
+                sum += (uint8_t)tmp[i];
+            }
+            length += n;
+            buf.erase(0, consumed);
+            if(decoder.isDone()){
+                return true;
+            }
+            if(decoder.hasError()){
+                return false;
+            }
+            if(buf.empty()){
+                int rt = sock->recv(tmp, sizeof(tmp));
+                if(rt <= 0){
+                    return false;
+                }
+                buf.append(tmp, rt);
+            }
+        }
+    }
+    size_t cl = header.find("Content-Length: ");
+    uint64_t left = cl == std::string::npos ? 0 : atoll(header.c_str() + cl + 16);
+    while(left > 0){
+        if(buf.empty()){
+            int rt = sock->recv(tmp, sizeof(tmp));
+            if(rt <= 0){
+                return false;
+            }
+            buf.append(tmp, rt);
+        }
+        size_t n = std::min((uint64_t)buf.size(), left);
+        for(size_t i = 0 ; i < n ; ++i){
+            sum += (uint8_t)buf[i];
+        }
+        length += n;
+        left -= n;
+        buf.erase(0, n);
+    }
+    return true;
+}
+
+/// 流式消息体: 分块上传, 分块下载, 不读消息体时跳过, 后面跟流水线请求
+void test_stream(){
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", 18631);
+    wyz::Socket::ptr listener = wyz::Socket::CreateTCP(addr);
+    if(!listener->bind(addr) || !listener->listen()){
+        WYZ_LOG_ERROR(g_logger) << "bind " << addr->toString() << " fail";
+        ++fails;
+        return;
+    }
+    const uint64_t upload = 4 * 1024 * 1024 + 123;
+    const uint64_t download = 2 * 1024 * 1024 + 77;
+    const uint64_t skipped = 2 * 1024 * 1024;
+    wyz::Socket::ptr client = wyz::Socket::CreateTCP(addr);
+    wyz::IOManager::GetThis()->schedule([client, addr, upload, skipped](){
+        if(!client->connect(addr)){
+            return;
+        }
+        /// send 可能只发出一部分, 用 writeFixSize 发完
+        wyz::SocketStream stream(client, false);
+        std::string data = "POST /upload HTTP/1.1\r\nHost: test\r\nTransfer-Encoding: chunked\r\n\r\n";
+        stream.writeFixSize(data.c_str(), data.size());
+        std::string chunk;
+        uint64_t left = upload;
+        size_t size = 1;
+        while(left > 0){
+            size_t n = std::min((uint64_t)size, left);
+            char line[32];
+            int len = snprintf(line, sizeof(line), "%zx;ext=1\r\n", n);
+            chunk.assign(line, len);
+            for(size_t i = 0 ; i < n ; ++i){
+                chunk.push_back((char)((upload - left + i) & 0xff));
+            }
+            chunk += "\r\n";
+            stream.writeFixSize(chunk.c_str(), chunk.size());
+            left -= n;
+            size = size * 3 + 7;
+            if(size > 100000){
+                size = 1;
+            }
+        }
+        data = "0\r\nX-Trailer: 1\r\n\r\n"
+            "GET /next HTTP/1.1\r\nHost: test\r\n\r\n"
+            "POST /skip HTTP/1.1\r\nHost: test\r\nContent-Length: " + std::to_string(skipped) + "\r\n\r\n";
+        stream.writeFixSize(data.c_str(), data.size());
+        std::string body(skipped, 'z');
+        stream.writeFixSize(body.c_str(), body.size());
+        data = "GET /last HTTP/1.1\r\nHost: test\r\nConnection: close\r\n\r\n";
+        stream.writeFixSize(data.c_str(), data.size());
+    });
+    wyz::IOManager::GetThis()->schedule([client, download](){
+        while(!client->isConnected()){
+            usleep(1000);
+        }
+        std::string buf;
+        uint64_t length = 0;
+        uint64_t sum = 0;
+        uint64_t expect = 0;
+        for(uint64_t i = 0 ; i < download ; ++i){
+            expect += (uint8_t)(i * 7);
+        }
+        CHECK(read_response(client, buf, length, sum) && length == download && sum == expect);
+        const char* bodies[] = {"next", "skip", "last"};
+        for(auto i : bodies){
+            CHECK(read_response(client, buf, length, sum) && length == strlen(i));
+        }
+        WYZ_LOG_INFO(g_logger) << "client download length=" << download << " fails=" << fails;
+        client->close();
+    });
+
+    wyz::Socket::ptr conn = listener->accept();
+    HttpSession::ptr session(new HttpSession(conn));
+    /// 分块上传, 以 64KB 为单位读取
+    HttpRequest::ptr req = session->recvRequest();
+    CHECK(req && req->getBodyStream() && req->getBody().empty());
+    if(!req || !req->getBodyStream()){
+        return;
+    }
+    std::vector<char> buf(65536);
+    uint64_t total = 0;
+    int rt;
+    /// 长度为 0 的读取立即返回 0, 不消耗数据
+    CHECK(req->getBodyStream()->read(&buf[0], 0) == 0);
+    while((rt = req->getBodyStream()->read(&buf[0], buf.size())) > 0){
+        for(int i = 0 ; i < rt ; ++i){
+            if((uint8_t)buf[i] != ((total + i) & 0xff)){
+                ++fails;
+                break;
+            }
+        }
+        total += rt;
+        CHECK(req->getBodyStream()->read(&buf[0], 0) == 0);
+    }
+    CHECK(rt == 0 && total == upload);
+    WYZ_LOG_INFO(g_logger) << "server chunked upload length=" << total;
+    {
+        HttpResponse::ptr rsp(new HttpResponse(req->getVersion(), false));
+        HttpBodyWriter writer(session, rsp);
+        uint64_t sent = 0;
+        while(sent < download){
+            size_t n = std::min((uint64_t)16384 + 3, download - sent);
+            for(size_t i = 0 ; i < n ; ++i){
+                buf[i] = (char)((sent + i) * 7);
+            }
+            CHECK(writer.write(&buf[0], n) == (int)n);
+            sent += n;
+        }
+        session->queueResponse(rsp);
+    }
+    const char* paths[] = {"/next", "/skip", "/last"};
+    for(auto i : paths){
+        req = session->recvRequest();
+        CHECK(req && req->getPath() == i);
+        if(!req){
+            break;
+        }
+        if(req->getBodyStream()){
+            /// 定长流式消息体: 读 0 字节之后消息体仍在, 剩下的由下一次 recvRequest 跳过
+            CHECK(req->getBodyStream()->read(&buf[0], 0) == 0);
+            CHECK(req->getBodyStream()->read(&buf[0], 1) == 1);
+            CHECK(req->getBodyStream()->read(&buf[0], 0) == 0);
+            CHECK(req->getBodyStream()->read(&buf[0], 1) == 1);
+        }
+        HttpResponse::ptr rsp(new HttpResponse(req->getVersion(), req->isClose()));
+        rsp->setBody(i + 1);
+        session->queueResponse(rsp);
+    }
+    session->flush();
+    WYZ_LOG_INFO(g_logger) << "test_stream fails=" << fails;
+}
+
+int main(int argc , char** argv){
+    signal(SIGPIPE, SIG_IGN);
+    wyz::LoggerMgr::GetInstance()->getLogger("system")->setLevel(wyz::LogLevel::ERROR);
+    {
+        wyz::IOManager iom(2, false, "http");
+        iom.schedule(&test_session);
+        iom.schedule(&test_stream);
+    }
+    test_params();
+    test_duplicate_header();
+    test_serialize_head();
+    bench_url_decode(200000);
+    bench_copy(200000);
+    bench_zero_copy(200000);
+    bench_response_stream(200000);
+    bench_response_vectored(200000);
+    return fails != 0;
+}
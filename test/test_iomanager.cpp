@@ -6,10 +6,18 @@
  */
 
 #include "../src/log.h"
+#include "../src/config.h"
 #include "../src/fiber.h"
+#include "../src/hook.h"
 #include "../src/scheduler.h"
 #include "../src/iomanager.h"
+#include "../src/util.h"
+#include "../src/macro.h"
+#include "../src/fdmanager.h"
+#include "../src/address.h"
+#include "../src/http/http_server.h"
 
+#include <atomic>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <cstring>
@@ -70,8 +78,275 @@ void test_timer(){
     } , true);
 }
 
+/// loopback 上 ping-pong, 对比 epoll 与 io_uring 每个请求的系统调用次数
+static const int s_echo_count = 20000;
+static int s_echo_port = 0;
+static const uint16_t s_http_port = 18730;
+
+static void echo_server(int lfd){
+    int fd = accept(lfd, nullptr, nullptr);
+    close(lfd);
+    char buf[64];
+    while(true){
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0){
+            break;
+        }
+        send(fd, buf, n, 0);
+    }
+    close(fd);
+}
+
+static void echo_client(uint64_t* used_us){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(s_echo_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr))){
+        WYZ_LOG_ERROR(g_logger) << "connect errno=" << errno << " " << strerror(errno);
+        close(fd);
+        return;
+    }
+    char buf[64] = "ping";
+    uint64_t start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < s_echo_count ; ++i){
+        send(fd, buf, sizeof(buf), 0);
+        size_t got = 0;
+        while(got < sizeof(buf)){
+            ssize_t n = recv(fd, buf + got, sizeof(buf) - got, 0);
+            if(n <= 0){
+                WYZ_LOG_ERROR(g_logger) << "recv n=" << n << " errno=" << errno;
+                close(fd);
+                return;
+            }
+            got += n;
+        }
+    }
+    *used_us = wyz::GetCurrentUS() - start;
+
+    /// 超时: 服务端不回数据
+    timeval tv = {0, 100 * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    uint64_t ts = wyz::GetCurrentMS();
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    int err = errno;
+    uint64_t used = wyz::GetCurrentMS() - ts;
+    WYZ_LOG_INFO(g_logger) << "recv timeout n=" << n << " errno=" << strerror(err)
+        << " used=" << used << "ms";
+    close(fd);
+}
+
+void test_io_uring(bool io_uring){
+    wyz::Config::LookupBase("iomanager.io_uring")->fromString(io_uring ? "true" : "false");
+    uint64_t used_us = 0;
+    wyz::IOManager::IOStats stats;
+    {
+        wyz::IOManager iom(2, false, "echo");
+        bool enabled = iom.hasIOUring();
+        iom.schedule([&iom, &used_us, &stats, enabled](){
+            int lfd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            bind(lfd, (sockaddr*)&addr, sizeof(addr));
+            listen(lfd, 16);
+            socklen_t len = sizeof(addr);
+            getsockname(lfd, (sockaddr*)&addr, &len);
+            s_echo_port = ntohs(addr.sin_port);
+            iom.schedule(std::bind(&echo_server, lfd));
+            echo_client(&used_us);
+            stats = iom.getStats();
+            WYZ_LOG_INFO(g_logger) << "io_uring=" << enabled;
+        });
+    }
+    /// 客户端和服务端都在 IOManager 中, 计数包括两端
+    WYZ_LOG_INFO(g_logger) << "echo io_uring=" << io_uring << " requests=" << s_echo_count
+        << " used=" << used_us << "us"
+        << " epoll_ctl=" << stats.epoll_ctl << " epoll_wait=" << stats.epoll_wait
+        << " uring_enter=" << stats.uring_enter << " io_calls=" << stats.io_calls
+        << " parks=" << stats.parks << " eventfd_reads=" << stats.eventfd_reads
+        << " waits=" << stats.waits
+        << " syscalls/request=" << (double)stats.syscalls() / s_echo_count
+        << " tickles=" << stats.tickles << " coalesced=" << stats.tickles_coalesced
+        << " found_work=" << stats.tickles_found_work;
+}
+
+/// 读一个完整的回应, 返回消息体长度, 失败返回 -1
+static int read_response(int fd, std::string& buf){
+    char tmp[4096];
+    while(true){
+        size_t end = buf.find("\r\n\r\n");
+        if(end != std::string::npos){
+            size_t pos = buf.find("Content-Length: ");
+            if(pos == std::string::npos || pos > end){
+                return -1;
+            }
+            size_t length = strtoul(buf.c_str() + pos + 16, nullptr, 10);
+            if(buf.size() >= end + 4 + length){
+                buf.erase(0, end + 4 + length);
+                return length;
+            }
+        }
+        ssize_t n = ::recv(fd, tmp, sizeof(tmp), 0);
+        if(n <= 0){
+            return -1;
+        }
+        buf.append(tmp, n);
+    }
+}
+
+/**
+ * @brief HttpServer 处理长连接请求时服务端每个请求的系统调用次数
+ * @details 客户端在没有 hook 的主线程中阻塞收发, IOManager 的计数只包括服务端
+ */
+void test_http_syscalls(bool io_uring){
+    static const int s_requests = 20000;
+    wyz::Config::LookupBase("iomanager.io_uring")->fromString(io_uring ? "true" : "false");
+    wyz::IOManager iom(2, false, "http");
+    wyz::http::HttpServer::ptr server(new wyz::http::HttpServer(true, &iom, &iom));
+    server->getServletDispatch()->addServlet("/ping", [](wyz::http::HttpRequest::ptr req
+            , wyz::http::HttpResponse::ptr rsp , wyz::http::HttpSession::ptr session){
+        rsp->setBody("pong");
+        return 0;
+    });
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", s_http_port);
+    /// 监听 socket 要在 hook 的线程中创建, accept 才会挂起协程
+    std::atomic<int> started = {0};
+    iom.schedule([server, addr, &started](){
+        started = server->bind(addr) && server->start() ? 1 : -1;
+    });
+    while(!started){
+        usleep(1000);
+    }
+    if(started < 0){
+        WYZ_LOG_ERROR(g_logger) << "http bind " << addr->toString() << " fail";
+        return;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(connect(fd, addr->getAddr(), addr->getLen())){
+        WYZ_LOG_ERROR(g_logger) << "http connect errno=" << errno << " " << strerror(errno);
+        close(fd);
+        server->stop();
+        return;
+    }
+    static const char s_request[] = "GET /ping HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+    std::string buf;
+    /// 预热: 连接已被接受, 会话的缓冲区已分配
+    send(fd, s_request, sizeof(s_request) - 1, 0);
+    WYZ_ASSERT(read_response(fd, buf) == 4);
+
+    wyz::IOManager::IOStats before = iom.getStats();
+    uint64_t start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < s_requests ; ++i){
+        send(fd, s_request, sizeof(s_request) - 1, 0);
+        WYZ_ASSERT(read_response(fd, buf) == 4);
+    }
+    uint64_t used = wyz::GetCurrentUS() - start;
+    wyz::IOManager::IOStats after = iom.getStats();
+    close(fd);
+    server->stop();
+
+    uint64_t io_calls = after.io_calls - before.io_calls;
+    uint64_t syscalls = after.syscalls() - before.syscalls();
+    WYZ_LOG_INFO(g_logger) << "http io_uring=" << iom.hasIOUring() << " requests=" << s_requests
+        << " used=" << used << "us"
+        << " epoll_ctl=" << after.epoll_ctl - before.epoll_ctl
+        << " epoll_wait=" << after.epoll_wait - before.epoll_wait
+        << " uring_enter=" << after.uring_enter - before.uring_enter
+        << " io_calls=" << io_calls
+        << " parks=" << after.parks - before.parks
+        << " eventfd=" << (after.eventfd_reads - before.eventfd_reads) + (after.tickles - before.tickles)
+        << " syscalls/request=" << (double)syscalls / s_requests;
+    /// 每个请求至少读一次请求, 写一次回应; io_uring 下先试一次系统调用, EAGAIN 时随 io_uring_enter 提交
+    WYZ_ASSERT(io_calls + after.uring_enter - before.uring_enter >= 2 * (uint64_t)s_requests);
+}
+
+/// 多线程在稀疏的大 fd 上并发 addEvent/delEvent, 分段表查找不加全局锁
+void test_fd_table(){
+    static const int s_workers = 4;
+    static const int s_loops = 100000;
+    std::atomic<int> done = {0};
+    uint64_t start = wyz::GetCurrentUS();
+    {
+        wyz::IOManager iom(s_workers, false, "fdtable");
+        for(int k = 0 ; k < s_workers ; ++k){
+            iom.schedule([&iom, &done, k](){
+                int fds[2];
+                if(pipe(fds)){
+                    return;
+                }
+                /// 每个协程落在不同的分段上
+                int fd = dup2(fds[1], 100 + k * 200);
+                for(int i = 0 ; i < s_loops ; ++i){
+                    iom.addEvent(fd, wyz::IOManager::WRITE, [](){});
+                    iom.delEvent(fd, wyz::IOManager::WRITE);
+                }
+                close(fd);
+                close(fds[0]);
+                close(fds[1]);
+                ++done;
+            });
+        }
+    }
+    uint64_t used = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << "fd table workers=" << done << " add+del=" << s_workers * s_loops
+        << " used=" << used << "us " << used * 1000.0 / (s_workers * s_loops) << "ns/op";
+}
+
+/**
+ * @brief poller 所在的线程长时间执行任务时, 另一个空闲线程接过 poller 继续轮询 IO
+ * @details 依次把忙任务指定到每个线程上, 其中一次落在 poller 上. 忙任务执行期间写 socket,
+ *          读协程被唤醒的延迟应当远小于忙任务的时间
+ */
+void test_poller_handoff(){
+    wyz::IOManager iom(2, false, "poller");
+    uint64_t worst = 0;
+    for(int thread : iom.getThreadIds()){
+        int fds[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)){
+            return;
+        }
+        /// socketpair 没有 hook, 登记之后读才会挂起协程
+        wyz::FdMar::GetInstance()->get(fds[0], true);
+        std::atomic<uint64_t> woke = {0};
+        std::atomic<bool> busy = {true};
+        iom.schedule([&woke, &fds](){
+            char c;
+            read(fds[0], &c, 1);
+            woke = wyz::GetCurrentUS();
+        });
+        usleep(50 * 1000);
+        iom.schedule([&busy](){
+            uint64_t start = wyz::GetCurrentUS();
+            while(wyz::GetCurrentUS() - start < 500 * 1000);
+            busy = false;
+        }, thread);
+        usleep(100 * 1000);
+        uint64_t sent = wyz::GetCurrentUS();
+        write(fds[1], "x", 1);
+        while(!woke || busy){
+            usleep(1000);
+        }
+        worst = std::max(worst, woke - sent);
+        close(fds[0]);
+        close(fds[1]);
+    }
+    WYZ_LOG_INFO(g_logger) << "poller handoff worst wakeup=" << worst << "us";
+    WYZ_ASSERT(worst < 200 * 1000);
+}
+
 int main(){
     test();
     // test_timer();
+    wyz::LoggerMgr::GetInstance()->getLogger("system")->setLevel(wyz::LogLevel::ERROR);
+    test_io_uring(false);
+    test_io_uring(true);
+    test_http_syscalls(false);
+    test_http_syscalls(true);
+    test_fd_table();
+    test_poller_handoff();
     return 0;
 }
\ No newline at end of file
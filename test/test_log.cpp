@@ -8,7 +8,225 @@
 #include "../src/log.h"
 #include "../src/util.h"
 #include "../src/thread.h"
+#include "test_check.h"
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <atomic>
+#include <unistd.h>
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
+
+/// 统计文件行数
+static size_t count_lines(const std::string& file){
+    std::ifstream ifs(file);
+    std::string line;
+    size_t n = 0;
+    while(std::getline(ifs, line)){
+        ++n;
+    }
+    return n;
+}
+
+/// 多线程写同一个文件, 对比同步与异步输出
+static void bench_appender(bool async, int threads, int lines){
+    std::string file = async ? "/tmp/wyz_log_async.txt" : "/tmp/wyz_log_sync.txt";
+    unlink(file.c_str());
+    wyz::Logger::ptr logger(new wyz::Logger(async ? "async" : "sync"));
+    logger->setLevel(wyz::LogLevel::INFO);
+    wyz::LogAppender::ptr appender;
+    if(async){
+        appender.reset(new wyz::AsyncLogAppender(file));
+    }else {
+        appender.reset(new wyz::FileLogAppender(file));
+    }
+    logger->addAppender(appender);
+
+    uint64_t start = wyz::GetCurrentUS();
+    std::vector<wyz::Thread::ptr> thrs;
+    for(int i = 0 ; i < threads ; ++i){
+        thrs.push_back(wyz::Thread::ptr(new wyz::Thread([logger, lines](){
+            for(int j = 0 ; j < lines ; ++j){
+                WYZ_LOG_INFO(logger) << "bench line " << j;
+            }
+        }, "bench_" + std::to_string(i))));
+    }
+    for(auto& i : thrs){
+        i->join();
+    }
+    uint64_t used = wyz::GetCurrentUS() - start;
+    std::string extra;
+    if(async){
+        auto a = std::dynamic_pointer_cast<wyz::AsyncLogAppender>(appender);
+        a->flush();
+        auto stats = a->getStats();
+        extra = " writevs=" + std::to_string(stats.writevs) + " blocked=" + std::to_string(stats.blocked);
+    }
+    size_t total = threads * lines;
+    std::cout << (async ? "async" : "sync ") << " threads=" << threads << " lines=" << total
+              << " used=" << used << "us " << used * 1000.0 / total << "ns/line"
+              << " file_lines=" << count_lines(file) << extra << std::endl;
+}
+
+/// 只格式化不输出, 用来测量写一行日志本身的开销
+class NullLogAppender : public wyz::LogAppender{
+public:
+    using ptr = std::shared_ptr<NullLogAppender>;
+    void log(std::shared_ptr<wyz::Logger> logger,wyz::LogLevel::Level level, wyz::LogEvent::ptr event)override{
+        static thread_local char buf[1024];
+        bytes += getFormatter()->format(buf, sizeof(buf), level, *event);
+    }
+    std::string toYamlString()override{
+        return "type: NullLogAppender";
+    }
+    size_t bytes = 0;
+};
+
+/// 单线程每行日志的耗时: 旧的流式格式化, 新的格式项, 被过滤的级别, 异步文件输出
+static void bench_latency(int lines){
+    wyz::Logger::ptr logger(new wyz::Logger("latency"));
+    logger->setLevel(wyz::LogLevel::INFO);
+    NullLogAppender::ptr null_appender(new NullLogAppender);
+    logger->addAppender(null_appender);
+    wyz::LogFormatter::ptr formatter = logger->getFormatter();
+
+    /// 两种格式化的输出相同
+    bool same = false;
+    {
+        wyz::LogEvent::ptr event(new wyz::LogEvent(logger, wyz::LogLevel::INFO, __FILE__, __LINE__
+                    , wyz::GetThreadId(), wyz::GetFiberId(), time(0), wyz::Thread::GetName()));
+        event->getSstream() << "same line " << -1 << ' ' << 2.5 << std::hex << 255;
+        std::stringstream ss;
+        formatter->format(ss, logger, wyz::LogLevel::INFO, event);
+        same = ss.str() == formatter->format(logger, wyz::LogLevel::INFO, event);
+    }
+    CHECK(same);
+
+    uint64_t start = wyz::GetCurrentUS();
+    size_t bytes = 0;
+    for(int j = 0 ; j < lines ; ++j){
+        wyz::LogEvent::ptr event(new wyz::LogEvent(logger, wyz::LogLevel::INFO, __FILE__, __LINE__
+                    , wyz::GetThreadId(), wyz::GetFiberId(), time(0), wyz::Thread::GetName()));
+        event->getSstream() << "bench line " << j;
+        std::stringstream ss;
+        formatter->format(ss, logger, wyz::LogLevel::INFO, event);
+        bytes += ss.str().size();
+    }
+    uint64_t used_stream = wyz::GetCurrentUS() - start;
+
+    start = wyz::GetCurrentUS();
+    for(int j = 0 ; j < lines ; ++j){
+        WYZ_LOG_INFO(logger) << "bench line " << j;
+    }
+    uint64_t used_fast = wyz::GetCurrentUS() - start;
+
+    start = wyz::GetCurrentUS();
+    for(int j = 0 ; j < lines ; ++j){
+        WYZ_LOG_DEBUG(logger) << "bench line " << j;
+    }
+    uint64_t used_filtered = wyz::GetCurrentUS() - start;
+
+    std::string file = "/tmp/wyz_log_latency.txt";
+    unlink(file.c_str());
+    logger->clearAppenders();
+    wyz::AsyncLogAppender::ptr async(new wyz::AsyncLogAppender(file));
+    logger->addAppender(async);
+    start = wyz::GetCurrentUS();
+    for(int j = 0 ; j < lines ; ++j){
+        WYZ_LOG_INFO(logger) << "bench line " << j;
+    }
+    async->flush(10000);
+    uint64_t used_async = wyz::GetCurrentUS() - start;
+
+    std::cout << "latency lines=" << lines
+              << " stream=" << used_stream * 1000.0 / lines << "ns/line"
+              << " fast=" << used_fast * 1000.0 / lines << "ns/line"
+              << " filtered=" << used_filtered * 1000.0 / lines << "ns/line"
+              << " async=" << used_async * 1000.0 / lines << "ns/line"
+              << " stream_bytes=" << bytes << " same_output=" << same
+              << " file_lines=" << count_lines(file) << std::endl;
+}
+
+/// 缓冲区满时的三种策略
+static void test_overflow(wyz::AsyncLogAppender::OverflowPolicy policy){
+    std::string file = std::string("/tmp/wyz_log_") + wyz::AsyncLogAppender::ToString(policy) + ".txt";
+    unlink(file.c_str());
+    wyz::Logger::ptr logger(new wyz::Logger("overflow"));
+    wyz::AsyncLogAppender::ptr appender(new wyz::AsyncLogAppender(file, 4096, policy));
+    logger->addAppender(appender);
+    const int n = 20000;
+    for(int i = 0 ; i < n ; ++i){
+        WYZ_LOG_INFO(logger) << "overflow line " << i;
+    }
+    appender->flush();
+    auto stats = appender->getStats();
+    std::cout << "overflow=" << wyz::AsyncLogAppender::ToString(policy)
+              << " logged=" << n << " lines=" << stats.lines << " dropped=" << stats.dropped
+              << " blocked=" << stats.blocked << " file_lines=" << count_lines(file) << std::endl;
+}
+
+static wyz::LogEvent::ptr new_event(wyz::Logger::ptr logger){
+    return wyz::LogEvent::ptr(new wyz::LogEvent(logger, wyz::LogLevel::INFO, __FILE__, __LINE__
+                , wyz::GetThreadId(), wyz::GetFiberId(), time(0), wyz::Thread::GetName()));
+}
+
+/// 事件在别的线程析构(协程换了线程), 流归还给构造它的线程, 不影响析构线程自己的流
+static void test_migrate_event(){
+    wyz::Logger::ptr logger(new wyz::Logger("migrate"));
+    wyz::Thread owner([logger](){
+        wyz::LogEvent::ptr event = new_event(logger);
+        wyz::LogStream* stream = &event->getSstream();
+        event->getSstream() << "migrated line";
+        wyz::LogStream* other_stream = nullptr;
+        /// 占住析构之后同样大小的内存, 流被错误释放时新事件不会恰好分到原来的地址
+        std::unique_ptr<wyz::LogStream> hold;
+        wyz::Thread other([&event, &other_stream, &hold, logger](){
+            wyz::LogEvent::ptr mine = new_event(logger);
+            other_stream = &mine->getSstream();
+            mine.reset();
+            event.reset();
+            hold.reset(new wyz::LogStream);
+            /// 自己的流仍然可以复用
+            mine = new_event(logger);
+            CHECK(&mine->getSstream() == other_stream);
+        }, "log_other");
+        other.join();
+        CHECK(other_stream != stream);
+        /// 构造线程的流已经归还, 新事件复用它而不是单独分配
+        event = new_event(logger);
+        CHECK(&event->getSstream() == stream);
+        CHECK(event->getContentSize() == 0);
+    }, "log_owner");
+    owner.join();
+    std::cout << "migrate event fails=" << fails << std::endl;
+}
+
+/// FATAL 返回时已经写入文件; 文件被改名或收到 SIGHUP 后重新打开
+static void test_fatal_and_reopen(){
+    std::string file = "/tmp/wyz_log_reopen.txt";
+    std::string rotated = file + ".1";
+    unlink(file.c_str());
+    unlink(rotated.c_str());
+    wyz::Logger::ptr logger(new wyz::Logger("reopen"));
+    wyz::AsyncLogAppender::ptr appender(new wyz::AsyncLogAppender(file));
+    logger->addAppender(appender);
+    WYZ_LOG_INFO(logger) << "before fatal";
+    WYZ_LOG_FATAL(logger) << "fatal line";
+    std::cout << "fatal flushed file_lines=" << count_lines(file) << std::endl;
+
+    rename(file.c_str(), rotated.c_str());
+    /// 轮转每秒检查一次
+    sleep(2);
+    WYZ_LOG_INFO(logger) << "after rotate";
+    appender->flush();
+    wyz::LoggerManager::InstallReopenSignal();
+    raise(SIGHUP);
+    WYZ_LOG_INFO(logger) << "after sighup";
+    appender->flush();
+    usleep(10 * 1000);
+    std::cout << "rotated_lines=" << count_lines(rotated) << " new_lines=" << count_lines(file)
+              << " reopens=" << appender->getStats().reopens << std::endl;
+}
 
 int main(){
     wyz::Logger::ptr logger(new wyz::Logger);
@@ -29,5 +247,14 @@ int main(){
 
     auto log = wyz::LoggerMgr::GetInstance()->getLogger("xx");
     WYZ_LOG_INFO(log) << "hello wyz";
-    return 0;
+
+    bench_latency(1000000);
+    bench_appender(false, 4, 50000);
+    bench_appender(true, 4, 50000);
+    test_overflow(wyz::AsyncLogAppender::BLOCK);
+    test_overflow(wyz::AsyncLogAppender::DROP);
+    test_overflow(wyz::AsyncLogAppender::COUNT);
+    test_fatal_and_reopen();
+    test_migrate_event();
+    return fails != 0;
 }
\ No newline at end of file
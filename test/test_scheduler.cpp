@@ -6,14 +6,18 @@
  */
 
 #include "../src/log.h"
+#include "../src/config.h"
 #include "../src/scheduler.h"
 #include "../src/fiber.h"
+#include "test_check.h"
+#include <atomic>
+#include <vector>
 #include <unistd.h>
 
 wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
 static int s_count = 5;
 void test_task(){
-   
+
     WYZ_LOG_INFO(g_logger) << "test in fiber s_count=" << s_count;
 
     // sleep(1);
@@ -35,7 +39,53 @@ void test_sche(){
     WYZ_LOG_INFO(g_logger) << "over ";
 }
 
+/// 每个任务再派生子任务, 模拟工作线程自己产生任务的场景
+static const int s_trees = 64;
+static const int s_depth = 12;
+static const int s_nodes = (1 << (s_depth + 1)) - 1;
+static std::atomic<uint64_t> s_done = {0};
+/// 每个任务的执行次数, 按 树 * s_nodes + 节点 编号, 子节点为 2n+1, 2n+2
+static std::vector<std::atomic<int> > s_runs(s_trees * s_nodes);
+void spawn_task(int tree, int node, int depth){
+    ++s_done;
+    ++s_runs[tree * s_nodes + node];
+    if(depth > 0){
+        wyz::Scheduler::GetThis()->schedule(std::bind(&spawn_task, tree, node * 2 + 1, depth - 1));
+        wyz::Scheduler::GetThis()->schedule(std::bind(&spawn_task, tree, node * 2 + 2, depth - 1));
+    }
+}
+
+/// 全局队列与工作窃取模式对比
+void test_work_stealing(bool work_stealing){
+    wyz::Config::LookupBase("scheduler.work_stealing")->fromString(work_stealing ? "true" : "false");
+    s_done = 0;
+    for(auto& i : s_runs){
+        i = 0;
+    }
+    uint64_t start = wyz::GetCurrentMS();
+    {
+        wyz::Scheduler sc(4, false, "ws");
+        sc.start();
+        for(int i = 0; i < s_trees; ++i){
+            sc.schedule(std::bind(&spawn_task, i, 0, s_depth));
+        }
+        sc.stop();
+    }
+    WYZ_LOG_INFO(g_logger) << "work_stealing=" << work_stealing
+        << " tasks=" << s_done << " used=" << (wyz::GetCurrentMS() - start) << "ms";
+    /// 被窃取的任务也只执行一次, 不丢失也不重复
+    CHECK(s_done == (uint64_t)s_trees * s_nodes);
+    int bad = 0;
+    for(auto& i : s_runs){
+        bad += i != 1;
+    }
+    CHECK(bad == 0);
+}
+
 int main(int argc , char** argv){
     test_sche();
-    return 0;
-}
\ No newline at end of file
+    wyz::LoggerMgr::GetInstance()->getLogger("system")->setLevel(wyz::LogLevel::ERROR);
+    test_work_stealing(false);
+    test_work_stealing(true);
+    return fails != 0;
+}
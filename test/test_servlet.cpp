@@ -0,0 +1,140 @@
+/*
+ * @Description: 测试路由分发, 对比基数树与 map + 线性扫描
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-11-22 20:31:06
+ */
+
+#include "../src/log.h"
+#include "../src/util.h"
+#include "../src/http/servlet.h"
+#include "test_check.h"
+#include <fnmatch.h>
+#include <map>
+#include <vector>
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
+
+using namespace wyz::http;
+
+static Servlet::ptr make_servlet(int32_t id){
+    return std::make_shared<FunctionServlet>([id](HttpRequest::ptr , HttpResponse::ptr , HttpSession::ptr){
+        return id;
+    });
+}
+
+static int32_t call(Servlet::ptr slt){
+    return slt->handle(nullptr, nullptr, nullptr);
+}
+
+void test_match(){
+    ServletDispatch::ptr sd(new ServletDispatch);
+    sd->addServlet("/user", make_servlet(1));
+    sd->addPrefixServlet("/user", make_servlet(2));
+    sd->addPrefixServlet("/user/info", make_servlet(3));
+    sd->addGlobServlet("/user/*.json", make_servlet(4));
+    sd->addGlobServlet("/img/??.png", make_servlet(5));
+    sd->addRoute(ServletDispatch::EXACT, HttpMethod::POST, "/login", make_servlet(6));
+    sd->addRoute(ServletDispatch::EXACT, HttpMethod::GET, "/login", make_servlet(7));
+    sd->addServlet("/", make_servlet(8));
+
+    CHECK(call(sd->getMatchedServlet(HttpMethod::GET, "/user")) == 1);
+    CHECK(call(sd->getMatchedServlet(HttpMethod::GET, "/users")) == 2);
+    CHECK(call(sd->getMatchedServlet(HttpMethod::GET, "/user/info/1")) == 3);
+    CHECK(call(sd->getMatchedServlet(HttpMethod::GET, "/user/a/b.json")) == 4);
+    CHECK(call(sd->getMatchedServlet(HttpMethod::GET, "/img/ab.png")) == 5);
+    CHECK(call(sd->getMatchedServlet(HttpMethod::POST, "/login")) == 6);
+    CHECK(call(sd->getMatchedServlet(HttpMethod::GET, "/login")) == 7);
+    CHECK(call(sd->getMatchedServlet(HttpMethod::GET, "/")) == 8);
+    CHECK(sd->getMatchedServlet(HttpMethod::DELETE, "/login")->getName() == "MethodNotAllowedServlet");
+    CHECK(sd->getMatchedServlet(HttpMethod::GET, "/img/abc.png")->getName() == "NotFoundServlet");
+    CHECK(sd->getMatchedServlet(HttpMethod::GET, "/log")->getName() == "NotFoundServlet");
+
+    sd->delPrefixServlet("/user/info");
+    CHECK(call(sd->getMatchedServlet(HttpMethod::GET, "/user/info/1")) == 2);
+    sd->delServlet("/user");
+    CHECK(call(sd->getMatchedServlet(HttpMethod::GET, "/user")) == 2);
+    CHECK(sd->getRouteCount() == 5);
+    WYZ_LOG_INFO(g_logger) << "test_match fails=" << fails << " routes=" << sd->getRouteCount()
+        << " nodes=" << sd->getNodeCount();
+}
+
+/// 原来的做法: 精确路由放 map, 通配路由线性 fnmatch
+class LinearDispatch{
+public:
+    void addServlet(const std::string& uri , Servlet::ptr slt)  { m_datas[uri] = slt;}
+    void addGlobServlet(const std::string& uri , Servlet::ptr slt) { m_globs.push_back(std::make_pair(uri, slt));}
+    Servlet::ptr getMatchedServlet(const std::string& uri){
+        auto it = m_datas.find(uri);
+        if(it != m_datas.end()){
+            return it->second;
+        }
+        for(auto& i : m_globs){
+            if(!fnmatch(i.first.c_str(), uri.c_str(), 0)){
+                return i.second;
+            }
+        }
+        return m_default;
+    }
+private:
+    std::map<std::string, Servlet::ptr> m_datas;
+    std::vector<std::pair<std::string, Servlet::ptr> > m_globs;
+    Servlet::ptr m_default = make_servlet(-1);
+};
+
+void bench_lookup(int paths , int loops){
+    ServletDispatch::ptr sd(new ServletDispatch);
+    LinearDispatch ld;
+    std::vector<std::string> uris;
+    for(int i = 0 ; i < paths ; ++i){
+        std::string uri = "/api/v" + std::to_string(i % 4) + "/module" + std::to_string(i / 100)
+            + "/item" + std::to_string(i);
+        uris.push_back(uri);
+        Servlet::ptr slt = make_servlet(i);
+        if(i % 10 == 0){
+            sd->addGlobServlet(uri + "/*", slt);
+            ld.addGlobServlet(uri + "/*", slt);
+            uris.back() += "/detail";
+        }else {
+            sd->addServlet(uri, slt);
+            ld.addServlet(uri, slt);
+        }
+    }
+
+    int64_t sum_tree = 0;
+    uint64_t start = wyz::GetCurrentUS();
+    for(int l = 0 ; l < loops ; ++l){
+        for(auto& i : uris){
+            sum_tree += call(sd->getMatchedServlet(HttpMethod::GET, i));
+        }
+    }
+    uint64_t tree_us = wyz::GetCurrentUS() - start;
+
+    int64_t sum_linear = 0;
+    start = wyz::GetCurrentUS();
+    for(int l = 0 ; l < loops ; ++l){
+        for(auto& i : uris){
+            sum_linear += call(ld.getMatchedServlet(i));
+        }
+    }
+    uint64_t linear_us = wyz::GetCurrentUS() - start;
+
+    uint64_t n = (uint64_t)uris.size() * loops;
+    WYZ_LOG_INFO(g_logger) << "paths=" << paths << " nodes=" << sd->getNodeCount()
+        << " tree=" << tree_us * 1000 / n << "ns/lookup"
+        << " map+linear=" << linear_us * 1000 / n << "ns/lookup"
+        << " same=" << (sum_tree == sum_linear);
+    CHECK(sum_tree == sum_linear);
+    /// 逐个路径确认两种查找命中同一个 servlet
+    int diff = 0;
+    for(auto& i : uris){
+        diff += sd->getMatchedServlet(HttpMethod::GET, i) != ld.getMatchedServlet(i);
+    }
+    CHECK(diff == 0);
+}
+
+int main(int argc , char** argv){
+    test_match();
+    bench_lookup(10000, 3);
+    return fails != 0;
+}
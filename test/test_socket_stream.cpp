@@ -0,0 +1,162 @@
+/*
+ * @Description: 测试 SocketStream 的读缓冲与写合并, 对比每次读写一个系统调用
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-11-28 19:40:18
+ */
+
+#include "../src/log.h"
+#include "../src/util.h"
+#include "../src/iomanager.h"
+#include "../src/address.h"
+#include "../src/socket.h"
+#include "../src/bytearray.h"
+#include "../src/streams/socket_stream.h"
+#include "test_check.h"
+#include <atomic>
+#include <signal.h>
+#include <string>
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
+
+static const uint16_t s_port = 18680;
+static const int s_records = 50000;
+
+/// 长度前缀的小记录, 一次写长度一次写内容
+static void write_records(wyz::SocketStream::ptr stream){
+    std::string payload(64, 'x');
+    for(int i = 0 ; i < s_records ; ++i){
+        uint32_t len = 8 + i % 50;
+        payload[0] = (char)i;
+        if(stream->writeFixSize(&len, sizeof(len)) <= 0
+                || stream->writeFixSize(&payload[0], len) <= 0){
+            WYZ_LOG_ERROR(g_logger) << "write fail i=" << i;
+            return;
+        }
+    }
+    stream->flushWrite();
+}
+
+static bool read_records(wyz::SocketStream::ptr stream , uint64_t& sum){
+    char buf[64];
+    for(int i = 0 ; i < s_records ; ++i){
+        uint32_t len = 0;
+        if(stream->readFixSize(&len, sizeof(len)) <= 0 || len != (uint32_t)(8 + i % 50)
+                || stream->readFixSize(buf, len) <= 0 || buf[0] != (char)i){
+            return false;
+        }
+        sum += len;
+    }
+    return true;
+}
+
+static wyz::SocketStream::ptr connect(wyz::Socket::ptr listener , wyz::SocketStream::ptr& server){
+    wyz::Address::ptr addr = listener->getLocalAddress();
+    wyz::Socket::ptr sock = wyz::Socket::CreateTCP(addr);
+    if(!sock->connect(addr)){
+        return nullptr;
+    }
+    wyz::Socket::ptr client = listener->accept();
+    if(!client){
+        return nullptr;
+    }
+    server.reset(new wyz::SocketStream(client));
+    return std::make_shared<wyz::SocketStream>(sock);
+}
+
+void bench(wyz::Socket::ptr listener , size_t read_buffer , size_t write_buffer){
+    wyz::SocketStream::ptr server;
+    wyz::SocketStream::ptr client = connect(listener, server);
+    if(!client){
+        ++fails;
+        return;
+    }
+    client->setWriteBufferSize(write_buffer);
+    server->setReadBufferSize(read_buffer);
+    uint64_t start = wyz::GetCurrentUS();
+    wyz::IOManager::GetThis()->schedule(std::bind(&write_records, client));
+    uint64_t sum = 0;
+    CHECK(read_records(server, sum));
+    uint64_t used = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << "read_buffer=" << read_buffer << " write_buffer=" << write_buffer
+        << " records=" << s_records << " used=" << used << "us per=" << used * 1000 / s_records << "ns sum=" << sum;
+}
+
+/// ByteArray 读写与读缓冲, 写合并混用
+void test_bytearray(wyz::Socket::ptr listener){
+    wyz::SocketStream::ptr server;
+    wyz::SocketStream::ptr client = connect(listener, server);
+    if(!client){
+        ++fails;
+        return;
+    }
+    client->setWriteBufferSize(1024);
+    server->setReadBufferSize(1024);
+
+    wyz::ByteArray::ptr out(new wyz::ByteArray(128));
+    for(int i = 0 ; i < 1000 ; ++i){
+        out->writeFuint32(i);
+    }
+    out->setPosition(0);
+    CHECK(client->write("hello", 5) == 5 && client->getWriteBuffered() == 5);
+    /// 比缓冲区小, 合并到缓冲区
+    CHECK(client->writeFixSize(out, 400) == 400 && client->getWriteBuffered() == 405);
+    /// 比缓冲区大, 与缓冲区中的数据一起 writev
+    CHECK(client->writeFixSize(out, 3600) == 3600 && client->getWriteBuffered() == 0);
+    CHECK(client->write("world", 5) == 5 && client->flushWrite() == 5);
+
+    char head[5];
+    CHECK(server->readFixSize(head, 5) == 5 && std::string(head, 5) == "hello");
+    CHECK(server->getReadBuffered() > 0);
+    wyz::ByteArray::ptr in(new wyz::ByteArray(100));
+    CHECK(server->read(in, 0) == 0 && in->getPosition() == 0);
+    CHECK(server->readFixSize(in, 4000) == 4000);
+    in->setPosition(0);
+    bool same = true;
+    for(int i = 0 ; i < 1000 ; ++i){
+        same = same && in->readFuint32() == (uint32_t)i;
+    }
+    CHECK(same);
+    CHECK(server->readFixSize(head, 5) == 5 && std::string(head, 5) == "world");
+
+    /// 读之前先发出合并的写, 两端都开启写合并时请求应答不会卡住
+    server->setWriteBufferSize(1024);
+    wyz::IOManager::GetThis()->schedule([server](){
+        char buf[4];
+        while(server->readFixSize(buf, 4) > 0){
+            server->write("pong", 4);
+        }
+    });
+    for(int i = 0 ; i < 3 ; ++i){
+        CHECK(client->write("ping", 4) == 4 && client->getWriteBuffered() == 4);
+        CHECK(client->readFixSize(head, 4) == 4 && std::string(head, 4) == "pong");
+    }
+    client->close();
+}
+
+void run(){
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", s_port);
+    wyz::Socket::ptr listener = wyz::Socket::CreateTCP(addr);
+    if(!listener->bind(addr) || !listener->listen()){
+        WYZ_LOG_ERROR(g_logger) << "bind " << addr->toString() << " fail";
+        ++fails;
+        return;
+    }
+    test_bytearray(listener);
+    bench(listener, 0, 0);
+    bench(listener, 16 * 1024, 0);
+    bench(listener, 0, 16 * 1024);
+    bench(listener, 16 * 1024, 16 * 1024);
+    WYZ_LOG_INFO(g_logger) << "test_socket_stream fails=" << fails;
+}
+
+int main(int argc, char const *argv[])
+{
+    signal(SIGPIPE, SIG_IGN);
+    WYZ_LOG_NAME("system")->setLevel(wyz::LogLevel::ERROR);
+    {
+        wyz::IOManager iom(1, false, "stream");
+        iom.schedule(&run);
+    }
+    return fails != 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * @Description: 测试TCP服务器, 对比单个 accept 协程与 SO_REUSEPORT 多监听
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-11-27 10:12:45
+ */
+
+#include "../src/log.h"
+#include "../src/address.h"
+#include "../src/iomanager.h"
+#include "../src/socket.h"
+#include "../src/tcpserver.h"
+#include "../src/util.h"
+#include "test_check.h"
+#include <atomic>
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
+
+static const int s_clients = 8;
+static const int s_connects = 600;
+
+/// 短连接: 连接后立即关闭
+static void connect_loop(wyz::Address::ptr addr, std::atomic<int>* done, std::atomic<int>* errors){
+    for(int i = 0 ; i < s_connects ; ++i){
+        wyz::Socket::ptr sock = wyz::Socket::CreateTCP(addr);
+        if(!sock->connect(addr)){
+            ++*errors;
+        }
+    }
+    ++*done;
+}
+
+void test_accept(bool reuse_port, uint32_t batch, uint16_t port){
+    wyz::IOManager iom(4, false, "tcp");
+    iom.schedule([&iom, reuse_port, batch, port](){
+        wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", port);
+        wyz::TCPServer::ptr server(new wyz::TCPServer(&iom, &iom));
+        server->setReusePort(reuse_port);
+        server->setAcceptBatch(batch);
+        bool bound = server->bind(addr);
+        CHECK(bound);
+        if(!bound){
+            return;
+        }
+        server->start();
+
+        std::atomic<int> done = {0};
+        std::atomic<int> errors = {0};
+        uint64_t start = wyz::GetCurrentMS();
+        for(int i = 0 ; i < s_clients ; ++i){
+            iom.schedule(std::bind(&connect_loop, addr, &done, &errors));
+        }
+        while(done < s_clients){
+            usleep(10 * 1000);
+        }
+        uint64_t used = wyz::GetCurrentMS() - start;
+        /// 等最后一批连接被 accept, 最多等 1 秒
+        uint64_t total = 0;
+        for(int i = 0 ; i < 100 && total < (uint64_t)s_clients * s_connects ; ++i){
+            usleep(10 * 1000);
+            total = 0;
+            for(auto& stat : server->getAcceptStats()){
+                total += stat.accepted;
+            }
+        }
+        total = 0;
+        for(auto& stat : server->getAcceptStats()){
+            WYZ_LOG_INFO(g_logger) << "  listener " << stat.address << " thread=" << stat.thread
+                << " accepted=" << stat.accepted << " rate=" << stat.rate << "/s";
+            total += stat.accepted;
+        }
+        WYZ_LOG_INFO(g_logger) << "reuse_port=" << reuse_port << " batch=" << batch
+            << " connects=" << s_clients * s_connects << " errors=" << errors
+            << " accepted=" << total << " used=" << used << "ms";
+        server->stop();
+        /// stop 在 accept 线程上关闭 socket 时读统计, 之后计数仍然保留
+        usleep(10 * 1000);
+        uint64_t after = 0;
+        for(auto& stat : server->getAcceptStats()){
+            after += stat.accepted;
+        }
+        CHECK(errors == 0);
+        CHECK(total == (uint64_t)s_clients * s_connects);
+        CHECK(after == total);
+    });
+}
+
+int main(int argc , char** argv){
+    wyz::LoggerMgr::GetInstance()->getLogger("system")->setLevel(wyz::LogLevel::ERROR);
+    test_accept(false, 1, 18620);
+    test_accept(true, 1, 18621);
+    test_accept(true, 16, 18622);
+    return fails != 0;
+}
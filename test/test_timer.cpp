@@ -0,0 +1,113 @@
+/*
+ * @Description: 测试定时器模块, 对比 set 与 时间轮
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-11-25 14:20:37
+ */
+
+#include "../src/log.h"
+#include "../src/config.h"
+#include "../src/iomanager.h"
+#include "../src/timer.h"
+#include "../src/util.h"
+#include "test_check.h"
+#include <atomic>
+#include <cstdlib>
+#include <unistd.h>
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
+
+class BenchTimerManager : public wyz::TimerManager {
+protected:
+    void onTimerInsertedAtFront() override {}
+};
+
+/// 模拟 do_io: 每次 IO 加一个超时定时器, IO 完成后取消
+void bench_add_cancel(bool wheel){
+    wyz::Config::LookupBase("timer.wheel")->fromString(wheel ? "true" : "false");
+    BenchTimerManager mgr;
+    const int n = 1000000;
+    std::vector<wyz::Timer::ptr> timers(n);
+    srand(1);
+    uint64_t start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < n ; ++i){
+        timers[i] = mgr.addTimer(1000 + rand() % 60000, [](){});
+    }
+    uint64_t used_add = wyz::GetCurrentUS() - start;
+    start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < n ; ++i){
+        timers[i]->cancel();
+    }
+    uint64_t used_cancel = wyz::GetCurrentUS() - start;
+    WYZ_LOG_INFO(g_logger) << (wheel ? "wheel" : "set")
+        << " timers=" << n << " add=" << used_add << "us cancel=" << used_cancel << "us"
+        << " has_timer=" << mgr.hasTimer();
+}
+
+/// 到期检查: 短定时器全部按时取出, 循环定时器重新加入
+void test_expire(bool wheel){
+    wyz::Config::LookupBase("timer.wheel")->fromString(wheel ? "true" : "false");
+    BenchTimerManager mgr;
+    const int n = 1000;
+    int fired = 0;
+    int early = 0;
+    for(int i = 0 ; i < n ; ++i){
+        uint64_t deadline = wyz::GetCurrentMS() + 1 + i % 300;
+        mgr.addTimer(1 + i % 300, [&fired, &early, deadline](){
+            ++fired;
+            early += wyz::GetCurrentMS() < deadline;
+        });
+    }
+    int circular = 0;
+    wyz::Timer::ptr ct = mgr.addTimer(20, [&circular](){ ++circular; }, true);
+    uint64_t start = wyz::GetCurrentMS();
+    while(fired < n && wyz::GetCurrentMS() - start < 2000){
+        uint64_t next = mgr.getNextTimer();
+        usleep((next > 10 ? 10 : next) * 1000);
+        std::vector<std::function<void()> > cbs;
+        mgr.listExpiredCb(cbs);
+        for(auto& cb : cbs){
+            cb();
+        }
+    }
+    ct->cancel();
+    WYZ_LOG_INFO(g_logger) << (wheel ? "wheel" : "set")
+        << " fired=" << fired << "/" << n << " circular=" << circular
+        << " used=" << (wyz::GetCurrentMS() - start) << "ms has_timer=" << mgr.hasTimer();
+    CHECK(fired == n);
+    CHECK(early == 0);
+    CHECK(circular > 0);
+}
+
+/// IOManager 中的循环定时器
+void test_iomanager(bool wheel){
+    wyz::Config::LookupBase("timer.wheel")->fromString(wheel ? "true" : "false");
+    static std::atomic<int> s_count = {0};
+    static wyz::Timer::ptr s_timer;
+    s_count = 0;
+    uint64_t start = wyz::GetCurrentMS();
+    {
+        wyz::IOManager iom(2, false, "timer");
+        s_timer = iom.addTimer(50, [](){
+            if(++s_count == 5){
+                s_timer->cancel();
+            }
+        }, true);
+    }
+    s_timer.reset();
+    WYZ_LOG_INFO(g_logger) << (wheel ? "wheel" : "set")
+        << " iomanager circular count=" << s_count
+        << " used=" << (wyz::GetCurrentMS() - start) << "ms";
+    CHECK(s_count == 5);
+}
+
+int main(int argc , char** argv){
+    wyz::LoggerMgr::GetInstance()->getLogger("system")->setLevel(wyz::LogLevel::ERROR);
+    bench_add_cancel(false);
+    bench_add_cancel(true);
+    test_expire(false);
+    test_expire(true);
+    test_iomanager(false);
+    test_iomanager(true);
+    return fails != 0;
+}
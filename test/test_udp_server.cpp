@@ -0,0 +1,237 @@
+/*
+ * @Description: 测试 UDP 服务器的批量收发, 对比每次 recvmmsg 一个与一批数据报
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-11-30 14:20:31
+ */
+
+#include "../src/log.h"
+#include "../src/util.h"
+#include "../src/iomanager.h"
+#include "../src/address.h"
+#include "../src/socket.h"
+#include "../src/udpserver.h"
+#include "test_check.h"
+#include <atomic>
+#include <cstring>
+#include <netinet/udp.h>
+#include <string>
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
+
+/// 每个数据报回 copies 份
+class EchoServer : public wyz::UDPServer {
+public:
+    using ptr = std::shared_ptr<EchoServer>;
+    EchoServer(wyz::IOManager* worker, int copies = 1)
+        : UDPServer(worker)
+        , m_copies(copies){
+    }
+    std::atomic<uint64_t> messages = {0};
+    std::atomic<uint64_t> bytes = {0};
+protected:
+    void handleBatch(wyz::UDPBatch& batch) override{
+        messages += batch.size();
+        for(auto& msg : batch){
+            bytes += msg.len;
+            for(int i = 0 ; i < m_copies ; ++i){
+                batch.reply(msg, msg.data, msg.len);
+            }
+        }
+    }
+private:
+    int m_copies;
+};
+
+static wyz::Socket::ptr connect(wyz::Address::ptr addr){
+    wyz::Socket::ptr sock = wyz::Socket::CreateUDPSock();
+    sock->setRecvTimeout(1000);
+    if(!sock->connect(addr)){
+        return nullptr;
+    }
+    return sock;
+}
+
+/// 每次发出 window 个带序号的数据报, 收齐应答再发下一批
+static void echo_client(wyz::Address::ptr addr, int count, int window, std::atomic<int>* done, std::atomic<int>* lost){
+    wyz::Socket::ptr sock = connect(addr);
+    char buf[64];
+    for(int i = 0 ; sock && i < count ; i += window){
+        for(int j = i ; j < i + window ; ++j){
+            int len = snprintf(buf, sizeof(buf), "seq=%d", j);
+            sock->send(buf, len);
+        }
+        for(int j = i ; j < i + window ; ++j){
+            int n = sock->recv(buf, sizeof(buf) - 1);
+            if(n <= 0){
+                *lost += i + window - j;
+                break;
+            }
+            buf[n] = '\0';
+            if(strncmp(buf, "seq=", 4) != 0){
+                ++fails;
+            }
+        }
+    }
+    ++*done;
+}
+
+void bench(wyz::IOManager* iom, uint32_t batch, uint16_t port){
+    const int clients = 8;
+    const int count = 320 * 64;
+    const int window = 64;
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", port);
+    EchoServer::ptr server(new EchoServer(iom));
+    server->setBatchSize(batch);
+    if(!server->bind(addr)){
+        WYZ_LOG_ERROR(g_logger) << "bind " << addr->toString() << " fail";
+        ++fails;
+        return;
+    }
+    server->start();
+
+    std::atomic<int> done(0);
+    std::atomic<int> lost(0);
+    uint64_t start = wyz::GetCurrentUS();
+    for(int i = 0 ; i < clients ; ++i){
+        iom->schedule(std::bind(&echo_client, addr, count, window, &done, &lost));
+    }
+    while(done < clients){
+        usleep(10 * 1000);
+    }
+    uint64_t used = wyz::GetCurrentUS() - start;
+    usleep(10 * 1000);
+    wyz::UDPServer::Stats s = server->getStats();
+    WYZ_LOG_INFO(g_logger) << "batch=" << batch << " datagrams=" << s.received << " lost=" << lost
+        << " used=" << used / 1000 << "ms rate=" << s.received * 1000000 / used << "/s"
+        << " recvmmsg=" << s.recvCalls << " sendmmsg=" << s.sendCalls
+        << " per_call=" << (s.recvCalls ? s.received / s.recvCalls : 0);
+    CHECK(s.received >= (uint64_t)(clients * count - lost) && s.sent == s.received);
+    server->stop();
+}
+
+/// 应答合并成 UDP_SEGMENT 发出, 客户端收到的仍是独立的数据报
+void test_gso(wyz::IOManager* iom, uint16_t port){
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", port);
+    EchoServer::ptr server(new EchoServer(iom, 4));
+    server->setGso(true);
+    if(!server->bind(addr)){
+        ++fails;
+        return;
+    }
+    server->start();
+    wyz::Socket::ptr sock = connect(addr);
+    std::string payload(100, 'g');
+    char buf[256];
+    int received = 0;
+    for(int i = 0 ; i < 10 ; ++i){
+        payload[0] = 'a' + i;
+        sock->send(payload.data(), payload.size());
+        for(int j = 0 ; j < 4 ; ++j){
+            int n = sock->recv(buf, sizeof(buf));
+            if(n == 100 && buf[0] == 'a' + i){
+                ++received;
+            }
+        }
+    }
+    /// 统计在 sendmmsg 返回后才更新
+    usleep(10 * 1000);
+    wyz::UDPServer::Stats s = server->getStats();
+    CHECK(received == 40 && s.sent == 40);
+    WYZ_LOG_INFO(g_logger) << "gso=" << server->isGso() << " received=" << received << " sent=" << s.sent
+        << " sendmmsg=" << s.sendCalls;
+    server->stop();
+}
+
+/// 客户端用 UDP_SEGMENT 发一个 8 段的数据报, 开启 GRO 的服务器按段拆开
+void test_gro(wyz::IOManager* iom, uint16_t port){
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", port);
+    EchoServer::ptr server(new EchoServer(iom));
+    server->setGro(true);
+    if(!server->bind(addr)){
+        ++fails;
+        return;
+    }
+    server->start();
+    wyz::Socket::ptr sock = connect(addr);
+    std::string payload(800, 'r');
+    iovec iov;
+    iov.iov_base = &payload[0];
+    iov.iov_len = payload.size();
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t seg = 100;
+    memcpy(CMSG_DATA(cmsg), &seg, sizeof(seg));
+    mmsghdr msg;
+    msg.msg_hdr = hdr;
+    CHECK(sock->sendBatch(&msg, 1) == 1);
+
+    char buf[1024];
+    int received = 0;
+    while(sock->recv(buf, sizeof(buf)) == 100){
+        ++received;
+        if(received == 8){
+            break;
+        }
+    }
+    CHECK(received == 8 && server->messages == 8 && server->bytes == 800);
+    wyz::UDPServer::Stats s = server->getStats();
+    WYZ_LOG_INFO(g_logger) << "gro=" << server->isGro() << " messages=" << server->messages
+        << " recvmmsg=" << s.recvCalls;
+    server->stop();
+}
+
+/// 超过 buffer_size 的数据报被截断, 丢弃并计数; stop 之后统计仍然可读
+void test_truncate(wyz::IOManager* iom, uint16_t port){
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", port);
+    EchoServer::ptr server(new EchoServer(iom));
+    server->setBufferSize(256);
+    if(!server->bind(addr)){
+        ++fails;
+        return;
+    }
+    server->start();
+    wyz::Socket::ptr sock = connect(addr);
+    std::string big(1000, 'b');
+    std::string small(100, 's');
+    sock->send(big.data(), big.size());
+    sock->send(small.data(), small.size());
+    char buf[2048];
+    int n = sock->recv(buf, sizeof(buf));
+    CHECK(n == 100 && buf[0] == 's');
+    /// 统计在 sendmmsg 返回后才更新
+    usleep(10 * 1000);
+    wyz::UDPServer::Stats s = server->getStats();
+    CHECK(s.truncated == 1 && s.received == 1 && server->messages == 1 && server->bytes == 100);
+    server->stop();
+    usleep(10 * 1000);
+    s = server->getStats();
+    CHECK(s.truncated == 1 && s.received == 1 && s.sent == 1);
+    WYZ_LOG_INFO(g_logger) << "truncated=" << s.truncated << " received=" << s.received;
+}
+
+int main(int argc, char const *argv[])
+{
+    WYZ_LOG_NAME("system")->setLevel(wyz::LogLevel::ERROR);
+    {
+        wyz::IOManager iom(2, false, "udp");
+        iom.schedule([&iom](){
+            test_gso(&iom, 18700);
+            test_gro(&iom, 18701);
+            test_truncate(&iom, 18704);
+            bench(&iom, 1, 18702);
+            bench(&iom, 32, 18703);
+        });
+    }
+    WYZ_LOG_INFO(g_logger) << "test_udp_server fails=" << fails;
+    return fails != 0;
+}
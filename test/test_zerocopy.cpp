@@ -0,0 +1,202 @@
+/*
+ * @Description: 测试 MSG_ZEROCOPY 发送, 回环上内核会拷贝, 应当退回拷贝发送并释放缓冲区
+ * @Version: 0.1
+ * @Autor: Wyz
+ * @Date: 2021-12-01 10:32:15
+ */
+
+#include "../src/log.h"
+#include "../src/util.h"
+#include "../src/config.h"
+#include "../src/iomanager.h"
+#include "../src/address.h"
+#include "../src/socket.h"
+#include "../src/streams/socket_stream.h"
+#include "test_check.h"
+#include <atomic>
+#include <signal.h>
+#include <string>
+#include <vector>
+
+static wyz::Logger::ptr g_logger = WYZ_LOG_ROOT();
+
+static const uint16_t s_port = 18710;
+
+static void print_stats(const char* name){
+    wyz::Socket::ZeroCopyStats s = wyz::Socket::GetZeroCopyStats();
+    WYZ_LOG_INFO(g_logger) << name << ": zerocopy_bytes=" << s.zeroCopyBytes << " copied_bytes=" << s.copiedBytes
+        << " pending_bytes=" << s.pendingBytes << " fallbacks=" << s.fallbacks;
+}
+
+/// 读完 length 字节并校验内容
+static void read_all(wyz::SocketStream::ptr stream, size_t length, bool* ok){
+    std::string buf(64 * 1024, '\0');
+    size_t offset = 0;
+    *ok = true;
+    while(offset < length){
+        int n = stream->read(&buf[0], std::min(buf.size(), length - offset));
+        if(n <= 0){
+            *ok = false;
+            return;
+        }
+        for(int i = 0 ; i < n ; ++i){
+            if(buf[i] != (char)((offset + i) % 251)){
+                *ok = false;
+            }
+        }
+        offset += n;
+    }
+}
+
+void run(){
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", s_port);
+    wyz::Socket::ptr listener = wyz::Socket::CreateTCP(addr);
+    if(!listener->bind(addr) || !listener->listen()){
+        WYZ_LOG_ERROR(g_logger) << "bind " << addr->toString() << " fail";
+        ++fails;
+        return;
+    }
+    wyz::Socket::ptr sock = wyz::Socket::CreateTCP(addr);
+    CHECK(sock->connect(addr));
+    wyz::Socket::ptr peer = listener->accept();
+    CHECK(peer);
+    wyz::SocketStream::ptr client(new wyz::SocketStream(sock));
+    wyz::SocketStream::ptr server(new wyz::SocketStream(peer));
+
+    bool enabled = sock->setZeroCopy(true);
+    WYZ_LOG_INFO(g_logger) << "SO_ZEROCOPY enabled=" << enabled;
+
+    /// 小于阈值的直接拷贝
+    std::shared_ptr<std::string> small(new std::string(1000, '\0'));
+    for(size_t i = 0 ; i < small->size() ; ++i){
+        (*small)[i] = (char)(i % 251);
+    }
+    bool ok = false;
+    CHECK(client->writeZeroCopy(small, small->data(), small->size()) == 1000);
+    read_all(server, 1000, &ok);
+    CHECK(ok && wyz::Socket::GetZeroCopyStats().copiedBytes == 1000 && small.use_count() == 1);
+    print_stats("small");
+
+    /// 大块数据, 回环上完成通知带有 COPIED, 之后退回拷贝发送
+    const size_t length = 8 * 1024 * 1024;
+    std::shared_ptr<std::string> big(new std::string(length, '\0'));
+    for(size_t i = 0 ; i < length ; ++i){
+        (*big)[i] = (char)(i % 251);
+    }
+    std::weak_ptr<std::string> weak(big);
+    wyz::IOManager::GetThis()->schedule(std::bind(&read_all, server, length, &ok));
+    uint64_t start = wyz::GetCurrentUS();
+    CHECK(client->writeZeroCopy(big, big->data(), length) == (int)length);
+    uint64_t used = wyz::GetCurrentUS() - start;
+    big.reset();
+    /// 等对方读完, 完成通知由定时器收取
+    usleep(100 * 1000);
+    wyz::Socket::ZeroCopyStats s = wyz::Socket::GetZeroCopyStats();
+    CHECK(ok && weak.expired() && s.pendingBytes == 0);
+    CHECK(s.zeroCopyBytes + s.copiedBytes == length + 1000);
+    if(enabled){
+        CHECK(s.fallbacks == 1 && !sock->isZeroCopy());
+    }
+    WYZ_LOG_INFO(g_logger) << "send " << length << " bytes used=" << used << "us";
+    print_stats("big");
+
+    client->close();
+    server->close();
+    listener->close();
+}
+
+/**
+ * @brief 两个线程上的收取定时器与发送并发, 每次发送前重新开启零拷贝
+ * @details 完成通知可能在 send 返回前被另一个线程的定时器收到, 缓冲区仍要全部释放
+ */
+void test_threads(){
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", s_port + 1);
+    wyz::Socket::ptr listener = wyz::Socket::CreateTCP(addr);
+    if(!listener->bind(addr) || !listener->listen()){
+        WYZ_LOG_ERROR(g_logger) << "bind " << addr->toString() << " fail";
+        ++fails;
+        return;
+    }
+    wyz::Socket::ptr sock = wyz::Socket::CreateTCP(addr);
+    CHECK(sock->connect(addr));
+    wyz::Socket::ptr peer = listener->accept();
+    CHECK(peer);
+    wyz::SocketStream::ptr client(new wyz::SocketStream(sock));
+    wyz::SocketStream::ptr server(new wyz::SocketStream(peer));
+
+    const size_t length = 256 * 1024;
+    const int count = 200;
+    bool ok = false;
+    wyz::IOManager::GetThis()->schedule(std::bind(&read_all, server, length * count, &ok));
+    std::vector<std::weak_ptr<std::string>> owners;
+    for(int i = 0 ; i < count ; ++i){
+        std::shared_ptr<std::string> buf(new std::string(length, '\0'));
+        for(size_t j = 0 ; j < length ; ++j){
+            (*buf)[j] = (char)((i * length + j) % 251);
+        }
+        owners.push_back(buf);
+        sock->setZeroCopy(true);
+        CHECK(client->writeZeroCopy(buf, buf->data(), length) == (int)length);
+    }
+    usleep(100 * 1000);
+    size_t alive = 0;
+    for(auto& i : owners){
+        alive += !i.expired();
+    }
+    wyz::Socket::ZeroCopyStats s = wyz::Socket::GetZeroCopyStats();
+    CHECK(ok && alive == 0 && s.pendingBytes == 0);
+    print_stats("threads");
+
+    client->close();
+    server->close();
+    listener->close();
+}
+
+/// close 等待未完成的零拷贝发送, 之后缓冲区全部释放
+void test_close(){
+    wyz::Address::ptr addr = wyz::IPv4Address::Create("127.0.0.1", s_port + 2);
+    wyz::Socket::ptr listener = wyz::Socket::CreateTCP(addr);
+    if(!listener->bind(addr) || !listener->listen()){
+        ++fails;
+        return;
+    }
+    wyz::Socket::ptr sock = wyz::Socket::CreateTCP(addr);
+    CHECK(sock->connect(addr));
+    wyz::Socket::ptr peer = listener->accept();
+    wyz::SocketStream::ptr server(new wyz::SocketStream(peer));
+    const size_t length = 1024 * 1024;
+    std::shared_ptr<std::string> buf(new std::string(length, '\0'));
+    for(size_t j = 0 ; j < length ; ++j){
+        (*buf)[j] = (char)(j % 251);
+    }
+    std::weak_ptr<std::string> weak(buf);
+    bool ok = false;
+    wyz::IOManager::GetThis()->schedule(std::bind(&read_all, server, length, &ok));
+    sock->setZeroCopy(true);
+    CHECK(sock->sendZeroCopy(buf, buf->data(), length) > 0);
+    buf.reset();
+    sock->close();
+    CHECK(weak.expired() && wyz::Socket::GetZeroCopyStats().pendingBytes == 0);
+    usleep(50 * 1000);
+    server->close();
+    listener->close();
+}
+
+void run_all(){
+    run();
+    test_threads();
+    test_close();
+    WYZ_LOG_INFO(g_logger) << "test_zerocopy fails=" << fails;
+}
+
+int main(int argc, char const *argv[])
+{
+    signal(SIGPIPE, SIG_IGN);
+    WYZ_LOG_NAME("system")->setLevel(wyz::LogLevel::ERROR);
+    {
+        /// 两个线程, 收取定时器可以在发送以外的线程上运行
+        wyz::IOManager iom(2, false, "zerocopy");
+        iom.schedule(&run_all);
+    }
+    return fails != 0;
+}